@@ -262,6 +262,16 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to point to data, of at least count()
+   *        values, e.g. memory shared by Blob%s whose contents are not needed
+   *        at the same time.
+   *
+   * The Blob gets memory of its own again when reshaped to a larger count.
+   */
+  void set_data(const shared_ptr<SyncedMemory>& data);
+  /// @brief Set the diff_ shared_ptr likewise.
+  void set_diff(const shared_ptr<SyncedMemory>& diff);
 
   bool ShapeEquals(const BlobProto& other);
 
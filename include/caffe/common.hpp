@@ -163,6 +163,10 @@ class Caffe {
   inline static void set_solver_count(int val) { Get().solver_count_ = val; }
   inline static bool root_solver() { return Get().root_solver_; }
   inline static void set_root_solver(bool val) { Get().root_solver_ = val; }
+  // The threads over the images of a batch of the CPU convolutions that do
+  // not set convolution_param.num_threads
+  inline static int conv_threads() { return Get().conv_threads_; }
+  inline static void set_conv_threads(int val) { Get().conv_threads_ = val; }
 
  protected:
 #ifndef CPU_ONLY
@@ -174,6 +178,7 @@ class Caffe {
   Brew mode_;
   int solver_count_;
   bool root_solver_;
+  int conv_threads_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
@@ -9,6 +9,7 @@ using namespace cv;
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/worker_pool.hpp"
 
 namespace caffe {
 
@@ -169,20 +170,25 @@ class CPMDataTransformer {
   float augmentation_scale(Mat& img, Mat& img_temp, MetaData& meta);
   Size augmentation_croppad(Mat& img_temp, Mat& img_aug, MetaData& meta);
 
-  bool augmentation_flip(Mat& img, Mat& img_aug, Mat& mask_miss, Mat& mask_all, MetaData& meta, int mode);
-  float augmentation_rotate(Mat& img_src, Mat& img_aug, Mat& mask_miss, Mat& mask_all, MetaData& meta, int mode);
-  float augmentation_scale(Mat& img, Mat& img_temp, Mat& mask_miss, Mat& mask_all, MetaData& meta, int mode);
-  Size augmentation_croppad(Mat& img_temp, Mat& img_aug, Mat& mask_miss, Mat& mask_miss_aug, Mat& mask_all, Mat& mask_all_aug, MetaData& meta, int mode);
+  // The same augmentations as one affine transform, applied to the image
+  // and masks with a single warp: each draws its parameter like the function
+  // above of the same name, moves the joints in meta, and composes its
+  // transform into M (3x3, CV_64FC1). size is the size of the image it
+  // applies to, and then of its result.
+  float augmentation_scale(Mat& M, Size& size, MetaData& meta);
+  float augmentation_rotate(Mat& M, Size& size, MetaData& meta);
+  Size augmentation_croppad(Mat& M, Size& size, MetaData& meta);
+  bool augmentation_flip(Mat& M, Size& size, MetaData& meta);
+  // Composes into M the downscale by 1/stride from the augmented image to
+  // the label grid, which the masks are warped to, and sets size to the
+  // size of the grid.
+  void toLabelGrid(Mat& M, Size& size);
 
   void RotatePoint(Point2f& p, Mat R);
   bool onPlane(Point p, Size img_size);
   void swapLeftRight(Joints& j);
   void SetAugTable(int numData);
 
-  float augmentation_rotate(Mat& M, MetaData& meta);
-  float augmentation_scale(Mat& M, MetaData& meta);
-  Size augmentation_croppad(Mat& M, MetaData& meta);
-  float augmentation_tform(Mat& img, Mat& img_temp, Mat &M, MetaData& meta);
  
   int np_in_lmdb;
   int np;
@@ -211,6 +217,10 @@ class CPMDataTransformer {
   void putGaussianMaps(Dtype* entry, Point2f center, int stride, int grid_x, int grid_y, double isigma[4]);
   void putVecMaps(Dtype* entryX, Dtype* entryY, Mat& count, Point2f centerA, Point2f centerB, int stride, int grid_x, int grid_y, float sigma, int thre);
   void putVecPeaks(Dtype* entryX, Dtype* entryY, Mat& count, Point2f centerA, Point2f centerB, int stride, int grid_x, int grid_y, float sigma, int thre);
+  // Writes the heatmap of joint job, or the part affinity field of limb
+  // job - label_joints_, for everyone in meta. Jobs write separate channels,
+  // so they may run on label_pool_.
+  void putLabelJob(Dtype* transformed_label, const MetaData& meta, int grid_x, int grid_y, int job);
   void dumpEverything(Dtype* transformed_data, Dtype* transformed_label, MetaData);
 
   // Tranformation parameters
@@ -220,6 +230,14 @@ class CPMDataTransformer {
   Phase phase_;
   Blob<Dtype> data_mean_;
   vector<Dtype> mean_values_;
+
+  // Layout of the label channels for np parts: the first heatmap channel,
+  // the number of joints, and the joints joined by each limb.
+  int label_heat_offset_;
+  int label_joints_;
+  vector<int> limb_from_;
+  vector<int> limb_to_;
+  shared_ptr<WorkerPool> label_pool_;
 };
 
 }  // namespace caffe
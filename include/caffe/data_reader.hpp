@@ -9,6 +9,7 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/ring_queue.hpp"
 
 namespace caffe {
 
@@ -19,6 +20,14 @@ namespace caffe {
  * databases are read sequentially, and that each solver accesses a different
  * subset of the database. Data is distributed to solvers in a round-robin
  * way to keep parallel training deterministic.
+ *
+ * With data_param.reader_threads > 1, the records are parsed by several
+ * threads, each reading a disjoint, strided subset of the database, and
+ * the body distributes them in database order (deterministic_read) or as
+ * they come.
+ *
+ * With data_param.shuffle, the records are read in a new random order at
+ * every epoch through a db::ShuffledCursor.
  */
 template <typename T>
 class DataReader {
@@ -26,26 +35,58 @@ class DataReader {
   explicit DataReader(const LayerParameter& param);
   ~DataReader();
 
-  inline BlockingQueue<T*>& free() const {
+  inline RingQueue<T*>& free() const {
     return queue_pair_->free_;
   }
-  inline BlockingQueue<T*>& full() const {
+  inline RingQueue<T*>& full() const {
     return queue_pair_->full_;
   }
+  // Database key of a record popped from full(). Only recorded when
+  // data_param.decoded_cache_bytes > 0, empty otherwise.
+  inline const string& key(const T* t) const {
+    return queue_pair_->keys_.find(t)->second;
+  }
 
  protected:
-  // Queue pairs are shared between a body and its readers
+  // Queue pairs are shared between a body and its readers. They hold a
+  // fixed number of records, so the hand-off uses lock-free rings sized for
+  // all of them.
   class QueuePair {
    public:
     explicit QueuePair(int size);
     ~QueuePair();
 
-    BlockingQueue<T*> free_;
-    BlockingQueue<T*> full_;
+    RingQueue<T*> free_;
+    RingQueue<T*> full_;
+    // Key of each record, filled in by the producer before pushing it to
+    // full_. All the records are inserted up front, so producers and
+    // consumers only look up the map.
+    map<const T*, string> keys_;
 
   DISABLE_COPY_AND_ASSIGN(QueuePair);
   };
 
+  // Parses every stride-th record of a source, starting at record offset,
+  // into a queue pair. Used by the body when data_param.reader_threads > 1.
+  class Reader : public InternalThread {
+   public:
+    Reader(db::Cursor* cursor, int offset, int stride, bool keep_keys,
+        QueuePair* qp);
+    virtual ~Reader();
+
+   protected:
+    void InternalThreadEntry();
+    void next();
+
+    shared_ptr<db::Cursor> cursor_;
+    const int offset_;
+    const int stride_;
+    const bool keep_keys_;
+    QueuePair* qp_;
+
+  DISABLE_COPY_AND_ASSIGN(Reader);
+  };
+
   // A single body is created per source
   class Body : public InternalThread {
    public:
@@ -55,9 +96,19 @@ class DataReader {
    protected:
     void InternalThreadEntry();
     void read_one(db::Cursor* cursor, QueuePair* qp);
+    // Hands the next record parsed by the reader threads to qp.
+    void read_one(QueuePair* qp);
+    void start_readers(db::DB* db);
+    void stop_readers();
 
     const LayerParameter param_;
+    const bool keep_keys_;
     BlockingQueue<shared_ptr<QueuePair> > new_queue_pairs_;
+    // Reader threads and the queues they fill: one per reader for
+    // deterministic reads, a single shared one otherwise.
+    vector<shared_ptr<Reader> > readers_;
+    vector<shared_ptr<QueuePair> > reader_qps_;
+    int next_reader_;
 
     friend class DataReader;
 
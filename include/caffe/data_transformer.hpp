@@ -15,6 +15,8 @@ using google::protobuf::RepeatedPtrField;
 
 namespace caffe {
 
+    struct PackedAnnotation;
+
     /**
      * @brief Applies common transformations to the input data, such as
      * scaling, mirroring, substracting the image mean...
@@ -30,6 +32,18 @@ namespace caffe {
      *    transformation.
      */
     void InitRand();
+    /**
+     * @brief Restarts the random stream from seed, e.g. to draw the same
+     *    crop and mirror for each frame of a video clip.
+     */
+    void InitRand(unsigned int seed);
+
+    /**
+     * @brief Resizes the images to height x width (WARP), whatever the mode
+     *    of resize_param, until called again. 0 x 0 goes back to
+     *    resize_param. The annotations follow the same resize.
+     */
+    void SetResizeShape(const int height, const int width);
 
     /**
      * @brief Applies the transformation defined in the data layer's
@@ -103,6 +117,25 @@ namespace caffe {
         const NormalizedBBox& crop_bbox, const bool do_mirror,
         RepeatedPtrField<AnnotationGroup>* transformed_anno_group_all);
 
+    /**
+     * @brief Transforms one annotation of an image of img_height x img_width,
+     *    appending it to transformed_anno_group unless it falls outside of
+     *    crop_bbox. Returns whether it was appended.
+     */
+    bool TransformAnnotation(const Annotation& anno,
+        const int img_height, const int img_width, const bool do_resize,
+        const NormalizedBBox& crop_bbox, const bool do_mirror,
+        AnnotationGroup* transformed_anno_group);
+
+    /**
+     * @brief As above for a record of AnnotatedDatum::packed_annotation,
+     *    which is transformed straight into transformed_anno_group.
+     */
+    bool TransformAnnotation(const PackedAnnotation& record,
+        const int img_height, const int img_width, const bool do_resize,
+        const NormalizedBBox& crop_bbox, const bool do_mirror,
+        AnnotationGroup* transformed_anno_group);
+
     /**
      * @brief Crops the datum according to bbox.
      */
@@ -214,6 +247,55 @@ namespace caffe {
     void ExpandImage(const cv::Mat& img, const float expand_ratio,
                     NormalizedBBox* expand_bbox, cv::Mat* expand_img);
 
+    /**
+     * @brief Decodes an encoded datum, honoring force_color and force_gray.
+     */
+    void DecodeImage(const Datum& datum, cv::Mat* cv_img);
+
+    /**
+     * @brief Copies the annotation of anno_datum but not its image data.
+     *    The datum of header_datum only records the size of img, so that
+     *    the annotation can follow img through the decode-once chain below.
+     */
+    void CopyAnnotation(const AnnotatedDatum& anno_datum, const cv::Mat& img,
+                    AnnotatedDatum* header_datum);
+    void CopyAnnotation(const AnnoFaceAttributeDatum& anno_datum,
+                    const cv::Mat& img, AnnoFaceAttributeDatum* header_datum);
+    void CopyAnnotation(const AnnotatedCCpdDatum& anno_datum,
+                    const cv::Mat& img, AnnotatedCCpdDatum* header_datum);
+
+    /**
+     * @brief Decode-once versions of DistortImage, ExpandImage, CropImage and
+     *    Transform. The image stays a cv::Mat between the stages instead of
+     *    being encoded back into the datum after each of them; the datums
+     *    only carry the annotation (see CopyAnnotation).
+     */
+    void DistortImage(const cv::Mat& img, cv::Mat* distort_img);
+    void ExpandImage(const AnnotatedDatum& anno_datum, const cv::Mat& img,
+                    AnnotatedDatum* expanded_anno_datum, cv::Mat* expand_img);
+    void ExpandImage(const AnnoFaceAttributeDatum& anno_datum,
+                    const cv::Mat& img,
+                    AnnoFaceAttributeDatum* expanded_anno_datum,
+                    cv::Mat* expand_img);
+    void ExpandImage(const AnnotatedCCpdDatum& anno_datum, const cv::Mat& img,
+                    AnnotatedCCpdDatum* expanded_anno_datum,
+                    cv::Mat* expand_img);
+    void CropImage(const AnnotatedDatum& anno_datum, const cv::Mat& img,
+                    const NormalizedBBox& bbox,
+                    AnnotatedDatum* cropped_anno_datum, cv::Mat* crop_img);
+    void CropImage_Sampling(const AnnotatedDatum& anno_datum,
+                    const cv::Mat& img, const NormalizedBBox& bbox,
+                    AnnotatedDatum* cropped_anno_datum, cv::Mat* crop_img);
+    void Transform(const AnnotatedDatum& anno_datum, const cv::Mat& img,
+                    Blob<Dtype>* transformed_blob,
+                    vector<AnnotationGroup>* transformed_anno_vec);
+    void Transform(const AnnoFaceAttributeDatum& anno_datum,
+                    const cv::Mat& img, Blob<Dtype>* transformed_blob,
+                    AnnoFaceAttribute* transformed_anno_vec);
+    void Transform(const AnnotatedCCpdDatum& anno_datum, const cv::Mat& img,
+                    Blob<Dtype>* transformed_blob,
+                    LicensePlate* transformed_anno_vec);
+
     void TransformInv(const Blob<Dtype>* blob, vector<cv::Mat>* cv_imgs);
     void TransformInv(const Dtype* data, cv::Mat* cv_img, const int height,
                         const int width, const int channels);
@@ -293,6 +375,12 @@ namespace caffe {
      */
     virtual int Rand(int n);
 
+    /**
+     * @brief Draws whether to expand the image according to expand_param,
+     *    and by which ratio.
+     */
+    bool RandExpandRatio(float* expand_ratio);
+
     // Transform and return the transformation information.
     void Transform(const Datum& datum, Dtype* transformed_data,
                     NormalizedBBox* crop_bbox, bool* do_mirror);
@@ -307,6 +395,8 @@ namespace caffe {
 
     // Tranformation parameters
     TransformationParameter param_;
+    // resize_param as given, before SetResizeShape.
+    ResizeParameter base_resize_param_;
 
 
     shared_ptr<Caffe::RNG> rng_;
@@ -43,7 +43,7 @@ class InternalThread {
 
  private:
   void entry(int device, Caffe::Brew mode, int rand_seed, int solver_count,
-      bool root_solver);
+      bool root_solver, int conv_threads);
 
   shared_ptr<boost::thread> thread_;
 };
@@ -2,6 +2,7 @@
 #define CAFFE_DATA_LAYER_HPP_
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -29,9 +30,52 @@ public:
     virtual inline int MinTopBlobs() const { return 1; }
 
 protected:
+    // Runs the per-item pipeline on its own thread, with its own
+    // DataTransformer and random stream.
+    class TransformWorker : public InternalThread {
+    public:
+        TransformWorker(AnnotatedDataLayer* layer, int worker_id);
+        virtual ~TransformWorker();
+
+        BlockingQueue<Batch<Dtype>*> jobs_;
+        BlockingQueue<Batch<Dtype>*> done_;
+
+    protected:
+        void InternalThreadEntry();
+
+        AnnotatedDataLayer* layer_;
+        const int worker_id_;
+        shared_ptr<DataTransformer<Dtype> > data_transformer_;
+        Blob<Dtype> transformed_data_;
+
+    DISABLE_COPY_AND_ASSIGN(TransformWorker);
+    };
+
     virtual void load_batch(Batch<Dtype>* batch);
+    // Distorts, expands, samples and transforms the items item_offset,
+    // item_offset + item_stride, ... of batch_datums_ into their slots of
+    // batch->data_, storing the annotations in batch_annos_.
+    void load_items(Batch<Dtype>* batch, int item_offset, int item_stride,
+        DataTransformer<Dtype>* data_transformer, Blob<Dtype>* transformed_data);
+#ifdef USE_OPENCV
+    // Decode-once version of the distort/expand/sample chain of load_items.
+    // Returns a newly allocated datum holding the annotation of the sampled
+    // image, which is stored in sampled_img.
+    AnnotatedDatum* SampleDecodedItem(const AnnotatedDatum& anno_datum,
+        DataTransformer<Dtype>* data_transformer, cv::Mat* sampled_img);
+#endif  // USE_OPENCV
+    // Index of the aspect ratio bucket of datum.
+    int BucketOf(const Datum& datum) const;
+    // Moves datums from the reader to their bucket until one of the buckets
+    // holds batch_size datums, and returns that bucket.
+    int FillBucket(int batch_size);
 
     DataReader<AnnotatedDatum> reader_;
+    // Datums and transformed annotations of the batch being loaded.
+    vector<AnnotatedDatum*> batch_datums_;
+    vector<vector<AnnotationGroup> > batch_annos_;
+    vector<int> batch_top_shape_;
+    vector<shared_ptr<TransformWorker> > transform_workers_;
     bool has_anno_type_;
     AnnotatedDatum_AnnotationType anno_type_;
     vector<BatchSampler> batch_samplers_;
@@ -43,6 +87,16 @@ protected:
     bool YoloFormat_;
     AnnotatedDataParameter_CROP_TYPE crop_type_;
     bool has_landmarks_;
+    // Aspect ratio buckets, with the height and width their images are
+    // resized to, and the datums waiting in each of them. The waiting datums
+    // are swapped out of the reader's, which go back to it at once.
+    vector<float> bucket_aspect_ratios_;
+    vector<std::pair<int, int> > bucket_shapes_;
+    vector<vector<AnnotatedDatum*> > bucket_datums_;
+    vector<AnnotatedDatum*> spare_datums_;
+    vector<shared_ptr<AnnotatedDatum> > bucket_pool_;
+    // Bucket of the batch being loaded, -1 without buckets.
+    int batch_bucket_;
 };
 
 }  // namespace caffe
@@ -30,15 +30,17 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
-  // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // The skip_im2col argument in forward_cpu_gemm is so that we can skip the
+  // im2col if we just called weight_cpu_gemm with the same input. The CPU
+  // helpers of different worker_ids use different column buffers, and may
+  // run concurrently.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output, bool skip_im2col = false);
+      Dtype* output, bool skip_im2col = false, int worker_id = 0);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output);
+      Dtype* output, int worker_id = 0);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-      weights);
+      weights, int worker_id = 0);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
 
 #ifndef CPU_ONLY
@@ -92,6 +94,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  /// @brief The column buffers of the workers after the first, which uses
+  ///        col_buffer_.
+  vector<shared_ptr<Blob<Dtype> > > worker_col_buffers_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -165,6 +170,11 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int col_offset_;
   int output_offset_;
 
+  inline Blob<Dtype>* col_buffer(int worker_id) {
+    return worker_id == 0 ? &col_buffer_ :
+        worker_col_buffers_[worker_id - 1].get();
+  }
+
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
 };
@@ -81,16 +81,18 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  // Prefetches batches (asynchronously if to GPU memory)
-  static const int PREFETCH_COUNT = 3;
-
  protected:
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
 
-  Batch<Dtype> prefetch_[PREFETCH_COUNT];
+  // Prefetches data_param.prefetch batches (asynchronously if to GPU memory).
+  // The batch handed to the top blobs by the last Forward is kept in
+  // prefetch_current_, since the tops share its memory, and only goes back
+  // to the free queue on the next Forward.
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
   BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  Batch<Dtype>* prefetch_current_;
 
   Blob<Dtype> transformed_data_;
 };
@@ -143,14 +145,12 @@ class ImageDataPrefetchingDataLayer :
       const vector<Blob<Dtype>*>& top);
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
-  // Prefetches batches (asynchronously if to GPU memory)
-  static const int PREFETCH_COUNT = 3;
 
  protected:
   virtual void InternalThreadEntry();
   virtual void load_batch(pairBatch<Dtype>* batch) = 0;
 
-  pairBatch<Dtype> prefetch_[PREFETCH_COUNT];
+  vector<shared_ptr<pairBatch<Dtype> > > prefetch_;
 
   BlockingQueue<pairBatch<Dtype>*> prefetch_free_;
   BlockingQueue<pairBatch<Dtype>*> prefetch_full_;
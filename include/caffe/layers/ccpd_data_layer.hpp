@@ -12,6 +12,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/image_cache.hpp"
 
 namespace caffe{
 
@@ -31,6 +32,12 @@ class ccpdDataLayer: public BasePrefetchingDataLayer<Dtype>{
         virtual void load_batch(Batch<Dtype>* batch);
 
         DataReader<AnnotatedCCpdDatum> reader_;
+#ifdef USE_OPENCV
+        // Shared cache of decoded images, NULL unless
+        // data_param.decoded_cache_bytes > 0.
+        DecodedImageCache* image_cache_;
+        string cache_key_prefix_;
+#endif  // USE_OPENCV
         bool has_anno_type_;
         AnnotatedCCpdDatum_AnnotationType anno_type_;
 };
@@ -8,6 +8,7 @@
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/layers/base_conv_layer.hpp"
+#include "caffe/util/worker_pool.hpp"
 
 namespace caffe {
 
@@ -58,11 +59,15 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
+   *  - num_threads (\b optional, default Caffe::conv_threads()). The threads
+   *  convolving the images of a batch in CPU mode.
    *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
    *    kernels + stream parallelism) engines.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Convolution"; }
 
@@ -77,6 +82,23 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+
+  // Forward and Backward of image n of the batch on worker worker_id. The
+  // gradients not needed are NULL, and weight_diff holds one weight diff per
+  // worker.
+  void forward_cpu_image(const Dtype* bottom_data, const Dtype* weight,
+      Dtype* top_data, int n, int worker_id);
+  void backward_cpu_image(const Dtype* top_diff, const Dtype* bottom_data,
+      const Dtype* weight, Dtype* weight_diff, Dtype* bottom_diff, int n,
+      int worker_id);
+  // Runs task on the images of the batch, on num_threads_ threads.
+  void RunImages(const WorkerPool::Task& task);
+
+  int num_threads_;
+  shared_ptr<WorkerPool> worker_pool_;
+  /// @brief The weight gradients of the images of each worker, summed into
+  ///        the weight diff at the end of Backward.
+  Blob<Dtype> worker_weight_diff_;
 };
 
 }  // namespace caffe
@@ -11,9 +11,18 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_mmap.hpp"
 
 namespace caffe {
 
+/**
+ * @brief Provides Datum records of a database to the Net.
+ *
+ * mmap databases (backend MMAP) are not parsed: the float records are
+ * copied from the memory map into the batch, only scaled by the
+ * transformation. With several solvers, each one reads its own share of
+ * the records.
+ */
 template <typename Dtype>
 class DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
@@ -30,8 +39,17 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual void load_batch(Batch<Dtype>* batch);
-
-  DataReader<Datum> reader_;
+  void load_mmap_batch(Batch<Dtype>* batch);
+  // Index of the next record of mmap_db_, in a new random order at every
+  // epoch with data_param.shuffle.
+  uint64_t next_mmap_record();
+
+  // NULL for mmap databases.
+  shared_ptr<DataReader<Datum> > reader_;
+  shared_ptr<db::MmapDB> mmap_db_;
+  // The records of this solver's share, in reading order.
+  vector<uint64_t> mmap_order_;
+  uint64_t mmap_position_;
 };
 
 }  // namespace caffe
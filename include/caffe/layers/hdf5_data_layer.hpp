@@ -7,23 +7,41 @@
 #include <vector>
 
 #include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 
 #include "caffe/layers/base_data_layer.hpp"
 
 namespace caffe {
 
+/**
+ * @brief The rows of an HDF5 file, one blob per top, and the order in which
+ *    HDF5DataLayer serves them.
+ */
+template <typename Dtype>
+class HDF5FileData {
+ public:
+  std::vector<shared_ptr<Blob<Dtype> > > blobs_;
+  std::vector<unsigned int> permutation_;
+};
+
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
+ * With several files, the next file is loaded on an internal thread while
+ * the current one is served, into the second of two file buffers. Shuffled
+ * rows are served through a permutation, the rows themselves staying in
+ * place.
+ *
  * TODO(dox): thorough documentation for Forward and proto params.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public Layer<Dtype>, public InternalThread {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), current_(NULL) {}
   virtual ~HDF5DataLayer();
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -46,15 +64,27 @@ class HDF5DataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
+  virtual void LoadHDF5FileData(const char* filename,
+      HDF5FileData<Dtype>* file_data);
+  // Loads the files after the first one, in the order of file_permutation_.
+  virtual void InternalThreadEntry();
+  // Copies the next batch_size rows to top, in CPU or GPU memory.
+  void CopyBatch(const vector<Blob<Dtype>*>& top, bool gpu);
+  // Moves on to the next file, or to the next epoch of a single file.
+  void NextFile();
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
-  unsigned int current_file_;
-  hsize_t current_row_;
-  std::vector<shared_ptr<Blob<Dtype> > > hdf_blobs_;
-  std::vector<unsigned int> data_permutation_;
+  // Position in file_permutation_ of the next file to load; owned by the
+  // internal thread once started.
+  unsigned int next_file_;
   std::vector<unsigned int> file_permutation_;
+  hsize_t current_row_;
+  // The file being served, one of file_data_.
+  HDF5FileData<Dtype>* current_;
+  HDF5FileData<Dtype> file_data_[2];
+  BlockingQueue<HDF5FileData<Dtype>*> file_free_;
+  BlockingQueue<HDF5FileData<Dtype>*> file_full_;
 };
 
 }  // namespace caffe
@@ -11,6 +11,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/worker_pool.hpp"
 
 namespace caffe {
 
@@ -37,6 +38,14 @@ class ImageDataLayer : public ImageDataPrefetchingDataLayer<Dtype> {
   virtual void load_batch(pairBatch<Dtype>* batch);
   virtual void get_random_erasing_box(float sl, float sh, float min_rate, 
                                 float max_rate, cv::Mat img, float *mean_value);
+  // Picks the files of a batch and the number of files of each class.
+  void choose_batch_files(std::vector< std::pair<std::string, int> >* files,
+                          std::vector< int >* counts);
+  // Chooses the files of the next batch and starts reading them on
+  // load_pool_.
+  void start_next_reads();
+  // load_pool_ task, reading next_files_[item_id] into next_images_.
+  void read_next_image(int item_id, int worker_id);
 
   int lines_id_;
   std::vector< std::pair<std::string, int> > fullImageSetDir_;
@@ -51,6 +60,14 @@ class ImageDataLayer : public ImageDataPrefetchingDataLayer<Dtype> {
   float scale_lower_;
   float scale_higher_;
   float mean_value[3];
+  // Images of the current batch, in the order of choosedImagefile_.
+  std::vector< cv::Mat > batch_images_;
+  // Files, class counts and images of the batch read ahead on load_pool_.
+  std::vector< std::pair<std::string, int> > next_files_;
+  std::vector< int > next_label_;
+  std::vector< cv::Mat > next_images_;
+  // Declared last, so that its workers stop before the images go away.
+  shared_ptr<WorkerPool> load_pool_;
 };
 
 
@@ -16,6 +16,7 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/worker_pool.hpp"
 
 namespace caffe {
 
@@ -37,6 +38,11 @@ class ReidDataLayer : public ReidPrefetchingDataLayer<Dtype> {
   virtual void load_batch(ReidBatch<Dtype>* batch);
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual unsigned int RandRng();
+  // Decodes lines_[item_id] into cv_imgs_.
+  void read_image(int item_id, int worker_id);
+  // Transforms the item_id-th image and pair image of loading_batch_, with
+  // the transformer of the worker when load_pool_ is set.
+  void transform_item(int item_id, int worker_id);
 
   inline vector<size_t> batch_ids() {
     const int batch_size = this->layer_param_.reid_data_param().batch_size();
@@ -89,6 +95,18 @@ class ReidDataLayer : public ReidPrefetchingDataLayer<Dtype> {
   Dtype pos_fraction;
   Dtype neg_fraction;
   int left_images;
+  // Batch being loaded, and the image indices of its items and pairs.
+  ReidBatch<Dtype>* loading_batch_;
+  Dtype* loading_data_;
+  Dtype* loading_datap_;
+  vector<size_t> loading_ids_;
+  vector<size_t> loading_pairs_;
+  // Per-worker transformers, so that each worker draws from its own random
+  // stream.
+  vector<shared_ptr<DataTransformer<Dtype> > > worker_transformers_;
+  vector<shared_ptr<Blob<Dtype> > > worker_transformed_data_;
+  // Declared last, so that its workers stop before the state they use.
+  shared_ptr<WorkerPool> load_pool_;
 };
 
 }  // namespace caffe
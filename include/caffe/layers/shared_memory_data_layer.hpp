@@ -0,0 +1,52 @@
+#ifndef CAFFE_SHARED_MEMORY_DATA_LAYER_HPP_
+#define CAFFE_SHARED_MEMORY_DATA_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/shm_batch_ring.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Provides the batches that a `caffe feed` process publishes in a
+ *    shared memory ring, so that several trainings on a host decode and
+ *    augment the data only once.
+ *
+ * The tops have the shapes of the data layer run by the feeder; the
+ * transformation and data_param other than prefetch are not used. The
+ * solvers of a training read distinct batches. If the feeder stops, the
+ * layer waits up to shared_memory_data_param.timeout for a new one.
+ */
+template <typename Dtype>
+class SharedMemoryDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit SharedMemoryDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param), rank_(0), solver_count_(1) {}
+  virtual ~SharedMemoryDataLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  // Each solver reads its own share of the batches of the ring.
+  virtual inline bool ShareInParallel() const { return false; }
+  virtual inline const char* type() const { return "SharedMemoryData"; }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 2; }
+
+ protected:
+  virtual void load_batch(Batch<Dtype>* batch);
+  // Maps the ring, waiting for a feeder, and reads this solver's share.
+  void OpenRing();
+
+  shared_ptr<ShmBatchRing> ring_;
+  int rank_;
+  int solver_count_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_SHARED_MEMORY_DATA_LAYER_HPP_
@@ -18,12 +18,17 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/video_frame_source.hpp"
 
 namespace caffe {
 
 /**
  * @brief Provides data to the Net from webcam or video files.
  *
+ * Each item is a clip of clip_length frames, skip_frames apart. Video files
+ * are read through a VideoFrameSource, which decodes ahead on its own
+ * threads and keeps the frames of overlapping clips.
+ *
  * TODO(weiliu89): thorough documentation for Forward and proto params.
  */
 template <typename Dtype>
@@ -37,18 +42,28 @@ class VideoDataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline const char* type() const { return "VideoData"; }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int MinTopBlobs() const { return 1; }
+  // The decoder of a video file, with its frame counters; NULL for webcams.
+  inline const VideoFrameSource* frame_source() const {
+    return frame_source_.get();
+  }
 
  protected:
   virtual void load_batch(Batch<Dtype>* batch);
+  // Reads the frames of the next clip.
+  void ReadClip(vector<cv::Mat>* clip);
 
   VideoDataParameter_VideoType video_type_;
   cv::VideoCapture cap_;
+  shared_ptr<VideoFrameSource> frame_source_;
 
   int skip_frames_;
-
-  int total_frames_;
-  int processed_frames_;
+  int clip_length_;
+  int clip_step_;
+  // First frame of the next clip of the video.
+  int next_clip_start_;
   vector<int> top_shape_;
+  // A transformed frame, for clips of several frames.
+  Blob<Dtype> frame_data_;
 };
 
 }  // namespace caffe
@@ -14,6 +14,8 @@
 
 namespace caffe {
 
+class DagScheduler;
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -217,6 +219,21 @@ class Net {
 
   void set_debug_info(const bool value) { debug_info_ = value; }
 
+  /// @brief The bytes of the tops, and of their memory with share_activations
+  inline size_t activation_bytes() const { return activation_bytes_; }
+  inline size_t shared_activation_bytes() const {
+    return shared_activation_bytes_;
+  }
+  /// @brief The bytes of the diffs used by Backward, and of their memory with
+  ///        share_diffs
+  inline size_t diff_bytes() const { return diff_bytes_; }
+  inline size_t shared_diff_bytes() const { return shared_diff_bytes_; }
+  /// @brief The scheduler of the layers with forward_threads, whose trace
+  ///        tells when and on which thread each layer ran in Forward
+  inline const DagScheduler* forward_scheduler() const {
+    return forward_scheduler_.get();
+  }
+
   // Helpers for Init.
   /**
    * @brief Remove layers that the user specified should be excluded given the current
@@ -242,6 +259,18 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /// @brief Make the data of the tops of TEST nets, and the diffs of the
+  ///        tops of TRAIN nets, share memory when their lifetimes do not
+  ///        overlap, as set by share_activations and share_diffs.
+  void ShareBlobMemory();
+  void ShareBlobMemory(const bool diff, size_t* bytes, size_t* shared_bytes);
+  /// @brief Make each layer of forward_scheduler_ depend on the layers
+  ///        computing its bottoms and using the memory of its tops before it.
+  void PlanForward();
+  /// @brief Forward the layers [start, end] with forward_scheduler_.
+  Dtype ParallelForwardFromTo(int start, int end);
+  void ForwardLayer(const int layer_id);
+
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
@@ -306,6 +335,19 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether the data or diffs of the tops share memory, except the blobs
+  /// of keep_blobs_.
+  bool share_activations_;
+  bool share_diffs_;
+  set<string> keep_blobs_;
+  size_t activation_bytes_;
+  size_t shared_activation_bytes_;
+  size_t diff_bytes_;
+  size_t shared_diff_bytes_;
+  /// The scheduler running Forward on forward_threads threads, if any, and
+  /// the losses of its layers.
+  shared_ptr<DagScheduler> forward_scheduler_;
+  vector<Dtype> layer_losses_;
   /// The root net that actually holds the shared layers in data parallelism
   const Net* const root_net_;
   DISABLE_COPY_AND_ASSIGN(Net);
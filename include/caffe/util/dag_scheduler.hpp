@@ -0,0 +1,74 @@
+#ifndef CAFFE_UTIL_DAG_SCHEDULER_HPP_
+#define CAFFE_UTIL_DAG_SCHEDULER_HPP_
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
+#include <vector>
+
+#include "boost/function.hpp"
+
+#include "caffe/common.hpp"
+#include "caffe/util/worker_pool.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs a task on the nodes of a directed acyclic graph with a
+ *    WorkerPool, each node as soon as the nodes it depends on are done.
+ *
+ * The nodes are numbered in a topological order: a node only depends on
+ * nodes of lower ids. Run() records on which worker, and when, each node
+ * ran, to check how the nodes overlapped.
+ */
+class DagScheduler {
+ public:
+  typedef boost::function<void(int node_id)> Task;
+
+  // When a node ran in the last Run(), in microseconds since its start.
+  struct Trace {
+    int worker_id;
+    double start_us;
+    double end_us;
+  };
+
+  explicit DagScheduler(int num_workers);
+
+  inline int num_workers() const { return pool_.size(); }
+  // Sets the nodes each node depends on.
+  void SetGraph(const vector<vector<int> >& predecessors);
+  // Runs task on the nodes [begin, end], as if the nodes before begin were
+  // done, and returns when they all are.
+  void Run(int begin, int end, const Task& task);
+  // The traces of the nodes of the last Run(), with a worker_id of -1 for
+  // the nodes out of its range.
+  inline const vector<Trace>& trace() const { return trace_; }
+
+ protected:
+  // Runs the ready nodes on worker worker_id until all the nodes are done.
+  void Work(int worker_id);
+  double ElapsedMicroSeconds() const;
+
+  WorkerPool pool_;
+  vector<vector<int> > predecessors_;
+  vector<vector<int> > successors_;
+
+  // The state of the current Run(), guarded by mutex_.
+  Task task_;
+  int end_;
+  int num_remaining_;
+  vector<int> num_pending_;
+  std::deque<int> ready_;
+  vector<Trace> trace_;
+  boost::posix_time::ptime start_time_;
+  boost::mutex mutex_;
+  boost::condition_variable ready_condition_;
+
+  DISABLE_COPY_AND_ASSIGN(DagScheduler);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DAG_SCHEDULER_HPP_
@@ -18,6 +18,13 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  // The current value, without copying it. The data is only valid until the
+  // cursor moves or is destroyed.
+  virtual const char* value_data() = 0;
+  virtual size_t value_size() = 0;
+  // Moves to the record of the given key. The cursor is not valid afterwards
+  // if there is no such record.
+  virtual void SeekToKey(const string& key) = 0;
   virtual bool valid() = 0;
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
@@ -14,16 +14,31 @@ namespace caffe { namespace db {
 class LevelDBCursor : public Cursor {
  public:
   explicit LevelDBCursor(leveldb::Iterator* iter)
-    : iter_(iter) { SeekToFirst(); }
+    : iter_(iter), found_(true) { SeekToFirst(); }
   ~LevelDBCursor() { delete iter_; }
-  virtual void SeekToFirst() { iter_->SeekToFirst(); }
-  virtual void Next() { iter_->Next(); }
+  virtual void SeekToFirst() {
+    iter_->SeekToFirst();
+    found_ = true;
+  }
+  virtual void Next() {
+    iter_->Next();
+    found_ = true;
+  }
   virtual string key() { return iter_->key().ToString(); }
   virtual string value() { return iter_->value().ToString(); }
-  virtual bool valid() { return iter_->Valid(); }
+  virtual const char* value_data() { return iter_->value().data(); }
+  virtual size_t value_size() { return iter_->value().size(); }
+  virtual void SeekToKey(const string& key) {
+    iter_->Seek(key);
+    found_ = iter_->Valid() && iter_->key() == key;
+  }
+  virtual bool valid() { return found_ && iter_->Valid(); }
 
  private:
   leveldb::Iterator* iter_;
+  // Whether the last SeekToKey found its key. Next() and SeekToFirst() reset
+  // it, so that valid() then only depends on the iterator.
+  bool found_;
 };
 
 class LevelDBTransaction : public Transaction {
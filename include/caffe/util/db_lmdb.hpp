@@ -34,6 +34,17 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  // Points into the memory map, which stays valid for the lifetime of the
+  // read transaction owned by the cursor.
+  virtual const char* value_data() {
+    return static_cast<const char*>(mdb_value_.mv_data);
+  }
+  virtual size_t value_size() { return mdb_value_.mv_size; }
+  virtual void SeekToKey(const string& key) {
+    mdb_key_.mv_size = key.size();
+    mdb_key_.mv_data = const_cast<char*>(key.data());
+    Seek(MDB_SET_KEY);
+  }
   virtual bool valid() { return valid_; }
 
  private:
@@ -0,0 +1,136 @@
+#ifndef CAFFE_UTIL_DB_MMAP_HPP
+#define CAFFE_UTIL_DB_MMAP_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+// A single file of fixed-size float records, e.g. precomputed features,
+// read through a memory map so that a batch is copied straight from the
+// page cache. The file holds, in this order:
+//   - an MmapHeader;
+//   - the records, each of channels x height x width floats;
+//   - the int32 label of each record;
+//   - the uint64 offsets of the keys, num_records + 1 of them, relative to
+//     the end of the offsets, followed by the keys.
+//
+// Records are written as serialized Datums, whose data or float_data is
+// converted to floats; all of them must have the same shape. The values
+// read back are the raw floats, not Datums. The file is only complete once
+// the database is closed.
+struct MmapHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t num_records;
+  uint32_t channels;
+  uint32_t height;
+  uint32_t width;
+  uint32_t reserved;
+  uint64_t labels_offset;
+  uint64_t keys_offset;
+  uint64_t padding[2];
+};
+
+const uint32_t kMmapMagic = 0x504d4d43;  // "CMMP"
+const uint32_t kMmapVersion = 1;
+
+class MmapDB;
+
+class MmapCursor : public Cursor {
+ public:
+  explicit MmapCursor(const MmapDB* db) : db_(db), index_(0) { }
+  virtual ~MmapCursor() { }
+  virtual void SeekToFirst() { index_ = 0; }
+  virtual void Next() { ++index_; }
+  virtual string key();
+  virtual string value() { return string(value_data(), value_size()); }
+  // Points into the memory map, valid until the database is closed.
+  virtual const char* value_data();
+  virtual size_t value_size();
+  // The first SeekToKey() indexes the keys of the database.
+  virtual void SeekToKey(const string& key);
+  virtual bool valid();
+  int label();
+
+ private:
+  const MmapDB* db_;
+  uint64_t index_;
+  std::map<string, uint64_t> key_index_;
+};
+
+class MmapTransaction : public Transaction {
+ public:
+  explicit MmapTransaction(MmapDB* db) : db_(db) { }
+  virtual void Put(const string& key, const string& value);
+  virtual void Commit();
+
+ private:
+  MmapDB* db_;
+  vector<string> keys_;
+  vector<int> labels_;
+  vector<float> records_;
+
+  DISABLE_COPY_AND_ASSIGN(MmapTransaction);
+};
+
+class MmapDB : public DB {
+ public:
+  MmapDB() : map_(NULL), map_size_(0), header_(NULL), file_(NULL) { }
+  virtual ~MmapDB() { Close(); }
+  virtual void Open(const string& source, Mode mode);
+  virtual void Close();
+  virtual MmapCursor* NewCursor();
+  virtual MmapTransaction* NewTransaction();
+
+  // Direct access to the records of a database opened for reading.
+  inline uint64_t num_records() const { return header_->num_records; }
+  inline int channels() const { return header_->channels; }
+  inline int height() const { return header_->height; }
+  inline int width() const { return header_->width; }
+  inline int record_floats() const {
+    return header_->channels * header_->height * header_->width;
+  }
+  inline const float* record(uint64_t i) const {
+    return reinterpret_cast<const float*>(map_ + sizeof(MmapHeader)) +
+        i * record_floats();
+  }
+  inline int label(uint64_t i) const {
+    return reinterpret_cast<const int32_t*>(map_ +
+        header_->labels_offset)[i];
+  }
+  string key(uint64_t i) const;
+
+ private:
+  // Appends the records of a transaction.
+  void Append(const vector<string>& keys, const vector<int>& labels,
+      const vector<float>& records);
+  // Writes the labels, the keys and the header after the records.
+  void Finish();
+
+  string source_;
+  // Reading: the memory map of the file.
+  char* map_;
+  size_t map_size_;
+  const MmapHeader* header_;
+  // Writing: the file, the header, and the labels and keys written so far.
+  FILE* file_;
+  MmapHeader write_header_;
+  vector<int> labels_;
+  vector<string> keys_;
+
+  friend class MmapTransaction;
+
+  DISABLE_COPY_AND_ASSIGN(MmapDB);
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_MMAP_HPP
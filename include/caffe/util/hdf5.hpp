@@ -1,6 +1,8 @@
 #ifndef CAFFE_UTIL_HDF5_H_
 #define CAFFE_UTIL_HDF5_H_
 
+#include <boost/thread/recursive_mutex.hpp>
+
 #include <string>
 
 #include "hdf5.h"
@@ -10,6 +12,11 @@
 
 namespace caffe {
 
+// The HDF5 library is not thread safe unless built so: lock this mutex
+// around every HDF5 call. It is recursive so that a locked section can
+// call another, e.g. a solver restore loading the net weights.
+boost::recursive_mutex& hdf5_mutex();
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
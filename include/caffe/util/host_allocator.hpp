@@ -0,0 +1,72 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Allocation counters of the HostAllocator, in blocks and bytes of their
+// size classes.
+struct HostAllocatorStats {
+  uint64_t allocations;
+  // Allocations served from the cache, and from the system.
+  uint64_t cache_hits;
+  uint64_t system_allocations;
+  uint64_t frees;
+  size_t bytes_in_use;
+  size_t peak_bytes_in_use;
+  size_t bytes_cached;
+};
+
+/**
+ * @brief The host memory of the SyncedMemory%s, in 64-byte aligned blocks
+ *    of size classes four per power of two, so that at most a fifth of a
+ *    block over 64 bytes is wasted.
+ *
+ * Freed blocks are kept for the next allocations of their class, up to
+ * cache_bytes (none by default), which saves the malloc, free and page
+ * faults of blobs reshaped to varying sizes. Blocks of 2 MB or more are
+ * aligned to 2 MB and may be backed by transparent huge pages.
+ */
+class HostAllocator {
+ public:
+  // The allocator of the process.
+  static HostAllocator& Get();
+
+  void* Allocate(size_t size);
+  void Free(void* ptr);
+
+  // Bytes of freed blocks kept for reuse; 0 returns the blocks to the
+  // system when freed.
+  void set_cache_bytes(size_t cache_bytes);
+  size_t cache_bytes() const;
+  // Returns the cached blocks to the system.
+  void Trim();
+  HostAllocatorStats stats() const;
+  void ResetPeak();
+
+  // The bytes of the size class of size.
+  static size_t ClassBytes(size_t size);
+
+ protected:
+  HostAllocator();
+  static int SizeClass(size_t size);
+  static size_t ClassBytesOf(int size_class);
+  static void* SystemAllocate(size_t block_bytes);
+
+  // Freed blocks of each size class.
+  vector<vector<void*> > free_;
+  size_t cache_bytes_;
+  HostAllocatorStats stats_;
+  mutable boost::mutex mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
@@ -0,0 +1,64 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief In-memory LRU cache of decoded images, bounded by a byte budget.
+ *
+ * A single cache is shared by all the data readers of the process, so that
+ * small datasets are only decoded once. Images are copied in and out, since
+ * the augmentation functions are free to modify their input in place.
+ */
+class DecodedImageCache {
+ public:
+  // Returns the cache of the process, growing its budget to byte_budget if
+  // it is smaller.
+  static DecodedImageCache& Get(size_t byte_budget);
+
+  explicit DecodedImageCache(size_t byte_budget);
+
+  // Copies the image cached under key into img and returns true, or returns
+  // false if there is none.
+  bool Lookup(const string& key, cv::Mat* img);
+  // Caches a copy of img under key, evicting the least recently used images
+  // to stay within the budget.
+  void Insert(const string& key, const cv::Mat& img);
+
+  size_t bytes() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+
+ protected:
+  typedef std::list<std::pair<string, cv::Mat> > LruList;
+
+  void Evict(size_t bytes_needed);
+
+  // Most recently used images first.
+  LruList lru_;
+  std::map<string, LruList::iterator> index_;
+  size_t byte_budget_;
+  size_t bytes_;
+  uint64_t hits_;
+  uint64_t misses_;
+  mutable boost::mutex mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(DecodedImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // USE_OPENCV
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
@@ -0,0 +1,53 @@
+#ifndef _CAFFE_UTIL_PACK_PIXELS_HPP_
+#define _CAFFE_UTIL_PACK_PIXELS_HPP_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// Converts an interleaved (HWC) 8-bit image of size height x width into the
+// planar (CHW) blob layout, computing
+//   data_blob[(c * height + h) * width + w] = (pixel - mean) * scale
+// where pixel is the value of channel c at (h, mirror ? width - 1 - w : w).
+// The row h of the image starts at data_im + h * im_step.
+//
+// The mean is taken, in this order of precedence, from
+//   - mean_data (a mean file): the mean of (c, h, w) is
+//     mean_data[c * mean_plane + h * mean_step + w], i.e. it follows the
+//     output position, like DataTransformer::Transform always did;
+//   - mean_values: one value per channel;
+//   - nothing, if both are NULL.
+//
+// Images with 1 or 3 channels go through kernels specialized for the
+// channel count and the mean mode, vectorized for float with the best of
+// AVX2 and SSSE3 the CPU supports (with GCC or Clang on x86); any other
+// channel count uses a generic scalar loop.
+template <typename Dtype>
+void pack_pixels_cpu(const uint8_t* data_im, const int im_step,
+    const int channels, const int height, const int width,
+    const Dtype* mean_data, const int mean_step, const int mean_plane,
+    const Dtype* mean_values, const Dtype scale, const bool mirror,
+    Dtype* data_blob);
+
+// The instruction sets pack_pixels_cpu vectorizes with, in increasing order.
+enum PackPixelsIsa {
+  PACK_PIXELS_SCALAR,
+  PACK_PIXELS_SSSE3,
+  PACK_PIXELS_AVX2
+};
+
+// The best instruction set of the CPU for pack_pixels_cpu.
+PackPixelsIsa pack_pixels_max_isa();
+
+// pack_pixels_cpu with the given instruction set, which the CPU must
+// support, so that each path can be tested.
+template <typename Dtype>
+void pack_pixels_cpu_isa(const PackPixelsIsa isa, const uint8_t* data_im,
+    const int im_step, const int channels, const int height, const int width,
+    const Dtype* mean_data, const int mean_step, const int mean_plane,
+    const Dtype* mean_values, const Dtype scale, const bool mirror,
+    Dtype* data_blob);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_PACK_PIXELS_HPP_
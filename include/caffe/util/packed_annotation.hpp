@@ -0,0 +1,84 @@
+#ifndef CAFFE_UTIL_PACKED_ANNOTATION_HPP_
+#define CAFFE_UTIL_PACKED_ANNOTATION_HPP_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "google/protobuf/repeated_field.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+using google::protobuf::RepeatedPtrField;
+
+/**
+ * @brief One Annotation of an AnnotatedDatum, in a fixed layout.
+ *
+ * AnnotatedDatum::packed_annotation holds a PackedAnnotationHeader followed
+ * by num_annotations records, in the order of the annotation groups. A group
+ * is a run of records with the same group_label. The label, score and size
+ * of the NormalizedBBox are not kept; ground truth does not use them.
+ */
+struct PackedAnnotation {
+  enum Flags {
+    DIFFICULT = 1,
+    // The Annotation had a face_lm message.
+    HAS_FACE_LM = 2
+  };
+  float xmin;
+  float ymin;
+  float xmax;
+  float ymax;
+  int32_t group_label;
+  int32_t instance_id;
+  int32_t has_lm;
+  int32_t flags;
+  // x and y of lefteye, righteye, nose, leftmouth and rightmouth.
+  float landmarks[10];
+};
+
+struct PackedAnnotationHeader {
+  uint32_t magic;
+  uint32_t num_annotations;
+};
+
+const uint32_t kPackedAnnotationMagic = 0x314e4150;  // "PAN1"
+
+// Serializes groups into packed.
+void PackAnnotationGroups(const RepeatedPtrField<AnnotationGroup>& groups,
+    string* packed);
+
+// Sets the five points of face_lm from the ten landmarks of a record.
+void UnpackLandmarks(const float* landmarks, AnnoFaceLandmarks* face_lm);
+
+// Fills anno with record, reusing its storage.
+void UnpackAnnotation(const PackedAnnotation& record, Annotation* anno);
+
+// Rebuilds the annotation groups of packed.
+void UnpackAnnotationGroups(const string& packed,
+    RepeatedPtrField<AnnotationGroup>* groups);
+
+// Returns the records of packed in place, and their number in num. The
+// records stay valid as long as packed is not modified.
+const PackedAnnotation* PackedAnnotations(const string& packed, int* num);
+
+// Moves the annotations of anno_datum from annotation_group to
+// packed_annotation, or back.
+void PackAnnotatedDatum(AnnotatedDatum* anno_datum);
+void UnpackAnnotatedDatum(AnnotatedDatum* anno_datum);
+
+// The annotation groups of anno_datum: annotation_group itself, or the
+// unpacked packed_annotation, stored in storage.
+const RepeatedPtrField<AnnotationGroup>& AnnotationGroups(
+    const AnnotatedDatum& anno_datum,
+    RepeatedPtrField<AnnotationGroup>* storage);
+
+// Number of annotations of anno_datum, in either form.
+int NumAnnotations(const AnnotatedDatum& anno_datum);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PACKED_ANNOTATION_HPP_
@@ -0,0 +1,64 @@
+#ifndef CAFFE_UTIL_RING_QUEUE_HPP_
+#define CAFFE_UTIL_RING_QUEUE_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A bounded lock-free queue, with the interface of BlockingQueue.
+ *
+ * The items live in a ring of capacity slots (rounded up to a power of two),
+ * each with a sequence number telling whether it is ready to be written or
+ * read, so that any number of producers and consumers only synchronize on
+ * two atomic counters. Blocking calls spin, then yield, then park on a
+ * condition variable, which is also where boost thread interruption is
+ * delivered, as with BlockingQueue.
+ *
+ * Meant for hand-offs where the number of items in flight is known, like
+ * the DataReader queue pairs: push blocks while the ring is full.
+ */
+template<typename T>
+class RingQueue {
+ public:
+  explicit RingQueue(int capacity);
+
+  void push(const T& t);
+
+  bool try_push(const T& t);
+
+  bool try_pop(T* t);
+
+  // This logs a message if the threads needs to be blocked
+  // useful for detecting e.g. when data feeding is too slow
+  T pop(const string& log_on_wait = "");
+
+  // The peek functions return the item the next pop() would return. They
+  // are only exact while no other thread pops concurrently.
+  bool try_peek(T* t);
+
+  // Return element without removing it
+  T peek();
+
+  // Number of items, exact only while no thread pushes or pops.
+  size_t size() const;
+
+  size_t capacity() const;
+
+ protected:
+  /**
+   Move the atomics and synchronization fields out of the header, like
+   BlockingQueue does for boost/thread.hpp.
+   */
+  class sync;
+
+  shared_ptr<sync> sync_;
+
+DISABLE_COPY_AND_ASSIGN(RingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_RING_QUEUE_HPP_
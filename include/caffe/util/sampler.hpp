@@ -20,6 +20,30 @@ bool SatisfySampleConstraint(const NormalizedBBox& sampled_bbox,
                              const vector<NormalizedBBox>& object_bboxes,
                              const SampleConstraint& sample_constraint);
 
+// Boxes as plain arrays of coordinates, so that the sampled boxes of many
+// trials are checked against all the object boxes at once.
+struct BBoxArray {
+    vector<float> xmin;
+    vector<float> ymin;
+    vector<float> xmax;
+    vector<float> ymax;
+    // BBoxSize of each box.
+    vector<float> size;
+
+    BBoxArray() {}
+    explicit BBoxArray(const vector<NormalizedBBox>& bboxes);
+    void push_back(const NormalizedBBox& bbox);
+    void clear();
+    inline int count() const { return xmin.size(); }
+};
+
+// SatisfySampleConstraint of each of the sampled_bboxes, stored in
+// satisfied. The results are bit-identical.
+void SatisfySampleConstraints(const BBoxArray& sampled_bboxes,
+                              const BBoxArray& object_bboxes,
+                              const SampleConstraint& sample_constraint,
+                              vector<bool>* satisfied);
+
 // Sample a NormalizedBBox given the specifictions.
 void SampleBBox(const Sampler& sampler, NormalizedBBox* sampled_bbox, float orl_ratio);
 void SampleBBox_Square(const AnnotatedDatum& anno_datum, const Sampler& sampler, 
@@ -0,0 +1,140 @@
+#ifndef CAFFE_UTIL_SHM_BATCH_RING_HPP_
+#define CAFFE_UTIL_SHM_BATCH_RING_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+const uint32_t kShmRingMagic = 0x52534843;  // "CHSR"
+const uint32_t kShmRingVersion = 1;
+const int kShmRingMaxTops = 2;
+const int kShmRingMaxAxes = 8;
+
+// A top shape in shared memory: the number of axes, then the axes.
+typedef int32_t ShmShape[kShmRingMaxAxes + 1];
+
+// The start of the shared memory, followed by the slots.
+struct ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  int32_t num_slots;
+  int32_t num_tops;
+  // Floats of each top in a slot, and the shapes of the first batch.
+  uint64_t capacity[kShmRingMaxTops];
+  ShmShape shape[kShmRingMaxTops];
+  int32_t producer_pid;
+  int32_t closed;
+  // Number of batches published, and one past the newest batch taken by a
+  // consumer.
+  uint64_t written;
+  uint64_t read_end;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+// The start of each slot, followed by the floats of its tops.
+struct ShmSlotHeader {
+  // The batch in the slot, kShmSlotWriting while it is written.
+  uint64_t seq;
+  ShmShape shape[kShmRingMaxTops];
+};
+
+const uint64_t kShmSlotWriting = UINT64_MAX;
+
+/**
+ * @brief A ring of batches in POSIX shared memory, written by one feeder
+ *    process and read by any number of training processes on the host.
+ *
+ * Every consumer sees the batches in order, starting from the newest one
+ * when it opens the ring. The producer stays at most num_slots - 1 batches
+ * ahead of the fastest consumer; a slower consumer skips the batches that
+ * were overwritten before it got to them. A batch being overwritten while a
+ * consumer copies it is detected by EndRead(), so consumers never block the
+ * producer, and a consumer may die at any time.
+ *
+ * The consumers of one training can share the batches out: each one then
+ * reads only the batches of its own rank.
+ */
+class ShmBatchRing {
+ public:
+  // Creates the ring name (e.g. "/pose_train"), replacing any previous ring
+  // of that name, with slots for tops of up to capacity floats each.
+  static ShmBatchRing* Create(const string& name, int num_slots,
+      const vector<uint64_t>& capacity, const vector<vector<int> >& shapes);
+  // Maps the ring name, waiting up to timeout_ms for a running feeder to
+  // create it.
+  static ShmBatchRing* Open(const string& name, int timeout_ms);
+  // The producer closes and removes the ring, the consumers unmap it.
+  ~ShmBatchRing();
+
+  inline int num_slots() const { return header_->num_slots; }
+  inline int num_tops() const { return header_->num_tops; }
+  inline uint64_t capacity(int top) const { return header_->capacity[top]; }
+  // The shape of top in the first batch.
+  vector<int> shape(int top) const;
+
+  // Producer: returns the slot for the next batch, with the floats of each
+  // top at offset(top), or NULL if the consumers are still num_slots - 1
+  // batches behind after timeout_ms.
+  float* BeginWrite(int timeout_ms);
+  // Publishes the batch, of the given shapes.
+  void EndWrite(const vector<vector<int> >& shapes);
+
+  // Consumer: reads only the batches whose number is rank modulo count from
+  // now on.
+  void ShareReads(int rank, int count);
+  // Consumer: returns the next batch to copy, or NULL if none was published
+  // within timeout_ms or if the feeder stopped.
+  const float* BeginRead(int timeout_ms);
+  // The shape of top in the batch being read.
+  vector<int> read_shape(int top) const;
+  // Whether the batch was left untouched while it was copied; if not, it
+  // must be read again.
+  bool EndRead();
+
+  inline uint64_t offset(int top) const { return offsets_[top]; }
+  // Consumer: whether the feeder closed the ring or died. No batch will be
+  // published anymore; a new feeder creates a new ring of the same name.
+  bool stopped() const;
+
+ protected:
+  ShmBatchRing(const string& name, bool producer);
+  // Maps the file fd of size bytes, and closes it.
+  void Map(int fd, size_t size);
+  // Computes the layout of the slots from the header.
+  void Layout();
+  ShmSlotHeader* slot(uint64_t seq) const;
+  float* slot_data(uint64_t seq) const;
+  // Locks the mutex, recovering it from a process that died holding it.
+  void Lock();
+  void Unlock();
+  // Waits on the condition for up to timeout_ms, false on timeout.
+  bool Wait(int timeout_ms);
+
+  const string name_;
+  const bool producer_;
+  char* map_;
+  size_t map_size_;
+  ShmRingHeader* header_;
+  size_t slot_bytes_;
+  vector<uint64_t> offsets_;
+  // Consumer: the next batch to read, the one being read, and its shapes.
+  uint64_t next_;
+  uint64_t reading_;
+  vector<vector<int> > read_shapes_;
+  // Consumer: the batches read are read_rank_ modulo read_count_.
+  int read_rank_;
+  int read_count_;
+
+  DISABLE_COPY_AND_ASSIGN(ShmBatchRing);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SHM_BATCH_RING_HPP_
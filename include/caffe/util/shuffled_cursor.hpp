@@ -0,0 +1,67 @@
+#ifndef CAFFE_UTIL_SHUFFLED_CURSOR_HPP
+#define CAFFE_UTIL_SHUFFLED_CURSOR_HPP
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+// Fills keys with the keys of the database, in database order. The index is
+// read from the side file <source>.keys when it is newer than the database,
+// and is otherwise built with cursor and saved there for the next run.
+// Failing to save it is not an error, e.g. for a read-only location.
+void LoadKeyIndex(const string& source, Cursor* cursor, vector<string>* keys);
+
+// Iterates a database in a random order, a new permutation of the keys being
+// drawn from the Caffe random generator at every epoch. The cursor wraps
+// another one, which it moves with SeekToKey.
+//
+// To keep some read locality, the permutation is read by windows of
+// window_size records: the records of a window are fetched in database
+// order, buffered, then handed out in the order of the permutation. The
+// value of the current record is thus only a copy, valid until Next().
+//
+// Like the other cursors, the cursor is not valid at the end of an epoch;
+// SeekToFirst() starts the next one.
+class ShuffledCursor : public Cursor {
+ public:
+  // Takes ownership of cursor.
+  ShuffledCursor(Cursor* cursor, const vector<string>& keys, int window_size);
+  virtual ~ShuffledCursor() { }
+  virtual void SeekToFirst();
+  virtual void Next();
+  virtual string key() { return keys_[permutation_[position_]]; }
+  virtual string value() { return window_values_[window_offset()]; }
+  virtual const char* value_data() {
+    return window_values_[window_offset()].data();
+  }
+  virtual size_t value_size() {
+    return window_values_[window_offset()].size();
+  }
+  virtual void SeekToKey(const string& key);
+  virtual bool valid() { return position_ < permutation_.size(); }
+
+ protected:
+  inline int window_offset() const { return position_ - window_begin_; }
+  // Fetches the values of the window starting at position_.
+  void LoadWindow();
+
+  shared_ptr<Cursor> cursor_;
+  const vector<string> keys_;
+  const int window_size_;
+  // Indices into keys_ of the current epoch.
+  vector<int> permutation_;
+  int position_;
+  int window_begin_;
+  vector<string> window_values_;
+
+  DISABLE_COPY_AND_ASSIGN(ShuffledCursor);
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SHUFFLED_CURSOR_HPP
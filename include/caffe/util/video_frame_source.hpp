@@ -0,0 +1,98 @@
+#ifndef CAFFE_UTIL_VIDEO_FRAME_SOURCE_HPP_
+#define CAFFE_UTIL_VIDEO_FRAME_SOURCE_HPP_
+
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#if OPENCV_VERSION == 3
+#include <opencv2/videoio.hpp>
+#else
+#include <opencv2/opencv.hpp>
+#endif  // OPENCV_VERSION == 3
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/worker_pool.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Random access to the frames of a video file, decoded ahead.
+ *
+ * The video is decoded by windows of window_frames consecutive frames, on a
+ * WorkerPool of num_threads workers, each with its own cv::VideoCapture.
+ * When a frame is requested, the windows following it are decoded in the
+ * background, so that the caller transforms a clip while the next ones are
+ * decoded. Decoded windows stay cached until Release(), so that overlapping
+ * clips, or the clips of a batch, do not decode the same frames twice.
+ *
+ * With a single thread the video is read straight through; with more, each
+ * worker seeks to the windows it decodes.
+ *
+ * The frames are shared with the cache: callers must not modify them.
+ */
+class VideoFrameSource {
+ public:
+  VideoFrameSource(const string& video_file, int num_threads,
+                   int window_frames);
+  ~VideoFrameSource();
+
+  // Points frame to the frame at index and returns true, or returns false
+  // past the end of the video.
+  bool GetFrame(int index, cv::Mat* frame);
+  // Drops the cached windows holding only frames before index.
+  void Release(int index);
+
+  // Number of frames announced by the container, which may be off by a few.
+  inline int total_frames() const { return total_frames_; }
+  // Nominal frame rate of the video.
+  inline double fps() const { return fps_; }
+  // Frames decoded so far; frames decoded again after Release() count again.
+  inline uint64_t decoded_frames() const { return decoded_frames_; }
+  // Frames decoded per second of decoding thread time.
+  double decode_fps() const;
+
+ protected:
+  inline int window_of(int index) const { return index / window_frames_; }
+  // Decodes the num_threads windows from first_window in the background,
+  // skipping the ones already cached. The previous round must be collected.
+  void StartRound(int first_window);
+  // Waits for the running round, if any, and caches its windows.
+  void CollectRound();
+  // decode_pool_ task, decoding window round_begin_ + item_id.
+  void DecodeWindow(int item_id, int worker_id);
+
+  const string video_file_;
+  const int window_frames_;
+  int total_frames_;
+  double fps_;
+  // Set once a window comes out short, i.e. the real number of frames.
+  int end_frame_;
+  uint64_t decoded_frames_;
+  double decode_us_;
+  std::map<int, vector<cv::Mat> > windows_;
+
+  // The running round: the windows of decode_pool_'s items, their frames
+  // and decoding times, and the captures of the workers.
+  bool round_running_;
+  int round_begin_;
+  vector<bool> round_wanted_;
+  vector<vector<cv::Mat> > round_frames_;
+  vector<double> round_us_;
+  vector<shared_ptr<cv::VideoCapture> > captures_;
+  // Frame each capture reads next.
+  vector<int> capture_positions_;
+  // Declared last, so that its workers stop before the buffers go away.
+  shared_ptr<WorkerPool> decode_pool_;
+
+  DISABLE_COPY_AND_ASSIGN(VideoFrameSource);
+};
+
+}  // namespace caffe
+
+#endif  // USE_OPENCV
+#endif  // CAFFE_UTIL_VIDEO_FRAME_SOURCE_HPP_
@@ -0,0 +1,71 @@
+#ifndef CAFFE_UTIL_WORKER_POOL_HPP_
+#define CAFFE_UTIL_WORKER_POOL_HPP_
+
+#include <vector>
+
+#include "boost/function.hpp"
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of threads running a task over the items of a batch.
+ *
+ * Item i always runs on worker i % size(), so a task that draws random
+ * numbers from the thread-local Caffe generator, or uses per-worker state
+ * indexed by worker_id, gives reproducible results for a given seed and
+ * number of workers. The workers are seeded like any InternalThread, from
+ * the thread creating the pool.
+ */
+class WorkerPool {
+ public:
+  typedef boost::function<void(int item_id, int worker_id)> Task;
+
+  explicit WorkerPool(int num_workers);
+  ~WorkerPool();
+
+  inline int size() const { return workers_.size(); }
+  // Runs task on the items [0, num_items) in the background. The task must
+  // stay valid until Wait() returns.
+  void Start(int num_items, const Task& task);
+  // Blocks until the items of the last Start() are done.
+  void Wait();
+  // Start() then Wait().
+  void Run(int num_items, const Task& task) {
+    Start(num_items, task);
+    Wait();
+  }
+
+ protected:
+  class Worker : public InternalThread {
+   public:
+    Worker(WorkerPool* pool, int worker_id, int num_workers);
+    virtual ~Worker();
+
+    // Number of items of each started run, and acknowledgements.
+    BlockingQueue<int> jobs_;
+    BlockingQueue<int> done_;
+
+   protected:
+    void InternalThreadEntry();
+
+    WorkerPool* pool_;
+    const int worker_id_;
+    const int num_workers_;
+
+  DISABLE_COPY_AND_ASSIGN(Worker);
+  };
+
+  Task task_;
+  vector<shared_ptr<Worker> > workers_;
+  bool running_;
+
+  DISABLE_COPY_AND_ASSIGN(WorkerPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WORKER_POOL_HPP_
@@ -146,6 +146,20 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::set_data(const shared_ptr<SyncedMemory>& data) {
+  CHECK_GE(data->size(), count_ * sizeof(Dtype));
+  data_ = data;
+  capacity_ = count_;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::set_diff(const shared_ptr<SyncedMemory>& diff) {
+  CHECK_GE(diff->size(), count_ * sizeof(Dtype));
+  diff_ = diff;
+  capacity_ = count_;
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
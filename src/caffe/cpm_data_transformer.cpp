@@ -3,6 +3,7 @@
 //#include <opencv2/contrib/contrib.hpp>
 //#include <opencv2/highgui/highgui.hpp>
 #endif  // USE_OPENCV
+#include <boost/bind.hpp>
 
 #include <iostream>
 #include <algorithm>
@@ -39,6 +40,14 @@ string DecodeString(const string& data, size_t idx) {
   return result;
 }
 
+// Composes the 2x3 affine transform A after the 3x3 transform M.
+static void composeAffine(const Mat& A, Mat& M){
+  Mat A3 = Mat::eye(3, 3, CV_64FC1);
+  A.copyTo(A3.rowRange(0, 2));
+  Mat composed = A3 * M;
+  M = composed;
+}
+
 template<typename Dtype>
 void CPMDataTransformer<Dtype>::ReadMetaData(MetaData& meta, const string& data, size_t offset3, size_t offset1) { //very specific to genLMDB.py
   // ------------------- Dataset name ----------------------
@@ -242,6 +251,35 @@ template<typename Dtype> CPMDataTransformer<Dtype>::CPMDataTransformer(const CPM
   np_in_lmdb = param_.np_in_lmdb();
   np = param_.num_parts();
   is_table_set = false;
+
+  // Label layouts known to generateLabelMap: 18 joints and 19 limbs (given
+  // 1-based) for 56 parts, 15 joints and 14 limbs for 43 parts.
+  label_heat_offset_ = 0;
+  label_joints_ = 0;
+  if (np == 56){
+    int mid_1[19] = {2, 9,  10, 2,  12, 13, 2, 3, 4, 3,  2, 6, 7, 6,  2, 1,  1,  15, 16};
+    int mid_2[19] = {9, 10, 11, 12, 13, 14, 3, 4, 5, 17, 6, 7, 8, 18, 1, 15, 16, 17, 18};
+    label_heat_offset_ = np+39;
+    label_joints_ = 18;
+    for (int i = 0; i < 19; i++){
+      limb_from_.push_back(mid_1[i]-1);
+      limb_to_.push_back(mid_2[i]-1);
+    }
+  }
+  else if (np == 43){
+    int mid_1[14] = {0, 1, 2, 3, 1, 5, 6, 1, 14, 8, 9,  14, 11, 12};
+    int mid_2[14] = {1, 2, 3, 4, 5, 6, 7, 14, 8, 9, 10, 11, 12, 13};
+    label_heat_offset_ = np+29;
+    label_joints_ = 15;
+    limb_from_.assign(mid_1, mid_1 + 14);
+    limb_to_.assign(mid_2, mid_2 + 14);
+  }
+  const int label_threads = param_.label_threads();
+  CHECK_GT(label_threads, 0);
+  if (label_threads > 1){
+    LOG(INFO) << "Generating labels with " << label_threads << " threads.";
+    label_pool_.reset(new WorkerPool(label_threads));
+  }
 }
 
 template<typename Dtype> void CPMDataTransformer<Dtype>::Transform(const Datum& datum, Dtype* transformed_data) {
@@ -525,40 +563,30 @@ template<typename Dtype> void CPMDataTransformer<Dtype>::Transform_nv(const Datu
   Mat mask_miss_aug, mask_all_aug ;
   //Mat mask_miss_aug = Mat::zeros(crop_y, crop_x, CV_8UC1);
   //Mat mask_all_aug = Mat::zeros(crop_y, crop_x, CV_8UC1);
-  Mat img_temp, img_temp2, img_temp3; //size determined by scale
   VLOG(2) << "   input size (" << img.cols << ", " << img.rows << ")"; 
   // We only do random transform as augmentation when training.
   if (phase_ == TRAIN) {
-    as.scale = augmentation_scale(img, img_temp, mask_miss, mask_all, meta, mode);
-    //LOG(INFO) << meta.joint_self.joints.size();
-    //LOG(INFO) << meta.joint_self.joints[0];
-    as.degree = augmentation_rotate(img_temp, img_temp2, mask_miss, mask_all, meta, mode);
-    //LOG(INFO) << meta.joint_self.joints.size();
-    //LOG(INFO) << meta.joint_self.joints[0];
-    if(0 && param_.visualize()) 
-      visualize(img_temp2, meta, as);
-    as.crop = augmentation_croppad(img_temp2, img_temp3, mask_miss, mask_miss_aug, mask_all, mask_all_aug, meta, mode);
-    //LOG(INFO) << meta.joint_self.joints.size();
-    //LOG(INFO) << meta.joint_self.joints[0];
-    if(0 && param_.visualize()) 
-      visualize(img_temp3, meta, as);
-    as.flip = augmentation_flip(img_temp3, img_aug, mask_miss_aug, mask_all_aug, meta, mode);
-    //LOG(INFO) << meta.joint_self.joints.size();
-    //LOG(INFO) << meta.joint_self.joints[0];
+    // scale, rotate, crop and flip as one transform
+    Mat M = Mat::eye(3, 3, CV_64FC1);
+    Size size = img.size();
+    as.scale = augmentation_scale(M, size, meta);
+    as.degree = augmentation_rotate(M, size, meta);
+    as.crop = augmentation_croppad(M, size, meta);
+    as.flip = augmentation_flip(M, size, meta);
+    // a single resampling of the image, padded with gray
+    warpAffine(img, img_aug, M.rowRange(0, 2), size, INTER_CUBIC, BORDER_CONSTANT, Scalar(128,128,128));
     if(param_.visualize()) 
       visualize(img_aug, meta, as);
 
-    // imshow("img_aug", img_aug);
-    // Mat label_map = mask_miss_aug;
-    // applyColorMap(label_map, label_map, COLORMAP_JET);
-    // addWeighted(label_map, 0.5, img_aug, 0.5, 0.0, label_map);
-    // imshow("mask_miss_aug", label_map);
-
+    // and of the masks, straight to the label grid
+    Mat M_grid = M.clone();
+    Size grid_size = size;
+    toLabelGrid(M_grid, grid_size);
     if (mode > 4){
-      resize(mask_miss_aug, mask_miss_aug, Size(), 1.0/stride, 1.0/stride, INTER_CUBIC);
+      warpAffine(mask_miss, mask_miss_aug, M_grid.rowRange(0, 2), grid_size, INTER_CUBIC, BORDER_CONSTANT, Scalar(255)); //Scalar(0) for MPI, COCO with Scalar(255);
     }
     if (mode > 5){
-      resize(mask_all_aug, mask_all_aug, Size(), 1.0/stride, 1.0/stride, INTER_CUBIC);
+      warpAffine(mask_all, mask_all_aug, M_grid.rowRange(0, 2), grid_size, INTER_CUBIC, BORDER_CONSTANT, Scalar(0));
     }
   }
   else {
@@ -624,14 +652,13 @@ template<typename Dtype> void CPMDataTransformer<Dtype>::Transform_nv(const Datu
 }
 
 
-// include mask_miss
+// one transform for image, mask_miss and mask_all
 template<typename Dtype>
-float CPMDataTransformer<Dtype>::augmentation_scale(Mat& img_src, Mat& img_temp, Mat& mask_miss, Mat& mask_all, MetaData& meta, int mode) {
+float CPMDataTransformer<Dtype>::augmentation_scale(Mat& M, Size& size, MetaData& meta) {
   float dice = static_cast <float> (rand()) / static_cast <float> (RAND_MAX); //[0,1]
   float scale_multiplier;
   //float scale = (param_.scale_max() - param_.scale_min()) * dice + param_.scale_min(); //linear shear into [scale_min, scale_max]
   if(dice > param_.scale_prob()) {
-    img_temp = img_src.clone();
     scale_multiplier = 1;
   }
   else {
@@ -640,13 +667,12 @@ float CPMDataTransformer<Dtype>::augmentation_scale(Mat& img_src, Mat& img_temp,
   }
   float scale_abs = param_.target_dist()/meta.scale_self;
   float scale = scale_abs * scale_multiplier;
-  resize(img_src, img_temp, Size(), scale, scale, INTER_CUBIC);
-  if(mode>4){
-    resize(mask_miss, mask_miss, Size(), scale, scale, INTER_CUBIC);
-  }
-  if(mode>5){
-    resize(mask_all, mask_all, Size(), scale, scale, INTER_CUBIC);
-  }
+  Mat S = Mat::zeros(2, 3, CV_64FC1);
+  S.at<double>(0,0) = scale;
+  S.at<double>(1,1) = scale;
+  composeAffine(S, M);
+  // as resize() would
+  size = Size(round(size.width * double(scale)), round(size.height * double(scale)));
 
   //modify meta data
   meta.objpos *= scale;
@@ -663,7 +689,7 @@ float CPMDataTransformer<Dtype>::augmentation_scale(Mat& img_src, Mat& img_temp,
 }
 
 template<typename Dtype>
-Size CPMDataTransformer<Dtype>::augmentation_croppad(Mat& img_src, Mat& img_dst, Mat& mask_miss, Mat& mask_miss_aug, Mat& mask_all, Mat& mask_all_aug, MetaData& meta, int mode) {
+Size CPMDataTransformer<Dtype>::augmentation_croppad(Mat& M, Size& size, MetaData& meta) {
   float dice_x = static_cast <float> (rand()) / static_cast <float> (RAND_MAX); //[0,1]
   float dice_y = static_cast <float> (rand()) / static_cast <float> (RAND_MAX); //[0,1]
   int crop_x = param_.crop_size_x();
@@ -672,32 +698,16 @@ Size CPMDataTransformer<Dtype>::augmentation_croppad(Mat& img_src, Mat& img_dst,
   float x_offset = int((dice_x - 0.5) * 2 * param_.center_perterb_max());
   float y_offset = int((dice_y - 0.5) * 2 * param_.center_perterb_max());
 
-  //LOG(INFO) << "Size of img_temp is " << img_temp.cols << " " << img_temp.rows;
-  //LOG(INFO) << "ROI is " << x_offset << " " << y_offset << " " << min(800, img_temp.cols) << " " << min(256, img_temp.rows);
   Point2i center = meta.objpos + Point2f(x_offset, y_offset);
   int offset_left = -(center.x - (crop_x/2));
   int offset_up = -(center.y - (crop_y/2));
-  // int to_pad_right = max(center.x + (crop_x - crop_x/2) - img_src.cols, 0);
-  // int to_pad_down = max(center.y + (crop_y - crop_y/2) - img_src.rows, 0);
-  
-  img_dst = Mat::zeros(crop_y, crop_x, CV_8UC3) + Scalar(128,128,128);
-  mask_miss_aug = Mat::zeros(crop_y, crop_x, CV_8UC1) + Scalar(255); //for MPI, COCO with Scalar(255);
-  mask_all_aug = Mat::zeros(crop_y, crop_x, CV_8UC1);
-  for(int i=0;i<crop_y;i++){
-    for(int j=0;j<crop_x;j++){ //i,j on cropped
-      int coord_x_on_img = center.x - crop_x/2 + j;
-      int coord_y_on_img = center.y - crop_y/2 + i;
-      if(onPlane(Point(coord_x_on_img, coord_y_on_img), Size(img_src.cols, img_src.rows))){
-        img_dst.at<Vec3b>(i,j) = img_src.at<Vec3b>(coord_y_on_img, coord_x_on_img);
-        if(mode>4){
-          mask_miss_aug.at<uchar>(i,j) = mask_miss.at<uchar>(coord_y_on_img, coord_x_on_img);
-        }
-        if(mode>5){
-          mask_all_aug.at<uchar>(i,j) = mask_all.at<uchar>(coord_y_on_img, coord_x_on_img);
-        }
-      }
-    }
-  }
+
+  // the crop is padded like the warp, see Transform_nv
+  Mat T = Mat::eye(2, 3, CV_64FC1);
+  T.at<double>(0,2) = offset_left;
+  T.at<double>(1,2) = offset_up;
+  composeAffine(T, M);
+  size = Size(crop_x, crop_y);
 
   //modify meta data
   Point2f offset(offset_left, offset_up);
@@ -716,7 +726,7 @@ Size CPMDataTransformer<Dtype>::augmentation_croppad(Mat& img_src, Mat& img_dst,
 }
 
 template<typename Dtype>
-bool CPMDataTransformer<Dtype>::augmentation_flip(Mat& img_src, Mat& img_aug, Mat& mask_miss, Mat& mask_all, MetaData& meta, int mode) {
+bool CPMDataTransformer<Dtype>::augmentation_flip(Mat& M, Size& size, MetaData& meta) {
   bool doflip;
   if(param_.aug_way() == "rand"){
     float dice = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
@@ -731,14 +741,13 @@ bool CPMDataTransformer<Dtype>::augmentation_flip(Mat& img_src, Mat& img_aug, Ma
   }
 
   if(doflip){
-    flip(img_src, img_aug, 1);
-    int w = img_src.cols;
-    if(mode>4){
-      flip(mask_miss, mask_miss, 1);
-    }
-    if(mode>5){
-      flip(mask_all, mask_all, 1);
-    }
+    int w = size.width;
+    Mat F = Mat::zeros(2, 3, CV_64FC1);
+    F.at<double>(0,0) = -1;
+    F.at<double>(0,2) = w - 1;
+    F.at<double>(1,1) = 1;
+    composeAffine(F, M);
+
     meta.objpos.x = w - 1 - meta.objpos.x;
     for(int i=0; i<np; i++){
       meta.joint_self.joints[i].x = w - 1 - meta.joint_self.joints[i].x;
@@ -755,14 +764,11 @@ bool CPMDataTransformer<Dtype>::augmentation_flip(Mat& img_src, Mat& img_aug, Ma
         swapLeftRight(meta.joint_others[p]);
     }
   }
-  else {
-    img_aug = img_src.clone();
-  }
   return doflip;
 }
 
 template<typename Dtype>
-float CPMDataTransformer<Dtype>::augmentation_rotate(Mat& img_src, Mat& img_dst, Mat& mask_miss, Mat& mask_all, MetaData& meta, int mode) {
+float CPMDataTransformer<Dtype>::augmentation_rotate(Mat& M, Size& size, MetaData& meta) {
   
   float degree;
   if(param_.aug_way() == "rand"){
@@ -777,21 +783,14 @@ float CPMDataTransformer<Dtype>::augmentation_rotate(Mat& img_src, Mat& img_dst,
     LOG(INFO) << "Unhandled exception!!!!!!";
   }
   
-  Point2f center(img_src.cols/2.0, img_src.rows/2.0);
+  Point2f center(size.width/2.0, size.height/2.0);
   Mat R = getRotationMatrix2D(center, degree, 1.0);
-  Rect bbox = RotatedRect(center, img_src.size(), degree).boundingRect();
+  Rect bbox = RotatedRect(center, size, degree).boundingRect();
   // adjust transformation matrix
   R.at<double>(0,2) += bbox.width/2.0 - center.x;
   R.at<double>(1,2) += bbox.height/2.0 - center.y;
-  //LOG(INFO) << "R=[" << R.at<double>(0,0) << " " << R.at<double>(0,1) << " " << R.at<double>(0,2) << ";" 
-  //          << R.at<double>(1,0) << " " << R.at<double>(1,1) << " " << R.at<double>(1,2) << "]";
-  warpAffine(img_src, img_dst, R, bbox.size(), INTER_CUBIC, BORDER_CONSTANT, Scalar(128,128,128));
-  if(mode >4){
-    warpAffine(mask_miss, mask_miss, R, bbox.size(), INTER_CUBIC, BORDER_CONSTANT, Scalar(255)); //Scalar(0) for MPI, COCO with Scalar(255);
-  }
-  if(mode >5){
-    warpAffine(mask_all, mask_all, R, bbox.size(), INTER_CUBIC, BORDER_CONSTANT, Scalar(0));
-  }
+  composeAffine(R, M);
+  size = bbox.size();
 
   //adjust meta data
   RotatePoint(meta.objpos, R);
@@ -808,6 +807,20 @@ float CPMDataTransformer<Dtype>::augmentation_rotate(Mat& img_src, Mat& img_dst,
 }
 // end here
 
+// as resize() by 1/stride would: grid cell g is centered on pixel
+// (g + 0.5) * stride - 0.5
+template<typename Dtype>
+void CPMDataTransformer<Dtype>::toLabelGrid(Mat& M, Size& size) {
+  int stride = param_.stride();
+  Mat D = Mat::zeros(2, 3, CV_64FC1);
+  D.at<double>(0,0) = 1.0/stride;
+  D.at<double>(1,1) = 1.0/stride;
+  D.at<double>(0,2) = 0.5/stride - 0.5;
+  D.at<double>(1,2) = 0.5/stride - 0.5;
+  composeAffine(D, M);
+  size = Size(round(size.width * (1.0/stride)), round(size.height * (1.0/stride)));
+}
+
 
 template<typename Dtype>
 float CPMDataTransformer<Dtype>::augmentation_scale(Mat& img_src, Mat& img_temp, MetaData& meta) {
@@ -1016,22 +1029,49 @@ float CPMDataTransformer<Dtype>::augmentation_rotate(Mat& img_src, Mat& img_dst,
   return degree;
 }
 
+// The grid coordinate v clamped to [0, size], NaN giving 0.
+static int clampToGrid(float v, int size){
+  if (!(v > 0))
+    return 0;
+  return v < size ? int(v) : size;
+}
+
 template<typename Dtype>
 void CPMDataTransformer<Dtype>::putGaussianMaps(Dtype* entry, Point2f center, int stride, int grid_x, int grid_y, float sigma){
   //LOG(INFO) << "putGaussianMaps here we start for " << center.x << " " << center.y;
   float start = stride/2.0 - 0.5; //0 if stride = 1, 0.5 if stride = 2, 1.5 if stride = 4, ...
-  for (int g_y = 0; g_y < grid_y; g_y++){
-    for (int g_x = 0; g_x < grid_x; g_x++){
-      float x = start + g_x * stride;
-      float y = start + g_y * stride;
-      float d2 = (x-center.x)*(x-center.x) + (y-center.y)*(y-center.y);
+  // Nothing is added beyond exponent ln(100), i.e. sigma * sqrt(2 ln(100))
+  // (about 3 sigma) from the center, so only the cells of that window are
+  // visited, give or take one.
+  float radius = sigma * sqrt(2 * 4.6052);
+  int min_x = clampToGrid(floor((center.x - radius - start) / stride), grid_x);
+  int max_x = clampToGrid(ceil((center.x + radius - start) / stride) + 1, grid_x);
+  int min_y = clampToGrid(floor((center.y - radius - start) / stride), grid_y);
+  int max_y = clampToGrid(ceil((center.y + radius - start) / stride) + 1, grid_y);
+  if (min_x >= max_x || min_y >= max_y){
+    return;
+  }
+  // The Gaussian is separable: look its factors up per column and per row.
+  vector<float> d2_x(max_x - min_x), exp_x(max_x - min_x);
+  for (int g_x = min_x; g_x < max_x; g_x++){
+    float x = start + g_x * stride;
+    d2_x[g_x - min_x] = (x-center.x)*(x-center.x);
+    exp_x[g_x - min_x] = exp(-d2_x[g_x - min_x] / 2.0 / sigma / sigma);
+  }
+  for (int g_y = min_y; g_y < max_y; g_y++){
+    float y = start + g_y * stride;
+    float d2_y = (y-center.y)*(y-center.y);
+    float exp_y = exp(-d2_y / 2.0 / sigma / sigma);
+    Dtype* row = entry + g_y*grid_x;
+    for (int g_x = min_x; g_x < max_x; g_x++){
+      float d2 = d2_x[g_x - min_x] + d2_y;
       float exponent = d2 / 2.0 / sigma / sigma;
       if(exponent > 4.6052){ //ln(100) = -ln(1%)
         continue;
       }
-      entry[g_y*grid_x + g_x] += exp(-exponent);
-      if(entry[g_y*grid_x + g_x] > 1) 
-        entry[g_y*grid_x + g_x] = 1;
+      row[g_x] += exp_x[g_x - min_x] * exp_y;
+      if(row[g_x] > 1)
+        row[g_x] = 1;
     }
   }
 }
@@ -1091,30 +1131,31 @@ void CPMDataTransformer<Dtype>::putVecMaps(Dtype* entryX, Dtype* entryY, Mat& co
   int max_y = std::min( int(round(std::max(centerA.y, centerB.y)+thre)), grid_y);
 
   float norm_bc = sqrt(bc.x*bc.x + bc.y*bc.y);
+  if (norm_bc == 0){
+    // A limb of no length has no direction.
+    return;
+  }
   bc.x = bc.x /norm_bc;
   bc.y = bc.y /norm_bc;
 
-  // float x_p = (centerA.x + centerB.x) / 2;
-  // float y_p = (centerA.y + centerB.y) / 2;
-  // float angle = atan2f(centerB.y - centerA.y, centerB.x - centerA.x);
-  // float sine = sinf(angle);
-  // float cosine = cosf(angle);
-  // float a_sqrt = (centerA.x - x_p) * (centerA.x - x_p) + (centerA.y - y_p) * (centerA.y - y_p);
-  // float b_sqrt = 10; //fixed
-
   for (int g_y = min_y; g_y < max_y; g_y++){
-    for (int g_x = min_x; g_x < max_x; g_x++){
+    // Unless the limb is horizontal, the cells of the row within thre of it
+    // are a segment around where the row crosses the limb's line.
+    int row_min_x = min_x;
+    int row_max_x = max_x;
+    if (bc.y != 0){
+      float cross_x = centerA.x + (g_y - centerA.y) * bc.x / bc.y;
+      float half_width = thre / std::abs(bc.y);
+      row_min_x = std::max(clampToGrid(floor(cross_x - half_width), grid_x), min_x);
+      row_max_x = std::min(clampToGrid(ceil(cross_x + half_width) + 1, grid_x), max_x);
+    }
+    for (int g_x = row_min_x; g_x < row_max_x; g_x++){
       Point2f ba;
       ba.x = g_x - centerA.x;
       ba.y = g_y - centerA.y;
       float dist = std::abs(ba.x*bc.y -ba.y*bc.x);
 
-      // float A = cosine * (g_x - x_p) + sine * (g_y - y_p);
-      // float B = sine * (g_x - x_p) - cosine * (g_y - y_p);
-      // float judge = A * A / a_sqrt + B * B / b_sqrt;
-
       if(dist <= thre){
-      //if(judge <= 1){
         int cnt = count.at<uchar>(g_y, g_x);
         //LOG(INFO) << "putVecMaps here we start for " << g_x << " " << g_y;
         if (cnt == 0){
@@ -1132,6 +1173,44 @@ void CPMDataTransformer<Dtype>::putVecMaps(Dtype* entryX, Dtype* entryY, Mat& co
   }
 }
 
+template<typename Dtype>
+void CPMDataTransformer<Dtype>::putLabelJob(Dtype* transformed_label, const MetaData& meta, int grid_x, int grid_y, int job){
+  int channelOffset = grid_y * grid_x;
+  if (job < label_joints_){
+    Dtype* entry = transformed_label + (label_heat_offset_ + job)*channelOffset;
+    if(meta.joint_self.isVisible[job] <= 1){
+      putGaussianMaps(entry, meta.joint_self.joints[job], param_.stride(),
+                      grid_x, grid_y, param_.sigma()); //self
+    }
+    for(int j = 0; j < meta.numOtherPeople; j++){ //for every other person
+      if(meta.joint_others[j].isVisible[job] <= 1){
+        putGaussianMaps(entry, meta.joint_others[j].joints[job], param_.stride(),
+                        grid_x, grid_y, param_.sigma());
+      }
+    }
+    return;
+  }
+  int limb = job - label_joints_;
+  int from = limb_from_[limb];
+  int to = limb_to_[limb];
+  Dtype* entryX = transformed_label + (np+ 1+ 2*limb)*channelOffset;
+  Dtype* entryY = transformed_label + (np+ 2+ 2*limb)*channelOffset;
+  int thre = 1;
+  Mat count = Mat::zeros(grid_y, grid_x, CV_8UC1);
+  const Joints& jo = meta.joint_self;
+  if(jo.isVisible[from]<=1 && jo.isVisible[to]<=1){
+    putVecMaps(entryX, entryY, count, jo.joints[from], jo.joints[to],
+               param_.stride(), grid_x, grid_y, param_.sigma(), thre); //self
+  }
+  for(int j = 0; j < meta.numOtherPeople; j++){ //for every other person
+    const Joints& jo2 = meta.joint_others[j];
+    if(jo2.isVisible[from]<=1 && jo2.isVisible[to]<=1){
+      putVecMaps(entryX, entryY, count, jo2.joints[from], jo2.joints[to],
+                 param_.stride(), grid_x, grid_y, param_.sigma(), thre);
+    }
+  }
+}
+
 template<typename Dtype>
 void CPMDataTransformer<Dtype>::generateLabelMap(Dtype* transformed_label, Mat& img_aug, MetaData meta) {
   int rezX = img_aug.cols;
@@ -1142,118 +1221,36 @@ void CPMDataTransformer<Dtype>::generateLabelMap(Dtype* transformed_label, Mat&
   int channelOffset = grid_y * grid_x;
   int mode = 5; // TO DO: make this as a parameter
 
-  for (int g_y = 0; g_y < grid_y; g_y++){
-    for (int g_x = 0; g_x < grid_x; g_x++){
-      for (int i = np+1; i < 2*(np+1); i++){
-        if (mode == 6 && i == (2*np + 1))
-          continue;
-        transformed_label[i*channelOffset + g_y*grid_x + g_x] = 0;
-      }
-    }
+  for (int i = np+1; i < 2*(np+1); i++){
+    if (mode == 6 && i == (2*np + 1))
+      continue;
+    caffe_set(channelOffset, Dtype(0), transformed_label + i*channelOffset);
   }
 
-  if (np == 56){
-    for (int i = 0; i < 18; i++){
-      Point2f center = meta.joint_self.joints[i];
-      if(meta.joint_self.isVisible[i] <= 1){
-        putGaussianMaps(transformed_label + (i+np+39)*channelOffset, center, param_.stride(), 
-                        grid_x, grid_y, param_.sigma()); //self
-      }
-      for(int j = 0; j < meta.numOtherPeople; j++){ //for every other person
-        Point2f center = meta.joint_others[j].joints[i];
-        if(meta.joint_others[j].isVisible[i] <= 1){
-          putGaussianMaps(transformed_label + (i+np+39)*channelOffset, center, param_.stride(), 
-                          grid_x, grid_y, param_.sigma());
-        }
-      }
-    }
-
-    int mid_1[19] = {2, 9,  10, 2,  12, 13, 2, 3, 4, 3,  2, 6, 7, 6,  2, 1,  1,  15, 16};
-    int mid_2[19] = {9, 10, 11, 12, 13, 14, 3, 4, 5, 17, 6, 7, 8, 18, 1, 15, 16, 17, 18};
-    int thre = 1;
-
-    for(int i=0;i<19;i++){
-      Mat count = Mat::zeros(grid_y, grid_x, CV_8UC1);
-      Joints jo = meta.joint_self;
-      if(jo.isVisible[mid_1[i]-1]<=1 && jo.isVisible[mid_2[i]-1]<=1){
-        //putVecPeaks
-        putVecMaps(transformed_label + (np+ 1+ 2*i)*channelOffset, transformed_label + (np+ 2+ 2*i)*channelOffset, 
-                  count, jo.joints[mid_1[i]-1], jo.joints[mid_2[i]-1], param_.stride(), grid_x, grid_y, param_.sigma(), thre); //self
-      }
-
-      for(int j = 0; j < meta.numOtherPeople; j++){ //for every other person
-        Joints jo2 = meta.joint_others[j];
-        if(jo2.isVisible[mid_1[i]-1]<=1 && jo2.isVisible[mid_2[i]-1]<=1){
-          //putVecPeaks
-          putVecMaps(transformed_label + (np+ 1+ 2*i)*channelOffset, transformed_label + (np+ 2+ 2*i)*channelOffset, 
-                  count, jo2.joints[mid_1[i]-1], jo2.joints[mid_2[i]-1], param_.stride(), grid_x, grid_y, param_.sigma(), thre); //self
-        }
-      }
-    }
-
-    //put background channel
-    for (int g_y = 0; g_y < grid_y; g_y++){
-      for (int g_x = 0; g_x < grid_x; g_x++){
-        float maximum = 0;
-        //second background channel
-        for (int i = np+39; i < np+57; i++){
-          maximum = (maximum > transformed_label[i*channelOffset + g_y*grid_x + g_x]) ? maximum : transformed_label[i*channelOffset + g_y*grid_x + g_x];
-        }
-        transformed_label[(2*np+1)*channelOffset + g_y*grid_x + g_x] = max(1.0-maximum, 0.0);
-      }
-    }
-    //LOG(INFO) << "background put";
+  // One job per joint heatmap and per limb, see putLabelJob.
+  int num_jobs = label_joints_ + limb_from_.size();
+  if (label_pool_){
+    label_pool_->Run(num_jobs, boost::bind(&CPMDataTransformer<Dtype>::putLabelJob,
+        this, transformed_label, boost::cref(meta), grid_x, grid_y, _1));
   }
-  
-  else if (np == 43){
-    for (int i = 0; i < 15; i++){
-      Point2f center = meta.joint_self.joints[i];
-      if(meta.joint_self.isVisible[i] <= 1){
-        putGaussianMaps(transformed_label + (i+np+29)*channelOffset, center, param_.stride(), 
-                        grid_x, grid_y, param_.sigma()); //self
-      }
-      for(int j = 0; j < meta.numOtherPeople; j++){ //for every other person
-        Point2f center = meta.joint_others[j].joints[i];
-        if(meta.joint_others[j].isVisible[i] <= 1){
-          putGaussianMaps(transformed_label + (i+np+29)*channelOffset, center, param_.stride(), 
-                          grid_x, grid_y, param_.sigma());
-        }
-      }
+  else{
+    for (int job = 0; job < num_jobs; job++){
+      putLabelJob(transformed_label, meta, grid_x, grid_y, job);
     }
+  }
 
-    int mid_1[14] = {0, 1, 2, 3, 1, 5, 6, 1, 14, 8, 9,  14, 11, 12};
-    int mid_2[14] = {1, 2, 3, 4, 5, 6, 7, 14, 8, 9, 10, 11, 12, 13};
-    int thre = 1;
-
-    for(int i=0;i<14;i++){
-      Mat count = Mat::zeros(grid_y, grid_x, CV_8UC1);
-      Joints jo = meta.joint_self;
-      if(jo.isVisible[mid_1[i]]<=1 && jo.isVisible[mid_2[i]]<=1){
-        //putVecPeaks
-        putVecMaps(transformed_label + (np+ 1+ 2*i)*channelOffset, transformed_label + (np+ 2+ 2*i)*channelOffset, 
-                  count, jo.joints[mid_1[i]], jo.joints[mid_2[i]], param_.stride(), grid_x, grid_y, param_.sigma(), thre); //self
-      }
-
-      for(int j = 0; j < meta.numOtherPeople; j++){ //for every other person
-        Joints jo2 = meta.joint_others[j];
-        if(jo2.isVisible[mid_1[i]]<=1 && jo2.isVisible[mid_2[i]]<=1){
-          //putVecPeaks
-          putVecMaps(transformed_label + (np+ 1+ 2*i)*channelOffset, transformed_label + (np+ 2+ 2*i)*channelOffset, 
-                  count, jo2.joints[mid_1[i]], jo2.joints[mid_2[i]], param_.stride(), grid_x, grid_y, param_.sigma(), thre); //self
-        }
+  if (label_joints_ > 0){
+    //put background channel: 1 - the maximum of the heatmaps
+    Dtype* background = transformed_label + (2*np+1)*channelOffset;
+    caffe_set(channelOffset, Dtype(0), background);
+    for (int i = label_heat_offset_; i < label_heat_offset_ + label_joints_; i++){
+      const Dtype* heatmap = transformed_label + i*channelOffset;
+      for (int k = 0; k < channelOffset; k++){
+        background[k] = std::max(background[k], heatmap[k]);
       }
     }
-
-    //put background channel
-    for (int g_y = 0; g_y < grid_y; g_y++){
-      for (int g_x = 0; g_x < grid_x; g_x++){
-        float maximum = 0;
-        //second background channel
-        for (int i = np+29; i < np+44; i++){
-          maximum = (maximum > transformed_label[i*channelOffset + g_y*grid_x + g_x]) ? maximum : transformed_label[i*channelOffset + g_y*grid_x + g_x];
-        }
-        transformed_label[(2*np+1)*channelOffset + g_y*grid_x + g_x] = max(1.0-maximum, 0.0);
-      }
+    for (int k = 0; k < channelOffset; k++){
+      background[k] = max(1.0-background[k], 0.0);
     }
     //LOG(INFO) << "background put";
   }
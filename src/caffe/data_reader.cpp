@@ -8,6 +8,7 @@
 #include "caffe/layers/annotated_data_layer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/shuffled_cursor.hpp"
 
 namespace caffe {
 
@@ -62,10 +63,13 @@ DataReader<T>::~DataReader() {
 }
 
 template <typename T>
-DataReader<T>::QueuePair::QueuePair(int size) {
+DataReader<T>::QueuePair::QueuePair(int size)
+    : free_(size), full_(size) {
   // Initialize the free queue with requested number of data
   for (int i = 0; i < size; ++i) {
-    free_.push(new T());
+    T* t = new T();
+    keys_[t] = string();
+    free_.push(t);
   }
 }
 
@@ -80,10 +84,57 @@ DataReader<T>::QueuePair::~QueuePair() {
   }
 }
 
+template <typename T>
+DataReader<T>::Reader::Reader(db::Cursor* cursor, int offset, int stride,
+    bool keep_keys, QueuePair* qp)
+    : cursor_(cursor), offset_(offset), stride_(stride),
+      keep_keys_(keep_keys), qp_(qp) {
+    StartInternalThread();
+}
+
+template <typename T>
+DataReader<T>::Reader::~Reader() {
+    StopInternalThread();
+}
+
+template <typename T>
+void DataReader<T>::Reader::next() {
+    cursor_->Next();
+    if (!cursor_->valid()) {
+        cursor_->SeekToFirst();
+    }
+}
+
+template <typename T>
+void DataReader<T>::Reader::InternalThreadEntry() {
+    try {
+        for (int i = 0; i < offset_; ++i) {
+            next();
+        }
+        while (!must_stop()) {
+            T* t = qp_->free_.pop();
+            t->ParseFromArray(cursor_->value_data(), cursor_->value_size());
+            if (keep_keys_) {
+                qp_->keys_.find(t)->second = cursor_->key();
+            }
+            qp_->full_.push(t);
+            // Skip the records of the other readers. Moving the cursor is
+            // cheap compared to parsing.
+            for (int i = 0; i < stride_; ++i) {
+                next();
+            }
+        }
+    } catch (boost::thread_interrupted&) {
+        // Interrupted exception is expected on shutdown
+    }
+}
+
 template <typename T>
 DataReader<T>::Body::Body(const LayerParameter& param)
     : param_(param),
-      new_queue_pairs_() {
+      keep_keys_(param.data_param().decoded_cache_bytes() > 0),
+      new_queue_pairs_(),
+      next_reader_(0) {
     StartInternalThread();
 }
 
@@ -92,11 +143,61 @@ DataReader<T>::Body::~Body() {
     StopInternalThread();
 }
 
+template <typename T>
+void DataReader<T>::Body::start_readers(db::DB* db) {
+    const DataParameter& data_param = param_.data_param();
+    const int num_readers = data_param.reader_threads();
+    const int qp_size = data_param.batch_size();
+    LOG(INFO) << "Reading " << data_param.source() << " with " << num_readers
+              << (data_param.deterministic_read() ? " deterministic" : "")
+              << " reader threads.";
+    if (data_param.deterministic_read()) {
+        for (int i = 0; i < num_readers; ++i) {
+            reader_qps_.push_back(shared_ptr<QueuePair>(new QueuePair(qp_size)));
+        }
+    } else {
+        reader_qps_.push_back(
+            shared_ptr<QueuePair>(new QueuePair(qp_size * num_readers)));
+    }
+    // Cursors are created on this thread, as LMDB does not allow opening the
+    // database handle from concurrent transactions.
+    for (int i = 0; i < num_readers; ++i) {
+        QueuePair* qp = reader_qps_[i % reader_qps_.size()].get();
+        readers_.push_back(shared_ptr<Reader>(
+            new Reader(db->NewCursor(), i, num_readers, keep_keys_, qp)));
+    }
+}
+
+template <typename T>
+void DataReader<T>::Body::stop_readers() {
+    // Readers must be stopped before their queues and the database go away.
+    readers_.clear();
+    reader_qps_.clear();
+}
+
 template <typename T>
 void DataReader<T>::Body::InternalThreadEntry() {
+    CHECK_NE(param_.data_param().backend(), DataParameter_DB_MMAP)
+        << "mmap databases hold raw floats, not " << T().GetTypeName()
+        << " records.";
     shared_ptr<db::DB> db(db::GetDB(param_.data_param().backend()));
     db->Open(param_.data_param().source(), db::READ);
-    shared_ptr<db::Cursor> cursor(db->NewCursor());
+    CHECK_GT(param_.data_param().reader_threads(), 0);
+    shared_ptr<db::Cursor> cursor;
+    if (param_.data_param().shuffle()) {
+        if (param_.data_param().reader_threads() > 1) {
+            LOG(WARNING) << "Shuffled reads use a single reader thread.";
+        }
+        db::Cursor* db_cursor = db->NewCursor();
+        vector<string> keys;
+        db::LoadKeyIndex(param_.data_param().source(), db_cursor, &keys);
+        cursor.reset(new db::ShuffledCursor(db_cursor, keys,
+            param_.data_param().shuffle_window()));
+    } else if (param_.data_param().reader_threads() > 1) {
+        start_readers(db.get());
+    } else {
+        cursor.reset(db->NewCursor());
+    }
     vector<shared_ptr<QueuePair> > qps;
     try {
         int solver_count = param_.phase() == TRAIN ? Caffe::solver_count() : 1;
@@ -106,13 +207,21 @@ void DataReader<T>::Body::InternalThreadEntry() {
         // so read one item, then wait for the next solver.
         for (int i = 0; i < solver_count; ++i) {
             shared_ptr<QueuePair> qp(new_queue_pairs_.pop());
-            read_one(cursor.get(), qp.get());
+            if (cursor) {
+                read_one(cursor.get(), qp.get());
+            } else {
+                read_one(qp.get());
+            }
             qps.push_back(qp);
         }
         // Main loop
         while (!must_stop()) {
             for (int i = 0; i < solver_count; ++i) {
-                read_one(cursor.get(), qps[i].get());
+                if (cursor) {
+                    read_one(cursor.get(), qps[i].get());
+                } else {
+                    read_one(qps[i].get());
+                }
             }
             // Check no additional readers have been created. This can happen if
             // more than one net is trained at a time per process, whether single
@@ -123,13 +232,17 @@ void DataReader<T>::Body::InternalThreadEntry() {
     } catch (boost::thread_interrupted&) {
         // Interrupted exception is expected on shutdown
     }
+    stop_readers();
 }
 
 template <typename T>
 void DataReader<T>::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
     T* t = qp->free_.pop();
-    // TODO deserialize in-place instead of copy?
-    t->ParseFromString(cursor->value());
+    // Deserialize in-place from the database, without copying the value.
+    t->ParseFromArray(cursor->value_data(), cursor->value_size());
+    if (keep_keys_) {
+        qp->keys_.find(t)->second = cursor->key();
+    }
     qp->full_.push(t);
 
     // go to the next iter
@@ -140,6 +253,29 @@ void DataReader<T>::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
     }
 }
 
+template <typename T>
+void DataReader<T>::Body::read_one(QueuePair* qp) {
+    // Records are read in database order from the readers in turn, reader i
+    // holding the records i, i + reader_threads, ...
+    QueuePair* reader_qp = reader_qps_[next_reader_].get();
+    next_reader_ = (next_reader_ + 1) % reader_qps_.size();
+    T* t = qp->free_.pop();
+    T* parsed;
+    try {
+        parsed = reader_qp->full_.pop();
+    } catch (boost::thread_interrupted&) {
+        // Give t back, so that the queue pair still owns it on shutdown.
+        qp->free_.push(t);
+        throw;
+    }
+    t->Swap(parsed);
+    if (keep_keys_) {
+        qp->keys_.find(t)->second.swap(reader_qp->keys_.find(parsed)->second);
+    }
+    qp->full_.push(t);
+    reader_qp->free_.push(parsed);
+}
+
 // Instance class
 template class DataReader<Datum>;
 template class DataReader<AnnotatedDatum>;
@@ -9,6 +9,8 @@
 #include "caffe/util/im_transforms.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/pack_pixels.hpp"
+#include "caffe/util/packed_annotation.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
@@ -40,6 +42,7 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
 	if (param_.has_resize_param()) {
 		CHECK_GT(param_.resize_param().height(), 0);
 		CHECK_GT(param_.resize_param().width(), 0);
+		base_resize_param_ = param_.resize_param();
 	}
 	if (param_.has_expand_param()) {
 		CHECK_GT(param_.expand_param().max_expand_ratio(), 1.);
@@ -276,6 +279,171 @@ void DataTransformer<Dtype>::Transform(
 	Transform(anno_datum, transformed_blob, transformed_anno_vec, &do_mirror);
 }
 
+template<typename Dtype>
+bool DataTransformer<Dtype>::TransformAnnotation(const Annotation& anno,
+		const int img_height, const int img_width, const bool do_resize,
+		const NormalizedBBox& crop_bbox, const bool do_mirror,
+		AnnotationGroup* transformed_anno_group) {
+	const NormalizedBBox& bbox = anno.bbox();
+	const AnnoFaceLandmarks& lmarks = anno.face_lm();
+	bool has_valid_lm = false;
+	const int has_lm = anno.has_lm();
+	if(has_lm > 0){
+		CHECK_EQ(has_lm, 1);
+		CHECK_GT(lmarks.righteye().x() , 0.f);
+	}
+	// Adjust bounding box annotation.
+	NormalizedBBox resize_bbox = bbox;
+	AnnoFaceLandmarks resize_lmarks = lmarks;
+	if (do_resize && param_.has_resize_param()) {
+		CHECK_GT(img_height, 0);
+		CHECK_GT(img_width, 0);
+		UpdateBBoxByResizePolicy(param_.resize_param(), img_width, img_height,
+															&resize_bbox);
+		if(has_lm > 0){
+			UpdateLandmarkFacePoseByResizePolicy(param_.resize_param(),
+								img_width, img_height,
+								&resize_lmarks);
+		}
+	}
+	if (param_.has_emit_constraint() &&
+			!MeetEmitConstraint(crop_bbox, resize_bbox,
+													param_.emit_constraint())) {
+		return false;
+	}
+	NormalizedBBox proj_bbox;
+	AnnoFaceLandmarks project_facemark = resize_lmarks;
+	if (!ProjectBBox(crop_bbox, resize_bbox, &proj_bbox)) {
+		return false;
+	}
+	Annotation* transformed_anno = transformed_anno_group->add_annotation();
+	transformed_anno->set_instance_id(anno.instance_id());
+	NormalizedBBox* transformed_bbox = transformed_anno->mutable_bbox();
+	transformed_bbox->CopyFrom(proj_bbox);
+	if (do_mirror) {
+		Dtype temp = transformed_bbox->xmin();
+		transformed_bbox->set_xmin(1 - transformed_bbox->xmax());
+		transformed_bbox->set_xmax(1 - temp);
+	}
+	if (do_resize && param_.has_resize_param()) {
+		ExtrapolateBBox(param_.resize_param(), img_height, img_width,
+				crop_bbox, transformed_bbox);
+	}
+	if(has_lm > 0 && ProjectfacemarksBBox(crop_bbox, &project_facemark)){
+		has_valid_lm = true;
+		point lefteye = project_facemark.lefteye();
+		point righteye = project_facemark.righteye();
+		point nose = project_facemark.nose();
+		point leftmouth = project_facemark.leftmouth();
+		point rightmouth = project_facemark.rightmouth();
+
+		if(do_mirror){
+			project_facemark.mutable_lefteye()->set_x(1-lefteye.x());
+			project_facemark.mutable_righteye()->set_x(1-righteye.x());
+			project_facemark.mutable_nose()->set_x(1-nose.x());
+			project_facemark.mutable_leftmouth()->set_x(1-leftmouth.x());
+			project_facemark.mutable_rightmouth()->set_x(1-rightmouth.x());
+		}
+	}
+	if(has_valid_lm){
+		transformed_anno->set_has_lm(1);
+	}
+	else{
+		transformed_anno->set_has_lm(0);
+		project_facemark.mutable_lefteye()->set_x(-1.);
+		project_facemark.mutable_righteye()->set_x(-1.);
+		project_facemark.mutable_nose()->set_x(-1.);
+		project_facemark.mutable_leftmouth()->set_x(-1.);
+		project_facemark.mutable_rightmouth()->set_x(-1.);
+		project_facemark.mutable_lefteye()->set_y(-1.);
+		project_facemark.mutable_righteye()->set_y(-1.);
+		project_facemark.mutable_nose()->set_y(-1.);
+		project_facemark.mutable_leftmouth()->set_y(-1.);
+		project_facemark.mutable_rightmouth()->set_y(-1.);
+	}
+	AnnoFaceLandmarks* trans_lm = transformed_anno->mutable_face_lm();
+	trans_lm->CopyFrom(project_facemark);
+	return true;
+}
+
+template<typename Dtype>
+bool DataTransformer<Dtype>::TransformAnnotation(const PackedAnnotation& record,
+		const int img_height, const int img_width, const bool do_resize,
+		const NormalizedBBox& crop_bbox, const bool do_mirror,
+		AnnotationGroup* transformed_anno_group) {
+	const int has_lm = record.has_lm;
+	if(has_lm > 0){
+		CHECK_EQ(has_lm, 1);
+		// x of the right eye.
+		CHECK_GT(record.landmarks[2], 0.f);
+	}
+	// Adjust bounding box annotation.
+	NormalizedBBox resize_bbox;
+	resize_bbox.set_xmin(record.xmin);
+	resize_bbox.set_ymin(record.ymin);
+	resize_bbox.set_xmax(record.xmax);
+	resize_bbox.set_ymax(record.ymax);
+	resize_bbox.set_difficult(record.flags & PackedAnnotation::DIFFICULT);
+	if (do_resize && param_.has_resize_param()) {
+		CHECK_GT(img_height, 0);
+		CHECK_GT(img_width, 0);
+		UpdateBBoxByResizePolicy(param_.resize_param(), img_width, img_height,
+															&resize_bbox);
+	}
+	if (param_.has_emit_constraint() &&
+			!MeetEmitConstraint(crop_bbox, resize_bbox,
+													param_.emit_constraint())) {
+		return false;
+	}
+	NormalizedBBox proj_bbox;
+	if (!ProjectBBox(crop_bbox, resize_bbox, &proj_bbox)) {
+		return false;
+	}
+	Annotation* transformed_anno = transformed_anno_group->add_annotation();
+	transformed_anno->set_instance_id(record.instance_id);
+	NormalizedBBox* transformed_bbox = transformed_anno->mutable_bbox();
+	transformed_bbox->CopyFrom(proj_bbox);
+	if (do_mirror) {
+		Dtype temp = transformed_bbox->xmin();
+		transformed_bbox->set_xmin(1 - transformed_bbox->xmax());
+		transformed_bbox->set_xmax(1 - temp);
+	}
+	if (do_resize && param_.has_resize_param()) {
+		ExtrapolateBBox(param_.resize_param(), img_height, img_width,
+				crop_bbox, transformed_bbox);
+	}
+	// The landmarks are projected in the output annotation itself.
+	AnnoFaceLandmarks* trans_lm = transformed_anno->mutable_face_lm();
+	point* points[5] = {trans_lm->mutable_lefteye(),
+			trans_lm->mutable_righteye(), trans_lm->mutable_nose(),
+			trans_lm->mutable_leftmouth(), trans_lm->mutable_rightmouth()};
+	bool has_valid_lm = false;
+	if(has_lm > 0){
+		UnpackLandmarks(record.landmarks, trans_lm);
+		if (do_resize && param_.has_resize_param()) {
+			UpdateLandmarkFacePoseByResizePolicy(param_.resize_param(),
+								img_width, img_height, trans_lm);
+		}
+		has_valid_lm = ProjectfacemarksBBox(crop_bbox, trans_lm);
+	}
+	if(has_valid_lm){
+		transformed_anno->set_has_lm(1);
+		if(do_mirror){
+			for (int p = 0; p < 5; ++p) {
+				points[p]->set_x(1 - points[p]->x());
+			}
+		}
+	}
+	else{
+		transformed_anno->set_has_lm(0);
+		for (int p = 0; p < 5; ++p) {
+			points[p]->set_x(-1.);
+			points[p]->set_y(-1.);
+		}
+	}
+	return true;
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::TransformAnnotation(
 		const AnnotatedDatum& anno_datum, const bool do_resize,
@@ -283,104 +451,47 @@ void DataTransformer<Dtype>::TransformAnnotation(
 		RepeatedPtrField<AnnotationGroup>* transformed_anno_group_all) {
 	const int img_height = anno_datum.datum().height();
 	const int img_width = anno_datum.datum().width();
-	if (anno_datum.type() == AnnotatedDatum_AnnotationType_BBOX) {
-		// Go through each AnnotationGroup.
-		for (int g = 0; g < anno_datum.annotation_group_size(); ++g) {
-			const AnnotationGroup& anno_group = anno_datum.annotation_group(g);
-			AnnotationGroup transformed_anno_group;
-			// Go through each Annotation.
-			bool has_valid_annotation = false;
-			for (int a = 0; a < anno_group.annotation_size(); ++a) {
-				const Annotation& anno = anno_group.annotation(a);
-				const NormalizedBBox& bbox = anno.bbox();
-                const AnnoFaceLandmarks& lmarks = anno.face_lm();
-                bool has_valid_lm = false;
-                const int has_lm = anno.has_lm();
-                if(has_lm > 0){
-                    CHECK_EQ(has_lm, 1);
-                    CHECK_GT(lmarks.righteye().x() , 0.f);
-                }
-				// Adjust bounding box annotation.
-				NormalizedBBox resize_bbox = bbox;
-                AnnoFaceLandmarks resize_lmarks = lmarks;
-				if (do_resize && param_.has_resize_param()) {
-					CHECK_GT(img_height, 0);
-					CHECK_GT(img_width, 0);
-					UpdateBBoxByResizePolicy(param_.resize_param(), img_width, img_height,
-																		&resize_bbox);
-                    if(has_lm > 0){
-                        UpdateLandmarkFacePoseByResizePolicy(param_.resize_param(),
-											img_width, img_height,
-											&resize_lmarks);
-                    }
-				}
-				if (param_.has_emit_constraint() &&
-						!MeetEmitConstraint(crop_bbox, resize_bbox,
-																param_.emit_constraint())) {
-					continue;
-				}
-				NormalizedBBox proj_bbox;
-                AnnoFaceLandmarks project_facemark = resize_lmarks;
-				if (ProjectBBox(crop_bbox, resize_bbox, &proj_bbox)) {
-					has_valid_annotation = true;
-					Annotation* transformed_anno =
-							transformed_anno_group.add_annotation();
-					transformed_anno->set_instance_id(anno.instance_id());
-					NormalizedBBox* transformed_bbox = transformed_anno->mutable_bbox();
-					transformed_bbox->CopyFrom(proj_bbox);
-					if (do_mirror) {
-						Dtype temp = transformed_bbox->xmin();
-						transformed_bbox->set_xmin(1 - transformed_bbox->xmax());
-						transformed_bbox->set_xmax(1 - temp);
-					}
-					if (do_resize && param_.has_resize_param()) {
-						ExtrapolateBBox(param_.resize_param(), img_height, img_width,
-								crop_bbox, transformed_bbox);
-					}    
-                    if(has_lm > 0 && ProjectfacemarksBBox(crop_bbox, &project_facemark)){
-                        has_valid_lm = true;
-                        point lefteye = project_facemark.lefteye();
-                        point righteye = project_facemark.righteye();
-                        point nose = project_facemark.nose();
-                        point leftmouth = project_facemark.leftmouth();
-                        point rightmouth = project_facemark.rightmouth();
-
-                        if(do_mirror){
-                            project_facemark.mutable_lefteye()->set_x(1-lefteye.x());
-                            project_facemark.mutable_righteye()->set_x(1-righteye.x());
-                            project_facemark.mutable_nose()->set_x(1-nose.x());
-                            project_facemark.mutable_leftmouth()->set_x(1-leftmouth.x());
-                            project_facemark.mutable_rightmouth()->set_x(1-rightmouth.x());
-                        }
-                    }
-					if(has_valid_lm){
-						transformed_anno->set_has_lm(1);
-					}
-                    else{
-						transformed_anno->set_has_lm(0);
-						project_facemark.mutable_lefteye()->set_x(-1.);
-						project_facemark.mutable_righteye()->set_x(-1.);
-						project_facemark.mutable_nose()->set_x(-1.);
-						project_facemark.mutable_leftmouth()->set_x(-1.);
-						project_facemark.mutable_rightmouth()->set_x(-1.);
-						project_facemark.mutable_lefteye()->set_y(-1.);
-						project_facemark.mutable_righteye()->set_y(-1.);
-						project_facemark.mutable_nose()->set_y(-1.);
-						project_facemark.mutable_leftmouth()->set_y(-1.);
-						project_facemark.mutable_rightmouth()->set_y(-1.);
-					}
-					AnnoFaceLandmarks* trans_lm = transformed_anno->mutable_face_lm();
-					trans_lm->CopyFrom(project_facemark);                  
-				}
+	if (anno_datum.type() != AnnotatedDatum_AnnotationType_BBOX) {
+		LOG(FATAL) << "Unknown annotation type.";
+	}
+	if (anno_datum.has_packed_annotation()) {
+		// Read the records in place; a group is a run of records with the same
+		// label.
+		int num_annotations;
+		const PackedAnnotation* records =
+				PackedAnnotations(anno_datum.packed_annotation(), &num_annotations);
+		for (int i = 0; i < num_annotations; ) {
+			const int group_label = records[i].group_label;
+			AnnotationGroup* transformed_anno_group =
+					transformed_anno_group_all->Add();
+			for (; i < num_annotations && records[i].group_label == group_label;
+					++i) {
+				TransformAnnotation(records[i], img_height, img_width, do_resize,
+						crop_bbox, do_mirror, transformed_anno_group);
 			}
-			// Save for output.
-			if (has_valid_annotation) {
-				transformed_anno_group.set_group_label(anno_group.group_label());
-				transformed_anno_group_all->Add()->CopyFrom(transformed_anno_group);
+			if (transformed_anno_group->annotation_size() > 0) {
+				transformed_anno_group->set_group_label(group_label);
+			} else {
+				transformed_anno_group_all->RemoveLast();
 			}
 		}
-	} else {
-		LOG(FATAL) << "Unknown annotation type.";
+		return;
+	}
+	// Go through each AnnotationGroup.
+	for (int g = 0; g < anno_datum.annotation_group_size(); ++g) {
+		const AnnotationGroup& anno_group = anno_datum.annotation_group(g);
+		AnnotationGroup* transformed_anno_group = transformed_anno_group_all->Add();
+		// Go through each Annotation.
+		for (int a = 0; a < anno_group.annotation_size(); ++a) {
+			TransformAnnotation(anno_group.annotation(a), img_height, img_width,
+					do_resize, crop_bbox, do_mirror, transformed_anno_group);
+		}
+		// Keep it for output unless every annotation was cropped out.
+		if (transformed_anno_group->annotation_size() > 0) {
+			transformed_anno_group->set_group_label(anno_group.group_label());
+		} else {
+			transformed_anno_group_all->RemoveLast();
+		}
 	}
 }
 
@@ -758,27 +869,33 @@ void DataTransformer<Dtype>::ExpandImage(const Datum& datum,
 }
 
 template<typename Dtype>
-void DataTransformer<Dtype>::ExpandImage(const AnnotatedDatum& anno_datum,
-																				 AnnotatedDatum* expanded_anno_datum) {
+bool DataTransformer<Dtype>::RandExpandRatio(float* expand_ratio) {
 	if (!param_.has_expand_param()) {
-		expanded_anno_datum->CopyFrom(anno_datum);
-		return;
+		return false;
 	}
 	const ExpansionParameter& expand_param = param_.expand_param();
 	const float expand_prob = expand_param.prob();
 	float prob;
 	caffe_rng_uniform(1, 0.f, 1.f, &prob);
 	if (prob > expand_prob) {
-		expanded_anno_datum->CopyFrom(anno_datum);
-		return;
+		return false;
 	}
 	const float max_expand_ratio = expand_param.max_expand_ratio();
 	if (fabs(max_expand_ratio - 1.) < 1e-2) {
+		return false;
+	}
+	caffe_rng_uniform(1, 1.f, max_expand_ratio, expand_ratio);
+	return true;
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::ExpandImage(const AnnotatedDatum& anno_datum,
+																				 AnnotatedDatum* expanded_anno_datum) {
+	float expand_ratio;
+	if (!RandExpandRatio(&expand_ratio)) {
 		expanded_anno_datum->CopyFrom(anno_datum);
 		return;
 	}
-	float expand_ratio;
-	caffe_rng_uniform(1, 1.f, max_expand_ratio, &expand_ratio);
 	// Expand the datum.
 	NormalizedBBox expand_bbox;
 	ExpandImage(anno_datum.datum(), expand_ratio, &expand_bbox,
@@ -796,25 +913,11 @@ void DataTransformer<Dtype>::ExpandImage(const AnnotatedDatum& anno_datum,
 template<typename Dtype>
 void DataTransformer<Dtype>::ExpandImage(const AnnoFaceAttributeDatum& anno_datum,
 																				 AnnoFaceAttributeDatum* expanded_anno_datum) {
-	if (!param_.has_expand_param()) {
-		expanded_anno_datum->CopyFrom(anno_datum);
-		return;
-	}
-	const ExpansionParameter& expand_param = param_.expand_param();
-	const float expand_prob = expand_param.prob();
-	float prob;
-	caffe_rng_uniform(1, 0.f, 1.f, &prob);
-	if (prob > expand_prob) {
-		expanded_anno_datum->CopyFrom(anno_datum);
-		return;
-	}
-	const float max_expand_ratio = expand_param.max_expand_ratio();
-	if (fabs(max_expand_ratio - 1.) < 1e-2) {
+	float expand_ratio;
+	if (!RandExpandRatio(&expand_ratio)) {
 		expanded_anno_datum->CopyFrom(anno_datum);
 		return;
 	}
-	float expand_ratio;
-	caffe_rng_uniform(1, 1.f, max_expand_ratio, &expand_ratio);
 	// Expand the datum.
 	NormalizedBBox expand_bbox;
 	ExpandImage(anno_datum.datum(), expand_ratio, &expand_bbox,
@@ -833,25 +936,11 @@ void DataTransformer<Dtype>::ExpandImage(const AnnoFaceAttributeDatum& anno_datu
 template<typename Dtype>
 void DataTransformer<Dtype>::ExpandImage(const AnnotatedCCpdDatum& anno_datum,
 																				 AnnotatedCCpdDatum* expanded_anno_datum) {
-	if (!param_.has_expand_param()) {
-		expanded_anno_datum->CopyFrom(anno_datum);
-		return;
-	}
-	const ExpansionParameter& expand_param = param_.expand_param();
-	const float expand_prob = expand_param.prob();
-	float prob;
-	caffe_rng_uniform(1, 0.f, 1.f, &prob);
-	if (prob > expand_prob) {
-		expanded_anno_datum->CopyFrom(anno_datum);
-		return;
-	}
-	const float max_expand_ratio = expand_param.max_expand_ratio();
-	if (fabs(max_expand_ratio - 1.) < 1e-2) {
+	float expand_ratio;
+	if (!RandExpandRatio(&expand_ratio)) {
 		expanded_anno_datum->CopyFrom(anno_datum);
 		return;
 	}
-	float expand_ratio;
-	caffe_rng_uniform(1, 1.f, max_expand_ratio, &expand_ratio);
 	// Expand the datum.
 	NormalizedBBox expand_bbox;
 	ExpandImage(anno_datum.datum(), expand_ratio, &expand_bbox,
@@ -1015,38 +1104,15 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
 	}
 	CHECK(cv_cropped_image.data);
 
-	Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-	int top_index;
-	for (int h = 0; h < height; ++h) {
-		const uchar* ptr = cv_cropped_image.ptr<uchar>(h);
-		int img_index = 0;
-		int h_idx = h;
-		for (int w = 0; w < width; ++w) {
-			int w_idx = w;
-			if (*do_mirror) {
-				w_idx = (width - 1 - w);
-			}
-			int h_idx_real = h_idx;
-			int w_idx_real = w_idx;
-			for (int c = 0; c < img_channels; ++c) {
-				top_index = (c * height + h_idx_real) * width + w_idx_real;
-				Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-				if (has_mean_file) {
-					int mean_index = (c * img_height + h_off + h_idx_real) * img_width
-							+ w_off + w_idx_real;
-					transformed_data[top_index] =
-							(pixel - mean[mean_index]) * scale;
-				} else {
-					if (has_mean_values) {
-						transformed_data[top_index] =
-								(pixel - mean_values_[c]) * scale;
-					} else {
-						transformed_data[top_index] = pixel * scale;
-					}
-				}
-			}
-		}
-	}
+	// De-interleave, subtract the mean, scale and mirror in one pass. The mean
+	// file is indexed by the output position inside the crop window.
+	const Dtype* mean_data =
+			has_mean_file ? mean + h_off * img_width + w_off : NULL;
+	const Dtype* mean_values = has_mean_values ? &mean_values_[0] : NULL;
+	pack_pixels_cpu(cv_cropped_image.ptr<uchar>(0),
+			static_cast<int>(cv_cropped_image.step[0]), img_channels, height, width,
+			mean_data, img_width, img_height * img_width, mean_values, scale,
+			*do_mirror, transformed_blob->mutable_cpu_data());
 }
 
 template<typename Dtype>
@@ -1129,6 +1195,239 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
 	Transform(cv_img, transformed_blob, &crop_bbox, &do_mirror);
 }
 
+template<typename Dtype>
+void DataTransformer<Dtype>::DecodeImage(const Datum& datum, cv::Mat* cv_img) {
+	CHECK(datum.encoded()) << "Datum is not encoded";
+	CHECK(!(param_.force_color() && param_.force_gray()))
+			<< "cannot set both force_color and force_gray";
+	if (param_.force_color() || param_.force_gray()) {
+		// If force_color then decode in color otherwise decode in gray.
+		*cv_img = DecodeDatumToCVMat(datum, param_.force_color());
+	} else {
+		*cv_img = DecodeDatumToCVMatNative(datum);
+	}
+}
+
+// Records the size of img, but not its data, in header_datum.
+static void SetImageHeader(const cv::Mat& img, const Datum& datum,
+													 Datum* header_datum) {
+	header_datum->set_channels(img.channels());
+	header_datum->set_height(img.rows);
+	header_datum->set_width(img.cols);
+	header_datum->set_label(datum.label());
+	header_datum->clear_data();
+	header_datum->clear_float_data();
+	header_datum->set_encoded(false);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CopyAnnotation(const AnnotatedDatum& anno_datum,
+		const cv::Mat& img, AnnotatedDatum* header_datum) {
+	SetImageHeader(img, anno_datum.datum(), header_datum->mutable_datum());
+	if (anno_datum.has_type()) {
+		header_datum->set_type(anno_datum.type());
+	}
+	header_datum->mutable_annotation_group()->CopyFrom(
+			anno_datum.annotation_group());
+	if (anno_datum.has_packed_annotation()) {
+		header_datum->set_packed_annotation(anno_datum.packed_annotation());
+	}
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CopyAnnotation(
+		const AnnoFaceAttributeDatum& anno_datum, const cv::Mat& img,
+		AnnoFaceAttributeDatum* header_datum) {
+	SetImageHeader(img, anno_datum.datum(), header_datum->mutable_datum());
+	if (anno_datum.has_type()) {
+		header_datum->set_type(anno_datum.type());
+	}
+	header_datum->mutable_faceattri()->CopyFrom(anno_datum.faceattri());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CopyAnnotation(
+		const AnnotatedCCpdDatum& anno_datum, const cv::Mat& img,
+		AnnotatedCCpdDatum* header_datum) {
+	SetImageHeader(img, anno_datum.datum(), header_datum->mutable_datum());
+	if (anno_datum.has_type()) {
+		header_datum->set_type(anno_datum.type());
+	}
+	header_datum->mutable_lpnumber()->CopyFrom(anno_datum.lpnumber());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::DistortImage(const cv::Mat& img,
+																					cv::Mat* distort_img) {
+	if (!param_.has_distort_param()) {
+		*distort_img = img;
+		return;
+	}
+	*distort_img = ApplyDistort(img, param_.distort_param());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::ExpandImage(const AnnotatedDatum& anno_datum,
+		const cv::Mat& img, AnnotatedDatum* expanded_anno_datum,
+		cv::Mat* expand_img) {
+	float expand_ratio;
+	if (!RandExpandRatio(&expand_ratio)) {
+		CopyAnnotation(anno_datum, img, expanded_anno_datum);
+		*expand_img = img;
+		return;
+	}
+	// Expand the image.
+	NormalizedBBox expand_bbox;
+	ExpandImage(img, expand_ratio, &expand_bbox, expand_img);
+	SetImageHeader(*expand_img, anno_datum.datum(),
+								 expanded_anno_datum->mutable_datum());
+	expanded_anno_datum->set_type(anno_datum.type());
+
+	// Transform the annotation according to crop_bbox.
+	const bool do_resize = false;
+	const bool do_mirror = false;
+	TransformAnnotation(anno_datum, do_resize, expand_bbox, do_mirror,
+											expanded_anno_datum->mutable_annotation_group());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::ExpandImage(
+		const AnnoFaceAttributeDatum& anno_datum, const cv::Mat& img,
+		AnnoFaceAttributeDatum* expanded_anno_datum, cv::Mat* expand_img) {
+	float expand_ratio;
+	if (!RandExpandRatio(&expand_ratio)) {
+		CopyAnnotation(anno_datum, img, expanded_anno_datum);
+		*expand_img = img;
+		return;
+	}
+	// Expand the image.
+	NormalizedBBox expand_bbox;
+	ExpandImage(img, expand_ratio, &expand_bbox, expand_img);
+	SetImageHeader(*expand_img, anno_datum.datum(),
+								 expanded_anno_datum->mutable_datum());
+	expanded_anno_datum->set_type(anno_datum.type());
+
+	// Transform the annotation according to crop_bbox.
+	const bool do_resize = false;
+	const bool do_mirror = false;
+	const bool do_expand = true;
+	TransformAnnoFaceAttribute(anno_datum, do_resize, expand_bbox, do_mirror,
+											do_expand, expanded_anno_datum->mutable_faceattri());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::ExpandImage(
+		const AnnotatedCCpdDatum& anno_datum, const cv::Mat& img,
+		AnnotatedCCpdDatum* expanded_anno_datum, cv::Mat* expand_img) {
+	float expand_ratio;
+	if (!RandExpandRatio(&expand_ratio)) {
+		CopyAnnotation(anno_datum, img, expanded_anno_datum);
+		*expand_img = img;
+		return;
+	}
+	// Expand the image.
+	NormalizedBBox expand_bbox;
+	ExpandImage(img, expand_ratio, &expand_bbox, expand_img);
+	SetImageHeader(*expand_img, anno_datum.datum(),
+								 expanded_anno_datum->mutable_datum());
+	expanded_anno_datum->set_type(anno_datum.type());
+
+	// Transform the annotation according to crop_bbox.
+	const bool do_resize = false;
+	const bool do_mirror = false;
+	const bool do_expand = true;
+	TransformAnnoCcpd(anno_datum, do_resize, expand_bbox, do_mirror,
+										do_expand, expanded_anno_datum->mutable_lpnumber());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CropImage(const AnnotatedDatum& anno_datum,
+		const cv::Mat& img, const NormalizedBBox& bbox,
+		AnnotatedDatum* cropped_anno_datum, cv::Mat* crop_img) {
+	// Crop the image.
+	CropImage(img, bbox, crop_img);
+	SetImageHeader(*crop_img, anno_datum.datum(),
+								 cropped_anno_datum->mutable_datum());
+	cropped_anno_datum->set_type(anno_datum.type());
+
+	// Transform the annotation according to crop_bbox.
+	const bool do_resize = false;
+	const bool do_mirror = false;
+	NormalizedBBox crop_bbox;
+	ClipBBox(bbox, &crop_bbox);
+	TransformAnnotation(anno_datum, do_resize, crop_bbox, do_mirror,
+											cropped_anno_datum->mutable_annotation_group());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CropImage_Sampling(
+		const AnnotatedDatum& anno_datum, const cv::Mat& img,
+		const NormalizedBBox& bbox, AnnotatedDatum* cropped_anno_datum,
+		cv::Mat* crop_img) {
+	// Crop the image.
+	CropImageData_Anchor(img, bbox, crop_img);
+	SetImageHeader(*crop_img, anno_datum.datum(),
+								 cropped_anno_datum->mutable_datum());
+	cropped_anno_datum->set_type(anno_datum.type());
+
+	// Transform the annotation according to crop_bbox.
+	const bool do_resize = false;
+	const bool do_mirror = false;
+	TransformAnnotation(anno_datum, do_resize, bbox, do_mirror,
+											cropped_anno_datum->mutable_annotation_group());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const AnnotatedDatum& anno_datum,
+		const cv::Mat& img, Blob<Dtype>* transformed_blob,
+		vector<AnnotationGroup>* transformed_anno_vec) {
+	// Transform image.
+	NormalizedBBox crop_bbox;
+	bool do_mirror;
+	Transform(img, transformed_blob, &crop_bbox, &do_mirror);
+
+	// Transform annotation.
+	const bool do_resize = true;
+	RepeatedPtrField<AnnotationGroup> transformed_anno_group_all;
+	TransformAnnotation(anno_datum, do_resize, crop_bbox, do_mirror,
+											&transformed_anno_group_all);
+	for (int g = 0; g < transformed_anno_group_all.size(); ++g) {
+		transformed_anno_vec->push_back(transformed_anno_group_all.Get(g));
+	}
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(
+		const AnnoFaceAttributeDatum& anno_datum, const cv::Mat& img,
+		Blob<Dtype>* transformed_blob, AnnoFaceAttribute* transformed_anno_vec) {
+	// Transform image.
+	NormalizedBBox crop_bbox;
+	bool do_mirror;
+	Transform(img, transformed_blob, &crop_bbox, &do_mirror);
+
+	// Transform annotation.
+	const bool do_resize = true;
+	const bool do_expand = false;
+	TransformAnnoFaceAttribute(anno_datum, do_resize, crop_bbox, do_mirror,
+											do_expand, transformed_anno_vec);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const AnnotatedCCpdDatum& anno_datum,
+		const cv::Mat& img, Blob<Dtype>* transformed_blob,
+		LicensePlate* transformed_anno_vec) {
+	// Transform image.
+	NormalizedBBox crop_bbox;
+	bool do_mirror;
+	Transform(img, transformed_blob, &crop_bbox, &do_mirror);
+
+	// Transform annotation.
+	const bool do_resize = true;
+	const bool do_expand = false;
+	TransformAnnoCcpd(anno_datum, do_resize, crop_bbox, do_mirror, do_expand,
+										transformed_anno_vec);
+}
+
 template <typename Dtype>
 void DataTransformer<Dtype>::CropImageData_Anchor(const cv::Mat& img,
 									const NormalizedBBox& bbox, cv::Mat* crop_img) {
@@ -1545,6 +1844,34 @@ void DataTransformer<Dtype>::InitRand() {
 	}
 }
 
+template <typename Dtype>
+void DataTransformer<Dtype>::InitRand(unsigned int seed) {
+	if (rng_) {
+		rng_.reset(new Caffe::RNG(seed));
+	}
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::SetResizeShape(const int height,
+		const int width) {
+	if (height == 0 && width == 0) {
+		// A given resize_param always has a height, see the constructor.
+		if (base_resize_param_.has_height()) {
+			param_.mutable_resize_param()->CopyFrom(base_resize_param_);
+		} else {
+			param_.clear_resize_param();
+		}
+		return;
+	}
+	CHECK_GT(height, 0);
+	CHECK_GT(width, 0);
+	ResizeParameter* resize_param = param_.mutable_resize_param();
+	resize_param->CopyFrom(base_resize_param_);
+	resize_param->set_resize_mode(ResizeParameter_Resize_mode_WARP);
+	resize_param->set_height(height);
+	resize_param->set_width(width);
+}
+
 template <typename Dtype>
 int DataTransformer<Dtype>::Rand(int n) {
 	CHECK(rng_);
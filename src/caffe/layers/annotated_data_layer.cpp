@@ -1,15 +1,20 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 #endif  // USE_OPENCV
+#include <float.h>
 #include <stdint.h>
 
+#include <boost/thread.hpp>
 #include <algorithm>
+#include <cmath>
 #include <map>
+#include <utility>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/annotated_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/packed_annotation.hpp"
 #include "caffe/util/sampler.hpp"
 
 #define BOOL_TEST_DATA 0 
@@ -19,12 +24,48 @@ namespace caffe {
 template <typename Dtype>
 AnnotatedDataLayer<Dtype>::AnnotatedDataLayer(const LayerParameter& param)
   : BasePrefetchingDataLayer<Dtype>(param),
-    reader_(param) {
+    reader_(param), batch_bucket_(-1) {
 }
 
 template <typename Dtype>
 AnnotatedDataLayer<Dtype>::~AnnotatedDataLayer() {
     this->StopInternalThread();
+    // Workers may still hold the batch in flight, stop them before the
+    // datums and batches go away.
+    transform_workers_.clear();
+}
+
+template <typename Dtype>
+AnnotatedDataLayer<Dtype>::TransformWorker::TransformWorker(
+    AnnotatedDataLayer* layer, int worker_id)
+  : jobs_(), done_(), layer_(layer), worker_id_(worker_id) {
+    data_transformer_.reset(
+        new DataTransformer<Dtype>(layer->transform_param_, layer->phase_));
+    data_transformer_->InitRand();
+    transformed_data_.ReshapeLike(layer->transformed_data_);
+    // The thread is seeded from the calling thread, so each worker gets its
+    // own reproducible random stream for the sampler and expansion.
+    StartInternalThread();
+}
+
+template <typename Dtype>
+AnnotatedDataLayer<Dtype>::TransformWorker::~TransformWorker() {
+    StopInternalThread();
+}
+
+template <typename Dtype>
+void AnnotatedDataLayer<Dtype>::TransformWorker::InternalThreadEntry() {
+    const int num_workers = layer_->transform_workers_.size();
+    try {
+        while (!must_stop()) {
+            Batch<Dtype>* batch = jobs_.pop();
+            layer_->load_items(batch, worker_id_, num_workers,
+                               data_transformer_.get(), &transformed_data_);
+            done_.push(batch);
+        }
+    } catch (boost::thread_interrupted&) {
+        // Interrupted exception is expected on shutdown
+    }
 }
 
 template <typename Dtype>
@@ -51,11 +92,32 @@ void AnnotatedDataLayer<Dtype>::DataLayerSetUp(
     // Make sure dimension is consistent within batch.
     const TransformationParameter& transform_param =
         this->layer_param_.transform_param();
-    if (transform_param.has_resize_param()) {
+    for (int i = 0; i < anno_data_param.bucket_aspect_ratio_size(); ++i) {
+        CHECK(transform_param.has_resize_param())
+            << "bucket_aspect_ratio needs a resize_param.";
+        const ResizeParameter& resize_param = transform_param.resize_param();
+        const float ratio = anno_data_param.bucket_aspect_ratio(i);
+        CHECK_GT(ratio, 0);
+        // The shape FIT_SMALL_SIZE gives to an image of this aspect ratio.
+        int height = resize_param.height();
+        int width = resize_param.width();
+        if (ratio < static_cast<float>(width) / height) {
+            height = static_cast<int>(width / ratio);
+        } else {
+            width = static_cast<int>(ratio * height);
+        }
+        bucket_aspect_ratios_.push_back(ratio);
+        bucket_shapes_.push_back(std::make_pair(height, width));
+        LOG(INFO) << "Bucket of aspect ratio " << ratio << ": " << height
+            << "x" << width;
+    }
+    bucket_datums_.resize(bucket_shapes_.size());
+    if (transform_param.has_resize_param() && bucket_shapes_.empty()) {
         if (transform_param.resize_param().resize_mode() ==
             ResizeParameter_Resize_mode_FIT_SMALL_SIZE) {
         CHECK_EQ(batch_size, 1)
-            << "Only support batch size of 1 for FIT_SMALL_SIZE.";
+            << "Only support batch size of 1 for FIT_SMALL_SIZE, "
+            << "unless images are batched by bucket_aspect_ratio.";
         }
     }
     YoloFormat_ = anno_data_param.yoloformat();
@@ -64,6 +126,11 @@ void AnnotatedDataLayer<Dtype>::DataLayerSetUp(
 
     // Read a data point, and use it to initialize the top blob.
     AnnotatedDatum& anno_datum = *(reader_.full().peek());
+    if (!bucket_shapes_.empty()) {
+        const std::pair<int, int>& shape =
+            bucket_shapes_[BucketOf(anno_datum.datum())];
+        this->data_transformer_->SetResizeShape(shape.first, shape.second);
+    }
 
     // Use data_transformer to infer the expected blob shape from anno_datum.
     vector<int> top_shape =
@@ -72,8 +139,8 @@ void AnnotatedDataLayer<Dtype>::DataLayerSetUp(
     // Reshape top[0] and prefetch_data according to the batch_size.
     top_shape[0] = batch_size;
     top[0]->Reshape(top_shape);
-    for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-        this->prefetch_[i].data_.Reshape(top_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+        this->prefetch_[i]->data_.Reshape(top_shape);
     }
     LOG(INFO) << "output data size: " << top[0]->num() << ","
         << top[0]->channels() << "," << top[0]->height() << ","
@@ -100,9 +167,7 @@ void AnnotatedDataLayer<Dtype>::DataLayerSetUp(
                 // [item_id, group_label, instance_id, xmin, ymin, xmax, ymax, diff]
                 // Note: Refer to caffe.proto for details about group_label and
                 // instance_id.
-                for (int g = 0; g < anno_datum.annotation_group_size(); ++g) {
-                    num_bboxes += anno_datum.annotation_group(g).annotation_size();
-                }
+                num_bboxes = NumAnnotations(anno_datum);
                 if(YoloFormat_){
                     label_shape[0] = batch_size;
                     label_shape[1] = 1;
@@ -136,8 +201,20 @@ void AnnotatedDataLayer<Dtype>::DataLayerSetUp(
             label_shape[0] = batch_size;
         }
         top[1]->Reshape(label_shape);
-        for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-            this->prefetch_[i].label_.Reshape(label_shape);
+        for (int i = 0; i < this->prefetch_.size(); ++i) {
+            this->prefetch_[i]->label_.Reshape(label_shape);
+        }
+    }
+    // Start the transform workers.
+    const int transform_threads =
+        this->layer_param_.data_param().transform_threads();
+    CHECK_GT(transform_threads, 0);
+    if (transform_threads > 1) {
+        LOG(INFO) << "Transforming items with " << transform_threads
+            << " threads.";
+        transform_workers_.resize(transform_threads);
+        for (int i = 0; i < transform_threads; ++i) {
+            transform_workers_[i].reset(new TransformWorker(this, i));
         }
     }
 }
@@ -156,224 +233,80 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
     // Reshape according to the first anno_datum of each batch
     // on single input batches allows for inputs of varying dimension.
     const int batch_size = this->layer_param_.data_param().batch_size();
-    const AnnotatedDataParameter& anno_data_param =
-        this->layer_param_.annotated_data_param();
-    const TransformationParameter& transform_param =
-    this->layer_param_.transform_param();
-    AnnotatedDatum& anno_datum = *(reader_.full().peek());
-    // Use data_transformer to infer the expected blob shape from anno_datum.
-    vector<int> top_shape =
-        this->data_transformer_->InferBlobShape(anno_datum.datum());
-    this->transformed_data_.Reshape(top_shape);
+    vector<int> top_shape;
+    if (!bucket_shapes_.empty()) {
+        // The batch is the first bucket to fill up, all its images being
+        // resized to the shape of the bucket.
+        timer.Start();
+        batch_bucket_ = FillBucket(batch_size);
+        batch_datums_.swap(bucket_datums_[batch_bucket_]);
+        bucket_datums_[batch_bucket_].clear();
+        read_time += timer.MicroSeconds();
+        const std::pair<int, int>& shape = bucket_shapes_[batch_bucket_];
+        this->data_transformer_->SetResizeShape(shape.first, shape.second);
+        top_shape =
+            this->data_transformer_->InferBlobShape(batch_datums_[0]->datum());
+    } else {
+        AnnotatedDatum& anno_datum = *(reader_.full().peek());
+        // Use data_transformer to infer the expected blob shape from anno_datum.
+        top_shape = this->data_transformer_->InferBlobShape(anno_datum.datum());
+    }
     // Reshape batch according to the batch_size.
     top_shape[0] = batch_size;
     batch->data_.Reshape(top_shape);
-
-    Dtype* top_data = batch->data_.mutable_cpu_data();
-    Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
+    batch_top_shape_ = top_shape;
+    // Move the batch to the cpu before the items are written into it,
+    // possibly from several transform workers at once.
+    batch->data_.mutable_cpu_data();
     if (this->output_labels_ && !has_anno_type_) {
-        top_label = batch->label_.mutable_cpu_data();
+        batch->label_.mutable_cpu_data();
     }
-    // Store transformed annotation.
-    map<int, vector<AnnotationGroup> > all_anno;
-    int num_bboxes = 0;
 
-    for (int item_id = 0; item_id < batch_size; ++item_id) {
-        timer.Start();
-        // get a anno_datum
-        AnnotatedDatum& anno_datum = *(reader_.full().pop("Waiting for data"));
-        read_time += timer.MicroSeconds();
+    if (bucket_shapes_.empty()) {
         timer.Start();
-        AnnotatedDatum distort_datum;
-        AnnotatedDatum* expand_datum = NULL;
-        AnnotatedDatum* resized_anno_datum = NULL;
-        bool do_resize = false;
-        if (transform_param.has_distort_param()) {
-            distort_datum.CopyFrom(anno_datum);
-            this->data_transformer_->DistortImage(anno_datum.datum(),
-                                                distort_datum.mutable_datum());
-            if (transform_param.has_expand_param()) {
-                expand_datum = new AnnotatedDatum();
-                this->data_transformer_->ExpandImage(distort_datum, expand_datum);
-            } else {
-                expand_datum = &distort_datum;
-            }
-        } else {
-            if (transform_param.has_expand_param()) {
-                expand_datum = new AnnotatedDatum();
-                this->data_transformer_->ExpandImage(anno_datum, expand_datum);
-            } else {
-                expand_datum = &anno_datum;
-            }
-        }
-        AnnotatedDatum* sampled_datum = NULL;
-        bool has_sampled = false;
-        bool CropSample = false;
-        vector<NormalizedBBox> sampled_bboxes;
-        sampled_bboxes.clear();
-        if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_BATCH){
-            if (batch_samplers_.size() > 0) {
-                GenerateBatchSamples(*expand_datum, batch_samplers_, &sampled_bboxes);
-                CropSample = true;
-            } else {
-                sampled_datum = expand_datum;
-            }
-        }
-        else if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_JITTER){
-            GenerateJitterSamples(*expand_datum, 0.1, &sampled_bboxes);
-            CropSample = true;
-        }
-        else if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_ANCHOR){
-            if(data_anchor_samplers_.size() > 0){
-                GenerateBatchDataAnchorSamples(*expand_datum, data_anchor_samplers_, &sampled_bboxes);
-                int rand_idx = caffe_rng_rand() % sampled_bboxes.size();
-                sampled_datum = new AnnotatedDatum();
-                this->data_transformer_->CropImage_Sampling(*expand_datum,
-                                                    sampled_bboxes[rand_idx],
-                                                    sampled_datum);
-                has_sampled = true;
-            }else{
-                sampled_datum = expand_datum;
-            }
+        batch_datums_.resize(batch_size);
+        for (int item_id = 0; item_id < batch_size; ++item_id) {
+            // get a anno_datum
+            batch_datums_[item_id] = reader_.full().pop("Waiting for data");
         }
-        else if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_GT_BBOX){
-            if (anno_data_param.has_bbox_sampler()) {
-                resized_anno_datum = new AnnotatedDatum();
-                do_resize = true;
-                GenerateLFFDSample(*expand_datum, &sampled_bboxes, 
-                                bbox_small_scale_, bbox_large_scale_, anchor_stride_,
-                                resized_anno_datum, transform_param, do_resize);
-                CHECK_GT(resized_anno_datum->datum().channels(), 0);
-                sampled_datum = new AnnotatedDatum();
-                this->data_transformer_->CropImage_Sampling(*resized_anno_datum,
-                                                sampled_bboxes[0], sampled_datum);
-                has_sampled = true;
-            } else {
-                sampled_datum = expand_datum;
-            }
+        read_time += timer.MicroSeconds();
+    }
+
+    timer.Start();
+    // Store transformed annotation.
+    batch_annos_.clear();
+    batch_annos_.resize(batch_size);
+    if (transform_workers_.size() > 0) {
+        // Item i is always handled by worker i % transform_threads, so the
+        // random streams consumed per item do not depend on scheduling.
+        for (int i = 0; i < transform_workers_.size(); ++i) {
+            transform_workers_[i]->jobs_.push(batch);
         }
-        else if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_DEFAULT){
-            sampled_datum = expand_datum;
+        for (int i = 0; i < transform_workers_.size(); ++i) {
+            transform_workers_[i]->done_.pop();
         }
-        if(CropSample){        
-            if (sampled_bboxes.size() > 0) {
-                int rand_idx = caffe_rng_rand() % sampled_bboxes.size();
-                sampled_datum = new AnnotatedDatum();
-                this->data_transformer_->CropImage(*expand_datum,
-                                                    sampled_bboxes[rand_idx],
-                                                    sampled_datum);
-                has_sampled = true;
-            } else {
-                sampled_datum = expand_datum;
-            }
+    } else {
+        load_items(batch, 0, 1, this->data_transformer_.get(),
+                   &(this->transformed_data_));
+    }
+    trans_time += timer.MicroSeconds();
+
+    int num_bboxes = 0;
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+        // Count the number of bboxes.
+        const vector<AnnotationGroup>& anno_vec = batch_annos_[item_id];
+        for (int g = 0; g < anno_vec.size(); ++g) {
+            num_bboxes += anno_vec[g].annotation_size();
         }
-        CHECK(sampled_datum != NULL);
-        timer.Start();
-        vector<int> shape = this->data_transformer_->InferBlobShape(sampled_datum->datum());
-        if (transform_param.has_resize_param()) {
-            if (transform_param.resize_param().resize_mode() ==
-                ResizeParameter_Resize_mode_FIT_SMALL_SIZE) {
-            this->transformed_data_.Reshape(shape);
-            batch->data_.Reshape(shape);
-            top_data = batch->data_.mutable_cpu_data();
-            } else {
-            CHECK(std::equal(top_shape.begin() + 1, top_shape.begin() + 4,
-                    shape.begin() + 1));
-            }
+        if (bucket_shapes_.empty()) {
+            reader_.free().push(batch_datums_[item_id]);
         } else {
-            CHECK(std::equal(top_shape.begin() + 1, top_shape.begin() + 4,
-                shape.begin() + 1));
-        }
-        // Apply data transformations (mirror, scale, crop...)
-        int offset = batch->data_.offset(item_id);
-        this->transformed_data_.set_cpu_data(top_data + offset);
-        vector<AnnotationGroup> transformed_anno_vec;
-        if (this->output_labels_) {
-            if (has_anno_type_) {
-                CHECK(sampled_datum->has_type()) << "Some datum misses AnnotationType.";
-                if (anno_data_param.has_anno_type()) {
-                    sampled_datum->set_type(anno_type_);
-                } else {
-                    CHECK_EQ(anno_type_, sampled_datum->type()) << "Different AnnotationType.";
-                }
-                // Transform datum and annotation_group at the same time
-                transformed_anno_vec.clear();
-                this->data_transformer_->Transform(*sampled_datum,
-                                                    &(this->transformed_data_),
-                                                    &transformed_anno_vec);
-                if (anno_type_ == AnnotatedDatum_AnnotationType_BBOX) {
-                    // Count the number of bboxes.
-                    for (int g = 0; g < transformed_anno_vec.size(); ++g) {
-                        num_bboxes += transformed_anno_vec[g].annotation_size();
-                    }
-                } else {
-                    LOG(FATAL) << "Unknown annotation type.";
-                }
-                all_anno[item_id] = transformed_anno_vec;
-            } else {
-                this->data_transformer_->Transform(sampled_datum->datum(),
-                                                    &(this->transformed_data_));
-                // Otherwise, store the label from datum.
-                CHECK(sampled_datum->datum().has_label()) << "Cannot find any label.";
-                top_label[item_id] = sampled_datum->datum().label();
-            }
-        } 
-        else {
-            this->data_transformer_->Transform(sampled_datum->datum(),
-                                            &(this->transformed_data_));
-        }
-        # if BOOL_TEST_DATA
-        cv::Mat cropImage;
-        std::string save_folder = "../../anchorTestImage";
-        std::string prefix_imgName = "crop_image";
-        int jj = 0;
-        std::string saved_img_name = save_folder + "/" + to_string(item_id) + "_" + to_string(jj) +".jpg";
-        const float* data = this->transformed_data_.cpu_data();
-        int Trans_Height = this->transformed_data_.height();
-        int Trans_Width = this->transformed_data_.width();
-        for(int row = 0; row < Trans_Height; row++){
-            unsigned char *ImgData = cropImage.ptr<uchar>(row);
-            for(int col = 0; col < Trans_Width; col++){
-            ImgData[3 * col + 0] = static_cast<uchar>(data[0 * Trans_Height * Trans_Width + row * Trans_Width + col]);
-            ImgData[3 * col + 1] = static_cast<uchar>(data[1 * Trans_Height * Trans_Width + row * Trans_Width + col]);
-            ImgData[3 * col + 2] = static_cast<uchar>(data[2 * Trans_Height * Trans_Width + row * Trans_Width + col]);
-            }
-        }
-        int Crop_Height = cropImage.rows;
-        int Crop_Width = cropImage.cols;
-        for (int g = 0; g < transformed_anno_vec.size(); ++g) {
-            const AnnotationGroup& anno_group = transformed_anno_vec[g];
-            for (int a = 0; a < anno_group.annotation_size(); ++a) {
-            const Annotation& anno = anno_group.annotation(a);
-            const NormalizedBBox& bbox = anno.bbox();
-            int xmin = int(bbox.xmin() * Crop_Width);
-            int ymin = int(bbox.ymin() * Crop_Height);
-            int xmax = int(bbox.xmax() * Crop_Width);
-            int ymax = int(bbox.ymax() * Crop_Height);
-            cv::rectangle(cropImage, cv::Point2i(xmin, ymin), cv::Point2i(xmax, ymax), cv::Scalar(255,0,0), 1, 1, 0);
-            }
-        }
-        cv::imwrite(saved_img_name, cropImage);
-        LOG(INFO)<<"*** Datum Write Into Jpg File Sucessfully! ***";
-        jj ++ ;
-        if(jj == 1000){
-            LOG(FATAL)<<"We have completed 1000 times images crop testd!";
-        }
-        #endif
-        // clear memory
-        if (has_sampled) {
-            delete sampled_datum;
-        }
-        if (transform_param.has_expand_param()) {
-            delete expand_datum;
-        }
-        if(do_resize){
-            delete resized_anno_datum;
+            spare_datums_.push_back(batch_datums_[item_id]);
         }
-        trans_time += timer.MicroSeconds();
-        reader_.free().push(const_cast<AnnotatedDatum*>(&anno_datum));
     }
 
+    Dtype* top_label = NULL;
+
     // Store "rich" annotation if needed.
     if (this->output_labels_ && has_anno_type_) {
         vector<int> label_shape(4);
@@ -394,7 +327,7 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
                         caffe_set<Dtype>(19 * num_bboxes * batch_size, -1, batch->label_.mutable_cpu_data());
                         top_label = batch->label_.mutable_cpu_data();
                         for (int item_id = 0; item_id < batch_size; ++item_id) {
-                            const vector<AnnotationGroup>& anno_vec = all_anno[item_id];
+                            const vector<AnnotationGroup>& anno_vec = batch_annos_[item_id];
                             int idx = item_id * num_bboxes * 19 ;
                             for (int g = 0; g < anno_vec.size(); ++g) {
                                 const AnnotationGroup& anno_group = anno_vec[g];
@@ -446,7 +379,7 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
                         caffe_set<Dtype>(8 * num_bboxes * batch_size, -1, batch->label_.mutable_cpu_data());
                         top_label = batch->label_.mutable_cpu_data();
                         for (int item_id = 0; item_id < batch_size; ++item_id) {
-                            const vector<AnnotationGroup>& anno_vec = all_anno[item_id];
+                            const vector<AnnotationGroup>& anno_vec = batch_annos_[item_id];
                             int idx = item_id * num_bboxes * 8 ;
                             for (int g = 0; g < anno_vec.size(); ++g) {
                                 const AnnotationGroup& anno_group = anno_vec[g];
@@ -484,7 +417,7 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
                         top_label = batch->label_.mutable_cpu_data();
                         int idx = 0;
                         for (int item_id = 0; item_id < batch_size; ++item_id) {
-                            const vector<AnnotationGroup>& anno_vec = all_anno[item_id];
+                            const vector<AnnotationGroup>& anno_vec = batch_annos_[item_id];
                             for (int g = 0; g < anno_vec.size(); ++g) {
                                 const AnnotationGroup& anno_group = anno_vec[g];
                                 for (int a = 0; a < anno_group.annotation_size(); ++a) {
@@ -528,7 +461,7 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
                         top_label = batch->label_.mutable_cpu_data();
                         int idx = 0;
                         for (int item_id = 0; item_id < batch_size; ++item_id) {
-                            const vector<AnnotationGroup>& anno_vec = all_anno[item_id];
+                            const vector<AnnotationGroup>& anno_vec = batch_annos_[item_id];
                             for (int g = 0; g < anno_vec.size(); ++g) {
                                 const AnnotationGroup& anno_group = anno_vec[g];
                                 for (int a = 0; a < anno_group.annotation_size(); ++a) {
@@ -559,6 +492,364 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
     DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+// This function is called on prefetch thread, or on a transform worker
+#ifdef USE_OPENCV
+template <typename Dtype>
+AnnotatedDatum* AnnotatedDataLayer<Dtype>::SampleDecodedItem(
+    const AnnotatedDatum& anno_datum, DataTransformer<Dtype>* data_transformer,
+    cv::Mat* sampled_img) {
+    const TransformationParameter& transform_param =
+    this->layer_param_.transform_param();
+    cv::Mat cv_img;
+    data_transformer->DecodeImage(anno_datum.datum(), &cv_img);
+    AnnotatedDatum header_datum;
+    data_transformer->CopyAnnotation(anno_datum, cv_img, &header_datum);
+    if (transform_param.has_distort_param()) {
+        cv::Mat distort_img;
+        data_transformer->DistortImage(cv_img, &distort_img);
+        cv_img = distort_img;
+    }
+    AnnotatedDatum expand_datum;
+    cv::Mat expand_img;
+    if (transform_param.has_expand_param()) {
+        data_transformer->ExpandImage(header_datum, cv_img, &expand_datum,
+                                      &expand_img);
+    } else {
+        expand_datum.Swap(&header_datum);
+        expand_img = cv_img;
+    }
+    // Sampling only looks at the annotation and the image size, so the
+    // samplers draw exactly the same boxes as on the encoded datum.
+    vector<NormalizedBBox> sampled_bboxes;
+    bool crop_sample = false;
+    AnnotatedDatum* sampled_datum = new AnnotatedDatum();
+    if (crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_BATCH) {
+        if (batch_samplers_.size() > 0) {
+            GenerateBatchSamples(expand_datum, batch_samplers_, &sampled_bboxes);
+            crop_sample = true;
+        }
+    } else if (crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_JITTER) {
+        GenerateJitterSamples(expand_datum, 0.1, &sampled_bboxes);
+        crop_sample = true;
+    } else if (crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_ANCHOR) {
+        if (data_anchor_samplers_.size() > 0) {
+            GenerateBatchDataAnchorSamples(expand_datum, data_anchor_samplers_,
+                                           &sampled_bboxes);
+            int rand_idx = caffe_rng_rand() % sampled_bboxes.size();
+            data_transformer->CropImage_Sampling(expand_datum, expand_img,
+                                                 sampled_bboxes[rand_idx],
+                                                 sampled_datum, sampled_img);
+            return sampled_datum;
+        }
+    }
+    if (crop_sample && sampled_bboxes.size() > 0) {
+        int rand_idx = caffe_rng_rand() % sampled_bboxes.size();
+        data_transformer->CropImage(expand_datum, expand_img,
+                                    sampled_bboxes[rand_idx],
+                                    sampled_datum, sampled_img);
+    } else {
+        sampled_datum->Swap(&expand_datum);
+        *sampled_img = expand_img;
+    }
+    return sampled_datum;
+}
+#endif  // USE_OPENCV
+
+template<typename Dtype>
+void AnnotatedDataLayer<Dtype>::load_items(Batch<Dtype>* batch,
+    int item_offset, int item_stride,
+    DataTransformer<Dtype>* data_transformer, Blob<Dtype>* transformed_data) {
+    const int batch_size = this->layer_param_.data_param().batch_size();
+    const AnnotatedDataParameter& anno_data_param =
+        this->layer_param_.annotated_data_param();
+    const TransformationParameter& transform_param =
+    this->layer_param_.transform_param();
+    const vector<int>& top_shape = batch_top_shape_;
+    vector<int> item_shape = top_shape;
+    item_shape[0] = 1;
+    transformed_data->Reshape(item_shape);
+    if (batch_bucket_ >= 0) {
+        const std::pair<int, int>& shape = bucket_shapes_[batch_bucket_];
+        data_transformer->SetResizeShape(shape.first, shape.second);
+    }
+
+    Dtype* top_data = batch->data_.mutable_cpu_data();
+    Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
+    if (this->output_labels_ && !has_anno_type_) {
+        top_label = batch->label_.mutable_cpu_data();
+    }
+#ifdef USE_OPENCV
+    // CROP_GT_BBOX resamples the encoded image itself (GenerateLFFDSample),
+    // so it keeps going through the encoded datum.
+    const bool use_decode_once = transform_param.decode_once() &&
+        crop_type_ != AnnotatedDataParameter_CROP_TYPE_CROP_GT_BBOX;
+#endif  // USE_OPENCV
+
+    for (int item_id = item_offset; item_id < batch_size;
+         item_id += item_stride) {
+        AnnotatedDatum& anno_datum = *batch_datums_[item_id];
+        AnnotatedDatum distort_datum;
+        AnnotatedDatum* expand_datum = NULL;
+        AnnotatedDatum* resized_anno_datum = NULL;
+        bool do_resize = false;
+        AnnotatedDatum* sampled_datum = NULL;
+        bool has_sampled = false;
+#ifdef USE_OPENCV
+        // Decode the image once and augment it as a cv::Mat.
+        cv::Mat sampled_img;
+        if (use_decode_once && anno_datum.datum().encoded()) {
+            sampled_datum = SampleDecodedItem(anno_datum, data_transformer,
+                                              &sampled_img);
+            has_sampled = true;
+        }
+#endif  // USE_OPENCV
+        if (sampled_datum == NULL) {
+            if (transform_param.has_distort_param()) {
+                distort_datum.CopyFrom(anno_datum);
+                data_transformer->DistortImage(anno_datum.datum(),
+                                                    distort_datum.mutable_datum());
+                if (transform_param.has_expand_param()) {
+                    expand_datum = new AnnotatedDatum();
+                    data_transformer->ExpandImage(distort_datum, expand_datum);
+                } else {
+                    expand_datum = &distort_datum;
+                }
+            } else {
+                if (transform_param.has_expand_param()) {
+                    expand_datum = new AnnotatedDatum();
+                    data_transformer->ExpandImage(anno_datum, expand_datum);
+                } else {
+                    expand_datum = &anno_datum;
+                }
+            }
+            bool CropSample = false;
+            vector<NormalizedBBox> sampled_bboxes;
+            sampled_bboxes.clear();
+            if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_BATCH){
+                if (batch_samplers_.size() > 0) {
+                    GenerateBatchSamples(*expand_datum, batch_samplers_, &sampled_bboxes);
+                    CropSample = true;
+                } else {
+                    sampled_datum = expand_datum;
+                }
+            }
+            else if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_JITTER){
+                GenerateJitterSamples(*expand_datum, 0.1, &sampled_bboxes);
+                CropSample = true;
+            }
+            else if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_ANCHOR){
+                if(data_anchor_samplers_.size() > 0){
+                    GenerateBatchDataAnchorSamples(*expand_datum, data_anchor_samplers_, &sampled_bboxes);
+                    int rand_idx = caffe_rng_rand() % sampled_bboxes.size();
+                    sampled_datum = new AnnotatedDatum();
+                    data_transformer->CropImage_Sampling(*expand_datum,
+                                                        sampled_bboxes[rand_idx],
+                                                        sampled_datum);
+                    has_sampled = true;
+                }else{
+                    sampled_datum = expand_datum;
+                }
+            }
+            else if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_GT_BBOX){
+                if (anno_data_param.has_bbox_sampler()) {
+                    resized_anno_datum = new AnnotatedDatum();
+                    do_resize = true;
+                    GenerateLFFDSample(*expand_datum, &sampled_bboxes, 
+                                    bbox_small_scale_, bbox_large_scale_, anchor_stride_,
+                                    resized_anno_datum, transform_param, do_resize);
+                    CHECK_GT(resized_anno_datum->datum().channels(), 0);
+                    sampled_datum = new AnnotatedDatum();
+                    data_transformer->CropImage_Sampling(*resized_anno_datum,
+                                                    sampled_bboxes[0], sampled_datum);
+                    has_sampled = true;
+                } else {
+                    sampled_datum = expand_datum;
+                }
+            }
+            else if(crop_type_ == AnnotatedDataParameter_CROP_TYPE_CROP_DEFAULT){
+                sampled_datum = expand_datum;
+            }
+            if(CropSample){        
+                if (sampled_bboxes.size() > 0) {
+                    int rand_idx = caffe_rng_rand() % sampled_bboxes.size();
+                    sampled_datum = new AnnotatedDatum();
+                    data_transformer->CropImage(*expand_datum,
+                                                        sampled_bboxes[rand_idx],
+                                                        sampled_datum);
+                    has_sampled = true;
+                } else {
+                    sampled_datum = expand_datum;
+                }
+            }
+        }
+        CHECK(sampled_datum != NULL);
+        vector<int> shape;
+#ifdef USE_OPENCV
+        if (!sampled_img.empty()) {
+            shape = data_transformer->InferBlobShape(sampled_img);
+        } else {
+            shape = data_transformer->InferBlobShape(sampled_datum->datum());
+        }
+#else
+        shape = data_transformer->InferBlobShape(sampled_datum->datum());
+#endif  // USE_OPENCV
+        if (transform_param.has_resize_param() && batch_bucket_ < 0) {
+            if (transform_param.resize_param().resize_mode() ==
+                ResizeParameter_Resize_mode_FIT_SMALL_SIZE) {
+            transformed_data->Reshape(shape);
+            batch->data_.Reshape(shape);
+            top_data = batch->data_.mutable_cpu_data();
+            } else {
+            CHECK(std::equal(top_shape.begin() + 1, top_shape.begin() + 4,
+                    shape.begin() + 1));
+            }
+        } else {
+            CHECK(std::equal(top_shape.begin() + 1, top_shape.begin() + 4,
+                shape.begin() + 1));
+        }
+        // Apply data transformations (mirror, scale, crop...)
+        int offset = batch->data_.offset(item_id);
+        transformed_data->set_cpu_data(top_data + offset);
+        vector<AnnotationGroup>& transformed_anno_vec = batch_annos_[item_id];
+        if (this->output_labels_ && has_anno_type_) {
+            CHECK(sampled_datum->has_type()) << "Some datum misses AnnotationType.";
+            if (anno_data_param.has_anno_type()) {
+                sampled_datum->set_type(anno_type_);
+            } else {
+                CHECK_EQ(anno_type_, sampled_datum->type()) << "Different AnnotationType.";
+            }
+            // Transform datum and annotation_group at the same time
+            transformed_anno_vec.clear();
+#ifdef USE_OPENCV
+            if (!sampled_img.empty()) {
+                data_transformer->Transform(*sampled_datum, sampled_img,
+                                                    transformed_data,
+                                                    &transformed_anno_vec);
+            } else
+#endif  // USE_OPENCV
+            {
+                data_transformer->Transform(*sampled_datum,
+                                                    transformed_data,
+                                                    &transformed_anno_vec);
+            }
+            if (anno_type_ != AnnotatedDatum_AnnotationType_BBOX) {
+                LOG(FATAL) << "Unknown annotation type.";
+            }
+        } else {
+#ifdef USE_OPENCV
+            if (!sampled_img.empty()) {
+                data_transformer->Transform(sampled_img, transformed_data);
+            } else
+#endif  // USE_OPENCV
+            {
+                data_transformer->Transform(sampled_datum->datum(),
+                                                    transformed_data);
+            }
+            if (this->output_labels_) {
+                // Otherwise, store the label from datum.
+                CHECK(sampled_datum->datum().has_label()) << "Cannot find any label.";
+                top_label[item_id] = sampled_datum->datum().label();
+            }
+        }
+        # if BOOL_TEST_DATA
+        cv::Mat cropImage;
+        std::string save_folder = "../../anchorTestImage";
+        std::string prefix_imgName = "crop_image";
+        int jj = 0;
+        std::string saved_img_name = save_folder + "/" + to_string(item_id) + "_" + to_string(jj) +".jpg";
+        const float* data = transformed_data->cpu_data();
+        int Trans_Height = transformed_data->height();
+        int Trans_Width = transformed_data->width();
+        for(int row = 0; row < Trans_Height; row++){
+            unsigned char *ImgData = cropImage.ptr<uchar>(row);
+            for(int col = 0; col < Trans_Width; col++){
+            ImgData[3 * col + 0] = static_cast<uchar>(data[0 * Trans_Height * Trans_Width + row * Trans_Width + col]);
+            ImgData[3 * col + 1] = static_cast<uchar>(data[1 * Trans_Height * Trans_Width + row * Trans_Width + col]);
+            ImgData[3 * col + 2] = static_cast<uchar>(data[2 * Trans_Height * Trans_Width + row * Trans_Width + col]);
+            }
+        }
+        int Crop_Height = cropImage.rows;
+        int Crop_Width = cropImage.cols;
+        for (int g = 0; g < transformed_anno_vec.size(); ++g) {
+            const AnnotationGroup& anno_group = transformed_anno_vec[g];
+            for (int a = 0; a < anno_group.annotation_size(); ++a) {
+            const Annotation& anno = anno_group.annotation(a);
+            const NormalizedBBox& bbox = anno.bbox();
+            int xmin = int(bbox.xmin() * Crop_Width);
+            int ymin = int(bbox.ymin() * Crop_Height);
+            int xmax = int(bbox.xmax() * Crop_Width);
+            int ymax = int(bbox.ymax() * Crop_Height);
+            cv::rectangle(cropImage, cv::Point2i(xmin, ymin), cv::Point2i(xmax, ymax), cv::Scalar(255,0,0), 1, 1, 0);
+            }
+        }
+        cv::imwrite(saved_img_name, cropImage);
+        LOG(INFO)<<"*** Datum Write Into Jpg File Sucessfully! ***";
+        jj ++ ;
+        if(jj == 1000){
+            LOG(FATAL)<<"We have completed 1000 times images crop testd!";
+        }
+        #endif
+        // clear memory
+        if (has_sampled) {
+            delete sampled_datum;
+        }
+        if (transform_param.has_expand_param()) {
+            delete expand_datum;
+        }
+        if(do_resize){
+            delete resized_anno_datum;
+        }
+    }
+}
+
+template <typename Dtype>
+int AnnotatedDataLayer<Dtype>::BucketOf(const Datum& datum) const {
+    CHECK_GT(datum.height(), 0) << "bucket_aspect_ratio needs the image size "
+        << "in the datum.";
+    CHECK_GT(datum.width(), 0) << "bucket_aspect_ratio needs the image size "
+        << "in the datum.";
+    // Closest ratio on a log scale, so that 1:2 and 2:1 are as far from 1:1.
+    const float log_ratio =
+        std::log(static_cast<float>(datum.width()) / datum.height());
+    int bucket = 0;
+    float min_distance = FLT_MAX;
+    for (int i = 0; i < bucket_aspect_ratios_.size(); ++i) {
+        const float distance =
+            std::fabs(log_ratio - std::log(bucket_aspect_ratios_[i]));
+        if (distance < min_distance) {
+            min_distance = distance;
+            bucket = i;
+        }
+    }
+    return bucket;
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+int AnnotatedDataLayer<Dtype>::FillBucket(int batch_size) {
+    while (true) {
+        AnnotatedDatum* anno_datum = reader_.full().pop("Waiting for data");
+        const int bucket = BucketOf(anno_datum->datum());
+        AnnotatedDatum* waiting_datum;
+        if (spare_datums_.empty()) {
+            bucket_pool_.push_back(
+                shared_ptr<AnnotatedDatum>(new AnnotatedDatum()));
+            waiting_datum = bucket_pool_.back().get();
+        } else {
+            waiting_datum = spare_datums_.back();
+            spare_datums_.pop_back();
+        }
+        // The reader only has prefetch * batch_size datums, which must not
+        // all get stuck in buckets.
+        waiting_datum->Swap(anno_datum);
+        reader_.free().push(anno_datum);
+        bucket_datums_[bucket].push_back(waiting_datum);
+        if (bucket_datums_[bucket].size() == batch_size) {
+            return bucket;
+        }
+    }
+}
+
 INSTANTIATE_CLASS(AnnotatedDataLayer);
 REGISTER_LAYER_CLASS(AnnotatedData);
 
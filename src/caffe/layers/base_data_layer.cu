@@ -7,29 +7,31 @@ namespace caffe {
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
-  // Reshape to loaded data.
-  top[0]->ReshapeLike(batch->data_);
-  // Copy the data
-  caffe_copy(batch->data_.count(), batch->data_.gpu_data(),
-      top[0]->mutable_gpu_data());
+  if (prefetch_current_) {
+    // The last iteration's kernels read this batch through the shared tops;
+    // let them finish before the prefetch thread may overwrite it.
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
+    prefetch_free_.push(prefetch_current_);
+  }
+  prefetch_current_ = prefetch_full_.pop("Data layer prefetch queue empty");
+  // Reshape to loaded data and share its memory, which the prefetch thread
+  // already pushed to the GPU, instead of copying it.
+  top[0]->ReshapeLike(prefetch_current_->data_);
+  top[0]->ShareData(prefetch_current_->data_);
   if (this->output_labels_) {
     // Reshape to loaded labels.
-    top[1]->ReshapeLike(batch->label_);
-    // Copy the labels.
-    caffe_copy(batch->label_.count(), batch->label_.gpu_data(),
-        top[1]->mutable_gpu_data());
+    top[1]->ReshapeLike(prefetch_current_->label_);
+    top[1]->ShareData(prefetch_current_->label_);
   }
-  // Ensure the copy is synchronous wrt the host, so that the next batch isn't
-  // copied in meanwhile.
-  CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
-  prefetch_free_.push(batch);
 }
 
 template <typename Dtype>
 void ReidPrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   if (prefetch_current_) {
+    // Ensure the last copies out of this batch are done before the prefetch
+    // thread may overwrite it.
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
     prefetch_free_.push(prefetch_current_);
   }
   prefetch_current_ = this->prefetch_full_.pop("Data layer prefetch queue empty");
@@ -37,6 +37,20 @@ void ccpdDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom, co
         << "Only support batch size of 1 for FIT_SMALL_SIZE.";
     }
     }
+#ifdef USE_OPENCV
+    image_cache_ = NULL;
+    const DataParameter& data_param = this->layer_param_.data_param();
+    if (data_param.decoded_cache_bytes() > 0) {
+        // Only the decode-once path decodes to a cv::Mat that can be cached.
+        CHECK(transform_param.decode_once())
+            << "decoded_cache_bytes requires transform_param.decode_once.";
+        image_cache_ = &DecodedImageCache::Get(data_param.decoded_cache_bytes());
+        // Images decoded with other color settings are cached apart.
+        cache_key_prefix_ = data_param.source() + ":" +
+            (transform_param.force_color() ? "color:" : "") +
+            (transform_param.force_gray() ? "gray:" : "");
+    }
+#endif  // USE_OPENCV
     // Read a data point, and use it to initialize the top blob.
     AnnotatedCCpdDatum& anno_datum = *(reader_.full().peek());
 
@@ -47,8 +61,8 @@ void ccpdDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom, co
     // Reshape top[0] and prefetch_data according to the batch_size.
     top_shape[0] = batch_size;
     top[0]->Reshape(top_shape);
-    for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-        this->prefetch_[i].data_.Reshape(top_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+        this->prefetch_[i]->data_.Reshape(top_shape);
     }
     LOG(INFO) << "output data size: " << top[0]->num() << ","
         << top[0]->channels() << "," << top[0]->height() << ","
@@ -72,8 +86,8 @@ void ccpdDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom, co
             label_shape[0] = batch_size;
         }
         top[1]->Reshape(label_shape);
-        for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-            this->prefetch_[i].label_.Reshape(label_shape);
+        for (int i = 0; i < this->prefetch_.size(); ++i) {
+            this->prefetch_[i]->label_.Reshape(label_shape);
         }
     }
 }
@@ -123,27 +137,70 @@ void ccpdDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
     #endif
         AnnotatedCCpdDatum distort_datum;
         AnnotatedCCpdDatum* expand_datum = NULL;
-        if (transform_param.has_distort_param()) {
-            distort_datum.CopyFrom(anno_datum);
-            this->data_transformer_->DistortImage(anno_datum.datum(),
-                                                    distort_datum.mutable_datum());
-            if (transform_param.has_expand_param()) {
-                expand_datum = new AnnotatedCCpdDatum();
-                this->data_transformer_->ExpandImage(distort_datum, expand_datum);
+#ifdef USE_OPENCV
+        // Decode the image once and distort/expand it as a cv::Mat.
+        AnnotatedCCpdDatum header_datum;
+        cv::Mat expand_img;
+        if (transform_param.decode_once() && anno_datum.datum().encoded()) {
+            cv::Mat cv_img;
+            if (image_cache_) {
+                const string key = cache_key_prefix_ + reader_.key(&anno_datum);
+                if (!image_cache_->Lookup(key, &cv_img)) {
+                    this->data_transformer_->DecodeImage(anno_datum.datum(),
+                                                         &cv_img);
+                    image_cache_->Insert(key, cv_img);
+                }
             } else {
-                expand_datum = &distort_datum;
+                this->data_transformer_->DecodeImage(anno_datum.datum(), &cv_img);
+            }
+            this->data_transformer_->CopyAnnotation(anno_datum, cv_img,
+                                                    &header_datum);
+            if (transform_param.has_distort_param()) {
+                cv::Mat distort_img;
+                this->data_transformer_->DistortImage(cv_img, &distort_img);
+                cv_img = distort_img;
             }
-            } else {
             if (transform_param.has_expand_param()) {
                 expand_datum = new AnnotatedCCpdDatum();
-                this->data_transformer_->ExpandImage(anno_datum, expand_datum);
+                this->data_transformer_->ExpandImage(header_datum, cv_img,
+                                                     expand_datum, &expand_img);
             } else {
-                expand_datum = &anno_datum;
+                expand_datum = &header_datum;
+                expand_img = cv_img;
+            }
+        } else
+#endif  // USE_OPENCV
+        {
+            if (transform_param.has_distort_param()) {
+                distort_datum.CopyFrom(anno_datum);
+                this->data_transformer_->DistortImage(anno_datum.datum(),
+                                                        distort_datum.mutable_datum());
+                if (transform_param.has_expand_param()) {
+                    expand_datum = new AnnotatedCCpdDatum();
+                    this->data_transformer_->ExpandImage(distort_datum, expand_datum);
+                } else {
+                    expand_datum = &distort_datum;
+                }
+            } else {
+                if (transform_param.has_expand_param()) {
+                    expand_datum = new AnnotatedCCpdDatum();
+                    this->data_transformer_->ExpandImage(anno_datum, expand_datum);
+                } else {
+                    expand_datum = &anno_datum;
+                }
             }
         }
         timer.Start();
-        vector<int> shape =
-            this->data_transformer_->InferBlobShape(expand_datum->datum());
+        vector<int> shape;
+#ifdef USE_OPENCV
+        if (!expand_img.empty()) {
+            shape = this->data_transformer_->InferBlobShape(expand_img);
+        } else {
+            shape = this->data_transformer_->InferBlobShape(expand_datum->datum());
+        }
+#else
+        shape = this->data_transformer_->InferBlobShape(expand_datum->datum());
+#endif  // USE_OPENCV
         if (transform_param.has_resize_param()) {
             if (transform_param.resize_param().resize_mode() ==
                 ResizeParameter_Resize_mode_FIT_SMALL_SIZE) {
@@ -163,23 +220,32 @@ void ccpdDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
         int offset = batch->data_.offset(item_id);
         this->transformed_data_.set_cpu_data(top_data + offset);
         LicensePlate transformed_anno_vec;
-        if (this->output_labels_) {
-            if (has_anno_type_) {
-                // Transform datum and annotation_group at the same time
+        if (this->output_labels_ && has_anno_type_) {
+            // Transform datum and annotation_group at the same time
+#ifdef USE_OPENCV
+            if (!expand_img.empty()) {
+                this->data_transformer_->Transform(*expand_datum, expand_img,
+                                                &(this->transformed_data_),
+                                                &transformed_anno_vec);
+            } else
+#endif  // USE_OPENCV
+            {
                 this->data_transformer_->Transform(*expand_datum,
                                                 &(this->transformed_data_),
                                                 &transformed_anno_vec);
-                all_anno[item_id] = transformed_anno_vec;
-            } else {
+            }
+            all_anno[item_id] = transformed_anno_vec;
+        } else {
+#ifdef USE_OPENCV
+            if (!expand_img.empty()) {
+                this->data_transformer_->Transform(expand_img,
+                                                &(this->transformed_data_));
+            } else
+#endif  // USE_OPENCV
+            {
                 this->data_transformer_->Transform(expand_datum->datum(),
                                                 &(this->transformed_data_));
-                // Otherwise, store the label from datum.
-                // CHECK(expand_datum->datum().has_label()) << "Cannot find any label.";
-                // top_label[item_id] = expand_datum->datum().label();
             }
-        } else {
-            this->data_transformer_->Transform(expand_datum->datum(),
-                                            &(this->transformed_data_));
         }
         // clear memory
         if (transform_param.has_expand_param()) {
@@ -228,6 +294,14 @@ void ccpdDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
 
     timer.Stop();
     batch_timer.Stop();
+#ifdef USE_OPENCV
+    if (image_cache_) {
+        LOG_EVERY_N(INFO, 1000) << "Decoded image cache: "
+            << image_cache_->hits() << " hits, "
+            << image_cache_->misses() << " misses, "
+            << (image_cache_->bytes() >> 20) << " MB.";
+    }
+#endif  // USE_OPENCV
     DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
     DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
     DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
@@ -1,9 +1,29 @@
 #include <vector>
 
+#include "boost/bind.hpp"
+
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  BaseConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  num_threads_ = conv_param.num_threads() > 0 ? conv_param.num_threads() :
+      Caffe::conv_threads();
+  CHECK_GT(num_threads_, 0);
+  // Allocated on their first use only, as the pool.
+  this->worker_col_buffers_.clear();
+  for (int i = 1; i < num_threads_; ++i) {
+    this->worker_col_buffers_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::compute_output_shape() {
   const int* kernel_shape_data = this->kernel_shape_.cpu_data();
@@ -21,21 +41,63 @@ void ConvolutionLayer<Dtype>::compute_output_shape() {
   }
 }
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::RunImages(const WorkerPool::Task& task) {
+  if (num_threads_ == 1) {
+    for (int n = 0; n < this->num_; ++n) {
+      task(n, 0);
+    }
+    return;
+  }
+  if (!worker_pool_) {
+    worker_pool_.reset(new WorkerPool(num_threads_));
+  }
+  worker_pool_->Run(this->num_, task);
+}
+
+// This function may be called on the threads of worker_pool_
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_image(const Dtype* bottom_data,
+      const Dtype* weight, Dtype* top_data, int n, int worker_id) {
+  this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+      top_data + n * this->top_dim_, false, worker_id);
+  if (this->bias_term_) {
+    const Dtype* bias = this->blobs_[1]->cpu_data();
+    this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  if (this->bias_term_) {
+    // Synced to the CPU before the workers read it.
+    this->blobs_[1]->cpu_data();
+  }
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
-    for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
-      if (this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
-        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
-      }
-    }
+    RunImages(boost::bind(&ConvolutionLayer<Dtype>::forward_cpu_image, this,
+        bottom_data, weight, top_data, _1, _2));
+  }
+}
+
+// This function may be called on the threads of worker_pool_
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_image(const Dtype* top_diff,
+      const Dtype* bottom_data, const Dtype* weight, Dtype* weight_diff,
+      Dtype* bottom_diff, int n, int worker_id) {
+  // gradient w.r.t. weight. Note that we will accumulate diffs.
+  if (weight_diff) {
+    this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+        top_diff + n * this->top_dim_,
+        weight_diff + worker_id * this->blobs_[0]->count(), worker_id);
+  }
+  // gradient w.r.t. bottom data, if necessary.
+  if (bottom_diff) {
+    this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+        bottom_diff + n * this->bottom_dim_, worker_id);
   }
 }
 
@@ -44,6 +106,17 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const bool reduce_weight_diff =
+      this->param_propagate_down_[0] && num_threads_ > 1;
+  Dtype* image_weight_diff = weight_diff;
+  if (reduce_weight_diff) {
+    // Each worker accumulates the gradients of its images in its own diff.
+    vector<int> shape(1, num_threads_);
+    shape.push_back(this->blobs_[0]->count());
+    worker_weight_diff_.Reshape(shape);
+    image_weight_diff = worker_weight_diff_.mutable_cpu_data();
+    caffe_set(worker_weight_diff_.count(), Dtype(0), image_weight_diff);
+  }
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
@@ -56,18 +129,17 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       }
     }
     if (this->param_propagate_down_[0] || propagate_down[i]) {
-      for (int n = 0; n < this->num_; ++n) {
-        // gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
-          this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
-              top_diff + n * this->top_dim_, weight_diff);
-        }
-        // gradient w.r.t. bottom data, if necessary.
-        if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
-              bottom_diff + n * this->bottom_dim_);
-        }
-      }
+      RunImages(boost::bind(&ConvolutionLayer<Dtype>::backward_cpu_image,
+          this, top_diff, bottom_data, weight,
+          this->param_propagate_down_[0] ? image_weight_diff : NULL,
+          propagate_down[i] ? bottom_diff : NULL, _1, _2));
+    }
+  }
+  if (reduce_weight_diff) {
+    const int count = this->blobs_[0]->count();
+    for (int worker_id = 0; worker_id < num_threads_; ++worker_id) {
+      caffe_axpy(count, Dtype(1), image_weight_diff + worker_id * count,
+          weight_diff);
     }
   }
 }
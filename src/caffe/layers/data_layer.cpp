@@ -2,19 +2,40 @@
 #include <opencv2/core/core.hpp>
 #endif  // USE_OPENCV
 #include <stdint.h>
+#include <string.h>
 
+#include <boost/thread.hpp>
+#include <map>
+#include <string>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+// Solvers build their nets one after the other, so the layers reading the
+// same mmap source are numbered in solver order, like the queue pairs of a
+// DataReader body.
+static boost::mutex mmap_ranks_mutex_;
+static map<const string, int> mmap_ranks_;
+
+static int next_mmap_rank(const LayerParameter& param) {
+  boost::mutex::scoped_lock lock(mmap_ranks_mutex_);
+  int& count = mmap_ranks_[param.name() + ":" + param.data_param().source()];
+  return count++ % Caffe::solver_count();
+}
+
 template <typename Dtype>
 DataLayer<Dtype>::DataLayer(const LayerParameter& param)
   : BasePrefetchingDataLayer<Dtype>(param),
-    reader_(param) {
+    mmap_position_(0) {
+  if (param.data_param().backend() != DataParameter_DB_MMAP) {
+    reader_.reset(new DataReader<Datum>(param));
+  }
 }
 
 template <typename Dtype>
@@ -26,17 +47,50 @@ template <typename Dtype>
 void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int batch_size = this->layer_param_.data_param().batch_size();
-  // Read a data point, and use it to initialize the top blob.
-  Datum& datum = *(reader_.full().peek());
+  vector<int> top_shape;
+  if (reader_) {
+    // Read a data point, and use it to initialize the top blob.
+    Datum& datum = *(reader_->full().peek());
 
-  // Use data_transformer to infer the expected blob shape from datum.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
+    // Use data_transformer to infer the expected blob shape from datum.
+    top_shape = this->data_transformer_->InferBlobShape(datum);
+  } else {
+    const TransformationParameter& transform_param =
+        this->layer_param_.transform_param();
+    CHECK(!transform_param.crop_size() && !transform_param.mirror() &&
+          !transform_param.has_mean_file() &&
+          transform_param.mean_value_size() == 0)
+        << "mmap records are only scaled; crop, mirror and mean subtraction "
+        << "need a LEVELDB or LMDB database.";
+    mmap_db_.reset(new db::MmapDB());
+    mmap_db_->Open(this->layer_param_.data_param().source(), db::READ);
+    CHECK_GT(mmap_db_->num_records(), 0) << "Empty mmap db.";
+    // Each solver reads every solver_count-th record from its rank on, as
+    // a DataReader hands records to the solvers in turn.
+    const int solver_count =
+        this->phase_ == TRAIN ? Caffe::solver_count() : 1;
+    const int rank =
+        solver_count > 1 ? next_mmap_rank(this->layer_param_) : 0;
+    CHECK_GT(mmap_db_->num_records(), rank)
+        << "Fewer mmap records than solvers.";
+    mmap_order_.clear();
+    for (uint64_t i = rank; i < mmap_db_->num_records(); i += solver_count) {
+      mmap_order_.push_back(i);
+    }
+    // The first epoch is shuffled on the prefetch thread, like the next ones.
+    mmap_position_ = this->layer_param_.data_param().shuffle() ?
+        mmap_order_.size() : 0;
+    top_shape.push_back(1);
+    top_shape.push_back(mmap_db_->channels());
+    top_shape.push_back(mmap_db_->height());
+    top_shape.push_back(mmap_db_->width());
+  }
   this->transformed_data_.Reshape(top_shape);
   // Reshape top[0] and prefetch_data according to the batch_size.
   top_shape[0] = batch_size;
   top[0]->Reshape(top_shape);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].data_.Reshape(top_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
   }
   LOG(INFO) << "output data size: " << top[0]->num() << ","
       << top[0]->channels() << "," << top[0]->height() << ","
@@ -45,8 +99,8 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   if (this->output_labels_) {
     vector<int> label_shape(1, batch_size);
     top[1]->Reshape(label_shape);
-    for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-      this->prefetch_[i].label_.Reshape(label_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.Reshape(label_shape);
     }
   }
 }
@@ -61,11 +115,17 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer timer;
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
+  if (mmap_db_) {
+    load_mmap_batch(batch);
+    batch_timer.Stop();
+    DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+    return;
+  }
 
   // Reshape according to the first datum of each batch
   // on single input batches allows for inputs of varying dimension.
   const int batch_size = this->layer_param_.data_param().batch_size();
-  Datum& datum = *(reader_.full().peek());
+  Datum& datum = *(reader_->full().peek());
   // Use data_transformer to infer the expected blob shape from datum.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
   this->transformed_data_.Reshape(top_shape);
@@ -82,7 +142,7 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     timer.Start();
     // get a datum
-    Datum& datum = *(reader_.full().pop("Waiting for data"));
+    Datum& datum = *(reader_->full().pop("Waiting for data"));
     read_time += timer.MicroSeconds();
     timer.Start();
     // Apply data transformations (mirror, scale, crop...)
@@ -95,7 +155,7 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
     }
     trans_time += timer.MicroSeconds();
 
-    reader_.free().push(const_cast<Datum*>(&datum));
+    reader_->free().push(const_cast<Datum*>(&datum));
   }
   timer.Stop();
   batch_timer.Stop();
@@ -104,6 +164,52 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+template <typename Dtype>
+uint64_t DataLayer<Dtype>::next_mmap_record() {
+  if (mmap_position_ == mmap_order_.size()) {
+    if (this->layer_param_.data_param().shuffle()) {
+      shuffle(mmap_order_.begin(), mmap_order_.end());
+    }
+    mmap_position_ = 0;
+  }
+  return mmap_order_[mmap_position_++];
+}
+
+// Converts a float record to the type of the batch.
+template <typename Dtype>
+static void copy_record(const float* record, const int count, Dtype* data) {
+  for (int i = 0; i < count; ++i) {
+    data[i] = record[i];
+  }
+}
+
+template <>
+void copy_record<float>(const float* record, const int count, float* data) {
+  memcpy(data, record, count * sizeof(float));
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void DataLayer<Dtype>::load_mmap_batch(Batch<Dtype>* batch) {
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  const int record_floats = mmap_db_->record_floats();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = this->output_labels_ ?
+      batch->label_.mutable_cpu_data() : NULL;
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    const uint64_t index = next_mmap_record();
+    copy_record(mmap_db_->record(index), record_floats,
+                top_data + item_id * record_floats);
+    if (this->output_labels_) {
+      top_label[item_id] = mmap_db_->label(index);
+    }
+  }
+  const Dtype scale = this->layer_param_.transform_param().scale();
+  if (scale != Dtype(1)) {
+    caffe_scal(batch_size * record_floats, scale, top_data);
+  }
+}
+
 INSTANTIATE_CLASS(DataLayer);
 REGISTER_LAYER_CLASS(Data);
 
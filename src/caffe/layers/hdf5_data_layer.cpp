@@ -1,11 +1,4 @@
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <boost/thread.hpp>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -16,55 +9,68 @@ TODO:
 
 #include "caffe/layers/hdf5_data_layer.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  // The thread fills file_data_, so it must stop before they go away.
+  this->StopInternalThread();
+}
 
-// Load data and label from HDF5 filename into the class property blobs.
+// Load data and label from HDF5 filename into the blobs of file_data.
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
+void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename,
+    HDF5FileData<Dtype>* file_data) {
   DLOG(INFO) << "Loading HDF5 file: " << filename;
+  // The prefetch thread loads the files while the net may read or write
+  // other HDF5 files.
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
   if (file_id < 0) {
     LOG(FATAL) << "Failed opening HDF5 file: " << filename;
   }
 
   int top_size = this->layer_param_.top_size();
-  hdf_blobs_.resize(top_size);
+  std::vector<shared_ptr<Blob<Dtype> > >& hdf_blobs = file_data->blobs_;
+  hdf_blobs.resize(top_size);
 
   const int MIN_DATA_DIM = 1;
   const int MAX_DATA_DIM = INT_MAX;
 
   for (int i = 0; i < top_size; ++i) {
-    hdf_blobs_[i] = shared_ptr<Blob<Dtype> >(new Blob<Dtype>());
+    // Blobs keep their memory when reloaded with a smaller file.
+    if (!hdf_blobs[i]) {
+      hdf_blobs[i].reset(new Blob<Dtype>());
+    }
     hdf5_load_nd_dataset(file_id, this->layer_param_.top(i).c_str(),
-        MIN_DATA_DIM, MAX_DATA_DIM, hdf_blobs_[i].get());
+        MIN_DATA_DIM, MAX_DATA_DIM, hdf_blobs[i].get());
   }
 
   herr_t status = H5Fclose(file_id);
   CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
+  lock.unlock();
 
   // MinTopBlobs==1 guarantees at least one top blob
-  CHECK_GE(hdf_blobs_[0]->num_axes(), 1) << "Input must have at least 1 axis.";
-  const int num = hdf_blobs_[0]->shape(0);
+  CHECK_GE(hdf_blobs[0]->num_axes(), 1) << "Input must have at least 1 axis.";
+  const int num = hdf_blobs[0]->shape(0);
   for (int i = 1; i < top_size; ++i) {
-    CHECK_EQ(hdf_blobs_[i]->shape(0), num);
+    CHECK_EQ(hdf_blobs[i]->shape(0), num);
   }
   // Default to identity permutation.
-  data_permutation_.clear();
-  data_permutation_.resize(hdf_blobs_[0]->shape(0));
-  for (int i = 0; i < hdf_blobs_[0]->shape(0); i++)
-    data_permutation_[i] = i;
+  std::vector<unsigned int>& permutation = file_data->permutation_;
+  permutation.resize(num);
+  for (int i = 0; i < num; i++)
+    permutation[i] = i;
 
   // Shuffle if needed.
   if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
-    DLOG(INFO) << "Successully loaded " << hdf_blobs_[0]->shape(0)
-               << " rows (shuffled)";
+    shuffle(permutation.begin(), permutation.end());
+    DLOG(INFO) << "Successully loaded " << num << " rows (shuffled)";
   } else {
-    DLOG(INFO) << "Successully loaded " << hdf_blobs_[0]->shape(0) << " rows";
+    DLOG(INFO) << "Successully loaded " << num << " rows";
   }
 }
 
@@ -74,6 +80,11 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Refuse transformation parameters since HDF5 is totally generic.
   CHECK(!this->layer_param_.has_transform_param()) <<
       this->type() << " does not transform data.";
+  // Start over if set up again.
+  this->StopInternalThread();
+  HDF5FileData<Dtype>* file_data;
+  while (file_free_.try_pop(&file_data)) { }
+  while (file_full_.try_pop(&file_data)) { }
   // Read the source to parse the filenames.
   const string& source = this->layer_param_.hdf5_data_param().source();
   LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
@@ -89,7 +100,6 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   source_file.close();
   num_files_ = hdf_filenames_.size();
-  current_file_ = 0;
   LOG(INFO) << "Number of HDF5 files: " << num_files_;
   CHECK_GE(num_files_, 1) << "Must have at least 1 HDF5 filename listed in "
     << source;
@@ -103,59 +113,107 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   // Shuffle if needed.
   if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(file_permutation_.begin(), file_permutation_.end());
+    shuffle(file_permutation_.begin(), file_permutation_.end());
   }
 
   // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
+  current_ = &file_data_[0];
+  LoadHDF5FileData(hdf_filenames_[file_permutation_[0]].c_str(), current_);
   current_row_ = 0;
+  next_file_ = 1;
 
   // Reshape blobs.
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
   const int top_size = this->layer_param_.top_size();
   vector<int> top_shape;
   for (int i = 0; i < top_size; ++i) {
-    top_shape.resize(hdf_blobs_[i]->num_axes());
+    top_shape.resize(current_->blobs_[i]->num_axes());
     top_shape[0] = batch_size;
     for (int j = 1; j < top_shape.size(); ++j) {
-      top_shape[j] = hdf_blobs_[i]->shape(j);
+      top_shape[j] = current_->blobs_[i]->shape(j);
     }
     top[i]->Reshape(top_shape);
   }
+
+  // Load the next file while the first one is served.
+  if (num_files_ > 1) {
+    file_free_.push(&file_data_[1]);
+    this->StartInternalThread();
+  }
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == hdf_blobs_[0]->shape(0)) {
-      if (num_files_ > 1) {
-        ++current_file_;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          if (this->layer_param_.hdf5_data_param().shuffle()) {
-            std::random_shuffle(file_permutation_.begin(),
-                                file_permutation_.end());
-          }
-          DLOG(INFO) << "Looping around to first file.";
+void HDF5DataLayer<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      HDF5FileData<Dtype>* file_data = file_free_.pop();
+      if (next_file_ == num_files_) {
+        next_file_ = 0;
+        if (this->layer_param_.hdf5_data_param().shuffle()) {
+          shuffle(file_permutation_.begin(), file_permutation_.end());
         }
-        LoadHDF5FileData(
-            hdf_filenames_[file_permutation_[current_file_]].c_str());
+        DLOG(INFO) << "Looping around to first file.";
       }
-      current_row_ = 0;
-      if (this->layer_param_.hdf5_data_param().shuffle())
-        std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
+      LoadHDF5FileData(
+          hdf_filenames_[file_permutation_[next_file_]].c_str(), file_data);
+      ++next_file_;
+      file_full_.push(file_data);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::NextFile() {
+  if (num_files_ > 1) {
+    file_free_.push(current_);
+    current_ = file_full_.pop("Waiting for the next HDF5 file");
+  } else if (this->layer_param_.hdf5_data_param().shuffle()) {
+    shuffle(current_->permutation_.begin(), current_->permutation_.end());
+  }
+  current_row_ = 0;
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::CopyBatch(const vector<Blob<Dtype>*>& top,
+      bool gpu) {
+  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
+  for (int i = 0; i < batch_size; ) {
+    if (current_row_ == current_->blobs_[0]->shape(0)) {
+      NextFile();
+    }
+    // Copy the rows that follow each other in the file at once: the whole
+    // batch when not shuffling.
+    const std::vector<unsigned int>& permutation = current_->permutation_;
+    const unsigned int first_row = permutation[current_row_];
+    int num_rows = 1;
+    while (i + num_rows < batch_size &&
+           current_row_ + num_rows < permutation.size() &&
+           permutation[current_row_ + num_rows] == first_row + num_rows) {
+      ++num_rows;
     }
     for (int j = 0; j < this->layer_param_.top_size(); ++j) {
       int data_dim = top[j]->count() / top[j]->shape(0);
-      caffe_copy(data_dim,
-          &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_]
-            * data_dim], &top[j]->mutable_cpu_data()[i * data_dim]);
+      CHECK_EQ(current_->blobs_[j]->count(1), data_dim)
+          << "The rows of " << this->layer_param_.top(j)
+          << " differ in size from the first file's.";
+      caffe_copy(num_rows * data_dim,
+          &current_->blobs_[j]->cpu_data()[first_row * data_dim],
+          gpu ? &top[j]->mutable_gpu_data()[i * data_dim]
+              : &top[j]->mutable_cpu_data()[i * data_dim]);
     }
+    i += num_rows;
+    current_row_ += num_rows;
   }
 }
 
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CopyBatch(top, false);
+}
+
 #ifdef CPU_ONLY
 STUB_GPU_FORWARD(HDF5DataLayer, Forward);
 #endif
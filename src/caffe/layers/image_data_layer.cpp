@@ -1,5 +1,6 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
+#include <boost/bind.hpp>
 
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
@@ -18,6 +19,7 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/worker_pool.hpp"
 
 
 #include <dirent.h>
@@ -169,8 +171,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int batch_size = this->layer_param_.image_data_param().batch_size();
   CHECK_GT(batch_size, 0) << "Positive batch size required";
   top_shape[0] = batch_size;
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].data_.Reshape(top_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
   }
   top[0]->Reshape(top_shape);
 
@@ -180,42 +182,35 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // label
   vector<int> label_shape(1, label_num_);
   top[1]->Reshape(label_shape);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].label_.Reshape(label_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.Reshape(label_shape);
   }
   // sample_label_
   vector<int> label_shape_sample(1, batch_size);
   top[2]->Reshape(label_shape_sample);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].labelSample_.Reshape(label_shape_sample);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->labelSample_.Reshape(label_shape_sample);
+  }
+  const int load_threads = this->layer_param_.image_data_param().load_threads();
+  CHECK_GT(load_threads, 0);
+  if (load_threads > 1) {
+    LOG(INFO) << "Reading images with " << load_threads << " threads.";
+    load_pool_.reset(new WorkerPool(load_threads));
   }
 }
 
-
-// This function is called on prefetch thread
 template <typename Dtype>
-void ImageDataLayer<Dtype>::load_batch(pairBatch<Dtype>* batch) {
-  choosedImagefile_.clear();
+void ImageDataLayer<Dtype>::choose_batch_files(
+    std::vector< std::pair<std::string, int> >* files,
+    std::vector< int >* counts) {
+  const int batch_size = this->layer_param_.image_data_param().batch_size();
+  files->clear();
+  counts->clear();
   labelIdxSet_.clear();
-  label.clear();
-  CPUTimer batch_timer;
-  batch_timer.Start();
-  double read_time = 0;
-  double trans_time = 0;
-  CPUTimer timer;
-  CHECK(batch->data_.count());
-  CHECK(this->transformed_data_.count());
-  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
-  const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
-  const bool is_color = image_data_param.is_color();
-  string root_folder = image_data_param.root_folder();
-
   /**************随机挑选符合要求的人脸图片*************/
   struct dirent *faceSetDir;
   std::vector<std::string> filelist;
-  while (choosedImagefile_.size() < batch_size){
+  while (files->size() < batch_size){
     int rand_class_idx = caffe_rng_rand() % fullImageSetDir_.size();
     while(std::count(labelIdxSet_.begin(), labelIdxSet_.end(), rand_class_idx)!=0){
       rand_class_idx = caffe_rng_rand() % fullImageSetDir_.size();
@@ -237,32 +232,97 @@ void ImageDataLayer<Dtype>::load_batch(pairBatch<Dtype>* batch) {
     }
     closedir(dir);
     int nrof_image_in_class = filelist.size();
-    int length = choosedImagefile_.size();
+    int length = files->size();
     int temp = std::min(nrof_image_in_class, batch_size - length );
     int nrof_image_from_class = std::min(sample_num_, temp);
     unsigned seed = std::chrono::system_clock::now ().time_since_epoch ().count ();  
     std::shuffle(filelist.begin(), filelist.end(), std::default_random_engine (seed));
     for(int i = 0; i < nrof_image_from_class; i++){
-      choosedImagefile_.push_back(std::make_pair(filelist[i], fullImageSetDir_[rand_class_idx].second));
+      files->push_back(std::make_pair(filelist[i], fullImageSetDir_[rand_class_idx].second));
     }
     labelIdxSet_.push_back(rand_class_idx);
-    label.push_back(nrof_image_from_class);
+    counts->push_back(nrof_image_from_class);
   }
   /**************遍历人脸数据集根目录遍历文件夹**********/
+}
+
+template <typename Dtype>
+void ImageDataLayer<Dtype>::start_next_reads() {
+  choose_batch_files(&next_files_, &next_label_);
+  next_images_.clear();
+  next_images_.resize(next_files_.size());
+  load_pool_->Start(next_files_.size(),
+      boost::bind(&ImageDataLayer<Dtype>::read_next_image, this, _1, _2));
+}
+
+// This function is called on the workers of load_pool_
+template <typename Dtype>
+void ImageDataLayer<Dtype>::read_next_image(int item_id, int worker_id) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  next_images_[item_id] = ReadImageToCVMat(next_files_[item_id].first,
+      image_data_param.new_height(), image_data_param.new_width(),
+      image_data_param.is_color());
+}
+
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void ImageDataLayer<Dtype>::load_batch(pairBatch<Dtype>* batch) {
+  CPUTimer batch_timer;
+  batch_timer.Start();
+  double read_time = 0;
+  double trans_time = 0;
+  CPUTimer timer;
+  CHECK(batch->data_.count());
+  CHECK(this->transformed_data_.count());
+  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
+  const int batch_size = image_data_param.batch_size();
+  const int new_height = image_data_param.new_height();
+  const int new_width = image_data_param.new_width();
+  const bool is_color = image_data_param.is_color();
+  string root_folder = image_data_param.root_folder();
+
+  if (load_pool_) {
+    // The images of this batch were read while the previous batch was
+    // transformed, except for the first batch. Start reading the next batch
+    // before transforming this one.
+    if (next_files_.empty()) {
+      start_next_reads();
+    }
+    timer.Start();
+    load_pool_->Wait();
+    read_time += timer.MicroSeconds();
+    choosedImagefile_.swap(next_files_);
+    label.swap(next_label_);
+    batch_images_.swap(next_images_);
+    start_next_reads();
+  } else {
+    choose_batch_files(&choosedImagefile_, &label);
+    batch_images_.resize(batch_size);
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      timer.Start();
+      batch_images_[item_id] = ReadImageToCVMat(
+          choosedImagefile_[item_id].first, new_height, new_width, is_color);
+      read_time += timer.MicroSeconds();
+    }
+  }
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    CHECK(batch_images_[item_id].data) << "Could not load "
+        << choosedImagefile_[item_id].first;
+  }
 
   // Reshape according to the first image of each batch
   // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(choosedImagefile_[lines_id_].first,
-      new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << choosedImagefile_[lines_id_].first;
   // Use data_transformer to infer the expected blob shape from a cv_img.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
+  vector<int> top_shape =
+      this->data_transformer_->InferBlobShape(batch_images_[lines_id_]);
   this->transformed_data_.Reshape(top_shape);
   // Reshape batch according to the batch_size.
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
 
-  label_num_ = labelIdxSet_.size();
+  label_num_ = label.size();
   vector<int> label_shape(1, label_num_);
   batch->label_.Reshape(label_shape);
 
@@ -276,11 +336,7 @@ void ImageDataLayer<Dtype>::load_batch(pairBatch<Dtype>* batch) {
     float sampleProb = 0.0f;
     caffe_rng_uniform(1, 0.0f, 1.0f, &sampleProb);
     // get a blob
-    timer.Start();
-    cv::Mat cv_img = ReadImageToCVMat(choosedImagefile_[item_id].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << choosedImagefile_[item_id].first;
-    read_time += timer.MicroSeconds();
+    cv::Mat& cv_img = batch_images_[item_id];
     timer.Start();
     if(sampleProb > problity_){ 
       // Apply transformations (mirror, crop...) to the image
@@ -6,6 +6,8 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/reid_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/worker_pool.hpp"
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 namespace caffe {
@@ -74,11 +76,24 @@ void ReidDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   CHECK_GT(lines_.size(), 0);
 
+  const int load_threads = this->layer_param_.reid_data_param().load_threads();
+  CHECK_GT(load_threads, 0);
+  if (load_threads > 1) {
+    LOG(INFO) << "Loading images with " << load_threads << " threads.";
+    load_pool_.reset(new WorkerPool(load_threads));
+  }
   this->cv_imgs_.clear();
+  this->cv_imgs_.resize(this->lines_.size());
+  if (load_pool_) {
+    load_pool_->Run(this->lines_.size(),
+        boost::bind(&ReidDataLayer<Dtype>::read_image, this, _1, _2));
+  } else {
+    for (size_t lines_id_ = 0; lines_id_ < this->lines_.size(); lines_id_++) {
+      read_image(lines_id_, 0);
+    }
+  }
   for (size_t lines_id_ = 0; lines_id_ < this->lines_.size(); lines_id_++) {
-    cv::Mat cv_img = ReadImageToCVMat(lines_[lines_id_].first, new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    this->cv_imgs_.push_back(cv_img);
+    CHECK(this->cv_imgs_[lines_id_].data) << "Could not load " << lines_[lines_id_].first;
   }
   // Read an image, and use it to initialize the top blob.
   cv::Mat cv_img = ReadImageToCVMat(lines_[0].first,
@@ -91,6 +106,13 @@ void ReidDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
   vector<int> prefetch_top_shape = top_shape;
   this->transformed_data_.Reshape(top_shape);
+  for (int i = 0; load_pool_ && i < load_pool_->size(); ++i) {
+    worker_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+    worker_transformers_[i]->InitRand();
+    worker_transformed_data_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>(top_shape)));
+  }
   // Reshape top[0] and prefetch_data according to the batch_size.
   top_shape[0] = batch_size * 2;
   prefetch_top_shape[0] = batch_size;
@@ -119,12 +141,42 @@ void ReidDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void ReidDataLayer<Dtype>::read_image(int item_id, int worker_id) {
+  const ReidDataParameter& reid_data_param = this->layer_param_.reid_data_param();
+  this->cv_imgs_[item_id] = ReadImageToCVMat(lines_[item_id].first,
+      reid_data_param.new_height(), reid_data_param.new_width(),
+      reid_data_param.is_color());
+}
+
+// This function is called on prefetch thread, or on a worker of load_pool_
+template <typename Dtype>
+void ReidDataLayer<Dtype>::transform_item(int item_id, int worker_id) {
+  DataTransformer<Dtype>* data_transformer = this->data_transformer_.get();
+  Blob<Dtype>* transformed_data = &this->transformed_data_;
+  if (load_pool_) {
+    data_transformer = worker_transformers_[worker_id].get();
+    transformed_data = worker_transformed_data_[worker_id].get();
+  }
+  const size_t true_idx = loading_ids_[item_id];
+  const size_t pair_idx = loading_pairs_[item_id];
+  const cv::Mat& cv_img_true = this->cv_imgs_[ true_idx ];
+  const cv::Mat& cv_img_pair = this->cv_imgs_[ pair_idx ];
+  const int t_offset = loading_batch_->data_.offset(item_id);
+  transformed_data->set_cpu_data(loading_data_ + t_offset);
+  data_transformer->Transform(cv_img_true, transformed_data);
+
+  // Pair Data
+  const int p_offset = loading_batch_->datap_.offset(item_id);
+  transformed_data->set_cpu_data(loading_datap_ + p_offset);
+  data_transformer->Transform(cv_img_pair, transformed_data);
+}
+
 // This function is called on prefetch thread
 template<typename Dtype>
 void ReidDataLayer<Dtype>::load_batch(ReidBatch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
-  double read_time = 0;
   double trans_time = 0;
   CPUTimer timer;
   CHECK(batch->data_.count());
@@ -147,33 +199,32 @@ void ReidDataLayer<Dtype>::load_batch(ReidBatch<Dtype>* batch) {
   batch->data_.Reshape(top_shape);
   batch->datap_.Reshape(top_shape);
 
-  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
-  Dtype* prefetch_datap = batch->datap_.mutable_cpu_data();
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
   Dtype* prefetch_labelp = batch->labelp_.mutable_cpu_data();
+  for (int i = 0; i < worker_transformed_data_.size(); ++i) {
+    worker_transformed_data_[i]->ReshapeLike(this->transformed_data_);
+  }
+
+  // Apply transformations (mirror, crop...) to the images
+  timer.Start();
+  loading_batch_ = batch;
+  loading_data_ = batch->data_.mutable_cpu_data();
+  loading_datap_ = batch->datap_.mutable_cpu_data();
+  loading_ids_ = batches;
+  loading_pairs_ = batches_pair;
+  if (load_pool_) {
+    load_pool_->Run(batch_size,
+        boost::bind(&ReidDataLayer<Dtype>::transform_item, this, _1, _2));
+  } else {
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      transform_item(item_id, 0);
+    }
+  }
+  trans_time += timer.MicroSeconds();
 
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
     const size_t true_idx = batches[item_id];
     const size_t pair_idx = batches_pair[item_id];
-    cv::Mat cv_img_true = this->cv_imgs_[ true_idx ];
-    cv::Mat cv_img_pair = this->cv_imgs_[ pair_idx ];
-    CHECK(cv_img_true.data) << "Could not load " << this->lines_[true_idx].first;
-    CHECK(cv_img_pair.data) << "Could not load " << this->lines_[pair_idx].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    const int t_offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + t_offset);
-    this->data_transformer_->Transform(cv_img_true, &(this->transformed_data_));
-
-    // Pair Data
-    const int p_offset = batch->datap_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_datap + p_offset);
-    this->data_transformer_->Transform(cv_img_pair, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
     CHECK_GE(lines_[true_idx].second, 0);
     CHECK_GE(lines_[pair_idx].second, 0);
     CHECK_LT(lines_[true_idx].second, this->label_set.size());
@@ -186,7 +237,6 @@ void ReidDataLayer<Dtype>::load_batch(ReidBatch<Dtype>* batch) {
   batch_timer.Stop();
   DLOG(INFO) << "Pair Idx : (" << batches[0] << "," << batches_pair[0] << ")";
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
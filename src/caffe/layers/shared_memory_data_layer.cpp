@@ -0,0 +1,107 @@
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/thread.hpp"
+
+#include "caffe/layers/shared_memory_data_layer.hpp"
+
+namespace caffe {
+
+// Solvers build their nets one after the other, so the layers reading the
+// same ring are numbered in solver order.
+static boost::mutex ring_ranks_mutex_;
+static map<const string, int> ring_ranks_;
+
+static int next_ring_rank(const LayerParameter& param) {
+  boost::mutex::scoped_lock lock(ring_ranks_mutex_);
+  int& count = ring_ranks_[param.name() + ":" +
+      param.shared_memory_data_param().name()];
+  return count++ % Caffe::solver_count();
+}
+
+template <typename Dtype>
+SharedMemoryDataLayer<Dtype>::~SharedMemoryDataLayer() {
+  this->StopInternalThread();
+}
+
+template <typename Dtype>
+void SharedMemoryDataLayer<Dtype>::DataLayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const SharedMemoryDataParameter& param =
+      this->layer_param_.shared_memory_data_param();
+  CHECK(param.has_name()) << "shared_memory_data_param.name is required.";
+  solver_count_ = this->phase_ == TRAIN ? Caffe::solver_count() : 1;
+  rank_ = solver_count_ > 1 ? next_ring_rank(this->layer_param_) : 0;
+  OpenRing();
+  CHECK_EQ(ring_->num_tops(), top.size()) << "The feeder of " << param.name()
+      << " publishes " << ring_->num_tops() << " tops.";
+  for (int i = 0; i < top.size(); ++i) {
+    top[i]->Reshape(ring_->shape(i));
+    for (int j = 0; j < this->prefetch_.size(); ++j) {
+      Blob<Dtype>& blob = i == 0 ? this->prefetch_[j]->data_ :
+          this->prefetch_[j]->label_;
+      blob.Reshape(ring_->shape(i));
+    }
+    LOG(INFO) << "output " << i << " shape: " << top[i]->shape_string();
+  }
+}
+
+template <typename Dtype>
+void SharedMemoryDataLayer<Dtype>::OpenRing() {
+  const SharedMemoryDataParameter& param =
+      this->layer_param_.shared_memory_data_param();
+  ring_.reset(ShmBatchRing::Open(param.name(), param.timeout() * 1000));
+  ring_->ShareReads(rank_, solver_count_);
+}
+
+// Converts the floats of a slot to the type of the batch.
+template <typename Dtype>
+static void copy_slot(const float* slot, const int count, Dtype* data) {
+  for (int i = 0; i < count; ++i) {
+    data[i] = slot[i];
+  }
+}
+
+template <>
+void copy_slot<float>(const float* slot, const int count, float* data) {
+  memcpy(data, slot, count * sizeof(float));
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void SharedMemoryDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+  do {
+    const float* slot;
+    while (!(slot = ring_->BeginRead(100))) {
+      boost::this_thread::interruption_point();
+      if (ring_->stopped()) {
+        const int num_tops = ring_->num_tops();
+        LOG(WARNING) << "The feeder of "
+            << this->layer_param_.shared_memory_data_param().name()
+            << " stopped, waiting for a new one.";
+        OpenRing();
+        CHECK_EQ(ring_->num_tops(), num_tops) << "The new feeder of "
+            << this->layer_param_.shared_memory_data_param().name()
+            << " publishes " << ring_->num_tops() << " tops.";
+      }
+    }
+    for (int i = 0; i < ring_->num_tops(); ++i) {
+      Blob<Dtype>& blob = i == 0 ? batch->data_ : batch->label_;
+      blob.Reshape(ring_->read_shape(i));
+      CHECK_LE(static_cast<uint64_t>(blob.count()), ring_->capacity(i))
+          << "The batch of " << blob.shape_string()
+          << " overflows the slot of top " << i;
+      copy_slot(slot + ring_->offset(i), blob.count(),
+                blob.mutable_cpu_data());
+    }
+    // Read the batch again if the feeder overwrote it meanwhile.
+  } while (!ring_->EndRead());
+}
+
+INSTANTIATE_CLASS(SharedMemoryDataLayer);
+REGISTER_LAYER_CLASS(SharedMemoryData);
+
+}  // namespace caffe
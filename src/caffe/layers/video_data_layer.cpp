@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <algorithm>
+#include <climits>
 #include <csignal>
 #include <map>
 #include <string>
@@ -12,6 +13,7 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/video_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
@@ -37,6 +39,11 @@ void VideoDataLayer<Dtype>::DataLayerSetUp(
   video_type_ = video_data_param.video_type();
   skip_frames_ = video_data_param.skip_frames();
   CHECK_GE(skip_frames_, 0);
+  clip_length_ = video_data_param.clip_length();
+  CHECK_GT(clip_length_, 0);
+  clip_step_ = video_data_param.clip_step() > 0 ? video_data_param.clip_step()
+      : clip_length_ * (skip_frames_ + 1);
+  next_clip_start_ = 0;
 
   // Read an image, and use it to initialize the top blob.
   cv::Mat cv_img;
@@ -49,15 +56,13 @@ void VideoDataLayer<Dtype>::DataLayerSetUp(
   } else if (video_type_ == VideoDataParameter_VideoType_VIDEO) {
     CHECK(video_data_param.has_video_file()) << "Must provide video file!";
     const string& video_file = video_data_param.video_file();
-    if (!cap_.open(video_file)) {
-      LOG(FATAL) << "Failed to open video: " << video_file;
-    }
-    total_frames_ = cap_.get(CV_CAP_PROP_FRAME_COUNT);
-    processed_frames_ = 0;
-    // Read image to infer shape.
-    cap_ >> cv_img;
-    // Set index back to the first frame.
-    cap_.set(CV_CAP_PROP_POS_FRAMES, 0);
+    frame_source_.reset(new VideoFrameSource(video_file,
+        video_data_param.decode_threads(), video_data_param.decode_window()));
+    LOG(INFO) << "Video " << video_file << ": "
+        << frame_source_->total_frames() << " frames at "
+        << frame_source_->fps() << " fps";
+    // Read image to infer shape. The clips start from the first frame.
+    frame_source_->GetFrame(0, &cv_img);
   } else {
     LOG(FATAL) << "Unknow video type!";
   }
@@ -65,22 +70,62 @@ void VideoDataLayer<Dtype>::DataLayerSetUp(
   // Use data_transformer to infer the expected blob shape from a cv_image.
   top_shape_ = this->data_transformer_->InferBlobShape(cv_img);
   this->transformed_data_.Reshape(top_shape_);
+  frame_data_.Reshape(top_shape_);
+  if (clip_length_ > 1) {
+    top_shape_.insert(top_shape_.begin() + 2, clip_length_);
+  }
   top_shape_[0] = batch_size;
   top[0]->Reshape(top_shape_);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].data_.Reshape(top_shape_);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape_);
   }
-  LOG(INFO) << "output data size: " << top[0]->num() << ","
-      << top[0]->channels() << "," << top[0]->height() << ","
-      << top[0]->width();
+  LOG(INFO) << "output data size: " << top[0]->shape_string();
   // label
   if (this->output_labels_) {
     vector<int> label_shape(1, batch_size);
     top[1]->Reshape(label_shape);
-    for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-      this->prefetch_[i].label_.Reshape(label_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.Reshape(label_shape);
+    }
+  }
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void VideoDataLayer<Dtype>::ReadClip(vector<cv::Mat>* clip) {
+  const int frame_step = skip_frames_ + 1;
+  clip->resize(clip_length_);
+  if (video_type_ == VideoDataParameter_VideoType_WEBCAM) {
+    for (int t = 0; t < clip_length_; ++t) {
+      // Drop the skipped frames, keep the next one.
+      for (int i = 0; i < frame_step; ++i) {
+        cap_ >> (*clip)[t];
+      }
+      CHECK((*clip)[t].data) << "Could not load image!";
+    }
+    return;
+  }
+  CHECK_EQ(video_type_, VideoDataParameter_VideoType_VIDEO)
+      << "Unknown video type.";
+  for (;;) {
+    int t = 0;
+    while (t < clip_length_ && frame_source_->GetFrame(
+        next_clip_start_ + t * frame_step, &(*clip)[t])) {
+      ++t;
+    }
+    if (t == clip_length_) {
+      break;
     }
+    CHECK_GT(next_clip_start_, 0) << "The video is shorter than a clip.";
+    LOG(INFO) << "Finished processing video.";
+    raise(SIGINT);
+    // Start over, until the signal handler stops the solver.
+    frame_source_->Release(INT_MAX);
+    next_clip_start_ = 0;
   }
+  next_clip_start_ += clip_step_;
+  // The frames before the next clip are not needed anymore.
+  frame_source_->Release(next_clip_start_);
 }
 
 // This function is called on prefetch thread
@@ -94,12 +139,8 @@ void VideoDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
 
-  // Reshape according to the first anno_datum of each batch
-  // on single input batches allows for inputs of varying dimension.
-  const int batch_size = this->layer_param_.data_param().batch_size();
-  top_shape_[0] = 1;
-  this->transformed_data_.Reshape(top_shape_);
   // Reshape batch according to the batch_size.
+  const int batch_size = this->layer_param_.data_param().batch_size();
   top_shape_[0] = batch_size;
   batch->data_.Reshape(top_shape_);
 
@@ -109,43 +150,33 @@ void VideoDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
     top_label = batch->label_.mutable_cpu_data();
   }
 
-  int skip_frames = skip_frames_;
+  const int channels = frame_data_.channels();
+  const int frame_size = frame_data_.height() * frame_data_.width();
+  vector<cv::Mat> clip;
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     timer.Start();
-    cv::Mat cv_img;
-    if (video_type_ == VideoDataParameter_VideoType_WEBCAM) {
-      cap_ >> cv_img;
-    } else if (video_type_ == VideoDataParameter_VideoType_VIDEO) {
-      if (processed_frames_ >= total_frames_) {
-        LOG(INFO) << "Finished processing video.";
-        raise(SIGINT);
-      }
-      ++processed_frames_;
-      cap_ >> cv_img;
-    } else {
-      LOG(FATAL) << "Unknown video type.";
-    }
-    CHECK(cv_img.data) << "Could not load image!";
+    ReadClip(&clip);
     read_time += timer.MicroSeconds();
-    if (skip_frames > 0) {
-      --skip_frames;
-      --item_id;
-    } else {
-      skip_frames = skip_frames_;
-      timer.Start();
+    timer.Start();
+    if (clip_length_ == 1) {
       // Apply transformations (mirror, crop...) to the image
       int offset = batch->data_.offset(item_id);
       this->transformed_data_.set_cpu_data(top_data + offset);
-      this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-      trans_time += timer.MicroSeconds();
+      this->data_transformer_->Transform(clip[0], &(this->transformed_data_));
+    } else {
+      // Draw the same crop and mirror for all the frames, and put each
+      // channel of frame t at (item_id, c, t).
+      const unsigned int seed = caffe_rng_rand();
+      for (int t = 0; t < clip_length_; ++t) {
+        this->data_transformer_->InitRand(seed);
+        this->data_transformer_->Transform(clip[t], &frame_data_);
+        for (int c = 0; c < channels; ++c) {
+          caffe_copy(frame_size, frame_data_.cpu_data() + c * frame_size,
+              top_data + ((item_id * channels + c) * clip_length_ + t) *
+              frame_size);
+        }
+      }
     }
-    CHECK(cv_img.data) << "Could not load image!";
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
     trans_time += timer.MicroSeconds();
     if (this->output_labels_) {
       top_label[item_id] = 0;
@@ -156,6 +187,10 @@ void VideoDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  if (frame_source_) {
+    DLOG(INFO) << "Decoded frames: " << frame_source_->decoded_frames()
+        << " (" << frame_source_->decode_fps() << " fps per thread).";
+  }
 }
 
 INSTANTIATE_CLASS(VideoDataLayer);
@@ -5,6 +5,7 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "hdf5.h"
 
 #include "caffe/common.hpp"
@@ -12,6 +13,7 @@
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/dag_scheduler.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -280,6 +282,30 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   ShareWeights();
   debug_info_ = param.debug_info();
+  share_activations_ = param.share_activations() && phase_ == TEST;
+  share_diffs_ = param.share_diffs() && phase_ == TRAIN;
+  keep_blobs_.clear();
+  keep_blobs_.insert(param.keep_blob().begin(), param.keep_blob().end());
+  activation_bytes_ = 0;
+  shared_activation_bytes_ = 0;
+  diff_bytes_ = 0;
+  shared_diff_bytes_ = 0;
+  ShareBlobMemory();
+  forward_scheduler_.reset();
+  if (param.forward_threads() > 1 && Caffe::mode() == Caffe::CPU) {
+    // Python layers would run on threads that do not hold the GIL.
+    bool has_python_layer = false;
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      has_python_layer |= string(layers_[layer_id]->type()) == "Python";
+    }
+    if (has_python_layer) {
+      LOG_IF(WARNING, Caffe::root_solver()) << "Ignoring forward_threads: "
+          << "the net has Python layers.";
+    } else {
+      forward_scheduler_.reset(new DagScheduler(param.forward_threads()));
+      PlanForward();
+    }
+  }
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
@@ -544,6 +570,9 @@ template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
+  if (forward_scheduler_ && Caffe::mode() == Caffe::CPU && !debug_info_) {
+    return ParallelForwardFromTo(start, end);
+  }
   Dtype loss = 0;
   for (int i = start; i <= end; ++i) {
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
@@ -553,6 +582,26 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   return loss;
 }
 
+template <typename Dtype>
+Dtype Net<Dtype>::ParallelForwardFromTo(int start, int end) {
+  layer_losses_.assign(layers_.size(), Dtype(0));
+  forward_scheduler_->Run(start, end,
+      boost::bind(&Net<Dtype>::ForwardLayer, this, _1));
+  // Sum in the order of the layers, for the same loss as in sequence.
+  Dtype loss = 0;
+  for (int i = start; i <= end; ++i) {
+    loss += layer_losses_[i];
+  }
+  return loss;
+}
+
+// This function is called on the threads of forward_scheduler_
+template <typename Dtype>
+void Net<Dtype>::ForwardLayer(const int layer_id) {
+  layer_losses_[layer_id] =
+      layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFrom(int start) {
   return ForwardFromTo(start, layers_.size() - 1);
@@ -743,6 +792,263 @@ void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  ShareBlobMemory();
+  if (forward_scheduler_) {
+    PlanForward();
+  }
+}
+
+// Assigns the lifetimes [begin, end] (in layers) to buffers whose lifetimes
+// do not overlap, best fit first, and returns the buffer of each lifetime.
+// buffer_bytes gets the largest bytes of the lifetimes of each buffer.
+static vector<int> PlanBuffers(const vector<int>& begin, const vector<int>& end,
+    const vector<size_t>& bytes, vector<size_t>* buffer_bytes) {
+  vector<pair<int, int> > order;
+  for (int i = 0; i < begin.size(); ++i) {
+    order.push_back(std::make_pair(begin[i], i));
+  }
+  std::sort(order.begin(), order.end());
+  vector<int> buffer(begin.size(), -1);
+  vector<int> buffer_end;
+  buffer_bytes->clear();
+  for (int k = 0; k < order.size(); ++k) {
+    const int i = order[k].second;
+    // The smallest free buffer large enough, else the largest free one.
+    int best = -1;
+    for (int j = 0; j < buffer_end.size(); ++j) {
+      if (buffer_end[j] >= begin[i]) {
+        continue;
+      }
+      if (best < 0) {
+        best = j;
+        continue;
+      }
+      const size_t best_bytes = (*buffer_bytes)[best];
+      const size_t j_bytes = (*buffer_bytes)[j];
+      if (j_bytes >= bytes[i] ? best_bytes < bytes[i] || j_bytes < best_bytes
+                              : best_bytes < bytes[i] && j_bytes > best_bytes) {
+        best = j;
+      }
+    }
+    if (best < 0) {
+      best = buffer_end.size();
+      buffer_end.push_back(0);
+      buffer_bytes->push_back(0);
+    }
+    buffer[i] = best;
+    buffer_end[best] = end[i];
+    (*buffer_bytes)[best] = std::max((*buffer_bytes)[best], bytes[i]);
+  }
+  return buffer;
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareBlobMemory(const bool diff, size_t* bytes,
+    size_t* shared_bytes) {
+  // A blob lives from the first layer computing it to the last layer using
+  // it, and its diff over the same layers in Backward. The tops sharing the
+  // data (diff) of their first bottom, or of the layers that may share it in
+  // Forward (Backward), have no memory of their own: they extend the
+  // lifetime of the blob owning the memory. A Permute only shares it when
+  // its order keeps the axes in place, so its top, and the tops sharing its
+  // memory, keep their own memory unless it already is that of its bottom.
+  const int num_blobs = blobs_.size();
+  vector<int> owner(num_blobs);
+  vector<bool> follows_owner(num_blobs, true);
+  vector<int> begin(num_blobs, -1);
+  vector<int> end(num_blobs, -1);
+  vector<bool> keep(num_blobs, false);
+  // The loss layers may compute the diffs of their bottoms in Forward, and
+  // keep them until their Backward.
+  vector<bool> diff_from_forward(num_blobs, false);
+  // The diffs of the blobs that no layer propagates down to are unused.
+  vector<bool> used(num_blobs, !diff);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    owner[blob_id] = blob_id;
+    keep[blob_id] = keep_blobs_.count(blob_names_[blob_id]) > 0 ||
+        (diff && blob_loss_weights_[blob_id] != Dtype(0));
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    keep[net_output_blob_indices_[i]] = true;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const string type = layers_[layer_id]->type();
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const bool shares_bottom = type == "Flatten" || type == "Reshape" ||
+        (!diff && type == "Split");
+    bool has_loss = false;
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      has_loss = has_loss ||
+          blob_loss_weights_[top_id_vecs_[layer_id][i]] != Dtype(0);
+    }
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      end[owner[bottom_ids[i]]] = layer_id;
+      if (diff && bottom_need_backward_[layer_id][i]) {
+        used[owner[bottom_ids[i]]] = true;
+        diff_from_forward[owner[bottom_ids[i]]] =
+            diff_from_forward[owner[bottom_ids[i]]] || has_loss;
+      }
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = top_id_vecs_[layer_id][i];
+      if (!bottom_ids.empty() && blob_id != bottom_ids[0]) {
+        const Blob<Dtype>& top = *blobs_[blob_id];
+        const Blob<Dtype>& bottom = *blobs_[bottom_ids[0]];
+        const bool same_memory = top.count() > 0 && bottom.count() > 0 &&
+            (diff ? top.diff() == bottom.diff() : top.data() == bottom.data());
+        if (shares_bottom || same_memory || type == "Permute") {
+          owner[blob_id] = owner[bottom_ids[0]];
+          follows_owner[blob_id] = (shares_bottom || same_memory) &&
+              follows_owner[bottom_ids[0]];
+        }
+      }
+      const int owner_id = owner[blob_id];
+      if (begin[owner_id] < 0) {
+        begin[owner_id] = layer_id;
+      }
+      end[owner_id] = layer_id;
+      // The tops of data and input layers are filled outside of Forward.
+      keep[owner_id] = keep[owner_id] || bottom_ids.empty();
+    }
+  }
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    keep[owner[blob_id]] = keep[owner[blob_id]] || keep[blob_id];
+    // Live from the Forward of the loss to its Backward.
+    if (diff_from_forward[blob_id]) {
+      end[blob_id] = layers_.size() - 1;
+    }
+  }
+  *bytes = 0;
+  size_t kept_bytes = 0;
+  vector<int> shared_ids, shared_begin, shared_end;
+  vector<size_t> shared_blob_bytes;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    const size_t blob_bytes = blobs_[blob_id]->count() * sizeof(Dtype);
+    if (owner[blob_id] != blob_id || !used[blob_id]) {
+      continue;
+    }
+    *bytes += blob_bytes;
+    if (keep[blob_id] || blob_bytes == 0) {
+      kept_bytes += blob_bytes;
+    } else {
+      shared_ids.push_back(blob_id);
+      shared_begin.push_back(begin[blob_id]);
+      shared_end.push_back(end[blob_id]);
+      shared_blob_bytes.push_back(blob_bytes);
+    }
+  }
+  vector<size_t> buffer_bytes;
+  const vector<int> buffer =
+      PlanBuffers(shared_begin, shared_end, shared_blob_bytes, &buffer_bytes);
+  vector<shared_ptr<SyncedMemory> > buffers;
+  *shared_bytes = kept_bytes;
+  for (int j = 0; j < buffer_bytes.size(); ++j) {
+    buffers.push_back(shared_ptr<SyncedMemory>(
+        new SyncedMemory(buffer_bytes[j])));
+    *shared_bytes += buffer_bytes[j];
+  }
+  for (int i = 0; i < shared_ids.size(); ++i) {
+    // The tops sharing the memory follow it to the buffer, including those
+    // which only share it once their layers run.
+    for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+      Blob<Dtype>* sharer = blobs_[blob_id].get();
+      if (owner[blob_id] != shared_ids[i] || !follows_owner[blob_id] ||
+          sharer->count() == 0) {
+        continue;
+      }
+      if (diff) {
+        sharer->set_diff(buffers[buffer[i]]);
+      } else {
+        sharer->set_data(buffers[buffer[i]]);
+      }
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Sharing " << (diff ? "diffs" :
+      "activations") << ": " << *bytes << " bytes of tops use "
+      << *shared_bytes << " bytes, " << shared_ids.size() << " tops in "
+      << buffers.size() << " buffers";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareBlobMemory() {
+  if (share_activations_) {
+    ShareBlobMemory(false, &activation_bytes_, &shared_activation_bytes_);
+  }
+  if (share_diffs_) {
+    ShareBlobMemory(true, &diff_bytes_, &shared_diff_bytes_);
+  }
+}
+
+// The root of the blobs sharing the memory of blob_id.
+static int MemoryRoot(vector<int>* parent, int blob_id) {
+  while ((*parent)[blob_id] != blob_id) {
+    blob_id = (*parent)[blob_id] = (*parent)[(*parent)[blob_id]];
+  }
+  return blob_id;
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanForward() {
+  // Group the blobs sharing memory: the tops that share the data of their
+  // bottom in Forward, and the blobs with the same memory, as the tops of
+  // share_activations.
+  const int num_blobs = blobs_.size();
+  vector<int> parent(num_blobs);
+  map<const SyncedMemory*, int> memory_blob;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    parent[blob_id] = blob_id;
+    if (blobs_[blob_id]->count() > 0) {
+      const SyncedMemory* memory = blobs_[blob_id]->data().get();
+      if (memory_blob.count(memory)) {
+        parent[blob_id] = MemoryRoot(&parent, memory_blob[memory]);
+      } else {
+        memory_blob[memory] = blob_id;
+      }
+    }
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const string type = layers_[layer_id]->type();
+    if (bottom_id_vecs_[layer_id].empty() || (type != "Split" &&
+        type != "Flatten" && type != "Reshape" && type != "Permute")) {
+      continue;
+    }
+    const int bottom_root = MemoryRoot(&parent, bottom_id_vecs_[layer_id][0]);
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      parent[MemoryRoot(&parent, top_id_vecs_[layer_id][i])] = bottom_root;
+    }
+  }
+  // A layer runs after the last layer writing the memory it reads or
+  // writes, and after the layers reading the memory it writes since then.
+  vector<int> last_writer(num_blobs, -1);
+  vector<vector<int> > readers(num_blobs);
+  vector<vector<int> > predecessors(layers_.size());
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    set<int> layer_predecessors;
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      const int root = MemoryRoot(&parent, bottom_ids[i]);
+      layer_predecessors.insert(last_writer[root]);
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      const int root = MemoryRoot(&parent, top_ids[i]);
+      layer_predecessors.insert(last_writer[root]);
+      layer_predecessors.insert(readers[root].begin(), readers[root].end());
+    }
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      readers[MemoryRoot(&parent, bottom_ids[i])].push_back(layer_id);
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      const int root = MemoryRoot(&parent, top_ids[i]);
+      last_writer[root] = layer_id;
+      readers[root].clear();
+    }
+    layer_predecessors.erase(-1);
+    layer_predecessors.erase(layer_id);
+    predecessors[layer_id].assign(layer_predecessors.begin(),
+                                  layer_predecessors.end());
+  }
+  forward_scheduler_->SetGraph(predecessors);
 }
 
 template <typename Dtype>
@@ -803,6 +1109,7 @@ void Net<Dtype>::CopyTrainedLayersFromBinaryProto(
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY,
                            H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
@@ -865,6 +1172,7 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_hid = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
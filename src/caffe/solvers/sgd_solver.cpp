@@ -317,6 +317,7 @@ void SGDSolver<Dtype>::SnapshotSolverStateToHDF5(
     string snapshot_filename =
         Solver<Dtype>::SnapshotFilename(".solverstate.h5");
     LOG(INFO) << "Snapshotting solver state to HDF5 file " << snapshot_filename;
+    boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
     hid_t file_hid = H5Fcreate(snapshot_filename.c_str(), H5F_ACC_TRUNC,
         H5P_DEFAULT, H5P_DEFAULT);
     CHECK_GE(file_hid, 0)
@@ -366,6 +367,7 @@ void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(
 
 template <typename Dtype>
 void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
+    boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
     hid_t file_hid = H5Fopen(state_file.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
     CHECK_GE(file_hid, 0) << "Couldn't open solver state file " << state_file;
     this->iter_ = hdf5_load_int(file_hid, "iter");
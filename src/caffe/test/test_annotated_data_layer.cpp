@@ -135,13 +135,14 @@ class AnnotatedDataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int transform_threads = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(num_);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_transform_threads(transform_threads);
 
     const Dtype scale = 3;
     TransformationParameter* transform_param =
@@ -368,6 +369,75 @@ class AnnotatedDataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Alternates portrait (2:1) and landscape (1:2) images, the pixels of
+  // image i being all i, and checks that the batches only hold one of them.
+  void TestReadBucket(DataParameter_DB backend) {
+    GetTempDirname(filename_.get());
+    scoped_ptr<db::DB> db(db::GetDB(backend));
+    db->Open(*filename_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    const int num_images = 12;
+    for (int i = 0; i < num_images; ++i) {
+      AnnotatedDatum anno_datum;
+      const bool portrait = i % 2 == 0;
+      cv::Mat image(portrait ? 12 : 6, portrait ? 6 : 12, CV_8UC3,
+                    cv::Scalar(i, i, i));
+      EncodeCVMatToDatum(image, "png", anno_datum.mutable_datum());
+      anno_datum.mutable_datum()->set_label(i);
+      stringstream ss;
+      ss << i;
+      string out;
+      CHECK(anno_datum.SerializeToString(&out));
+      txn->Put(ss.str(), out);
+    }
+    txn->Commit();
+    db->Close();
+
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    const int batch_size = 3;
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend);
+    ResizeParameter* resize_param =
+        param.mutable_transform_param()->mutable_resize_param();
+    resize_param->set_resize_mode(ResizeParameter_Resize_mode_FIT_SMALL_SIZE);
+    resize_param->set_height(4);
+    resize_param->set_width(4);
+    AnnotatedDataParameter* anno_data_param =
+        param.mutable_annotated_data_param();
+    anno_data_param->add_bucket_aspect_ratio(0.5);
+    anno_data_param->add_bucket_aspect_ratio(1);
+    anno_data_param->add_bucket_aspect_ratio(2);
+
+    AnnotatedDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), batch_size);
+    EXPECT_EQ(blob_top_data_->channels(), 3);
+    EXPECT_EQ(blob_top_data_->height(), 8);
+    EXPECT_EQ(blob_top_data_->width(), 4);
+    // Images 0, 2, 4 fill the portrait bucket first, then 1, 3, 5 the
+    // landscape one, and so on.
+    for (int iter = 0; iter < 4; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      const bool portrait = iter % 2 == 0;
+      EXPECT_EQ(blob_top_data_->num(), batch_size);
+      EXPECT_EQ(blob_top_data_->height(), portrait ? 8 : 4);
+      EXPECT_EQ(blob_top_data_->width(), portrait ? 4 : 8);
+      const int first_image = (iter / 2) * 2 * batch_size + iter % 2;
+      const int item_size = blob_top_data_->count(1);
+      for (int i = 0; i < batch_size; ++i) {
+        const int image = first_image + 2 * i;
+        EXPECT_EQ(image, blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < item_size; ++j) {
+          EXPECT_EQ(image, blob_top_data_->cpu_data()[i * item_size + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
   void TestReadCrop(Phase phase) {
     const Dtype scale = 3;
     LayerParameter param;
@@ -668,6 +738,20 @@ TYPED_TEST(AnnotatedDataLayerTest, TestReadLMDB) {
   }
 }
 
+TYPED_TEST(AnnotatedDataLayerTest, TestReadMultiThreadLMDB) {
+  const AnnotatedDatum_AnnotationType type = AnnotatedDatum_AnnotationType_BBOX;
+  const int transform_threads = 4;
+  for (int p = 0; p < kNumChoices; ++p) {
+    bool unique_pixel = kBoolChoices[p];
+    for (int a = 0; a < kNumChoices; ++a) {
+      bool unique_annotation = kBoolChoices[a];
+      this->Fill(DataParameter_DB_LMDB, unique_pixel, unique_annotation,
+                 true, type);
+      this->TestRead(transform_threads);
+    }
+  }
+}
+
 TYPED_TEST(AnnotatedDataLayerTest, TestReshapeLMDB) {
   const AnnotatedDatum_AnnotationType type = AnnotatedDatum_AnnotationType_BBOX;
   for (int p = 0; p < kNumChoices; ++p) {
@@ -686,6 +770,10 @@ TYPED_TEST(AnnotatedDataLayerTest, TestReshapeLMDB) {
   }
 }
 
+TYPED_TEST(AnnotatedDataLayerTest, TestReadBucketLMDB) {
+  this->TestReadBucket(DataParameter_DB_LMDB);
+}
+
 TYPED_TEST(AnnotatedDataLayerTest, TestReadCropTrainLMDB) {
   const bool unique_pixel = true;  // all pixels the same; images different
   const bool unique_annotation = false;  // all anno the same; groups different
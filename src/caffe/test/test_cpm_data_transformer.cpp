@@ -0,0 +1,399 @@
+#ifdef USE_OPENCV
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/cpm_data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class CPMDataTransformerTest : public ::testing::Test {
+ protected:
+  typedef typename CPMDataTransformer<Dtype>::Joints Joints;
+  typedef typename CPMDataTransformer<Dtype>::MetaData MetaData;
+
+  CPMDataTransformerTest()
+      : stride_(8), sigma_(7), width_(184), height_(152) {}
+
+  // Joints anywhere over the image and a margin around it.
+  Joints RandomJoints(int num_joints) {
+    vector<float> x(num_joints), y(num_joints), visible(num_joints);
+    caffe_rng_uniform<float>(num_joints, -40, width_ + 40, &x[0]);
+    caffe_rng_uniform<float>(num_joints, -40, height_ + 40, &y[0]);
+    caffe_rng_uniform<float>(num_joints, 0, 3, &visible[0]);
+    Joints joints;
+    for (int i = 0; i < num_joints; ++i) {
+      joints.joints.push_back(Point2f(x[i], y[i]));
+      joints.isVisible.push_back(floor(visible[i]));
+    }
+    return joints;
+  }
+
+  // A person with joints on the corners of the image, across its border
+  // and far out of it, and a limb of no length (joints 5 and 6).
+  MetaData RandomMeta(int num_joints) {
+    MetaData meta;
+    meta.joint_self = RandomJoints(num_joints);
+    Joints& self = meta.joint_self;
+    self.joints[0] = Point2f(0, 0);
+    self.joints[1] = Point2f(width_ - 1, height_ - 1);
+    self.joints[2] = Point2f(-12, height_ / 2);
+    self.joints[3] = Point2f(width_ + 100, -100);
+    self.joints[6] = self.joints[5];
+    for (int i = 0; i < 7; ++i) {
+      self.isVisible[i] = 1;
+    }
+    meta.numOtherPeople = 2;
+    for (int j = 0; j < meta.numOtherPeople; ++j) {
+      meta.joint_others.push_back(RandomJoints(num_joints));
+    }
+    return meta;
+  }
+
+  // The heatmap and field loops that generateLabelMap used to run over the
+  // whole grid.
+  void ReferenceGaussianMaps(Dtype* entry, Point2f center, int grid_x,
+      int grid_y) {
+    float start = stride_ / 2.0 - 0.5;
+    for (int g_y = 0; g_y < grid_y; g_y++) {
+      for (int g_x = 0; g_x < grid_x; g_x++) {
+        float x = start + g_x * stride_;
+        float y = start + g_y * stride_;
+        float d2 = (x - center.x) * (x - center.x) +
+            (y - center.y) * (y - center.y);
+        float exponent = d2 / 2.0 / sigma_ / sigma_;
+        if (exponent > 4.6052) {
+          continue;
+        }
+        entry[g_y * grid_x + g_x] += exp(-exponent);
+        if (entry[g_y * grid_x + g_x] > 1) {
+          entry[g_y * grid_x + g_x] = 1;
+        }
+      }
+    }
+  }
+
+  void ReferenceVecMaps(Dtype* entryX, Dtype* entryY, Mat& count,
+      Point2f centerA, Point2f centerB, int grid_x, int grid_y, int thre) {
+    centerB = centerB * 0.125;
+    centerA = centerA * 0.125;
+    Point2f bc = centerB - centerA;
+    int min_x = std::max(static_cast<int>(
+        round(std::min(centerA.x, centerB.x) - thre)), 0);
+    int max_x = std::min(static_cast<int>(
+        round(std::max(centerA.x, centerB.x) + thre)), grid_x);
+    int min_y = std::max(static_cast<int>(
+        round(std::min(centerA.y, centerB.y) - thre)), 0);
+    int max_y = std::min(static_cast<int>(
+        round(std::max(centerA.y, centerB.y) + thre)), grid_y);
+    float norm_bc = sqrt(bc.x * bc.x + bc.y * bc.y);
+    bc.x = bc.x / norm_bc;
+    bc.y = bc.y / norm_bc;
+    for (int g_y = min_y; g_y < max_y; g_y++) {
+      for (int g_x = min_x; g_x < max_x; g_x++) {
+        Point2f ba;
+        ba.x = g_x - centerA.x;
+        ba.y = g_y - centerA.y;
+        float dist = std::abs(ba.x * bc.y - ba.y * bc.x);
+        if (dist <= thre) {
+          int cnt = count.at<uchar>(g_y, g_x);
+          Dtype* x = entryX + g_y * grid_x + g_x;
+          Dtype* y = entryY + g_y * grid_x + g_x;
+          if (cnt == 0) {
+            *x = bc.x;
+            *y = bc.y;
+          } else {
+            *x = (*x * cnt + bc.x) / (cnt + 1);
+            *y = (*y * cnt + bc.y) / (cnt + 1);
+            count.at<uchar>(g_y, g_x) = cnt + 1;
+          }
+        }
+      }
+    }
+  }
+
+  void ReferenceLabelMap(Dtype* label, int np, int grid_x, int grid_y,
+      const MetaData& meta) {
+    const int channel_offset = grid_y * grid_x;
+    for (int i = np + 1; i < 2 * (np + 1); i++) {
+      caffe_set(channel_offset, Dtype(0), label + i * channel_offset);
+    }
+    vector<int> from, to;
+    int heat_offset, num_joints;
+    if (np == 56) {
+      int mid_1[19] = {2, 9,  10, 2,  12, 13, 2, 3, 4, 3,  2, 6, 7, 6,  2, 1,
+                       1,  15, 16};
+      int mid_2[19] = {9, 10, 11, 12, 13, 14, 3, 4, 5, 17, 6, 7, 8, 18, 1, 15,
+                       16, 17, 18};
+      for (int i = 0; i < 19; i++) {
+        from.push_back(mid_1[i] - 1);
+        to.push_back(mid_2[i] - 1);
+      }
+      heat_offset = np + 39;
+      num_joints = 18;
+    } else {
+      int mid_1[14] = {0, 1, 2, 3, 1, 5, 6, 1, 14, 8, 9,  14, 11, 12};
+      int mid_2[14] = {1, 2, 3, 4, 5, 6, 7, 14, 8, 9, 10, 11, 12, 13};
+      from.assign(mid_1, mid_1 + 14);
+      to.assign(mid_2, mid_2 + 14);
+      heat_offset = np + 29;
+      num_joints = 15;
+    }
+    vector<Joints> people(1, meta.joint_self);
+    people.insert(people.end(), meta.joint_others.begin(),
+        meta.joint_others.end());
+    for (int i = 0; i < num_joints; i++) {
+      for (int j = 0; j < people.size(); j++) {
+        if (people[j].isVisible[i] <= 1) {
+          ReferenceGaussianMaps(label + (i + heat_offset) * channel_offset,
+              people[j].joints[i], grid_x, grid_y);
+        }
+      }
+    }
+    for (int i = 0; i < from.size(); i++) {
+      Mat count = Mat::zeros(grid_y, grid_x, CV_8UC1);
+      for (int j = 0; j < people.size(); j++) {
+        const Joints& jo = people[j];
+        if (jo.isVisible[from[i]] <= 1 && jo.isVisible[to[i]] <= 1) {
+          ReferenceVecMaps(label + (np + 1 + 2 * i) * channel_offset,
+              label + (np + 2 + 2 * i) * channel_offset, count,
+              jo.joints[from[i]], jo.joints[to[i]], grid_x, grid_y, 1);
+        }
+      }
+    }
+    for (int k = 0; k < channel_offset; k++) {
+      float maximum = 0;
+      for (int i = heat_offset; i < heat_offset + num_joints; i++) {
+        maximum = std::max<float>(maximum, label[i * channel_offset + k]);
+      }
+      label[(2 * np + 1) * channel_offset + k] = std::max(1.0 - maximum, 0.0);
+    }
+  }
+
+  // Compares generateLabelMap with the reference loops on random people.
+  void TestLabelMap(int np, int label_threads) {
+    CPMTransformationParameter param;
+    param.set_num_parts(np);
+    param.set_stride(stride_);
+    param.set_sigma(sigma_);
+    param.set_label_threads(label_threads);
+    CPMDataTransformer<Dtype> transformer(param, TRAIN);
+    Mat img_aug(height_, width_, CV_8UC3);
+    const int grid_x = width_ / stride_;
+    const int grid_y = height_ / stride_;
+    const int channel_offset = grid_y * grid_x;
+    const int count = 2 * (np + 1) * channel_offset;
+    const int heat_offset = np == 56 ? np + 39 : np + 29;
+    Caffe::set_random_seed(1701);
+    for (int iter = 0; iter < 5; ++iter) {
+      MetaData meta = RandomMeta(np);
+      // Stale values in every channel, which the mask channels keep.
+      vector<Dtype> label(count);
+      caffe_rng_uniform<Dtype>(count, -1, 1, &label[0]);
+      vector<Dtype> reference(label);
+      transformer.generateLabelMap(&label[0], img_aug, meta);
+      ReferenceLabelMap(&reference[0], np, grid_x, grid_y, meta);
+      for (int i = 0; i < count; ++i) {
+        if (i / channel_offset >= heat_offset) {
+          // The heatmaps and background differ by rounding.
+          EXPECT_NEAR(reference[i], label[i], 1e-5) << "channel "
+              << i / channel_offset << " cell " << i % channel_offset;
+        } else {
+          EXPECT_EQ(reference[i], label[i]) << "channel "
+              << i / channel_offset << " cell " << i % channel_offset;
+        }
+      }
+    }
+  }
+
+  // A smooth image, which the two warps below resample alike.
+  Mat SmoothImage(int rows, int cols, int channels) {
+    Mat img(rows, cols, CV_8UC(channels));
+    for (int y = 0; y < rows; ++y) {
+      for (int x = 0; x < cols; ++x) {
+        for (int c = 0; c < channels; ++c) {
+          img.ptr<uchar>(y)[x * channels + c] = saturate_cast<uchar>(128 +
+              60 * sin(x / (9.0 + c) + c) + 50 * cos(y / (11.0 + 2 * c) - c));
+        }
+      }
+    }
+    return img;
+  }
+
+  // Expects dst to be within tolerance of reference where M maps it at
+  // least 4 pixels inside the source of the given size, away from the
+  // padding and the interpolation at the borders. Returns the number of
+  // pixels compared.
+  int ExpectNearInside(const Mat& reference, const Mat& dst, const Mat& M,
+      Size src_size, int max_error, float mean_error) {
+    EXPECT_EQ(reference.size(), dst.size());
+    EXPECT_EQ(reference.type(), dst.type());
+    Mat M_inv = M.inv();
+    const int channels = dst.channels();
+    int compared = 0;
+    double error = 0;
+    for (int y = 0; y < dst.rows; ++y) {
+      for (int x = 0; x < dst.cols; ++x) {
+        const double* m = M_inv.ptr<double>(0);
+        const double src_x = m[0] * x + m[1] * y + m[2];
+        const double src_y = m[3] * x + m[4] * y + m[5];
+        if (src_x < 4 || src_x > src_size.width - 5 ||
+            src_y < 4 || src_y > src_size.height - 5) {
+          continue;
+        }
+        for (int c = 0; c < channels; ++c) {
+          const int diff = std::abs(reference.ptr<uchar>(y)[x * channels + c]
+              - dst.ptr<uchar>(y)[x * channels + c]);
+          EXPECT_LE(diff, max_error) << "at (" << x << ", " << y << ")";
+          error += diff;
+        }
+        ++compared;
+      }
+    }
+    if (compared) {
+      EXPECT_LE(error / compared / channels, mean_error);
+    }
+    return compared;
+  }
+
+  void ExpectSameJoints(const Joints& expected, const Joints& joints) {
+    EXPECT_EQ(expected.isVisible, joints.isVisible);
+    ASSERT_EQ(expected.joints.size(), joints.joints.size());
+    for (int i = 0; i < joints.joints.size(); ++i) {
+      EXPECT_EQ(expected.joints[i], joints.joints[i]) << "joint " << i;
+    }
+  }
+
+  // Compares the augmentations composed into one matrix, with a single
+  // warp of the image and one of the mask to the label grid, with the
+  // chain of resize, rotation, crop and flip that Transform_nv used to run.
+  void TestComposedWarp(int seed) {
+    CPMTransformationParameter param;
+    const int np = 56;
+    param.set_num_parts(np);
+    param.set_stride(stride_);
+    param.set_crop_size_x(width_);
+    param.set_crop_size_y(height_);
+    param.set_scale_prob(1);
+    param.set_scale_min(0.6);
+    param.set_scale_max(1.3);
+    param.set_target_dist(0.6);
+    param.set_max_rotate_degree(40);
+    param.set_center_perterb_max(20);
+    param.set_flip_prob(0.5);
+    CPMDataTransformer<Dtype> transformer(param, TRAIN);
+    const Size img_size(240, 200);
+    Mat img = SmoothImage(img_size.height, img_size.width, 3);
+    Mat mask = SmoothImage(img_size.height, img_size.width, 1);
+    Caffe::set_random_seed(seed);
+    MetaData meta = RandomMeta(np);
+    vector<float> center(2);
+    caffe_rng_uniform<float>(2, -30, 30, &center[0]);
+    meta.objpos = Point2f(img_size.width / 2 + center[0],
+                          img_size.height / 2 + center[1]);
+    meta.scale_self = 0.6;
+    for (int p = 0; p < meta.numOtherPeople; ++p) {
+      meta.objpos_other.push_back(meta.joint_others[p].joints[0]);
+      meta.scale_other.push_back(0.6);
+    }
+
+    // The chain, on the image and on the mask, with the same draws.
+    MetaData meta_chain = meta;
+    Mat scaled, rotated, cropped, img_chain;
+    srand(seed);
+    const float scale = transformer.augmentation_scale(img, scaled,
+        meta_chain);
+    const float degree = transformer.augmentation_rotate(scaled, rotated,
+        meta_chain);
+    const Size crop = transformer.augmentation_croppad(rotated, cropped,
+        meta_chain);
+    const bool flip = transformer.augmentation_flip(cropped, img_chain,
+        meta_chain);
+    MetaData meta_mask = meta;
+    Mat mask3, mask_chain, grid_chain, grid_reference;
+    cvtColor(mask, mask3, CV_GRAY2BGR);
+    srand(seed);
+    transformer.augmentation_scale(mask3, scaled, meta_mask);
+    transformer.augmentation_rotate(scaled, rotated, meta_mask);
+    transformer.augmentation_croppad(rotated, cropped, meta_mask);
+    transformer.augmentation_flip(cropped, mask_chain, meta_mask);
+    resize(mask_chain, grid_chain, Size(), 1.0 / stride_, 1.0 / stride_,
+        INTER_CUBIC);
+    extractChannel(grid_chain, grid_reference, 0);
+
+    // The composed matrix.
+    MetaData meta_composed = meta;
+    Mat M = Mat::eye(3, 3, CV_64FC1);
+    Size size = img.size();
+    srand(seed);
+    EXPECT_EQ(scale, transformer.augmentation_scale(M, size, meta_composed));
+    EXPECT_EQ(degree,
+        transformer.augmentation_rotate(M, size, meta_composed));
+    EXPECT_EQ(crop, transformer.augmentation_croppad(M, size, meta_composed));
+    EXPECT_EQ(flip, transformer.augmentation_flip(M, size, meta_composed));
+    EXPECT_EQ(img_chain.size(), size);
+    Mat img_composed, mask_composed;
+    warpAffine(img, img_composed, M.rowRange(0, 2), size, INTER_CUBIC,
+        BORDER_CONSTANT, Scalar(128, 128, 128));
+    Mat M_grid = M.clone();
+    Size grid_size = size;
+    transformer.toLabelGrid(M_grid, grid_size);
+    EXPECT_EQ(grid_reference.size(), grid_size);
+    warpAffine(mask, mask_composed, M_grid.rowRange(0, 2), grid_size,
+        INTER_CUBIC, BORDER_CONSTANT, Scalar(255));
+
+    // The joints move the same, the image and mask differ by interpolation.
+    EXPECT_EQ(meta_chain.objpos, meta_composed.objpos);
+    ExpectSameJoints(meta_chain.joint_self, meta_composed.joint_self);
+    for (int p = 0; p < meta.numOtherPeople; ++p) {
+      EXPECT_EQ(meta_chain.objpos_other[p], meta_composed.objpos_other[p]);
+      ExpectSameJoints(meta_chain.joint_others[p],
+          meta_composed.joint_others[p]);
+    }
+    EXPECT_GT(ExpectNearInside(img_chain, img_composed, M, img_size, 8, 2),
+        0);
+    EXPECT_GT(ExpectNearInside(grid_reference, mask_composed, M_grid,
+        img_size, 8, 2), 0);
+  }
+
+  int stride_;
+  float sigma_;
+  int width_;
+  int height_;
+};
+
+TYPED_TEST_CASE(CPMDataTransformerTest, TestDtypes);
+
+TYPED_TEST(CPMDataTransformerTest, TestLabelMap56) {
+  this->TestLabelMap(56, 1);
+}
+
+TYPED_TEST(CPMDataTransformerTest, TestLabelMap56Threaded) {
+  this->TestLabelMap(56, 3);
+}
+
+TYPED_TEST(CPMDataTransformerTest, TestLabelMap43) {
+  this->TestLabelMap(43, 1);
+}
+
+TYPED_TEST(CPMDataTransformerTest, TestLabelMap43Threaded) {
+  this->TestLabelMap(43, 3);
+}
+
+TYPED_TEST(CPMDataTransformerTest, TestComposedWarp) {
+  for (int seed = 1701; seed < 1711; ++seed) {
+    this->TestComposedWarp(seed);
+  }
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -0,0 +1,114 @@
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/dag_scheduler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DagSchedulerTest : public ::testing::Test {
+ protected:
+  // 0 -> {1, 2, 3} -> 4 -> 5, and 6 alone.
+  DagSchedulerTest() : predecessors_(7) {
+    for (int node_id = 1; node_id <= 3; ++node_id) {
+      predecessors_[node_id].push_back(0);
+      predecessors_[4].push_back(node_id);
+    }
+    predecessors_[5].push_back(4);
+  }
+
+  // Records the order in which the nodes run, and checks that their
+  // predecessors in range are done.
+  void Record(int node_id) {
+    boost::mutex::scoped_lock lock(mutex_);
+    for (int i = 0; i < predecessors_[node_id].size(); ++i) {
+      const int predecessor = predecessors_[node_id][i];
+      EXPECT_TRUE(predecessor < begin_ || done_[predecessor]);
+    }
+    EXPECT_FALSE(done_[node_id]);
+    done_[node_id] = true;
+  }
+
+  void RunScheduler(DagScheduler* scheduler, int begin, int end) {
+    begin_ = begin;
+    done_.assign(predecessors_.size(), false);
+    scheduler->Run(begin, end,
+        boost::bind(&DagSchedulerTest::Record, this, _1));
+    for (int node_id = 0; node_id < predecessors_.size(); ++node_id) {
+      const bool in_range = node_id >= begin && node_id <= end;
+      EXPECT_EQ(in_range, done_[node_id]);
+      const DagScheduler::Trace& trace = scheduler->trace()[node_id];
+      if (in_range) {
+        EXPECT_GE(trace.worker_id, 0);
+        EXPECT_LT(trace.worker_id, scheduler->num_workers());
+        EXPECT_LE(trace.start_us, trace.end_us);
+      } else {
+        EXPECT_EQ(-1, trace.worker_id);
+      }
+    }
+  }
+
+  // Waits for the other node of an overlap test to start.
+  void Meet(int node_id) {
+    boost::mutex::scoped_lock lock(mutex_);
+    done_[node_id] = true;
+    meet_condition_.notify_all();
+    const boost::system_time timeout =
+        boost::get_system_time() + boost::posix_time::seconds(10);
+    while (!done_[1 - node_id]) {
+      if (!meet_condition_.timed_wait(lock, timeout)) {
+        return;
+      }
+    }
+  }
+
+  DagScheduler::Task meet_task() {
+    return boost::bind(&DagSchedulerTest::Meet, this, _1);
+  }
+
+  vector<vector<int> > predecessors_;
+  int begin_;
+  vector<bool> done_;
+  boost::mutex mutex_;
+  boost::condition_variable meet_condition_;
+};
+
+TEST_F(DagSchedulerTest, TestDependencies) {
+  const int num_workers[] = {1, 2, 4};
+  for (int i = 0; i < 3; ++i) {
+    DagScheduler scheduler(num_workers[i]);
+    EXPECT_EQ(num_workers[i], scheduler.num_workers());
+    scheduler.SetGraph(predecessors_);
+    for (int run = 0; run < 5; ++run) {
+      RunScheduler(&scheduler, 0, 6);
+    }
+  }
+}
+
+TEST_F(DagSchedulerTest, TestRange) {
+  DagScheduler scheduler(3);
+  scheduler.SetGraph(predecessors_);
+  RunScheduler(&scheduler, 2, 4);
+  RunScheduler(&scheduler, 1, 1);
+  RunScheduler(&scheduler, 4, 6);
+}
+
+TEST_F(DagSchedulerTest, TestOverlap) {
+  // Two independent nodes, each waiting for the other to start.
+  DagScheduler scheduler(2);
+  scheduler.SetGraph(vector<vector<int> >(2));
+  done_.assign(2, false);
+  scheduler.Run(0, 1, meet_task());
+  const DagScheduler::Trace& first = scheduler.trace()[0];
+  const DagScheduler::Trace& second = scheduler.trace()[1];
+  EXPECT_NE(first.worker_id, second.worker_id);
+  EXPECT_LE(first.start_us, second.end_us);
+  EXPECT_LE(second.start_us, first.end_us);
+}
+
+}  // namespace caffe
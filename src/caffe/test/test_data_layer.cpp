@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 
+#include "boost/filesystem.hpp"
 #include "boost/scoped_ptr.hpp"
 #include "gtest/gtest.h"
 
@@ -67,12 +68,14 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(const int prefetch = 4, const int reader_threads = 1) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(5);
+    data_param->set_prefetch(prefetch);
+    data_param->set_reader_threads(reader_threads);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
 
@@ -170,6 +173,51 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // With one epoch per batch, each batch must hold every record once, in an
+  // order that changes from epoch to epoch.
+  void TestReadShuffle(const int shuffle_window) {
+    const Dtype scale = 3;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle(true);
+    data_param->set_shuffle_window(shuffle_window);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_scale(scale);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    // mmap databases are shuffled by record index, without a key index.
+    if (backend_ != DataParameter_DB_MMAP) {
+      EXPECT_TRUE(boost::filesystem::exists(*filename_ + ".keys"));
+    }
+    int num_shuffled = 0;
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      vector<bool> seen(5, false);
+      bool in_order = true;
+      for (int i = 0; i < 5; ++i) {
+        const int label = blob_top_label_->cpu_data()[i];
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, 5);
+        EXPECT_FALSE(seen[label]) << "debug: iter " << iter << " i " << i;
+        seen[label] = true;
+        in_order &= label == i;
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(scale * label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+      num_shuffled += !in_order;
+    }
+    EXPECT_GT(num_shuffled, 0);
+  }
+
   void TestReadCrop(Phase phase) {
     const Dtype scale = 3;
     LayerParameter param;
@@ -396,6 +444,79 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadPrefetchLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  // The batch handed to the tops is held until the next Forward, so a
+  // single batch still has to make progress.
+  this->TestRead(1);
+  this->TestRead(8);
+}
+
+TYPED_TEST(DataLayerTest, TestReadMultiReaderLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  // Deterministic reads keep the database order whatever the number of
+  // readers, including more readers than records.
+  this->TestRead(4, 2);
+  this->TestRead(4, 3);
+  this->TestRead(4, 7);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  // Windows smaller than, equal to and larger than the database. The first
+  // run builds the key index, the next ones read it back.
+  this->TestReadShuffle(2);
+  this->TestReadShuffle(5);
+  this->TestReadShuffle(64);
+}
+
+TYPED_TEST(DataLayerTest, TestReadMmap) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_MMAP);
+  this->TestRead();
+  this->TestReadShuffle(64);
+}
+
+TYPED_TEST(DataLayerTest, TestReadMmapSolvers) {
+  typedef typename TypeParam::Dtype Dtype;
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_MMAP);
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(5);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(DataParameter_DB_MMAP);
+  // The layers of two solvers read alternate records.
+  Caffe::set_solver_count(2);
+  DataLayer<Dtype> layer0(param);
+  layer0.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> data1, label1;
+  vector<Blob<Dtype>*> top1;
+  top1.push_back(&data1);
+  top1.push_back(&label1);
+  DataLayer<Dtype> layer1(param);
+  layer1.SetUp(this->blob_bottom_vec_, top1);
+  Caffe::set_solver_count(1);
+  for (int iter = 0; iter < 2; ++iter) {
+    layer0.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer1.Forward(this->blob_bottom_vec_, top1);
+    for (int i = 0; i < 5; ++i) {
+      const int item = iter * 5 + i;
+      // Records 0, 2, 4 for the first solver and 1, 3 for the second.
+      EXPECT_EQ(item % 3 * 2, this->blob_top_label_->cpu_data()[i]);
+      EXPECT_EQ(item % 2 * 2 + 1, label1.cpu_data()[i]);
+      for (int j = 0; j < 24; ++j) {
+        EXPECT_EQ(item % 3 * 2, this->blob_top_data_->cpu_data()[i * 24 + j]);
+        EXPECT_EQ(item % 2 * 2 + 1, data1.cpu_data()[i * 24 + j]);
+      }
+    }
+  }
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -1,4 +1,5 @@
 #if defined(USE_LEVELDB) && defined(USE_LMDB) && defined(USE_OPENCV)
+#include <string.h>
 #include <string>
 
 #include "boost/scoped_ptr.hpp"
@@ -117,6 +118,44 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestValueData) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  while (cursor->valid()) {
+    const string value = cursor->value();
+    ASSERT_EQ(value.size(), cursor->value_size());
+    EXPECT_EQ(0, memcmp(value.data(), cursor->value_data(), value.size()));
+    Datum datum;
+    EXPECT_TRUE(datum.ParseFromArray(cursor->value_data(),
+                                     cursor->value_size()));
+    EXPECT_EQ(datum.channels(), 3);
+    cursor->Next();
+  }
+}
+
+TYPED_TEST(DBTest, TestSeekToKey) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  cursor->SeekToKey("fish-bike.jpg");
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  Datum datum;
+  datum.ParseFromString(cursor->value());
+  EXPECT_EQ(datum.height(), 323);
+  cursor->SeekToKey("cat.jpg");
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+  cursor->Next();
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  cursor->SeekToKey("dog.jpg");
+  EXPECT_FALSE(cursor->valid());
+  cursor->SeekToFirst();
+  EXPECT_TRUE(cursor->valid());
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
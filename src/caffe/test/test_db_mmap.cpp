@@ -0,0 +1,132 @@
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/db_mmap.hpp"
+#include "caffe/util/format.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::scoped_ptr;
+
+class MmapDBTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempDir(&source_);
+    source_ += "/db";
+  }
+
+  // Record i has label 10 * i and the values i + 0.5 * j, stored as floats,
+  // or as bytes for even records when with_bytes is set.
+  string MakeRecord(int i, bool with_bytes) {
+    Datum datum;
+    datum.set_channels(2);
+    datum.set_height(1);
+    datum.set_width(3);
+    datum.set_label(10 * i);
+    for (int j = 0; j < 6; ++j) {
+      if (with_bytes && i % 2 == 0) {
+        datum.mutable_data()->push_back(static_cast<char>(i + j));
+      } else {
+        datum.add_float_data(i + 0.5 * j);
+      }
+    }
+    return datum.SerializeAsString();
+  }
+
+  void Write(int first, int num, db::Mode mode, bool with_bytes) {
+    scoped_ptr<db::DB> db(db::GetDB("mmap"));
+    db->Open(source_, mode);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int i = first; i < first + num; ++i) {
+      txn->Put(format_int(i, 3), MakeRecord(i, with_bytes));
+      // Commit in several transactions.
+      if (i % 3 == 0) {
+        txn->Commit();
+      }
+    }
+    txn->Commit();
+    db->Close();
+  }
+
+  void ExpectRecord(db::MmapCursor* cursor, int i, bool with_bytes) {
+    ASSERT_TRUE(cursor->valid());
+    EXPECT_EQ(format_int(i, 3), cursor->key());
+    EXPECT_EQ(10 * i, cursor->label());
+    ASSERT_EQ(6 * sizeof(float), cursor->value_size());
+    const float* values = reinterpret_cast<const float*>(cursor->value_data());
+    for (int j = 0; j < 6; ++j) {
+      const float expected =
+          with_bytes && i % 2 == 0 ? i + j : i + 0.5f * j;
+      EXPECT_EQ(expected, values[j]) << "record " << i << " value " << j;
+    }
+  }
+
+  string source_;
+};
+
+TEST_F(MmapDBTest, TestReadWrite) {
+  Write(0, 7, db::NEW, true);
+  db::MmapDB db;
+  db.Open(source_, db::READ);
+  EXPECT_EQ(7, db.num_records());
+  EXPECT_EQ(2, db.channels());
+  EXPECT_EQ(1, db.height());
+  EXPECT_EQ(3, db.width());
+  scoped_ptr<db::MmapCursor> cursor(db.NewCursor());
+  for (int i = 0; i < 7; ++i) {
+    ExpectRecord(cursor.get(), i, true);
+    cursor->Next();
+  }
+  EXPECT_FALSE(cursor->valid());
+  cursor->SeekToFirst();
+  ExpectRecord(cursor.get(), 0, true);
+}
+
+TEST_F(MmapDBTest, TestSeekToKey) {
+  Write(0, 7, db::NEW, false);
+  db::MmapDB db;
+  db.Open(source_, db::READ);
+  scoped_ptr<db::MmapCursor> cursor(db.NewCursor());
+  cursor->SeekToKey(format_int(5, 3));
+  ExpectRecord(cursor.get(), 5, false);
+  cursor->Next();
+  ExpectRecord(cursor.get(), 6, false);
+  cursor->SeekToKey(format_int(2, 3));
+  ExpectRecord(cursor.get(), 2, false);
+  cursor->SeekToKey("missing");
+  EXPECT_FALSE(cursor->valid());
+}
+
+TEST_F(MmapDBTest, TestAppend) {
+  Write(0, 4, db::NEW, false);
+  Write(4, 5, db::WRITE, false);
+  db::MmapDB db;
+  db.Open(source_, db::READ);
+  EXPECT_EQ(9, db.num_records());
+  scoped_ptr<db::MmapCursor> cursor(db.NewCursor());
+  for (int i = 0; i < 9; ++i) {
+    ExpectRecord(cursor.get(), i, false);
+    cursor->Next();
+  }
+  EXPECT_FALSE(cursor->valid());
+}
+
+TEST_F(MmapDBTest, TestEmpty) {
+  Write(0, 0, db::NEW, false);
+  db::MmapDB db;
+  db.Open(source_, db::READ);
+  EXPECT_EQ(0, db.num_records());
+  scoped_ptr<db::MmapCursor> cursor(db.NewCursor());
+  EXPECT_FALSE(cursor->valid());
+}
+
+}  // namespace caffe
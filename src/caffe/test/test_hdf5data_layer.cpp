@@ -1,3 +1,4 @@
+#include <set>
 #include <string>
 #include <vector>
 
@@ -133,4 +134,61 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestReadShuffle) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+  param.add_top("label2");
+
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_shuffle(true);
+  const int data_size = 8 * 6 * 5;
+
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Each file of 10 rows is served in two batches, in a shuffled order, while
+  // the other file is loaded. Each pass over the source serves both files.
+  std::set<int> files_seen;
+  for (int file = 0; file < 4; ++file) {
+    vector<int> row_count(10, 0);
+    Dtype file_offset = -1;
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        // NB: label is 1-indexed
+        const int row = this->blob_top_label_->cpu_data()[i] - 1;
+        ASSERT_GE(row, 0);
+        ASSERT_LT(row, 10);
+        ++row_count[row];
+        EXPECT_EQ(row + 2, this->blob_top_label2_->cpu_data()[i]);
+        // The second file holds the same rows, offset by 2400.
+        const Dtype* data = this->blob_top_data_->cpu_data() + i * data_size;
+        if (file_offset < 0) {
+          file_offset = data[0] - row * data_size;
+        }
+        for (int j = 0; j < data_size; ++j) {
+          EXPECT_EQ(file_offset + row * data_size + j, data[j])
+              << "debug: i " << i << " j " << j << " file " << file;
+        }
+      }
+    }
+    EXPECT_TRUE(file_offset == 0 || file_offset == 2400);
+    files_seen.insert(static_cast<int>(file_offset / 2400));
+    if (file % 2 == 1) {
+      std::set<int> both_files;
+      both_files.insert(0);
+      both_files.insert(1);
+      EXPECT_TRUE(files_seen == both_files) << "pass " << file / 2;
+      files_seen.clear();
+    }
+    for (int row = 0; row < 10; ++row) {
+      EXPECT_EQ(1, row_count[row]) << "row " << row << " file " << file;
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class HostAllocatorTest : public ::testing::Test {
+ protected:
+  HostAllocatorTest() : allocator_(HostAllocator::Get()) {}
+
+  virtual void SetUp() {
+    // GPU mode allocates pinned memory instead.
+    Caffe::set_mode(Caffe::CPU);
+    cache_bytes_ = allocator_.cache_bytes();
+  }
+
+  virtual void TearDown() {
+    allocator_.set_cache_bytes(cache_bytes_);
+  }
+
+  HostAllocator& allocator_;
+  size_t cache_bytes_;
+};
+
+TEST_F(HostAllocatorTest, TestClassBytes) {
+  EXPECT_EQ(64, HostAllocator::ClassBytes(0));
+  EXPECT_EQ(64, HostAllocator::ClassBytes(64));
+  EXPECT_EQ(80, HostAllocator::ClassBytes(65));
+  EXPECT_EQ(128, HostAllocator::ClassBytes(128));
+  EXPECT_EQ(160, HostAllocator::ClassBytes(129));
+  EXPECT_EQ(1280, HostAllocator::ClassBytes(1025));
+  for (size_t size = 65; size < (1 << 20); size = size * 3 / 2 + 1) {
+    const size_t bytes = HostAllocator::ClassBytes(size);
+    EXPECT_GE(bytes, size);
+    EXPECT_LE(bytes - size, bytes / 5);
+  }
+}
+
+TEST_F(HostAllocatorTest, TestAlignment) {
+  const size_t sizes[] = { 1, 100, 4000, 3 << 20 };
+  for (int i = 0; i < 4; ++i) {
+    void* ptr = allocator_.Allocate(sizes[i]);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % 64);
+    memset(ptr, 1, sizes[i]);
+    allocator_.Free(ptr);
+  }
+}
+
+TEST_F(HostAllocatorTest, TestCache) {
+  allocator_.set_cache_bytes(1 << 20);
+  const HostAllocatorStats before = allocator_.stats();
+  void* ptr = allocator_.Allocate(1000);
+  allocator_.Free(ptr);
+  // A block of the same class is reused.
+  void* reused = allocator_.Allocate(1020);
+  EXPECT_EQ(ptr, reused);
+  const HostAllocatorStats after = allocator_.stats();
+  EXPECT_EQ(before.allocations + 2, after.allocations);
+  EXPECT_EQ(before.cache_hits + 1, after.cache_hits);
+  EXPECT_EQ(before.frees + 1, after.frees);
+  EXPECT_EQ(before.bytes_in_use + HostAllocator::ClassBytes(1000),
+            after.bytes_in_use);
+  allocator_.Free(reused);
+  EXPECT_EQ(before.bytes_cached + HostAllocator::ClassBytes(1000),
+            allocator_.stats().bytes_cached);
+  allocator_.Trim();
+  EXPECT_EQ(0, allocator_.stats().bytes_cached);
+}
+
+TEST_F(HostAllocatorTest, TestCacheLimit) {
+  allocator_.set_cache_bytes(0);
+  const HostAllocatorStats before = allocator_.stats();
+  allocator_.Free(allocator_.Allocate(1000));
+  allocator_.Free(allocator_.Allocate(1000));
+  const HostAllocatorStats after = allocator_.stats();
+  EXPECT_EQ(before.system_allocations + 2, after.system_allocations);
+  EXPECT_EQ(before.cache_hits, after.cache_hits);
+  EXPECT_EQ(0, after.bytes_cached);
+}
+
+TEST_F(HostAllocatorTest, TestSyncedMemory) {
+  allocator_.set_cache_bytes(1 << 20);
+  const HostAllocatorStats before = allocator_.stats();
+  {
+    SyncedMemory mem(4000);
+    memset(mem.mutable_cpu_data(), 1, 4000);
+  }
+  // The memory of a new SyncedMemory is zeroed, even when reused.
+  SyncedMemory mem(4000);
+  const char* data = static_cast<const char*>(mem.cpu_data());
+  for (int i = 0; i < 4000; ++i) {
+    EXPECT_EQ(0, data[i]);
+  }
+  EXPECT_EQ(before.cache_hits + 1, allocator_.stats().cache_hits);
+}
+
+}  // namespace caffe
@@ -0,0 +1,74 @@
+#ifdef USE_OPENCV
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DecodedImageCacheTest : public ::testing::Test {
+ protected:
+  // A 10x10 color image, i.e. 300 bytes, filled with value.
+  cv::Mat MakeImage(int value) {
+    return cv::Mat(10, 10, CV_8UC3, cv::Scalar(value, value, value));
+  }
+};
+
+TEST_F(DecodedImageCacheTest, TestLookup) {
+  DecodedImageCache cache(1000);
+  cv::Mat img;
+  EXPECT_FALSE(cache.Lookup("a", &img));
+  cache.Insert("a", MakeImage(1));
+  ASSERT_TRUE(cache.Lookup("a", &img));
+  EXPECT_EQ(10, img.rows);
+  EXPECT_EQ(10, img.cols);
+  EXPECT_EQ(1, img.at<cv::Vec3b>(5, 5)[0]);
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(1, cache.misses());
+  EXPECT_EQ(300, cache.bytes());
+}
+
+TEST_F(DecodedImageCacheTest, TestCopies) {
+  DecodedImageCache cache(1000);
+  cv::Mat img = MakeImage(1);
+  cache.Insert("a", img);
+  // Neither the inserted image nor a looked up one alias the cached one.
+  img.setTo(cv::Scalar(2, 2, 2));
+  cv::Mat cached;
+  ASSERT_TRUE(cache.Lookup("a", &cached));
+  EXPECT_EQ(1, cached.at<cv::Vec3b>(0, 0)[0]);
+  cached.setTo(cv::Scalar(3, 3, 3));
+  ASSERT_TRUE(cache.Lookup("a", &cached));
+  EXPECT_EQ(1, cached.at<cv::Vec3b>(0, 0)[0]);
+}
+
+TEST_F(DecodedImageCacheTest, TestEvictLeastRecentlyUsed) {
+  DecodedImageCache cache(1000);
+  cv::Mat img;
+  cache.Insert("a", MakeImage(1));
+  cache.Insert("b", MakeImage(2));
+  cache.Insert("c", MakeImage(3));
+  // Use a, so that b is the least recently used image.
+  EXPECT_TRUE(cache.Lookup("a", &img));
+  cache.Insert("d", MakeImage(4));
+  EXPECT_EQ(900, cache.bytes());
+  EXPECT_FALSE(cache.Lookup("b", &img));
+  EXPECT_TRUE(cache.Lookup("a", &img));
+  EXPECT_TRUE(cache.Lookup("c", &img));
+  EXPECT_TRUE(cache.Lookup("d", &img));
+}
+
+TEST_F(DecodedImageCacheTest, TestTooLarge) {
+  DecodedImageCache cache(200);
+  cv::Mat img;
+  cache.Insert("a", MakeImage(1));
+  EXPECT_FALSE(cache.Lookup("a", &img));
+  EXPECT_EQ(0, cache.bytes());
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
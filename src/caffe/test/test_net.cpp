@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
@@ -9,6 +10,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/dag_scheduler.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
@@ -629,6 +631,331 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  // Shares the data of the tops of the TEST net, or the diffs of the tops of
+  // the TRAIN net.
+  virtual void InitShareActivationsNet(const bool share,
+                                       const Phase phase = TEST) {
+    const string& proto =
+        "name: 'ShareActivationsNetwork' "
+        "keep_blob: 'conv2' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "  shape: { dim: 2 dim: 3 dim: 8 dim: 8 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv3' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv2' "
+        "  top: 'conv3' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv1' "
+        "  bottom: 'conv3' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'conv4' "
+        "  type: 'Convolution' "
+        "  bottom: 'sum' "
+        "  top: 'conv4' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'permute' "
+        "  type: 'Permute' "
+        "  bottom: 'conv4' "
+        "  top: 'conv4_perm' "
+        "  permute_param { order: 0 order: 2 order: 3 order: 1 } "
+        "} "
+        "layer { "
+        "  name: 'keep_order' "
+        "  type: 'Permute' "
+        "  bottom: 'conv4_perm' "
+        "  top: 'conv4_same' "
+        "  permute_param { order: 0 order: 1 order: 2 order: 3 } "
+        "} "
+        "layer { "
+        "  name: 'flatten' "
+        "  type: 'Flatten' "
+        "  bottom: 'conv4_same' "
+        "  top: 'flat' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'flat' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.mutable_state()->set_phase(phase);
+    if (phase == TRAIN) {
+      param.set_force_backward(true);
+      param.set_share_diffs(share);
+    } else {
+      param.set_share_activations(share);
+    }
+    net_.reset(new Net<Dtype>(param));
+  }
+
+  // Two heads with hinge losses, which compute the diffs of their bottoms
+  // in Forward.
+  virtual void InitShareDiffsLossNet(const bool share_diffs) {
+    const string& proto =
+        "name: 'ShareDiffsLossNetwork' "
+        "state { phase: TRAIN } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  top: 'label' "
+        "  input_param { "
+        "  shape: { dim: 2 dim: 3 dim: 8 dim: 8 } "
+        "  shape: { dim: 2 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'ip_a' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'conv1' "
+        "  top: 'ip_a' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'loss_a' "
+        "  type: 'HingeLoss' "
+        "  bottom: 'ip_a' "
+        "  bottom: 'label' "
+        "  top: 'loss_a' "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'ip_b' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'conv2' "
+        "  top: 'ip_b' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'loss_b' "
+        "  type: 'HingeLoss' "
+        "  bottom: 'ip_b' "
+        "  bottom: 'label' "
+        "  top: 'loss_b' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.set_share_diffs(share_diffs);
+    net_.reset(new Net<Dtype>(param));
+  }
+
+  // Three branches from data, summed: conv_a and ReLU in place, conv_b, and
+  // conv_c and Sigmoid in place.
+  virtual void InitParallelForwardNet(const int forward_threads,
+                                      const bool share_activations) {
+    const string& proto =
+        "name: 'ParallelForwardNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "  shape: { dim: 2 dim: 3 dim: 8 dim: 8 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv_a' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv_a' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu_a' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv_a' "
+        "  top: 'conv_a' "
+        "} "
+        "layer { "
+        "  name: 'conv_b' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv_b' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv_c' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv_c' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sigmoid_c' "
+        "  type: 'Sigmoid' "
+        "  bottom: 'conv_c' "
+        "  top: 'conv_c' "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv_a' "
+        "  bottom: 'conv_b' "
+        "  bottom: 'conv_c' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'sum' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.set_forward_threads(forward_threads);
+    param.set_share_activations(share_activations);
+    net_.reset(new Net<Dtype>(param));
+  }
+
   virtual void InitSkipPropNet(bool test_skip_true) {
     string proto =
       "name: 'SkipPropTestNetwork' "
@@ -2446,6 +2773,184 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestShareActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitShareActivationsNet(false);
+  shared_ptr<Net<Dtype> > ref_net = this->net_;
+  this->InitShareActivationsNet(true);
+  this->net_->ShareTrainedLayersWith(ref_net.get());
+  EXPECT_LT(this->net_->shared_activation_bytes(),
+            this->net_->activation_bytes());
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  // Check a larger shape too, for the memory planned again on Reshape.
+  for (int num = 2; num <= 4; num += 2) {
+    Blob<Dtype> data(num, 3, 8, 8);
+    filler.Fill(&data);
+    Net<Dtype>* nets[2] = { ref_net.get(), this->net_.get() };
+    for (int i = 0; i < 2; ++i) {
+      Blob<Dtype>* input = nets[i]->input_blobs()[0];
+      input->ReshapeLike(data);
+      caffe_copy(data.count(), data.cpu_data(), input->mutable_cpu_data());
+      nets[i]->Reshape();
+      nets[i]->Forward();
+    }
+    // The outputs and the kept blob are intact.
+    const char* kept[2] = { "ip", "conv2" };
+    for (int k = 0; k < 2; ++k) {
+      const Blob<Dtype>* expected = ref_net->blob_by_name(kept[k]).get();
+      const Blob<Dtype>* actual = this->net_->blob_by_name(kept[k]).get();
+      ASSERT_EQ(expected->count(), actual->count());
+      for (int i = 0; i < expected->count(); ++i) {
+        EXPECT_EQ(expected->cpu_data()[i], actual->cpu_data()[i]);
+      }
+    }
+  }
+  // conv4 takes the memory of conv1, which is no longer needed.
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->data(),
+            this->net_->blob_by_name("conv4")->data());
+}
+
+TYPED_TEST(NetTest, TestShareDiffs) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitShareActivationsNet(false, TRAIN);
+  shared_ptr<Net<Dtype> > ref_net = this->net_;
+  this->InitShareActivationsNet(true, TRAIN);
+  this->net_->ShareTrainedLayersWith(ref_net.get());
+  EXPECT_LT(this->net_->shared_diff_bytes(), this->net_->diff_bytes());
+  // The data is not shared in TRAIN nets.
+  EXPECT_EQ(0, this->net_->activation_bytes());
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int num = 2; num <= 4; num += 2) {
+    Blob<Dtype> data(num, 3, 8, 8);
+    Blob<Dtype> output_diff(num, 5, 1, 1);
+    filler.Fill(&data);
+    filler.Fill(&output_diff);
+    Net<Dtype>* nets[2] = { ref_net.get(), this->net_.get() };
+    for (int i = 0; i < 2; ++i) {
+      Blob<Dtype>* input = nets[i]->input_blobs()[0];
+      input->ReshapeLike(data);
+      caffe_copy(data.count(), data.cpu_data(), input->mutable_cpu_data());
+      nets[i]->Reshape();
+      nets[i]->ClearParamDiffs();
+      nets[i]->Forward();
+      caffe_copy(output_diff.count(), output_diff.cpu_data(),
+                 nets[i]->blob_by_name("ip")->mutable_cpu_diff());
+      nets[i]->Backward();
+    }
+    // The param diffs and the diff of the input are the same.
+    vector<Blob<Dtype>*> expected = ref_net->learnable_params();
+    vector<Blob<Dtype>*> actual = this->net_->learnable_params();
+    expected.push_back(ref_net->input_blobs()[0]);
+    actual.push_back(this->net_->input_blobs()[0]);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int j = 0; j < expected.size(); ++j) {
+      ASSERT_EQ(expected[j]->count(), actual[j]->count());
+      for (int i = 0; i < expected[j]->count(); ++i) {
+        EXPECT_EQ(expected[j]->cpu_diff()[i], actual[j]->cpu_diff()[i]);
+      }
+    }
+  }
+  // The diff of conv3 is no longer needed when Backward reaches the split of
+  // conv1, which computes the diff of conv1 in the same memory.
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->diff(),
+            this->net_->blob_by_name("conv3")->diff());
+}
+
+TYPED_TEST(NetTest, TestShareDiffsLosses) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitShareDiffsLossNet(false);
+  shared_ptr<Net<Dtype> > ref_net = this->net_;
+  this->InitShareDiffsLossNet(true);
+  this->net_->ShareTrainedLayersWith(ref_net.get());
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 8, 8);
+  filler.Fill(&data);
+  Net<Dtype>* nets[2] = { ref_net.get(), this->net_.get() };
+  for (int i = 0; i < 2; ++i) {
+    nets[i]->input_blobs()[0]->CopyFrom(data);
+    Dtype* label = nets[i]->input_blobs()[1]->mutable_cpu_data();
+    label[0] = 1;
+    label[1] = 3;
+    nets[i]->ClearParamDiffs();
+    nets[i]->ForwardBackward();
+  }
+  // The diff of ip_a, computed in the Forward of loss_a, outlives the
+  // Forward and Backward of the second head.
+  const vector<Blob<Dtype>*>& expected = ref_net->learnable_params();
+  const vector<Blob<Dtype>*>& actual = this->net_->learnable_params();
+  ASSERT_EQ(expected.size(), actual.size());
+  for (int j = 0; j < expected.size(); ++j) {
+    ASSERT_EQ(expected[j]->count(), actual[j]->count());
+    for (int i = 0; i < expected[j]->count(); ++i) {
+      EXPECT_EQ(expected[j]->cpu_diff()[i], actual[j]->cpu_diff()[i]);
+    }
+  }
+  EXPECT_NE(this->net_->blob_by_name("ip_a")->diff(),
+            this->net_->blob_by_name("ip_b")->diff());
+}
+
+TYPED_TEST(NetTest, TestParallelForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitParallelForwardNet(0, false);
+  shared_ptr<Net<Dtype> > ref_net = this->net_;
+  EXPECT_FALSE(ref_net->forward_scheduler());
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(ref_net->input_blobs()[0]);
+  ref_net->Forward();
+  // With the memory of the tops shared too, for the layers using the memory
+  // of the branches they do not belong to.
+  for (int share = 0; share < 2; ++share) {
+    this->InitParallelForwardNet(3, share);
+    Net<Dtype>* net = this->net_.get();
+    net->ShareTrainedLayersWith(ref_net.get());
+    net->input_blobs()[0]->CopyFrom(*ref_net->input_blobs()[0]);
+    const DagScheduler* scheduler = net->forward_scheduler();
+    if (Caffe::mode() == Caffe::GPU) {
+      // The layers run in sequence in GPU mode.
+      EXPECT_FALSE(scheduler);
+      continue;
+    }
+    ASSERT_TRUE(scheduler);
+    EXPECT_EQ(3, scheduler->num_workers());
+    for (int iter = 0; iter < 3; ++iter) {
+      net->Forward();
+      const Blob<Dtype>* expected = ref_net->output_blobs()[0];
+      const Blob<Dtype>* actual = net->output_blobs()[0];
+      for (int i = 0; i < expected->count(); ++i) {
+        EXPECT_EQ(expected->cpu_data()[i], actual->cpu_data()[i]);
+      }
+      // The layers ran after the layers computing their bottoms.
+      const vector<DagScheduler::Trace>& trace = scheduler->trace();
+      ASSERT_EQ(net->layers().size(), trace.size());
+      for (int layer_id = 0; layer_id < trace.size(); ++layer_id) {
+        EXPECT_GE(trace[layer_id].worker_id, 0);
+        const vector<int>& bottom_ids = net->bottom_ids(layer_id);
+        for (int other = 0; other < layer_id; ++other) {
+          const vector<int>& top_ids = net->top_ids(other);
+          for (int i = 0; i < bottom_ids.size(); ++i) {
+            if (std::find(top_ids.begin(), top_ids.end(), bottom_ids[i]) !=
+                top_ids.end()) {
+              EXPECT_GE(trace[layer_id].start_us, trace[other].end_us);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -0,0 +1,113 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/pack_pixels.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class PackPixelsTest : public ::testing::Test {
+ protected:
+  PackPixelsTest()
+      : height_(5), pad_h_(2), pad_w_(3), scale_(0.017) {}
+
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+  }
+
+  // Packs a random image of the given size with pack_pixels_cpu_isa and
+  // checks it against the straightforward per-pixel loop.
+  void TestPack(const PackPixelsIsa isa, const int channels, const int width,
+      const bool use_mean_file, const bool use_mean_values,
+      const bool mirror) {
+    // Leave some padding at the end of each row, like a cv::Mat ROI.
+    const int im_step = width * channels + 5;
+    vector<uint8_t> im(height_ * im_step);
+    for (int i = 0; i < im.size(); ++i) {
+      im[i] = caffe_rng_rand() % 256;
+    }
+    // The mean file is larger than the image; the image is cropped at
+    // (pad_h_, pad_w_).
+    const int mean_height = height_ + 2 * pad_h_;
+    const int mean_width = width + 2 * pad_w_;
+    vector<Dtype> mean(channels * mean_height * mean_width);
+    for (int i = 0; i < mean.size(); ++i) {
+      mean[i] = Dtype(caffe_rng_rand() % 2560) / 10;
+    }
+    vector<Dtype> mean_values(channels);
+    for (int c = 0; c < channels; ++c) {
+      mean_values[c] = Dtype(caffe_rng_rand() % 2560) / 10;
+    }
+    const Dtype* mean_data =
+        use_mean_file ? &mean[pad_h_ * mean_width + pad_w_] : NULL;
+    vector<Dtype> blob(channels * height_ * width, -1);
+    pack_pixels_cpu_isa(isa, &im[0], im_step, channels, height_, width,
+        mean_data, mean_width, mean_height * mean_width,
+        use_mean_values ? &mean_values[0] : NULL, scale_, mirror, &blob[0]);
+    for (int h = 0; h < height_; ++h) {
+      for (int w = 0; w < width; ++w) {
+        const int im_w = mirror ? width - 1 - w : w;
+        for (int c = 0; c < channels; ++c) {
+          const Dtype pixel = im[h * im_step + im_w * channels + c];
+          Dtype expected;
+          if (use_mean_file) {
+            expected = (pixel - mean[(c * mean_height + pad_h_ + h) *
+                mean_width + pad_w_ + w]) * scale_;
+          } else if (use_mean_values) {
+            expected = (pixel - mean_values[c]) * scale_;
+          } else {
+            expected = pixel * scale_;
+          }
+          EXPECT_EQ(expected, blob[(c * height_ + h) * width + w])
+              << "isa " << isa << " channels " << channels
+              << " width " << width
+              << " (c, h, w) = (" << c << ", " << h << ", " << w << ")";
+        }
+      }
+    }
+  }
+
+  // Covers widths around the 4 and 8 pixel vector steps, with each
+  // instruction set the CPU supports.
+  void TestAllModes(const int channels) {
+    const int widths[] = {1, 3, 4, 7, 8, 9, 17, 32};
+    for (int isa_id = PACK_PIXELS_SCALAR; isa_id <= pack_pixels_max_isa();
+         ++isa_id) {
+      const PackPixelsIsa isa = static_cast<PackPixelsIsa>(isa_id);
+      for (int i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i) {
+        for (int mirror = 0; mirror < 2; ++mirror) {
+          TestPack(isa, channels, widths[i], false, false, mirror);
+          TestPack(isa, channels, widths[i], false, true, mirror);
+          TestPack(isa, channels, widths[i], true, false, mirror);
+        }
+      }
+    }
+  }
+
+  const int height_;
+  const int pad_h_;
+  const int pad_w_;
+  const Dtype scale_;
+};
+
+TYPED_TEST_CASE(PackPixelsTest, TestDtypes);
+
+TYPED_TEST(PackPixelsTest, TestGray) {
+  this->TestAllModes(1);
+}
+
+TYPED_TEST(PackPixelsTest, TestColor) {
+  this->TestAllModes(3);
+}
+
+TYPED_TEST(PackPixelsTest, TestOtherChannels) {
+  this->TestAllModes(2);
+  this->TestAllModes(4);
+}
+
+}  // namespace caffe
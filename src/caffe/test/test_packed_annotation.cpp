@@ -0,0 +1,146 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/packed_annotation.hpp"
+#include "caffe/util/sampler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class PackedAnnotationTest : public ::testing::Test {
+ protected:
+  // Two groups of boxes, the second with landmarks on its first box.
+  virtual void SetUp() {
+    anno_datum_.set_type(AnnotatedDatum_AnnotationType_BBOX);
+    Datum* datum = anno_datum_.mutable_datum();
+    datum->set_channels(3);
+    datum->set_height(40);
+    datum->set_width(60);
+    for (int g = 0; g < 2; ++g) {
+      AnnotationGroup* group = anno_datum_.add_annotation_group();
+      group->set_group_label(g + 1);
+      for (int a = 0; a < 3; ++a) {
+        Annotation* anno = group->add_annotation();
+        anno->set_instance_id(a);
+        NormalizedBBox* bbox = anno->mutable_bbox();
+        bbox->set_xmin(0.1 * a + 0.05 * g);
+        bbox->set_ymin(0.2 * g + 0.01 * a);
+        bbox->set_xmax(0.1 * a + 0.05 * g + 0.3);
+        bbox->set_ymax(0.2 * g + 0.01 * a + 0.4);
+        bbox->set_difficult(a == 2);
+      }
+    }
+    Annotation* anno = anno_datum_.mutable_annotation_group(1)->
+        mutable_annotation(0);
+    anno->set_has_lm(1);
+    AnnoFaceLandmarks* face_lm = anno->mutable_face_lm();
+    point* points[5] = {face_lm->mutable_lefteye(),
+        face_lm->mutable_righteye(), face_lm->mutable_nose(),
+        face_lm->mutable_leftmouth(), face_lm->mutable_rightmouth()};
+    for (int i = 0; i < 5; ++i) {
+      points[i]->set_x(0.3 + 0.02 * i);
+      points[i]->set_y(0.4 + 0.01 * i);
+    }
+  }
+
+  AnnotatedDatum anno_datum_;
+};
+
+TEST_F(PackedAnnotationTest, TestRoundTrip) {
+  AnnotatedDatum packed_datum = anno_datum_;
+  PackAnnotatedDatum(&packed_datum);
+  EXPECT_EQ(packed_datum.annotation_group_size(), 0);
+  EXPECT_EQ(packed_datum.packed_annotation().size(),
+            sizeof(PackedAnnotationHeader) + 6 * sizeof(PackedAnnotation));
+  EXPECT_EQ(NumAnnotations(packed_datum), 6);
+  EXPECT_EQ(NumAnnotations(anno_datum_), 6);
+  UnpackAnnotatedDatum(&packed_datum);
+  EXPECT_FALSE(packed_datum.has_packed_annotation());
+  EXPECT_EQ(packed_datum.SerializeAsString(), anno_datum_.SerializeAsString());
+}
+
+TEST_F(PackedAnnotationTest, TestRecordsInPlace) {
+  string packed;
+  PackAnnotationGroups(anno_datum_.annotation_group(), &packed);
+  int num;
+  const PackedAnnotation* records = PackedAnnotations(packed, &num);
+  ASSERT_EQ(num, 6);
+  for (int i = 0; i < num; ++i) {
+    const Annotation& anno =
+        anno_datum_.annotation_group(i / 3).annotation(i % 3);
+    EXPECT_EQ(records[i].group_label, i / 3 + 1);
+    EXPECT_EQ(records[i].instance_id, anno.instance_id());
+    EXPECT_EQ(records[i].xmin, anno.bbox().xmin());
+    EXPECT_EQ(records[i].ymax, anno.bbox().ymax());
+    EXPECT_EQ(records[i].has_lm, anno.has_lm());
+    EXPECT_EQ(bool(records[i].flags & PackedAnnotation::DIFFICULT),
+              anno.bbox().difficult());
+    EXPECT_EQ(bool(records[i].flags & PackedAnnotation::HAS_FACE_LM),
+              anno.has_face_lm());
+  }
+  EXPECT_EQ(records[3].landmarks[2], anno_datum_.annotation_group(1).
+            annotation(0).face_lm().righteye().x());
+}
+
+TEST_F(PackedAnnotationTest, TestEmpty) {
+  AnnotatedDatum empty_datum;
+  PackAnnotatedDatum(&empty_datum);
+  EXPECT_EQ(NumAnnotations(empty_datum), 0);
+  RepeatedPtrField<AnnotationGroup> groups;
+  UnpackAnnotationGroups(empty_datum.packed_annotation(), &groups);
+  EXPECT_EQ(groups.size(), 0);
+}
+
+TEST_F(PackedAnnotationTest, TestGroupObjectBBoxes) {
+  AnnotatedDatum packed_datum = anno_datum_;
+  PackAnnotatedDatum(&packed_datum);
+  vector<NormalizedBBox> bboxes, packed_bboxes;
+  GroupObjectBBoxes(anno_datum_, &bboxes);
+  GroupObjectBBoxes(packed_datum, &packed_bboxes);
+  ASSERT_EQ(bboxes.size(), packed_bboxes.size());
+  for (int i = 0; i < bboxes.size(); ++i) {
+    EXPECT_EQ(bboxes[i].SerializeAsString(),
+              packed_bboxes[i].SerializeAsString());
+  }
+}
+
+TEST_F(PackedAnnotationTest, TestTransformAnnotation) {
+  AnnotatedDatum packed_datum = anno_datum_;
+  PackAnnotatedDatum(&packed_datum);
+  TransformationParameter transform_param;
+  DataTransformer<float> transformer(transform_param, TEST);
+  // The second crop drops the whole first group.
+  NormalizedBBox crop_bboxes[2];
+  crop_bboxes[0].set_xmin(0.15);
+  crop_bboxes[0].set_ymin(0.05);
+  crop_bboxes[0].set_xmax(0.8);
+  crop_bboxes[0].set_ymax(0.9);
+  crop_bboxes[1].set_xmin(0.1);
+  crop_bboxes[1].set_ymin(0.45);
+  crop_bboxes[1].set_xmax(1);
+  crop_bboxes[1].set_ymax(1);
+  const int num_groups[2] = {2, 1};
+  for (int c = 0; c < 2; ++c) {
+    for (int mirror = 0; mirror < 2; ++mirror) {
+      RepeatedPtrField<AnnotationGroup> groups, packed_groups;
+      transformer.TransformAnnotation(anno_datum_, false, crop_bboxes[c],
+                                      mirror, &groups);
+      transformer.TransformAnnotation(packed_datum, false, crop_bboxes[c],
+                                      mirror, &packed_groups);
+      ASSERT_EQ(groups.size(), num_groups[c]);
+      ASSERT_EQ(groups.size(), packed_groups.size());
+      for (int g = 0; g < groups.size(); ++g) {
+        EXPECT_EQ(groups.Get(g).SerializeAsString(),
+                  packed_groups.Get(g).SerializeAsString());
+      }
+    }
+  }
+}
+
+}  // namespace caffe
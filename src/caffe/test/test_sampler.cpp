@@ -0,0 +1,212 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/bbox_util.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/sampler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SamplerTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+    // A crowded image, with some boxes sharing edges and empty ones.
+    anno_datum_.set_type(AnnotatedDatum_AnnotationType_BBOX);
+    anno_datum_.mutable_datum()->set_height(480);
+    anno_datum_.mutable_datum()->set_width(640);
+    AnnotationGroup* group = anno_datum_.add_annotation_group();
+    group->set_group_label(1);
+    for (int i = 0; i < 60; ++i) {
+      NormalizedBBox* bbox = group->add_annotation()->mutable_bbox();
+      RandomBBox(bbox);
+      if (i % 10 == 0) {
+        bbox->set_xmax(bbox->xmin());
+      }
+      if (i % 15 == 1) {
+        bbox->set_xmin(0.5);
+      }
+    }
+  }
+
+  void RandomBBox(NormalizedBBox* bbox) {
+    float coords[4];
+    caffe_rng_uniform(4, 0.f, 1.f, coords);
+    bbox->set_xmin(std::min(coords[0], coords[1]));
+    bbox->set_xmax(std::max(coords[0], coords[1]));
+    bbox->set_ymin(std::min(coords[2], coords[3]));
+    bbox->set_ymax(std::max(coords[2], coords[3]));
+  }
+
+  // The constraint checking every subset of the six bounds selects.
+  SampleConstraint Constraint(int bounds) {
+    SampleConstraint constraint;
+    if (bounds & 1) constraint.set_min_jaccard_overlap(0.1);
+    if (bounds & 2) constraint.set_max_jaccard_overlap(0.7);
+    if (bounds & 4) constraint.set_min_sample_coverage(0.3);
+    if (bounds & 8) constraint.set_max_sample_coverage(0.9);
+    if (bounds & 16) constraint.set_min_object_coverage(0.5);
+    if (bounds & 32) constraint.set_max_object_coverage(0.95);
+    return constraint;
+  }
+
+  AnnotatedDatum anno_datum_;
+};
+
+TEST_F(SamplerTest, TestSatisfySampleConstraints) {
+  vector<NormalizedBBox> object_bboxes;
+  GroupObjectBBoxes(anno_datum_, &object_bboxes);
+  const BBoxArray object_bbox_array(object_bboxes);
+  vector<NormalizedBBox> sampled_bboxes(200);
+  for (int i = 0; i < sampled_bboxes.size(); ++i) {
+    RandomBBox(&sampled_bboxes[i]);
+  }
+  // Samples equal to an object, or touching it.
+  sampled_bboxes[0] = object_bboxes[3];
+  sampled_bboxes[1].set_xmin(object_bboxes[4].xmax());
+  const BBoxArray sampled_bbox_array(sampled_bboxes);
+  for (int bounds = 0; bounds < 64; ++bounds) {
+    const SampleConstraint constraint = Constraint(bounds);
+    vector<bool> satisfied;
+    SatisfySampleConstraints(sampled_bbox_array, object_bbox_array,
+                             constraint, &satisfied);
+    ASSERT_EQ(satisfied.size(), sampled_bboxes.size());
+    for (int i = 0; i < sampled_bboxes.size(); ++i) {
+      EXPECT_EQ(SatisfySampleConstraint(sampled_bboxes[i], object_bboxes,
+                                        constraint), satisfied[i])
+          << "bounds " << bounds << " sample " << i;
+    }
+  }
+}
+
+// GenerateBatchSamples as it was, checking one trial at a time.
+static void GenerateBatchSamplesSerial(const AnnotatedDatum& anno_datum,
+    const vector<BatchSampler>& batch_samplers,
+    vector<NormalizedBBox>* sampled_bboxes) {
+  vector<NormalizedBBox> object_bboxes;
+  GroupObjectBBoxes(anno_datum, &object_bboxes);
+  const float ratio = static_cast<float>(anno_datum.datum().height()) /
+      anno_datum.datum().width();
+  NormalizedBBox unit_bbox;
+  unit_bbox.set_xmin(0);
+  unit_bbox.set_ymin(0);
+  unit_bbox.set_xmax(1);
+  unit_bbox.set_ymax(1);
+  for (int s = 0; s < batch_samplers.size(); ++s) {
+    const BatchSampler& batch_sampler = batch_samplers[s];
+    int found = 0;
+    for (int i = 0; i < batch_sampler.max_trials(); ++i) {
+      if (batch_sampler.has_max_sample() &&
+          found >= batch_sampler.max_sample()) {
+        break;
+      }
+      NormalizedBBox sampled_bbox;
+      SampleBBox(batch_sampler.sampler(), &sampled_bbox, ratio);
+      LocateBBox(unit_bbox, sampled_bbox, &sampled_bbox);
+      if (SatisfySampleConstraint(sampled_bbox, object_bboxes,
+                                  batch_sampler.sample_constraint())) {
+        ++found;
+        sampled_bboxes->push_back(sampled_bbox);
+      }
+    }
+  }
+}
+
+TEST_F(SamplerTest, TestGenerateBatchSamplesBitIdentical) {
+  vector<BatchSampler> batch_samplers;
+  const int max_samples[] = {-1, 0, 1, 3, 50};
+  for (int m = 0; m < sizeof(max_samples) / sizeof(max_samples[0]); ++m) {
+    for (int bounds = 1; bounds < 64; bounds += 9) {
+      BatchSampler batch_sampler;
+      batch_sampler.mutable_sampler()->set_min_scale(0.3);
+      batch_sampler.mutable_sampler()->set_max_scale(0.7);
+      batch_sampler.mutable_sampler()->set_min_aspect_ratio(0.5);
+      batch_sampler.mutable_sampler()->set_max_aspect_ratio(2);
+      *batch_sampler.mutable_sample_constraint() = Constraint(bounds);
+      if (max_samples[m] >= 0) {
+        batch_sampler.set_max_sample(max_samples[m]);
+      }
+      batch_sampler.set_max_trials(50);
+      batch_samplers.push_back(batch_sampler);
+    }
+  }
+  for (int seed = 0; seed < 5; ++seed) {
+    vector<NormalizedBBox> expected, sampled;
+    Caffe::set_random_seed(seed);
+    GenerateBatchSamplesSerial(anno_datum_, batch_samplers, &expected);
+    const unsigned int expected_next = caffe_rng_rand();
+    Caffe::set_random_seed(seed);
+    GenerateBatchSamples(anno_datum_, batch_samplers, &sampled);
+    // The random generator is left in the same state.
+    EXPECT_EQ(expected_next, caffe_rng_rand());
+    ASSERT_EQ(expected.size(), sampled.size());
+    for (int i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i].SerializeAsString(),
+                sampled[i].SerializeAsString());
+    }
+  }
+}
+
+TEST_F(SamplerTest, TestGenerateBatchDataAnchorSamplesBitIdentical) {
+  // The anchor sampler sizes the crop by the area of the chosen face, so
+  // it needs non-empty boxes.
+  AnnotationGroup* group = anno_datum_.mutable_annotation_group(0);
+  for (int i = 0; i < group->annotation_size(); ++i) {
+    NormalizedBBox* bbox = group->mutable_annotation(i)->mutable_bbox();
+    if (bbox->xmax() - bbox->xmin() < 0.01) {
+      bbox->set_xmax(bbox->xmin() + 0.01);
+    }
+    if (bbox->ymax() - bbox->ymin() < 0.01) {
+      bbox->set_ymax(bbox->ymin() + 0.01);
+    }
+  }
+  vector<NormalizedBBox> object_bboxes;
+  GroupObjectBBoxes(anno_datum_, &object_bboxes);
+  const int max_samples[] = {1, 4, 50};
+  for (int m = 0; m < sizeof(max_samples) / sizeof(max_samples[0]); ++m) {
+    vector<DataAnchorSampler> samplers(1);
+    const int scales[] = {16, 32, 64, 128, 256, 512};
+    for (int i = 0; i < sizeof(scales) / sizeof(scales[0]); ++i) {
+      samplers[0].add_scale(scales[i]);
+    }
+    samplers[0].mutable_sample_constraint()->set_min_object_coverage(0.75);
+    samplers[0].set_max_sample(max_samples[m]);
+    samplers[0].set_max_trials(50);
+    for (int seed = 0; seed < 5; ++seed) {
+      vector<NormalizedBBox> expected, sampled;
+      Caffe::set_random_seed(seed);
+      int found = 0;
+      for (int i = 0; i < samplers[0].max_trials() &&
+           found < samplers[0].max_sample(); ++i) {
+        NormalizedBBox sampled_bbox;
+        GenerateDataAnchorSample(anno_datum_, samplers[0], object_bboxes,
+                                 &sampled_bbox);
+        if (SatisfySampleConstraint(sampled_bbox, object_bboxes,
+                                    samplers[0].sample_constraint())) {
+          ++found;
+          expected.push_back(sampled_bbox);
+        }
+      }
+      const unsigned int expected_next = caffe_rng_rand();
+      Caffe::set_random_seed(seed);
+      GenerateBatchDataAnchorSamples(anno_datum_, samplers, &sampled);
+      EXPECT_EQ(expected_next, caffe_rng_rand());
+      if (found == 0) {
+        ASSERT_EQ(sampled.size(), 1);
+        EXPECT_EQ(sampled[0].xmax(), 1.f);
+        continue;
+      }
+      ASSERT_EQ(expected.size(), sampled.size());
+      for (int i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(expected[i].SerializeAsString(),
+                  sampled[i].SerializeAsString());
+      }
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,193 @@
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/format.hpp"
+#include "caffe/util/shm_batch_ring.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::scoped_ptr;
+
+class ShmBatchRingTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    name_ = "/caffe_test_ring_" + format_int(getpid());
+    // Batches of 2 x 3 data and 2 labels.
+    capacity_.push_back(6);
+    capacity_.push_back(2);
+    shapes_.push_back(vector<int>(2, 2));
+    shapes_[0][1] = 3;
+    shapes_.push_back(vector<int>(1, 2));
+    producer_.reset(ShmBatchRing::Create(name_, 3, capacity_, shapes_));
+  }
+
+  // Publishes batch i, of data i + j and labels 10 * i + j.
+  bool Write(int i) {
+    float* slot = producer_->BeginWrite(0);
+    if (!slot) {
+      return false;
+    }
+    for (int j = 0; j < 6; ++j) {
+      slot[producer_->offset(0) + j] = i + j;
+    }
+    for (int j = 0; j < 2; ++j) {
+      slot[producer_->offset(1) + j] = 10 * i + j;
+    }
+    producer_->EndWrite(shapes_);
+    return true;
+  }
+
+  // Reads the next batch of consumer, and returns its index.
+  int Read(ShmBatchRing* consumer) {
+    const float* slot = consumer->BeginRead(0);
+    if (!slot) {
+      return -1;
+    }
+    EXPECT_EQ(shapes_[0], consumer->read_shape(0));
+    EXPECT_EQ(shapes_[1], consumer->read_shape(1));
+    const int i = slot[consumer->offset(0)];
+    for (int j = 0; j < 6; ++j) {
+      EXPECT_EQ(i + j, slot[consumer->offset(0) + j]);
+    }
+    for (int j = 0; j < 2; ++j) {
+      EXPECT_EQ(10 * i + j, slot[consumer->offset(1) + j]);
+    }
+    EXPECT_TRUE(consumer->EndRead());
+    return i;
+  }
+
+  string name_;
+  vector<uint64_t> capacity_;
+  vector<vector<int> > shapes_;
+  scoped_ptr<ShmBatchRing> producer_;
+};
+
+TEST_F(ShmBatchRingTest, TestWriteRead) {
+  scoped_ptr<ShmBatchRing> consumer(ShmBatchRing::Open(name_, 0));
+  EXPECT_EQ(3, consumer->num_slots());
+  EXPECT_EQ(2, consumer->num_tops());
+  EXPECT_EQ(6, consumer->capacity(0));
+  EXPECT_EQ(shapes_[0], consumer->shape(0));
+  EXPECT_EQ(shapes_[1], consumer->shape(1));
+  EXPECT_EQ(-1, Read(consumer.get()));
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_TRUE(Write(i));
+    EXPECT_EQ(i, Read(consumer.get()));
+  }
+  EXPECT_EQ(-1, Read(consumer.get()));
+}
+
+TEST_F(ShmBatchRingTest, TestPacing) {
+  scoped_ptr<ShmBatchRing> consumer(ShmBatchRing::Open(name_, 0));
+  // The feeder stays at most 2 batches ahead of the consumer.
+  EXPECT_TRUE(Write(0));
+  EXPECT_TRUE(Write(1));
+  EXPECT_FALSE(Write(2));
+  EXPECT_EQ(0, Read(consumer.get()));
+  EXPECT_TRUE(Write(2));
+  EXPECT_FALSE(Write(3));
+  EXPECT_EQ(1, Read(consumer.get()));
+  EXPECT_EQ(2, Read(consumer.get()));
+}
+
+TEST_F(ShmBatchRingTest, TestSlowConsumer) {
+  scoped_ptr<ShmBatchRing> fast(ShmBatchRing::Open(name_, 0));
+  scoped_ptr<ShmBatchRing> slow(ShmBatchRing::Open(name_, 0));
+  EXPECT_TRUE(Write(0));
+  EXPECT_EQ(0, Read(fast.get()));
+  EXPECT_EQ(0, Read(slow.get()));
+  for (int i = 1; i < 6; ++i) {
+    ASSERT_TRUE(Write(i));
+    EXPECT_EQ(i, Read(fast.get()));
+  }
+  // Batch 1 was overwritten: the slow consumer skips to the newest.
+  EXPECT_EQ(5, Read(slow.get()));
+  EXPECT_EQ(-1, Read(slow.get()));
+}
+
+TEST_F(ShmBatchRingTest, TestShareReads) {
+  scoped_ptr<ShmBatchRing> even(ShmBatchRing::Open(name_, 0));
+  scoped_ptr<ShmBatchRing> odd(ShmBatchRing::Open(name_, 0));
+  even->ShareReads(0, 2);
+  odd->ShareReads(1, 2);
+  EXPECT_TRUE(Write(0));
+  EXPECT_EQ(-1, Read(odd.get()));
+  EXPECT_EQ(0, Read(even.get()));
+  for (int i = 1; i < 7; ++i) {
+    ASSERT_TRUE(Write(i));
+    EXPECT_EQ(i % 2 ? i : -1, Read(odd.get()));
+    EXPECT_EQ(i % 2 ? -1 : i, Read(even.get()));
+  }
+  // The odd consumer falls behind: batch 10 takes the slot of batch 7, and
+  // it skips to 9, the newest odd batch.
+  for (int i = 7; i < 11; ++i) {
+    ASSERT_TRUE(Write(i));
+    if (i % 2 == 0) {
+      EXPECT_EQ(i, Read(even.get()));
+    }
+  }
+  EXPECT_EQ(9, Read(odd.get()));
+  EXPECT_EQ(-1, Read(odd.get()));
+}
+
+TEST_F(ShmBatchRingTest, TestOverwriteWhileReading) {
+  scoped_ptr<ShmBatchRing> fast(ShmBatchRing::Open(name_, 0));
+  scoped_ptr<ShmBatchRing> slow(ShmBatchRing::Open(name_, 0));
+  EXPECT_TRUE(Write(0));
+  EXPECT_EQ(0, Read(fast.get()));
+  ASSERT_TRUE(slow->BeginRead(0));
+  for (int i = 1; i < 4; ++i) {
+    ASSERT_TRUE(Write(i));
+    EXPECT_EQ(i, Read(fast.get()));
+  }
+  // Batch 3 took the slot of batch 0, batch 1 is still there.
+  EXPECT_FALSE(slow->EndRead());
+  EXPECT_EQ(1, Read(slow.get()));
+}
+
+TEST_F(ShmBatchRingTest, TestReadShapeWhileOverwritten) {
+  scoped_ptr<ShmBatchRing> fast(ShmBatchRing::Open(name_, 0));
+  scoped_ptr<ShmBatchRing> slow(ShmBatchRing::Open(name_, 0));
+  EXPECT_TRUE(Write(0));
+  EXPECT_EQ(0, Read(fast.get()));
+  ASSERT_TRUE(slow->BeginRead(0));
+  // Batch 3 takes the slot of batch 0 with another shape, which the slow
+  // consumer does not see.
+  vector<vector<int> > shapes = shapes_;
+  shapes[0][0] = 1;
+  for (int i = 1; i < 4; ++i) {
+    ASSERT_TRUE(producer_->BeginWrite(0));
+    producer_->EndWrite(shapes);
+    ASSERT_TRUE(fast->BeginRead(0));
+    EXPECT_EQ(shapes[0], fast->read_shape(0));
+  }
+  EXPECT_EQ(shapes_[0], slow->read_shape(0));
+  EXPECT_FALSE(slow->EndRead());
+}
+
+TEST_F(ShmBatchRingTest, TestFeederStopped) {
+  scoped_ptr<ShmBatchRing> consumer(ShmBatchRing::Open(name_, 0));
+  EXPECT_FALSE(consumer->stopped());
+  EXPECT_TRUE(Write(0));
+  producer_.reset();
+  // The batches published are still read, then the end is reported.
+  EXPECT_EQ(0, Read(consumer.get()));
+  EXPECT_TRUE(consumer->stopped());
+  EXPECT_EQ(-1, Read(consumer.get()));
+  // A new feeder replaces the ring.
+  producer_.reset(ShmBatchRing::Create(name_, 3, capacity_, shapes_));
+  consumer.reset(ShmBatchRing::Open(name_, 0));
+  EXPECT_FALSE(consumer->stopped());
+  EXPECT_TRUE(Write(0));
+  EXPECT_EQ(0, Read(consumer.get()));
+}
+
+}  // namespace caffe
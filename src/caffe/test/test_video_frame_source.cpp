@@ -0,0 +1,117 @@
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/video_frame_source.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class VideoFrameSourceTest : public ::testing::Test {
+ protected:
+  VideoFrameSourceTest() : num_frames_(37) {}
+
+  // Writes a Motion JPEG video, whose frame i is filled with 5 * i. Every
+  // frame is a key frame, so seeking is exact.
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+    filename_ += ".avi";
+    const int fourcc = 'M' | ('J' << 8) | ('P' << 16) | ('G' << 24);
+    cv::VideoWriter writer(filename_, fourcc, 25, cv::Size(32, 24));
+    written_ = writer.isOpened();
+    for (int i = 0; written_ && i < num_frames_; ++i) {
+      writer << cv::Mat(24, 32, CV_8UC3, cv::Scalar(5 * i, 5 * i, 5 * i));
+    }
+  }
+
+  virtual void TearDown() {
+    remove(filename_.c_str());
+  }
+
+  // Whether frame holds the value of frame index, give or take the JPEG
+  // compression.
+  bool IsFrame(const cv::Mat& frame, int index) {
+    return frame.rows == 24 && frame.cols == 32 &&
+        std::abs(frame.at<cv::Vec3b>(12, 16)[0] - 5 * index) <= 3;
+  }
+
+  const int num_frames_;
+  string filename_;
+  bool written_;
+};
+
+TEST_F(VideoFrameSourceTest, TestSequential) {
+  if (!written_) {
+    LOG(INFO) << "Skipping test: no Motion JPEG encoder.";
+    return;
+  }
+  VideoFrameSource source(filename_, 1, 8);
+  cv::Mat frame;
+  for (int i = 0; i < num_frames_; ++i) {
+    ASSERT_TRUE(source.GetFrame(i, &frame)) << "frame " << i;
+    EXPECT_TRUE(IsFrame(frame, i)) << "frame " << i;
+  }
+  EXPECT_FALSE(source.GetFrame(num_frames_, &frame));
+  EXPECT_FALSE(source.GetFrame(num_frames_ + 20, &frame));
+  // Each frame was decoded once.
+  EXPECT_EQ(num_frames_, source.decoded_frames());
+}
+
+TEST_F(VideoFrameSourceTest, TestOverlappingClips) {
+  if (!written_) {
+    LOG(INFO) << "Skipping test: no Motion JPEG encoder.";
+    return;
+  }
+  VideoFrameSource source(filename_, 1, 8);
+  cv::Mat frame;
+  // Clips of 10 frames starting every 3 frames.
+  for (int start = 0; start + 10 <= num_frames_; start += 3) {
+    for (int t = 0; t < 10; ++t) {
+      ASSERT_TRUE(source.GetFrame(start + t, &frame));
+      EXPECT_TRUE(IsFrame(frame, start + t));
+    }
+    source.Release(start + 3);
+  }
+  EXPECT_EQ(num_frames_, source.decoded_frames());
+  // Released frames are decoded again.
+  ASSERT_TRUE(source.GetFrame(0, &frame));
+  EXPECT_TRUE(IsFrame(frame, 0));
+  EXPECT_EQ(num_frames_ + 8, source.decoded_frames());
+}
+
+TEST_F(VideoFrameSourceTest, TestThreads) {
+  if (!written_) {
+    LOG(INFO) << "Skipping test: no Motion JPEG encoder.";
+    return;
+  }
+  VideoFrameSource sequential(filename_, 1, 5);
+  VideoFrameSource threaded(filename_, 3, 5);
+  cv::Mat expected, frame;
+  for (int i = 0; i < num_frames_; ++i) {
+    ASSERT_TRUE(sequential.GetFrame(i, &expected));
+    ASSERT_TRUE(threaded.GetFrame(i, &frame)) << "frame " << i;
+    EXPECT_EQ(0, cv::norm(expected, frame, cv::NORM_INF)) << "frame " << i;
+  }
+  EXPECT_FALSE(threaded.GetFrame(num_frames_, &frame));
+  // Jump back to released frames, forcing the workers to seek.
+  threaded.Release(num_frames_);
+  for (int i = 3; i < num_frames_; i += 7) {
+    ASSERT_TRUE(sequential.GetFrame(i, &expected));
+    ASSERT_TRUE(threaded.GetFrame(i, &frame));
+    EXPECT_EQ(0, cv::norm(expected, frame, cv::NORM_INF)) << "frame " << i;
+  }
+  EXPECT_GT(threaded.decode_fps(), 0);
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -0,0 +1,74 @@
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/worker_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class WorkerPoolTest : public ::testing::Test {
+ protected:
+  // Records the worker of each item and a random draw from its stream.
+  void Record(int item_id, int worker_id) {
+    workers_[item_id] = worker_id;
+    draws_[item_id] = caffe_rng_rand();
+  }
+
+  WorkerPool::Task record_task() {
+    return boost::bind(&WorkerPoolTest::Record, this, _1, _2);
+  }
+
+  void RunPool(int num_workers, int num_items) {
+    Caffe::set_random_seed(1701);
+    WorkerPool pool(num_workers);
+    EXPECT_EQ(num_workers, pool.size());
+    workers_.assign(num_items, -1);
+    draws_.assign(num_items, 0);
+    pool.Run(num_items, record_task());
+  }
+
+  vector<int> workers_;
+  vector<unsigned int> draws_;
+};
+
+TEST_F(WorkerPoolTest, TestItemsRunOnce) {
+  const int num_workers[] = {1, 3, 8};
+  for (int i = 0; i < 3; ++i) {
+    // Fewer, as many and more items than workers.
+    for (int num_items = 0; num_items < 20; ++num_items) {
+      RunPool(num_workers[i], num_items);
+      for (int item_id = 0; item_id < num_items; ++item_id) {
+        EXPECT_EQ(item_id % num_workers[i], workers_[item_id]);
+      }
+    }
+  }
+}
+
+TEST_F(WorkerPoolTest, TestReproducible) {
+  RunPool(4, 50);
+  const vector<unsigned int> draws = draws_;
+  RunPool(4, 50);
+  for (int i = 0; i < draws.size(); ++i) {
+    EXPECT_EQ(draws[i], draws_[i]);
+  }
+}
+
+TEST_F(WorkerPoolTest, TestStartWait) {
+  WorkerPool pool(3);
+  for (int run = 0; run < 5; ++run) {
+    workers_.assign(10, -1);
+    draws_.assign(10, 0);
+    pool.Start(10, record_task());
+    pool.Wait();
+    for (int i = 0; i < 10; ++i) {
+      EXPECT_EQ(i % 3, workers_[i]);
+    }
+  }
+}
+
+}  // namespace caffe
@@ -3,6 +3,7 @@
 
 #include "caffe/data_reader.hpp"
 #include "caffe/layers/base_data_layer.hpp"
+#include "caffe/layers/hdf5_data_layer.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/util/blocking_queue.hpp"
 
@@ -86,12 +87,15 @@ size_t BlockingQueue<T>::size() const {
   return queue_.size();
 }
 
+template class BlockingQueue<int>;
 template class BlockingQueue<Batch<float>*>;
 template class BlockingQueue<Batch<double>*>;
 template class BlockingQueue<pairBatch<float>*>;
 template class BlockingQueue<pairBatch<double>*>;
 template class BlockingQueue<ReidBatch<float>*>;
 template class BlockingQueue<ReidBatch<double>*>;
+template class BlockingQueue<HDF5FileData<float>*>;
+template class BlockingQueue<HDF5FileData<double>*>;
 template class BlockingQueue<Datum*>;
 template class BlockingQueue<AnnotatedDatum*>;
 template class BlockingQueue<AnnoFaceAttributeDatum*>;
@@ -0,0 +1,84 @@
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "caffe/util/dag_scheduler.hpp"
+
+namespace caffe {
+
+DagScheduler::DagScheduler(int num_workers)
+    : pool_(num_workers), end_(-1), num_remaining_(0) {
+}
+
+void DagScheduler::SetGraph(const vector<vector<int> >& predecessors) {
+  predecessors_ = predecessors;
+  successors_.assign(predecessors.size(), vector<int>());
+  for (int node_id = 0; node_id < predecessors.size(); ++node_id) {
+    for (int i = 0; i < predecessors[node_id].size(); ++i) {
+      const int predecessor = predecessors[node_id][i];
+      CHECK_GE(predecessor, 0);
+      CHECK_LT(predecessor, node_id) << "The nodes must be in a "
+          << "topological order.";
+      successors_[predecessor].push_back(node_id);
+    }
+  }
+}
+
+void DagScheduler::Run(int begin, int end, const Task& task) {
+  CHECK_GE(begin, 0);
+  CHECK_LT(end, predecessors_.size());
+  task_ = task;
+  end_ = end;
+  num_remaining_ = end - begin + 1;
+  num_pending_.assign(predecessors_.size(), 0);
+  ready_.clear();
+  const Trace not_run = { -1, 0, 0 };
+  trace_.assign(predecessors_.size(), not_run);
+  for (int node_id = begin; node_id <= end; ++node_id) {
+    for (int i = 0; i < predecessors_[node_id].size(); ++i) {
+      num_pending_[node_id] += predecessors_[node_id][i] >= begin;
+    }
+    if (num_pending_[node_id] == 0) {
+      ready_.push_back(node_id);
+    }
+  }
+  start_time_ = boost::posix_time::microsec_clock::local_time();
+  pool_.Run(pool_.size(), boost::bind(&DagScheduler::Work, this, _2));
+}
+
+double DagScheduler::ElapsedMicroSeconds() const {
+  return (boost::posix_time::microsec_clock::local_time() - start_time_)
+      .total_microseconds();
+}
+
+// This function is called on the worker threads
+void DagScheduler::Work(int worker_id) {
+  boost::mutex::scoped_lock lock(mutex_);
+  while (num_remaining_ > 0) {
+    if (ready_.empty()) {
+      ready_condition_.wait(lock);
+      continue;
+    }
+    const int node_id = ready_.front();
+    ready_.pop_front();
+    lock.unlock();
+    Trace trace;
+    trace.worker_id = worker_id;
+    trace.start_us = ElapsedMicroSeconds();
+    task_(node_id);
+    trace.end_us = ElapsedMicroSeconds();
+    lock.lock();
+    trace_[node_id] = trace;
+    --num_remaining_;
+    const vector<int>& successors = successors_[node_id];
+    for (int i = 0; i < successors.size(); ++i) {
+      if (successors[i] <= end_ && --num_pending_[successors[i]] == 0) {
+        ready_.push_back(successors[i]);
+      }
+    }
+    // Wake the idle workers for the new ready nodes, or to return.
+    ready_condition_.notify_all();
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,221 @@
+#include "caffe/util/db_mmap.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace caffe { namespace db {
+
+string MmapCursor::key() {
+  return db_->key(index_);
+}
+
+const char* MmapCursor::value_data() {
+  return reinterpret_cast<const char*>(db_->record(index_));
+}
+
+size_t MmapCursor::value_size() {
+  return db_->record_floats() * sizeof(float);
+}
+
+void MmapCursor::SeekToKey(const string& key) {
+  if (key_index_.empty()) {
+    for (uint64_t i = 0; i < db_->num_records(); ++i) {
+      key_index_[db_->key(i)] = i;
+    }
+  }
+  std::map<string, uint64_t>::const_iterator it = key_index_.find(key);
+  index_ = it == key_index_.end() ? db_->num_records() : it->second;
+}
+
+bool MmapCursor::valid() {
+  return index_ < db_->num_records();
+}
+
+int MmapCursor::label() {
+  return db_->label(index_);
+}
+
+void MmapTransaction::Put(const string& key, const string& value) {
+  Datum datum;
+  CHECK(datum.ParseFromString(value)) << "Record " << key
+      << " is not a Datum.";
+  CHECK(!datum.encoded()) << "Decode record " << key
+      << " before storing it in an mmap database.";
+  MmapHeader& header = db_->write_header_;
+  if (header.num_records == 0 && keys_.empty()) {
+    header.channels = datum.channels();
+    header.height = datum.height();
+    header.width = datum.width();
+  }
+  CHECK_EQ(datum.channels(), header.channels) << "Record " << key;
+  CHECK_EQ(datum.height(), header.height) << "Record " << key;
+  CHECK_EQ(datum.width(), header.width) << "Record " << key;
+  const int size = datum.channels() * datum.height() * datum.width();
+  if (datum.float_data_size() > 0) {
+    CHECK_EQ(datum.float_data_size(), size) << "Record " << key;
+    records_.insert(records_.end(), datum.float_data().begin(),
+                    datum.float_data().end());
+  } else {
+    const string& data = datum.data();
+    CHECK_EQ(data.size(), size) << "Record " << key;
+    for (int i = 0; i < size; ++i) {
+      records_.push_back(static_cast<uint8_t>(data[i]));
+    }
+  }
+  keys_.push_back(key);
+  labels_.push_back(datum.label());
+}
+
+void MmapTransaction::Commit() {
+  db_->Append(keys_, labels_, records_);
+  keys_.clear();
+  labels_.clear();
+  records_.clear();
+}
+
+void MmapDB::Open(const string& source, Mode mode) {
+  source_ = source;
+  if (mode == READ) {
+    const int fd = open(source.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "Failed to open mmap db " << source;
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat " << source;
+    map_size_ = st.st_size;
+    CHECK_GE(map_size_, sizeof(MmapHeader)) << "Truncated mmap db " << source;
+    void* map = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(map != MAP_FAILED) << "Failed to map " << source;
+    map_ = static_cast<char*>(map);
+    header_ = reinterpret_cast<const MmapHeader*>(map_);
+    CHECK_EQ(header_->magic, kMmapMagic) << source << " is not an mmap db.";
+    CHECK_EQ(header_->version, kMmapVersion) << "Unsupported version of "
+        << source;
+    CHECK_EQ(header_->labels_offset, sizeof(MmapHeader) +
+        header_->num_records * record_floats() * sizeof(float))
+        << "Corrupted mmap db " << source;
+    CHECK_EQ(header_->keys_offset, header_->labels_offset +
+        header_->num_records * sizeof(int32_t))
+        << "Corrupted mmap db " << source;
+    CHECK_LE(header_->keys_offset +
+        (header_->num_records + 1) * sizeof(uint64_t), map_size_)
+        << "Truncated mmap db " << source;
+    LOG(INFO) << "Opened mmap db " << source << ": " << num_records()
+              << " records of " << channels() << " x " << height() << " x "
+              << width();
+    return;
+  }
+  memset(&write_header_, 0, sizeof(write_header_));
+  write_header_.magic = kMmapMagic;
+  write_header_.version = kMmapVersion;
+  labels_.clear();
+  keys_.clear();
+  if (mode == WRITE) {
+    // Keep the labels and keys of the existing records, and append after
+    // the last record.
+    MmapDB db;
+    db.Open(source, READ);
+    write_header_.num_records = db.num_records();
+    write_header_.channels = db.channels();
+    write_header_.height = db.height();
+    write_header_.width = db.width();
+    for (uint64_t i = 0; i < db.num_records(); ++i) {
+      labels_.push_back(db.label(i));
+      keys_.push_back(db.key(i));
+    }
+    db.Close();
+    file_ = fopen(source.c_str(), "r+b");
+    CHECK(file_) << "Failed to open mmap db " << source;
+    const uint64_t records_end = sizeof(MmapHeader) +
+        write_header_.num_records * write_header_.channels *
+        write_header_.height * write_header_.width * sizeof(float);
+    CHECK_EQ(ftruncate(fileno(file_), records_end), 0);
+    CHECK_EQ(fseeko(file_, records_end, SEEK_SET), 0);
+  } else {
+    file_ = fopen(source.c_str(), "wb");
+    CHECK(file_) << "Failed to create mmap db " << source;
+    // The header is rewritten on Close().
+    CHECK_EQ(fwrite(&write_header_, sizeof(write_header_), 1, file_), 1);
+  }
+  LOG(INFO) << "Opened mmap db " << source;
+}
+
+void MmapDB::Close() {
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+    map_ = NULL;
+    header_ = NULL;
+  }
+  if (file_ != NULL) {
+    Finish();
+    fclose(file_);
+    file_ = NULL;
+  }
+}
+
+MmapCursor* MmapDB::NewCursor() {
+  CHECK(map_) << "Open mmap db " << source_ << " for reading first.";
+  return new MmapCursor(this);
+}
+
+MmapTransaction* MmapDB::NewTransaction() {
+  CHECK(file_) << "Open mmap db " << source_ << " for writing first.";
+  return new MmapTransaction(this);
+}
+
+string MmapDB::key(uint64_t i) const {
+  const uint64_t* offsets =
+      reinterpret_cast<const uint64_t*>(map_ + header_->keys_offset);
+  const char* keys =
+      reinterpret_cast<const char*>(offsets + header_->num_records + 1);
+  CHECK_LE(keys + offsets[i + 1], map_ + map_size_);
+  return string(keys + offsets[i], offsets[i + 1] - offsets[i]);
+}
+
+void MmapDB::Append(const vector<string>& keys, const vector<int>& labels,
+    const vector<float>& records) {
+  CHECK(file_);
+  if (!records.empty()) {
+    CHECK_EQ(fwrite(&records[0], sizeof(float), records.size(), file_),
+             records.size()) << "Failed to write to " << source_;
+  }
+  keys_.insert(keys_.end(), keys.begin(), keys.end());
+  labels_.insert(labels_.end(), labels.begin(), labels.end());
+  write_header_.num_records = keys_.size();
+}
+
+void MmapDB::Finish() {
+  const uint64_t num_records = keys_.size();
+  write_header_.labels_offset = sizeof(MmapHeader) + num_records *
+      write_header_.channels * write_header_.height * write_header_.width *
+      sizeof(float);
+  write_header_.keys_offset =
+      write_header_.labels_offset + num_records * sizeof(int32_t);
+  vector<int32_t> labels(labels_.begin(), labels_.end());
+  vector<uint64_t> offsets(1, 0);
+  for (uint64_t i = 0; i < num_records; ++i) {
+    offsets.push_back(offsets.back() + keys_[i].size());
+  }
+  bool ok = fseeko(file_, write_header_.labels_offset, SEEK_SET) == 0;
+  if (num_records > 0) {
+    ok = ok && fwrite(&labels[0], sizeof(int32_t), num_records, file_) ==
+        num_records;
+  }
+  ok = ok && fwrite(&offsets[0], sizeof(uint64_t), offsets.size(), file_) ==
+      offsets.size();
+  for (uint64_t i = 0; ok && i < num_records; ++i) {
+    ok = fwrite(keys_[i].data(), 1, keys_[i].size(), file_) ==
+        keys_[i].size();
+  }
+  ok = ok && fseeko(file_, 0, SEEK_SET) == 0;
+  ok = ok && fwrite(&write_header_, sizeof(write_header_), 1, file_) == 1;
+  CHECK(ok) << "Failed to write mmap db " << source_;
+}
+
+}  // namespace db
+}  // namespace caffe
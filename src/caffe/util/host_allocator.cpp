@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+// Each block starts with a header, and the memory returned follows it,
+// 64-byte aligned like the block.
+const size_t kHeaderBytes = 64;
+const uint32_t kBlockMagic = 0x4b4c4243;  // "CBLK"
+const size_t kHugePageBytes = 2 << 20;
+
+struct BlockHeader {
+  uint32_t magic;
+  int32_t size_class;
+};
+
+HostAllocator& HostAllocator::Get() {
+  // Never destroyed, as blobs of static storage may outlive it.
+  static HostAllocator* allocator = new HostAllocator();
+  return *allocator;
+}
+
+HostAllocator::HostAllocator() : cache_bytes_(0) {
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+// Class 0 holds up to 64 bytes. Class 4 * (k - 6) + m, for m in [1, 4],
+// holds up to 2^k + m * 2^(k - 2) bytes.
+int HostAllocator::SizeClass(size_t size) {
+  if (size <= 64) {
+    return 0;
+  }
+  int k = 6;
+  while ((size - 1) >> (k + 1)) {
+    ++k;
+  }
+  const size_t step = size_t(1) << (k - 2);
+  const size_t m = (size - (size_t(1) << k) + step - 1) / step;
+  return 4 * (k - 6) + m;
+}
+
+size_t HostAllocator::ClassBytesOf(int size_class) {
+  if (size_class == 0) {
+    return 64;
+  }
+  const int k = 6 + (size_class - 1) / 4;
+  const size_t m = (size_class - 1) % 4 + 1;
+  return (size_t(1) << k) + m * (size_t(1) << (k - 2));
+}
+
+size_t HostAllocator::ClassBytes(size_t size) {
+  return ClassBytesOf(SizeClass(size));
+}
+
+void* HostAllocator::SystemAllocate(size_t block_bytes) {
+  const bool huge = block_bytes >= kHugePageBytes;
+  void* block = NULL;
+  const int error = posix_memalign(&block, huge ? kHugePageBytes : 64,
+                                   block_bytes);
+  CHECK_EQ(error, 0) << "host allocation of size " << block_bytes
+      << " failed";
+#ifdef MADV_HUGEPAGE
+  if (huge) {
+    // Only a hint: the kernel may not support transparent huge pages.
+    madvise(block, block_bytes / kHugePageBytes * kHugePageBytes,
+            MADV_HUGEPAGE);
+  }
+#endif
+  return block;
+}
+
+void* HostAllocator::Allocate(size_t size) {
+  const int size_class = SizeClass(size);
+  const size_t bytes = ClassBytesOf(size_class);
+  void* block = NULL;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ++stats_.allocations;
+    stats_.bytes_in_use += bytes;
+    stats_.peak_bytes_in_use =
+        std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
+    if (size_class < free_.size() && !free_[size_class].empty()) {
+      block = free_[size_class].back();
+      free_[size_class].pop_back();
+      stats_.bytes_cached -= bytes;
+      ++stats_.cache_hits;
+    } else {
+      ++stats_.system_allocations;
+    }
+  }
+  if (!block) {
+    block = SystemAllocate(kHeaderBytes + bytes);
+  }
+  BlockHeader* header = static_cast<BlockHeader*>(block);
+  header->magic = kBlockMagic;
+  header->size_class = size_class;
+  return static_cast<char*>(block) + kHeaderBytes;
+}
+
+void HostAllocator::Free(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  void* block = static_cast<char*>(ptr) - kHeaderBytes;
+  const BlockHeader* header = static_cast<const BlockHeader*>(block);
+  CHECK_EQ(header->magic, kBlockMagic)
+      << "Freeing host memory not allocated by the HostAllocator";
+  const int size_class = header->size_class;
+  const size_t bytes = ClassBytesOf(size_class);
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ++stats_.frees;
+    stats_.bytes_in_use -= bytes;
+    if (stats_.bytes_cached + bytes <= cache_bytes_) {
+      if (free_.size() <= size_class) {
+        free_.resize(size_class + 1);
+      }
+      free_[size_class].push_back(block);
+      stats_.bytes_cached += bytes;
+      return;
+    }
+  }
+  free(block);
+}
+
+void HostAllocator::set_cache_bytes(size_t cache_bytes) {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    cache_bytes_ = cache_bytes;
+    if (stats_.bytes_cached <= cache_bytes_) {
+      return;
+    }
+  }
+  Trim();
+}
+
+size_t HostAllocator::cache_bytes() const {
+  boost::mutex::scoped_lock lock(mutex_);
+  return cache_bytes_;
+}
+
+void HostAllocator::Trim() {
+  vector<vector<void*> > blocks;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    blocks.swap(free_);
+    stats_.bytes_cached = 0;
+  }
+  for (int i = 0; i < blocks.size(); ++i) {
+    for (int j = 0; j < blocks[i].size(); ++j) {
+      free(blocks[i][j]);
+    }
+  }
+}
+
+HostAllocatorStats HostAllocator::stats() const {
+  boost::mutex::scoped_lock lock(mutex_);
+  return stats_;
+}
+
+void HostAllocator::ResetPeak() {
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.peak_bytes_in_use = stats_.bytes_in_use;
+}
+
+}  // namespace caffe
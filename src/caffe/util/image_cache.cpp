@@ -0,0 +1,83 @@
+#ifdef USE_OPENCV
+#include <string>
+
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+static boost::mutex cache_mutex_;
+
+static size_t ImageBytes(const cv::Mat& img) {
+  return img.total() * img.elemSize();
+}
+
+DecodedImageCache& DecodedImageCache::Get(size_t byte_budget) {
+  static DecodedImageCache cache(0);
+  boost::mutex::scoped_lock lock(cache_mutex_);
+  if (cache.byte_budget_ < byte_budget) {
+    boost::mutex::scoped_lock cache_lock(cache.mutex_);
+    LOG(INFO) << "Decoded image cache budget: " << (byte_budget >> 20)
+              << " MB.";
+    cache.byte_budget_ = byte_budget;
+  }
+  return cache;
+}
+
+DecodedImageCache::DecodedImageCache(size_t byte_budget)
+    : byte_budget_(byte_budget), bytes_(0), hits_(0), misses_(0) {
+}
+
+uint64_t DecodedImageCache::hits() const {
+  boost::mutex::scoped_lock lock(mutex_);
+  return hits_;
+}
+
+uint64_t DecodedImageCache::misses() const {
+  boost::mutex::scoped_lock lock(mutex_);
+  return misses_;
+}
+
+size_t DecodedImageCache::bytes() const {
+  boost::mutex::scoped_lock lock(mutex_);
+  return bytes_;
+}
+
+bool DecodedImageCache::Lookup(const string& key, cv::Mat* img) {
+  boost::mutex::scoped_lock lock(mutex_);
+  std::map<string, LruList::iterator>::iterator it = index_.find(key);
+  if (it == index_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  // Move the image to the front of the list.
+  lru_.splice(lru_.begin(), lru_, it->second);
+  it->second->second.copyTo(*img);
+  return true;
+}
+
+void DecodedImageCache::Insert(const string& key, const cv::Mat& img) {
+  const size_t img_bytes = ImageBytes(img);
+  // Copy outside of the lock.
+  cv::Mat cached = img.clone();
+  boost::mutex::scoped_lock lock(mutex_);
+  if (img_bytes > byte_budget_ || index_.find(key) != index_.end()) {
+    // Too large, or another reader decoded the same image meanwhile.
+    return;
+  }
+  Evict(img_bytes);
+  lru_.push_front(std::make_pair(key, cached));
+  index_[key] = lru_.begin();
+  bytes_ += img_bytes;
+}
+
+void DecodedImageCache::Evict(size_t bytes_needed) {
+  while (!lru_.empty() && bytes_ + bytes_needed > byte_budget_) {
+    bytes_ -= ImageBytes(lru_.back().second);
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -0,0 +1,298 @@
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PACK_PIXELS_X86
+#include <immintrin.h>
+#endif
+#include <string.h>
+
+#include "caffe/common.hpp"
+#include "caffe/util/pack_pixels.hpp"
+
+namespace caffe {
+
+enum PackMeanMode {
+  PACK_NO_MEAN,
+  PACK_MEAN_VALUES,
+  PACK_MEAN_FILE
+};
+
+// Packs the pixels [w_begin, width) of one output row. kChannels is 0 when
+// the channel count is only known at run time.
+template <typename Dtype, int kChannels, int kMeanMode>
+inline void pack_row(const uint8_t* im_row, const int channels,
+    const int width, const int w_begin, const bool mirror,
+    const Dtype* mean_row, const int mean_plane, const Dtype* mean_values,
+    const Dtype scale, Dtype* blob_row, const int blob_plane) {
+  const int num_channels = kChannels > 0 ? kChannels : channels;
+  for (int c = 0; c < num_channels; ++c) {
+    const uint8_t* im_ptr = im_row + c;
+    const Dtype* mean =
+        kMeanMode == PACK_MEAN_FILE ? mean_row + c * mean_plane : NULL;
+    const Dtype mean_value =
+        kMeanMode == PACK_MEAN_VALUES ? mean_values[c] : 0;
+    Dtype* blob_ptr = blob_row + c * blob_plane;
+    for (int w = w_begin; w < width; ++w) {
+      const int im_w = mirror ? width - 1 - w : w;
+      const Dtype pixel = static_cast<Dtype>(im_ptr[im_w * num_channels]);
+      if (kMeanMode == PACK_MEAN_FILE) {
+        blob_ptr[w] = (pixel - mean[w]) * scale;
+      } else if (kMeanMode == PACK_MEAN_VALUES) {
+        blob_ptr[w] = (pixel - mean_value) * scale;
+      } else {
+        blob_ptr[w] = pixel * scale;
+      }
+    }
+  }
+}
+
+// Vectorized prefix of pack_row with the instruction set isa. Returns the
+// number of output pixels of the row it packed; the remaining ones go
+// through pack_row.
+template <typename Dtype, int kChannels, int kMeanMode>
+struct pack_row_simd {
+  static int run(const PackPixelsIsa isa, const uint8_t* im_row,
+      const int width, const bool mirror, const Dtype* mean_row,
+      const int mean_plane, const Dtype* mean_values, const Dtype scale,
+      Dtype* blob_row, const int blob_plane) {
+    return 0;
+  }
+};
+
+#ifdef PACK_PIXELS_X86
+// The vector kernels are compiled for their instruction set whatever the
+// -march, and only run on the CPUs that support it.
+
+// Loads 4 pixels of kChannels (<= 4) bytes into the low bytes of a register.
+template <int kChannels>
+__attribute__((target("ssse3")))
+inline __m128i load_pixels(const uint8_t* im_ptr) {
+  int32_t tail;
+  memcpy(&tail, im_ptr + 4 * kChannels - 4, 4);
+  if (kChannels == 1) {
+    return _mm_cvtsi32_si128(tail);
+  }
+  return _mm_unpacklo_epi64(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(im_ptr)),
+      _mm_cvtsi32_si128(tail));
+}
+
+// Shuffle mask gathering channel c of the 4 pixels loaded by load_pixels
+// into 4 int32 lanes, in reverse order if reverse is set.
+__attribute__((target("ssse3")))
+inline __m128i pixel_shuffle_mask(const int channels, const int c,
+    const bool reverse) {
+  int8_t mask[16];
+  for (int i = 0; i < 4; ++i) {
+    const int pixel = reverse ? 3 - i : i;
+    mask[4 * i] = static_cast<int8_t>(pixel * channels + c);
+    mask[4 * i + 1] = mask[4 * i + 2] = mask[4 * i + 3] = -1;
+  }
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+}
+
+// Packs the pixels of the row 4 at a time from w, and returns where it
+// stopped.
+template <int kChannels, int kMeanMode>
+__attribute__((target("ssse3")))
+int pack_row_ssse3(int w, const uint8_t* im_row, const int width,
+    const bool mirror, const float* mean_row, const int mean_plane,
+    const float* mean_values, const float scale, float* blob_row,
+    const int blob_plane) {
+  const int num_channels = kChannels > 0 ? kChannels : 1;
+  __m128i masks[num_channels];
+  for (int c = 0; c < num_channels; ++c) {
+    masks[c] = pixel_shuffle_mask(num_channels, c, mirror);
+  }
+  const __m128 scale4 = _mm_set1_ps(scale);
+  for (; w + 4 <= width; w += 4) {
+    const int im_w = mirror ? width - 4 - w : w;
+    const __m128i pixels =
+        load_pixels<kChannels>(im_row + im_w * num_channels);
+    for (int c = 0; c < num_channels; ++c) {
+      __m128 v = _mm_cvtepi32_ps(_mm_shuffle_epi8(pixels, masks[c]));
+      if (kMeanMode == PACK_MEAN_FILE) {
+        v = _mm_sub_ps(v, _mm_loadu_ps(mean_row + c * mean_plane + w));
+      } else if (kMeanMode == PACK_MEAN_VALUES) {
+        v = _mm_sub_ps(v, _mm_set1_ps(mean_values[c]));
+      }
+      _mm_storeu_ps(blob_row + c * blob_plane + w, _mm_mul_ps(v, scale4));
+    }
+  }
+  return w;
+}
+
+// Packs the pixels of the row 8 at a time, then 4 at a time.
+template <int kChannels, int kMeanMode>
+__attribute__((target("avx2")))
+int pack_row_avx2(const uint8_t* im_row, const int width, const bool mirror,
+    const float* mean_row, const int mean_plane, const float* mean_values,
+    const float scale, float* blob_row, const int blob_plane) {
+  const int num_channels = kChannels > 0 ? kChannels : 1;
+  __m256i masks8[num_channels];
+  for (int c = 0; c < num_channels; ++c) {
+    masks8[c] = _mm256_broadcastsi128_si256(
+        pixel_shuffle_mask(num_channels, c, mirror));
+  }
+  const __m256 scale8 = _mm256_set1_ps(scale);
+  int w = 0;
+  for (; w + 8 <= width; w += 8) {
+    const int im_w = mirror ? width - 8 - w : w;
+    const __m128i lo = load_pixels<kChannels>(im_row + im_w * num_channels);
+    const __m128i hi =
+        load_pixels<kChannels>(im_row + (im_w + 4) * num_channels);
+    const __m256i pixels = mirror ?
+        _mm256_inserti128_si256(_mm256_castsi128_si256(hi), lo, 1) :
+        _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    for (int c = 0; c < num_channels; ++c) {
+      __m256 v = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(pixels, masks8[c]));
+      if (kMeanMode == PACK_MEAN_FILE) {
+        v = _mm256_sub_ps(v, _mm256_loadu_ps(mean_row + c * mean_plane + w));
+      } else if (kMeanMode == PACK_MEAN_VALUES) {
+        v = _mm256_sub_ps(v, _mm256_set1_ps(mean_values[c]));
+      }
+      _mm256_storeu_ps(blob_row + c * blob_plane + w,
+                       _mm256_mul_ps(v, scale8));
+    }
+  }
+  return pack_row_ssse3<kChannels, kMeanMode>(w, im_row, width, mirror,
+      mean_row, mean_plane, mean_values, scale, blob_row, blob_plane);
+}
+
+template <int kChannels, int kMeanMode>
+struct pack_row_simd<float, kChannels, kMeanMode> {
+  static int run(const PackPixelsIsa isa, const uint8_t* im_row,
+      const int width, const bool mirror, const float* mean_row,
+      const int mean_plane, const float* mean_values, const float scale,
+      float* blob_row, const int blob_plane) {
+    if (kChannels != 1 && kChannels != 3) {
+      return 0;
+    }
+    switch (isa) {
+    case PACK_PIXELS_AVX2:
+      return pack_row_avx2<kChannels, kMeanMode>(im_row, width, mirror,
+          mean_row, mean_plane, mean_values, scale, blob_row, blob_plane);
+    case PACK_PIXELS_SSSE3:
+      return pack_row_ssse3<kChannels, kMeanMode>(0, im_row, width, mirror,
+          mean_row, mean_plane, mean_values, scale, blob_row, blob_plane);
+    default:
+      return 0;
+    }
+  }
+};
+#endif  // PACK_PIXELS_X86
+
+template <typename Dtype, int kChannels, int kMeanMode>
+void pack_image(const PackPixelsIsa isa, const uint8_t* data_im,
+    const int im_step, const int channels, const int height, const int width,
+    const Dtype* mean_data, const int mean_step, const int mean_plane,
+    const Dtype* mean_values, const Dtype scale, const bool mirror,
+    Dtype* data_blob) {
+  const int blob_plane = height * width;
+  for (int h = 0; h < height; ++h) {
+    const uint8_t* im_row = data_im + h * im_step;
+    const Dtype* mean_row =
+        kMeanMode == PACK_MEAN_FILE ? mean_data + h * mean_step : NULL;
+    Dtype* blob_row = data_blob + h * width;
+    const int w_simd = pack_row_simd<Dtype, kChannels, kMeanMode>::run(
+        isa, im_row, width, mirror, mean_row, mean_plane, mean_values, scale,
+        blob_row, blob_plane);
+    pack_row<Dtype, kChannels, kMeanMode>(im_row, channels, width, w_simd,
+        mirror, mean_row, mean_plane, mean_values, scale, blob_row,
+        blob_plane);
+  }
+}
+
+template <typename Dtype, int kMeanMode>
+void pack_image_channels(const PackPixelsIsa isa, const uint8_t* data_im,
+    const int im_step, const int channels, const int height, const int width,
+    const Dtype* mean_data, const int mean_step, const int mean_plane,
+    const Dtype* mean_values, const Dtype scale, const bool mirror,
+    Dtype* data_blob) {
+  switch (channels) {
+  case 1:
+    pack_image<Dtype, 1, kMeanMode>(isa, data_im, im_step, channels, height,
+        width, mean_data, mean_step, mean_plane, mean_values, scale, mirror,
+        data_blob);
+    break;
+  case 3:
+    pack_image<Dtype, 3, kMeanMode>(isa, data_im, im_step, channels, height,
+        width, mean_data, mean_step, mean_plane, mean_values, scale, mirror,
+        data_blob);
+    break;
+  default:
+    pack_image<Dtype, 0, kMeanMode>(isa, data_im, im_step, channels, height,
+        width, mean_data, mean_step, mean_plane, mean_values, scale, mirror,
+        data_blob);
+  }
+}
+
+PackPixelsIsa pack_pixels_max_isa() {
+#ifdef PACK_PIXELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return PACK_PIXELS_AVX2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return PACK_PIXELS_SSSE3;
+  }
+#endif  // PACK_PIXELS_X86
+  return PACK_PIXELS_SCALAR;
+}
+
+template <typename Dtype>
+void pack_pixels_cpu_isa(const PackPixelsIsa isa, const uint8_t* data_im,
+    const int im_step, const int channels, const int height, const int width,
+    const Dtype* mean_data, const int mean_step, const int mean_plane,
+    const Dtype* mean_values, const Dtype scale, const bool mirror,
+    Dtype* data_blob) {
+  CHECK_LE(isa, pack_pixels_max_isa()) << "The CPU does not support the "
+      << "instruction set.";
+  if (mean_data) {
+    pack_image_channels<Dtype, PACK_MEAN_FILE>(isa, data_im, im_step,
+        channels, height, width, mean_data, mean_step, mean_plane,
+        mean_values, scale, mirror, data_blob);
+  } else if (mean_values) {
+    pack_image_channels<Dtype, PACK_MEAN_VALUES>(isa, data_im, im_step,
+        channels, height, width, mean_data, mean_step, mean_plane,
+        mean_values, scale, mirror, data_blob);
+  } else {
+    pack_image_channels<Dtype, PACK_NO_MEAN>(isa, data_im, im_step,
+        channels, height, width, mean_data, mean_step, mean_plane,
+        mean_values, scale, mirror, data_blob);
+  }
+}
+
+template <typename Dtype>
+void pack_pixels_cpu(const uint8_t* data_im, const int im_step,
+    const int channels, const int height, const int width,
+    const Dtype* mean_data, const int mean_step, const int mean_plane,
+    const Dtype* mean_values, const Dtype scale, const bool mirror,
+    Dtype* data_blob) {
+  static const PackPixelsIsa isa = pack_pixels_max_isa();
+  pack_pixels_cpu_isa(isa, data_im, im_step, channels, height, width,
+      mean_data, mean_step, mean_plane, mean_values, scale, mirror,
+      data_blob);
+}
+
+// Explicit instantiation
+template void pack_pixels_cpu<float>(const uint8_t* data_im,
+    const int im_step, const int channels, const int height, const int width,
+    const float* mean_data, const int mean_step, const int mean_plane,
+    const float* mean_values, const float scale, const bool mirror,
+    float* data_blob);
+template void pack_pixels_cpu<double>(const uint8_t* data_im,
+    const int im_step, const int channels, const int height, const int width,
+    const double* mean_data, const int mean_step, const int mean_plane,
+    const double* mean_values, const double scale, const bool mirror,
+    double* data_blob);
+template void pack_pixels_cpu_isa<float>(const PackPixelsIsa isa,
+    const uint8_t* data_im, const int im_step, const int channels,
+    const int height, const int width, const float* mean_data,
+    const int mean_step, const int mean_plane, const float* mean_values,
+    const float scale, const bool mirror, float* data_blob);
+template void pack_pixels_cpu_isa<double>(const PackPixelsIsa isa,
+    const uint8_t* data_im, const int im_step, const int channels,
+    const int height, const int width, const double* mean_data,
+    const int mean_step, const int mean_plane, const double* mean_values,
+    const double scale, const bool mirror, double* data_blob);
+
+}  // namespace caffe
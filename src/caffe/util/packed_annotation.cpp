@@ -0,0 +1,157 @@
+#include <string.h>
+
+#include <string>
+
+#include "caffe/util/packed_annotation.hpp"
+
+namespace caffe {
+
+static void PackLandmarks(const AnnoFaceLandmarks& face_lm, float* landmarks) {
+  const point* points[5] = {&face_lm.lefteye(), &face_lm.righteye(),
+      &face_lm.nose(), &face_lm.leftmouth(), &face_lm.rightmouth()};
+  for (int i = 0; i < 5; ++i) {
+    landmarks[2 * i] = points[i]->x();
+    landmarks[2 * i + 1] = points[i]->y();
+  }
+}
+
+void UnpackLandmarks(const float* landmarks, AnnoFaceLandmarks* face_lm) {
+  point* points[5] = {face_lm->mutable_lefteye(), face_lm->mutable_righteye(),
+      face_lm->mutable_nose(), face_lm->mutable_leftmouth(),
+      face_lm->mutable_rightmouth()};
+  for (int i = 0; i < 5; ++i) {
+    points[i]->set_x(landmarks[2 * i]);
+    points[i]->set_y(landmarks[2 * i + 1]);
+  }
+}
+
+void PackAnnotationGroups(const RepeatedPtrField<AnnotationGroup>& groups,
+    string* packed) {
+  int num_annotations = 0;
+  for (int g = 0; g < groups.size(); ++g) {
+    num_annotations += groups.Get(g).annotation_size();
+  }
+  packed->assign(sizeof(PackedAnnotationHeader) +
+                 num_annotations * sizeof(PackedAnnotation), 0);
+  PackedAnnotationHeader header;
+  header.magic = kPackedAnnotationMagic;
+  header.num_annotations = num_annotations;
+  memcpy(&(*packed)[0], &header, sizeof(header));
+  char* record_data = &(*packed)[sizeof(header)];
+  for (int g = 0; g < groups.size(); ++g) {
+    const AnnotationGroup& group = groups.Get(g);
+    for (int a = 0; a < group.annotation_size(); ++a) {
+      const Annotation& anno = group.annotation(a);
+      PackedAnnotation record;
+      memset(&record, 0, sizeof(record));
+      record.xmin = anno.bbox().xmin();
+      record.ymin = anno.bbox().ymin();
+      record.xmax = anno.bbox().xmax();
+      record.ymax = anno.bbox().ymax();
+      record.group_label = group.group_label();
+      record.instance_id = anno.instance_id();
+      record.has_lm = anno.has_lm();
+      if (anno.bbox().difficult()) {
+        record.flags |= PackedAnnotation::DIFFICULT;
+      }
+      if (anno.has_face_lm()) {
+        record.flags |= PackedAnnotation::HAS_FACE_LM;
+        PackLandmarks(anno.face_lm(), record.landmarks);
+      }
+      memcpy(record_data, &record, sizeof(record));
+      record_data += sizeof(record);
+    }
+  }
+}
+
+void UnpackAnnotation(const PackedAnnotation& record, Annotation* anno) {
+  anno->Clear();
+  anno->set_instance_id(record.instance_id);
+  NormalizedBBox* bbox = anno->mutable_bbox();
+  bbox->set_xmin(record.xmin);
+  bbox->set_ymin(record.ymin);
+  bbox->set_xmax(record.xmax);
+  bbox->set_ymax(record.ymax);
+  bbox->set_difficult(record.flags & PackedAnnotation::DIFFICULT);
+  if (record.has_lm != 0) {
+    anno->set_has_lm(record.has_lm);
+  }
+  if (record.flags & PackedAnnotation::HAS_FACE_LM) {
+    UnpackLandmarks(record.landmarks, anno->mutable_face_lm());
+  }
+}
+
+const PackedAnnotation* PackedAnnotations(const string& packed, int* num) {
+  CHECK_GE(packed.size(), sizeof(PackedAnnotationHeader))
+      << "Truncated packed annotation.";
+  const PackedAnnotationHeader* header =
+      reinterpret_cast<const PackedAnnotationHeader*>(packed.data());
+  CHECK_EQ(header->magic, kPackedAnnotationMagic)
+      << "Not a packed annotation.";
+  CHECK_EQ(packed.size(), sizeof(PackedAnnotationHeader) +
+           header->num_annotations * sizeof(PackedAnnotation))
+      << "Truncated packed annotation.";
+  // std::string storage comes from operator new, which is aligned for any
+  // fundamental type, so the records can be read in place.
+  *num = header->num_annotations;
+  return reinterpret_cast<const PackedAnnotation*>(
+      packed.data() + sizeof(PackedAnnotationHeader));
+}
+
+void UnpackAnnotationGroups(const string& packed,
+    RepeatedPtrField<AnnotationGroup>* groups) {
+  groups->Clear();
+  int num_annotations;
+  const PackedAnnotation* records = PackedAnnotations(packed, &num_annotations);
+  AnnotationGroup* group = NULL;
+  for (int i = 0; i < num_annotations; ++i) {
+    const PackedAnnotation& record = records[i];
+    if (group == NULL || group->group_label() != record.group_label) {
+      group = groups->Add();
+      group->set_group_label(record.group_label);
+    }
+    UnpackAnnotation(record, group->add_annotation());
+  }
+}
+
+void PackAnnotatedDatum(AnnotatedDatum* anno_datum) {
+  if (anno_datum->has_packed_annotation()) {
+    return;
+  }
+  PackAnnotationGroups(anno_datum->annotation_group(),
+                       anno_datum->mutable_packed_annotation());
+  anno_datum->clear_annotation_group();
+}
+
+void UnpackAnnotatedDatum(AnnotatedDatum* anno_datum) {
+  if (!anno_datum->has_packed_annotation()) {
+    return;
+  }
+  UnpackAnnotationGroups(anno_datum->packed_annotation(),
+                         anno_datum->mutable_annotation_group());
+  anno_datum->clear_packed_annotation();
+}
+
+const RepeatedPtrField<AnnotationGroup>& AnnotationGroups(
+    const AnnotatedDatum& anno_datum,
+    RepeatedPtrField<AnnotationGroup>* storage) {
+  if (!anno_datum.has_packed_annotation()) {
+    return anno_datum.annotation_group();
+  }
+  UnpackAnnotationGroups(anno_datum.packed_annotation(), storage);
+  return *storage;
+}
+
+int NumAnnotations(const AnnotatedDatum& anno_datum) {
+  int num_annotations = 0;
+  if (anno_datum.has_packed_annotation()) {
+    PackedAnnotations(anno_datum.packed_annotation(), &num_annotations);
+    return num_annotations;
+  }
+  for (int g = 0; g < anno_datum.annotation_group_size(); ++g) {
+    num_annotations += anno_datum.annotation_group(g).annotation_size();
+  }
+  return num_annotations;
+}
+
+}  // namespace caffe
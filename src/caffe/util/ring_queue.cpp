@@ -0,0 +1,262 @@
+#include <boost/thread.hpp>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/ring_queue.hpp"
+
+namespace caffe {
+
+// Attempts of a blocking call on the ring before yielding the processor, and
+// yields before parking. A prefetch hand-off is usually served while
+// spinning; an idle consumer ends up parked.
+static const int kRingSpins = 128;
+static const int kRingYields = 16;
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+template<typename T>
+class RingQueue<T>::sync {
+ public:
+  explicit sync(int capacity);
+
+  // Non-blocking ring operations, in the form taken by wait().
+  bool enqueue(T* t);
+  bool dequeue(T* t);
+  bool front(T* t);
+
+  typedef bool (sync::*Op)(T* t);
+  // Runs op until it succeeds: spins, yields, then parks on cond.
+  void wait(Op op, T* t, std::atomic<int>* waiters,
+      boost::condition_variable* cond, const string& log_on_wait);
+  // Wakes the threads parked on cond, if any.
+  void notify(std::atomic<int>* waiters, boost::condition_variable* cond);
+
+  struct Cell {
+    // pos when the cell is free for the push at position pos, pos + 1 when
+    // it holds the item of that push.
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  vector<Cell> cells_;
+  const size_t mask_;
+  // Producers and consumers each update their own position; keep them on
+  // separate cache lines.
+  char pad0_[64];
+  std::atomic<size_t> enqueue_pos_;
+  char pad1_[64];
+  std::atomic<size_t> dequeue_pos_;
+  char pad2_[64];
+
+  std::atomic<int> push_waiters_;
+  std::atomic<int> pop_waiters_;
+  boost::mutex mutex_;
+  boost::condition_variable not_full_;
+  boost::condition_variable not_empty_;
+};
+
+static size_t ring_size(int capacity) {
+  CHECK_GT(capacity, 0);
+  size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  return size;
+}
+
+template<typename T>
+RingQueue<T>::sync::sync(int capacity)
+    : cells_(ring_size(capacity)), mask_(ring_size(capacity) - 1),
+      enqueue_pos_(0), dequeue_pos_(0), push_waiters_(0), pop_waiters_(0) {
+  for (size_t i = 0; i < cells_.size(); ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template<typename T>
+bool RingQueue<T>::sync::enqueue(T* t) {
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Cell* cell;
+  for (;;) {
+    cell = &cells_[pos & mask_];
+    const size_t seq = cell->sequence.load(std::memory_order_acquire);
+    const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+          std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;  // full
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->data = *t;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool RingQueue<T>::sync::dequeue(T* t) {
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  Cell* cell;
+  for (;;) {
+    cell = &cells_[pos & mask_];
+    const size_t seq = cell->sequence.load(std::memory_order_acquire);
+    const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+          std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;  // empty
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  *t = cell->data;
+  cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool RingQueue<T>::sync::front(T* t) {
+  const size_t pos = dequeue_pos_.load(std::memory_order_acquire);
+  const Cell& cell = cells_[pos & mask_];
+  if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+    return false;
+  }
+  *t = cell.data;
+  return true;
+}
+
+template<typename T>
+void RingQueue<T>::sync::wait(Op op, T* t, std::atomic<int>* waiters,
+    boost::condition_variable* cond, const string& log_on_wait) {
+  for (int i = 0; i < kRingSpins; ++i) {
+    if ((this->*op)(t)) {
+      return;
+    }
+    cpu_relax();
+  }
+  for (int i = 0; i < kRingYields; ++i) {
+    boost::this_thread::interruption_point();
+    boost::this_thread::yield();
+    if ((this->*op)(t)) {
+      return;
+    }
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  waiters->fetch_add(1);
+  // Pairs with the fence of notify(): either op sees the item, or the
+  // notifying thread sees this waiter.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  try {
+    while (!(this->*op)(t)) {
+      if (!log_on_wait.empty()) {
+        LOG_EVERY_N(INFO, 1000)<< log_on_wait;
+      }
+      cond->wait(lock);
+    }
+  } catch (boost::thread_interrupted&) {
+    waiters->fetch_sub(1);
+    throw;
+  }
+  waiters->fetch_sub(1);
+}
+
+template<typename T>
+void RingQueue<T>::sync::notify(std::atomic<int>* waiters,
+    boost::condition_variable* cond) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters->load(std::memory_order_relaxed) > 0) {
+    // Taking the lock makes sure the waiter is blocked in cond->wait().
+    boost::mutex::scoped_lock lock(mutex_);
+    cond->notify_all();
+  }
+}
+
+template<typename T>
+RingQueue<T>::RingQueue(int capacity)
+    : sync_(new sync(capacity)) {
+}
+
+template<typename T>
+void RingQueue<T>::push(const T& t) {
+  T item = t;
+  sync_->wait(&sync::enqueue, &item, &sync_->push_waiters_,
+              &sync_->not_full_, "");
+  sync_->notify(&sync_->pop_waiters_, &sync_->not_empty_);
+}
+
+template<typename T>
+bool RingQueue<T>::try_push(const T& t) {
+  T item = t;
+  if (!sync_->enqueue(&item)) {
+    return false;
+  }
+  sync_->notify(&sync_->pop_waiters_, &sync_->not_empty_);
+  return true;
+}
+
+template<typename T>
+bool RingQueue<T>::try_pop(T* t) {
+  if (!sync_->dequeue(t)) {
+    return false;
+  }
+  sync_->notify(&sync_->push_waiters_, &sync_->not_full_);
+  return true;
+}
+
+template<typename T>
+T RingQueue<T>::pop(const string& log_on_wait) {
+  T t;
+  sync_->wait(&sync::dequeue, &t, &sync_->pop_waiters_, &sync_->not_empty_,
+              log_on_wait);
+  sync_->notify(&sync_->push_waiters_, &sync_->not_full_);
+  return t;
+}
+
+template<typename T>
+bool RingQueue<T>::try_peek(T* t) {
+  return sync_->front(t);
+}
+
+template<typename T>
+T RingQueue<T>::peek() {
+  T t;
+  sync_->wait(&sync::front, &t, &sync_->pop_waiters_, &sync_->not_empty_,
+              "");
+  return t;
+}
+
+template<typename T>
+size_t RingQueue<T>::size() const {
+  // Read the consumer position first: it never passes the producer one.
+  const size_t dequeue_pos =
+      sync_->dequeue_pos_.load(std::memory_order_acquire);
+  const size_t enqueue_pos =
+      sync_->enqueue_pos_.load(std::memory_order_acquire);
+  return enqueue_pos - dequeue_pos;
+}
+
+template<typename T>
+size_t RingQueue<T>::capacity() const {
+  return sync_->cells_.size();
+}
+
+template class RingQueue<int>;
+template class RingQueue<Datum*>;
+template class RingQueue<AnnotatedDatum*>;
+template class RingQueue<AnnoFaceAttributeDatum*>;
+template class RingQueue<AnnotatedCCpdDatum*>;
+
+}  // namespace caffe
@@ -1,10 +1,12 @@
 #include <algorithm>
+#include <limits>
 #include <vector>
 
 #include "caffe/util/bbox_util.hpp"
 #include "caffe/util/sampler.hpp"
 #include "caffe/util/im_transforms.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/packed_annotation.hpp"
 #include "google/protobuf/repeated_field.h"
 using google::protobuf::RepeatedPtrField;
 
@@ -60,6 +62,21 @@ void GenerateJitterSamples(const AnnotatedDatum& anno_datum, float jitter, vecto
 void GroupObjectBBoxes(const AnnotatedDatum& anno_datum,
                        vector<NormalizedBBox>* object_bboxes) {
     object_bboxes->clear();
+    if (anno_datum.has_packed_annotation()) {
+        int num_annotations;
+        const PackedAnnotation* records =
+            PackedAnnotations(anno_datum.packed_annotation(), &num_annotations);
+        object_bboxes->resize(num_annotations);
+        for (int i = 0; i < num_annotations; ++i) {
+            NormalizedBBox& bbox = (*object_bboxes)[i];
+            bbox.set_xmin(records[i].xmin);
+            bbox.set_ymin(records[i].ymin);
+            bbox.set_xmax(records[i].xmax);
+            bbox.set_ymax(records[i].ymax);
+            bbox.set_difficult(records[i].flags & PackedAnnotation::DIFFICULT);
+        }
+        return;
+    }
     for (int i = 0; i < anno_datum.annotation_group_size(); ++i) {
         const AnnotationGroup& anno_group = anno_datum.annotation_group(i);
         for (int j = 0; j < anno_group.annotation_size(); ++j) {
@@ -134,6 +151,210 @@ bool SatisfySampleConstraint(const NormalizedBBox& sampled_bbox,
     return found;
 }
 
+BBoxArray::BBoxArray(const vector<NormalizedBBox>& bboxes) {
+    for (int i = 0; i < bboxes.size(); ++i) {
+        push_back(bboxes[i]);
+    }
+}
+
+void BBoxArray::push_back(const NormalizedBBox& bbox) {
+    xmin.push_back(bbox.xmin());
+    ymin.push_back(bbox.ymin());
+    xmax.push_back(bbox.xmax());
+    ymax.push_back(bbox.ymax());
+    size.push_back(BBoxSize(bbox));
+}
+
+void BBoxArray::clear() {
+    xmin.clear();
+    ymin.clear();
+    xmax.clear();
+    ymax.clear();
+    size.clear();
+}
+
+enum SampleMetric {
+    JACCARD_OVERLAP,
+    SAMPLE_COVERAGE,
+    OBJECT_COVERAGE
+};
+
+// Computes JaccardOverlap(sample, object), BBoxCoverage(sample, object) or
+// BBoxCoverage(object, sample) for all the objects, with the same float
+// operations, but without branches so that the loop vectorizes.
+template <int kMetric>
+static void ComputeSampleMetric(const BBoxArray& sampled_bboxes, const int s,
+                                const BBoxArray& object_bboxes,
+                                float* values) {
+    const float sxmin = sampled_bboxes.xmin[s];
+    const float symin = sampled_bboxes.ymin[s];
+    const float sxmax = sampled_bboxes.xmax[s];
+    const float symax = sampled_bboxes.ymax[s];
+    const float ssize = sampled_bboxes.size[s];
+    const float* oxmin = &object_bboxes.xmin[0];
+    const float* oymin = &object_bboxes.ymin[0];
+    const float* oxmax = &object_bboxes.xmax[0];
+    const float* oymax = &object_bboxes.ymax[0];
+    const float* osize = &object_bboxes.size[0];
+    const int num_objects = object_bboxes.count();
+    for (int j = 0; j < num_objects; ++j) {
+        // IntersectBBox, which returns an empty box at 0 when disjoint. The
+        // order of the arguments of max and min follows it.
+        const bool disjoint = oxmin[j] > sxmax || oxmax[j] < sxmin ||
+            oymin[j] > symax || oymax[j] < symin;
+        float ixmin, iymin, ixmax, iymax;
+        if (kMetric == OBJECT_COVERAGE) {
+            ixmin = std::max(oxmin[j], sxmin);
+            iymin = std::max(oymin[j], symin);
+            ixmax = std::min(oxmax[j], sxmax);
+            iymax = std::min(oymax[j], symax);
+        } else {
+            ixmin = std::max(sxmin, oxmin[j]);
+            iymin = std::max(symin, oymin[j]);
+            ixmax = std::min(sxmax, oxmax[j]);
+            iymax = std::min(symax, oymax[j]);
+        }
+        ixmin = disjoint ? 0.f : ixmin;
+        iymin = disjoint ? 0.f : iymin;
+        ixmax = disjoint ? 0.f : ixmax;
+        iymax = disjoint ? 0.f : iymax;
+        const float iwidth = ixmax - ixmin;
+        const float iheight = iymax - iymin;
+        const float isize = iwidth * iheight;
+        if (kMetric == JACCARD_OVERLAP) {
+            const float overlap = isize / (ssize + osize[j] - isize);
+            values[j] = (iwidth > 0 && iheight > 0) ? overlap : 0.f;
+        } else {
+            // BBoxSize of the intersection.
+            const float valid_size =
+                (ixmax < ixmin || iymax < iymin) ? 0.f : isize;
+            const float coverage = valid_size /
+                (kMetric == SAMPLE_COVERAGE ? ssize : osize[j]);
+            values[j] = valid_size > 0 ? coverage : 0.f;
+        }
+    }
+}
+
+void SatisfySampleConstraints(const BBoxArray& sampled_bboxes,
+                              const BBoxArray& object_bboxes,
+                              const SampleConstraint& sample_constraint,
+                              vector<bool>* satisfied) {
+    const bool has_jaccard_overlap = sample_constraint.has_min_jaccard_overlap() ||
+        sample_constraint.has_max_jaccard_overlap();
+    const bool has_sample_coverage = sample_constraint.has_min_sample_coverage() ||
+        sample_constraint.has_max_sample_coverage();
+    const bool has_object_coverage = sample_constraint.has_min_object_coverage() ||
+        sample_constraint.has_max_object_coverage();
+    if (!has_jaccard_overlap && !has_sample_coverage && !has_object_coverage) {
+        satisfied->assign(sampled_bboxes.count(), true);
+        return;
+    }
+    satisfied->assign(sampled_bboxes.count(), false);
+    // SatisfySampleConstraint sets found as soon as an object passes the
+    // first constraint it checks, and never clears it: that constraint alone
+    // decides.
+    int metric;
+    bool has_min, has_max;
+    float min_value, max_value;
+    if (has_jaccard_overlap) {
+        metric = JACCARD_OVERLAP;
+        has_min = sample_constraint.has_min_jaccard_overlap();
+        has_max = sample_constraint.has_max_jaccard_overlap();
+        min_value = sample_constraint.min_jaccard_overlap();
+        max_value = sample_constraint.max_jaccard_overlap();
+    } else if (has_sample_coverage) {
+        metric = SAMPLE_COVERAGE;
+        has_min = sample_constraint.has_min_sample_coverage();
+        has_max = sample_constraint.has_max_sample_coverage();
+        min_value = sample_constraint.min_sample_coverage();
+        max_value = sample_constraint.max_sample_coverage();
+    } else {
+        metric = OBJECT_COVERAGE;
+        has_min = sample_constraint.has_min_object_coverage();
+        has_max = sample_constraint.has_max_object_coverage();
+        min_value = sample_constraint.min_object_coverage();
+        max_value = sample_constraint.max_object_coverage();
+    }
+    // An unset bound never fails, even against NaN.
+    if (!has_min) {
+        min_value = -std::numeric_limits<float>::infinity();
+    }
+    if (!has_max) {
+        max_value = std::numeric_limits<float>::infinity();
+    }
+    const int num_objects = object_bboxes.count();
+    vector<float> values(num_objects);
+    for (int s = 0; s < sampled_bboxes.count(); ++s) {
+        if (num_objects == 0) {
+            break;
+        }
+        switch (metric) {
+        case JACCARD_OVERLAP:
+            ComputeSampleMetric<JACCARD_OVERLAP>(sampled_bboxes, s,
+                object_bboxes, &values[0]);
+            break;
+        case SAMPLE_COVERAGE:
+            ComputeSampleMetric<SAMPLE_COVERAGE>(sampled_bboxes, s,
+                object_bboxes, &values[0]);
+            break;
+        default:
+            ComputeSampleMetric<OBJECT_COVERAGE>(sampled_bboxes, s,
+                object_bboxes, &values[0]);
+        }
+        for (int j = 0; j < num_objects; ++j) {
+            if (!(values[j] < min_value) && !(values[j] > max_value)) {
+                (*satisfied)[s] = true;
+                break;
+            }
+        }
+    }
+}
+
+// Runs the trials of a sampler, which are, one after the other:
+//   stop once max_sample samples were found (if max_sample >= 0),
+//   draw a sample with draw_sample, keep it if it meets sample_constraint.
+// The trials are drawn by chunks and their constraints checked together. A
+// chunk never has more trials than samples still missing, so the same
+// trials are drawn from the random generator as one at a time, and the
+// kept samples are the same. Returns the number of samples kept.
+template <typename DrawSample>
+static int RunSampleTrials(const int max_trials, const int max_sample,
+                           const BBoxArray& object_bboxes,
+                           const SampleConstraint& sample_constraint,
+                           DrawSample draw_sample,
+                           vector<NormalizedBBox>* sampled_bboxes) {
+    int found = 0;
+    vector<NormalizedBBox> chunk;
+    BBoxArray chunk_bboxes;
+    vector<bool> satisfied;
+    for (int trial = 0; trial < max_trials; ) {
+        int chunk_size = max_trials - trial;
+        if (max_sample >= 0) {
+            chunk_size = std::min(chunk_size, max_sample - found);
+            if (chunk_size <= 0) {
+                break;
+            }
+        }
+        chunk.resize(chunk_size);
+        chunk_bboxes.clear();
+        for (int i = 0; i < chunk_size; ++i) {
+            chunk[i].Clear();
+            draw_sample(&chunk[i]);
+            chunk_bboxes.push_back(chunk[i]);
+        }
+        SatisfySampleConstraints(chunk_bboxes, object_bboxes,
+                                 sample_constraint, &satisfied);
+        for (int i = 0; i < chunk_size; ++i) {
+            if (satisfied[i]) {
+                ++found;
+                sampled_bboxes->push_back(chunk[i]);
+            }
+        }
+        trial += chunk_size;
+    }
+    return found;
+}
+
 void SampleBBox(const Sampler& sampler, NormalizedBBox* sampled_bbox, float orl_ratio) {
     // Get random scale.
     CHECK_GE(sampler.max_scale(), sampler.min_scale());
@@ -210,28 +431,43 @@ void SampleBBox_Square(const AnnotatedDatum& anno_datum, const Sampler& sampler,
 
 
 
+// Draws the sampled boxes of GenerateSamples.
+struct DrawBatchSample {
+    const NormalizedBBox* source_bbox;
+    const Sampler* sampler;
+    float orl_ratio;
+
+    void operator()(NormalizedBBox* sampled_bbox) const {
+        // Generate sampled_bbox in the normalized space [0, 1].
+        SampleBBox(*sampler, sampled_bbox, orl_ratio);
+        // Transform the sampled_bbox w.r.t. source_bbox.
+        LocateBBox(*source_bbox, *sampled_bbox, sampled_bbox);
+    }
+};
+
+static void GenerateSamples(const NormalizedBBox& source_bbox,
+                            const BBoxArray& object_bboxes,
+                            const BatchSampler& batch_sampler,
+                            vector<NormalizedBBox>* sampled_bboxes,
+                            float orl_ratio) {
+    DrawBatchSample draw_sample;
+    draw_sample.source_bbox = &source_bbox;
+    draw_sample.sampler = &batch_sampler.sampler();
+    draw_sample.orl_ratio = orl_ratio;
+    // Determine if the sampled bbox is positive or negative by the constraint.
+    RunSampleTrials(batch_sampler.max_trials(),
+                    batch_sampler.has_max_sample() ?
+                        static_cast<int>(batch_sampler.max_sample()) : -1,
+                    object_bboxes, batch_sampler.sample_constraint(),
+                    draw_sample, sampled_bboxes);
+}
+
 void GenerateSamples(const NormalizedBBox& source_bbox,
                      const vector<NormalizedBBox>& object_bboxes,
                      const BatchSampler& batch_sampler,
                      vector<NormalizedBBox>* sampled_bboxes, float orl_ratio) {
-    int found = 0;
-    for (int i = 0; i < batch_sampler.max_trials(); ++i) {
-        if (batch_sampler.has_max_sample() &&
-            found >= batch_sampler.max_sample()) {
-        break;
-        }
-        // Generate sampled_bbox in the normalized space [0, 1].
-        NormalizedBBox sampled_bbox;
-        SampleBBox(batch_sampler.sampler(), &sampled_bbox, orl_ratio);
-        // Transform the sampled_bbox w.r.t. source_bbox.
-        LocateBBox(source_bbox, sampled_bbox, &sampled_bbox);
-        // Determine if the sampled bbox is positive or negative by the constraint.
-        if (SatisfySampleConstraint(sampled_bbox, object_bboxes,
-                                    batch_sampler.sample_constraint())) {
-        ++found;
-        sampled_bboxes->push_back(sampled_bbox);
-        }
-    }
+    GenerateSamples(source_bbox, BBoxArray(object_bboxes), batch_sampler,
+                    sampled_bboxes, orl_ratio);
 }
 
 void GenerateSamples_Square(const AnnotatedDatum& anno_datum,
@@ -266,6 +502,7 @@ void GenerateBatchSamples(const AnnotatedDatum& anno_datum,
     sampled_bboxes->clear();
     vector<NormalizedBBox> object_bboxes;
     GroupObjectBBoxes(anno_datum, &object_bboxes);
+    const BBoxArray object_bbox_array(object_bboxes);
     const int img_height = anno_datum.datum().height();
     const int img_width = anno_datum.datum().width();
     float ratio = (float)img_height / img_width;
@@ -276,7 +513,7 @@ void GenerateBatchSamples(const AnnotatedDatum& anno_datum,
         unit_bbox.set_ymin(0);
         unit_bbox.set_xmax(1);
         unit_bbox.set_ymax(1);
-        GenerateSamples(unit_bbox, object_bboxes, batch_samplers[i],
+        GenerateSamples(unit_bbox, object_bbox_array, batch_samplers[i],
                         sampled_bboxes, ratio);
         }
     }
@@ -375,29 +612,38 @@ void GenerateDataAnchorSample(const AnnotatedDatum& anno_datum,
     sampled_bbox->set_ymax((float)(h_off + sample_bbox_size) / img_height);             
 }
 
+// Draws the sampled boxes of GenerateBatchDataAnchorSamples.
+struct DrawDataAnchorSample {
+    const AnnotatedDatum* anno_datum;
+    const DataAnchorSampler* data_anchor_sampler;
+    const vector<NormalizedBBox>* object_bboxes;
+
+    void operator()(NormalizedBBox* sampled_bbox) const {
+        GenerateDataAnchorSample(*anno_datum, *data_anchor_sampler,
+                                 *object_bboxes, sampled_bbox);
+    }
+};
+
 void GenerateBatchDataAnchorSamples(const AnnotatedDatum& anno_datum,
                                 const vector<DataAnchorSampler>& data_anchor_samplers,
                                 vector<NormalizedBBox>* sampled_bboxes) {
     CHECK_EQ(data_anchor_samplers.size(), 1);
     vector<NormalizedBBox> object_bboxes;
     GroupObjectBBoxes(anno_datum, &object_bboxes);
+    const BBoxArray object_bbox_array(object_bboxes);
     for (int i = 0; i < data_anchor_samplers.size(); ++i) {
         if (data_anchor_samplers[i].use_original_image()) {
-            int found = 0;
+            DrawDataAnchorSample draw_sample;
+            draw_sample.anno_datum = &anno_datum;
+            draw_sample.data_anchor_sampler = &data_anchor_samplers[i];
+            draw_sample.object_bboxes = &object_bboxes;
+            const int found = RunSampleTrials(
+                data_anchor_samplers[i].max_trials(),
+                data_anchor_samplers[i].has_max_sample() ?
+                    static_cast<int>(data_anchor_samplers[i].max_sample()) : -1,
+                object_bbox_array, data_anchor_samplers[i].sample_constraint(),
+                draw_sample, sampled_bboxes);
             NormalizedBBox sampled_bbox;
-            for (int j = 0; j < data_anchor_samplers[i].max_trials(); ++j) {
-                if (data_anchor_samplers[i].has_max_sample() &&
-                    found >= data_anchor_samplers[i].max_sample()) {
-                break;
-                }
-                GenerateDataAnchorSample(anno_datum, data_anchor_samplers[i], object_bboxes, 
-                                        &sampled_bbox);
-                if (SatisfySampleConstraint(sampled_bbox, object_bboxes,
-                                            data_anchor_samplers[i].sample_constraint())){
-                    found++;
-                    sampled_bboxes->push_back(sampled_bbox);
-                }
-            }
             if(found == 0){
                 sampled_bbox.set_xmin(0.f);
                 sampled_bbox.set_ymin(0.f);
@@ -540,9 +786,12 @@ void ResizedCropSample(const AnnotatedDatum& anno_datum, AnnotatedDatum* resized
     RepeatedPtrField<AnnotationGroup>* Resized_anno_group = resized_anno_datum->mutable_annotation_group();
     // labels trans
     if (anno_datum.type() == AnnotatedDatum_AnnotationType_BBOX) {
+        RepeatedPtrField<AnnotationGroup> unpacked_groups;
+        const RepeatedPtrField<AnnotationGroup>& anno_groups =
+            AnnotationGroups(anno_datum, &unpacked_groups);
         // Go through each AnnotationGroup.
-        for (int g = 0; g < anno_datum.annotation_group_size(); ++g) {
-            const AnnotationGroup& anno_group = anno_datum.annotation_group(g);
+        for (int g = 0; g < anno_groups.size(); ++g) {
+            const AnnotationGroup& anno_group = anno_groups.Get(g);
             AnnotationGroup transformed_anno_group ;
             for (int a = 0; a < anno_group.annotation_size(); ++a) {
                 const Annotation& anno = anno_group.annotation(a);
@@ -0,0 +1,315 @@
+#include "caffe/util/shm_batch_ring.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/util/benchmark.hpp"
+
+namespace caffe {
+
+// Slots and the tops in them start on cache lines.
+static size_t align64(size_t bytes) {
+  return (bytes + 63) / 64 * 64;
+}
+
+static void set_shape(const vector<int>& shape, ShmShape* dst) {
+  CHECK_LE(shape.size(), kShmRingMaxAxes);
+  (*dst)[0] = shape.size();
+  std::copy(shape.begin(), shape.end(), *dst + 1);
+}
+
+static vector<int> get_shape(const ShmShape& src) {
+  CHECK_GE(src[0], 0);
+  CHECK_LE(src[0], kShmRingMaxAxes);
+  return vector<int>(src + 1, src + 1 + src[0]);
+}
+
+ShmBatchRing::ShmBatchRing(const string& name, bool producer)
+    : name_(name), producer_(producer), map_(NULL), map_size_(0),
+      header_(NULL), slot_bytes_(0), next_(0), reading_(0), read_rank_(0),
+      read_count_(1) {
+}
+
+ShmBatchRing* ShmBatchRing::Create(const string& name, int num_slots,
+    const vector<uint64_t>& capacity, const vector<vector<int> >& shapes) {
+  CHECK_GE(num_slots, 2) << "A ring needs at least 2 slots.";
+  CHECK_GT(capacity.size(), 0);
+  CHECK_LE(capacity.size(), kShmRingMaxTops);
+  CHECK_EQ(capacity.size(), shapes.size());
+  // Consumers of a previous ring keep their mapping, and find it closed.
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  CHECK_GE(fd, 0) << "Failed to create shared memory " << name << ": "
+      << strerror(errno);
+  size_t slot_bytes = align64(sizeof(ShmSlotHeader));
+  for (int i = 0; i < capacity.size(); ++i) {
+    slot_bytes += align64(capacity[i] * sizeof(float));
+  }
+  const size_t size = align64(sizeof(ShmRingHeader)) + num_slots * slot_bytes;
+  CHECK_EQ(ftruncate(fd, size), 0) << "Failed to size shared memory " << name
+      << ": " << strerror(errno);
+  ShmBatchRing* ring = new ShmBatchRing(name, true);
+  ring->Map(fd, size);
+  ShmRingHeader* header = ring->header_;
+  header->version = kShmRingVersion;
+  header->num_slots = num_slots;
+  header->num_tops = capacity.size();
+  for (int i = 0; i < capacity.size(); ++i) {
+    header->capacity[i] = capacity[i];
+    set_shape(shapes[i], &header->shape[i]);
+  }
+  header->producer_pid = getpid();
+  header->closed = 0;
+  header->written = 0;
+  header->read_end = 0;
+  pthread_mutexattr_t mutex_attr;
+  pthread_mutexattr_init(&mutex_attr);
+  pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+  CHECK_EQ(pthread_mutex_init(&header->mutex, &mutex_attr), 0);
+  pthread_mutexattr_destroy(&mutex_attr);
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  CHECK_EQ(pthread_cond_init(&header->cond, &cond_attr), 0);
+  pthread_condattr_destroy(&cond_attr);
+  ring->Layout();
+  for (int i = 0; i < num_slots; ++i) {
+    ring->slot(i)->seq = kShmSlotWriting;
+  }
+  // The ring is usable once the magic is there.
+  __sync_synchronize();
+  header->magic = kShmRingMagic;
+  LOG(INFO) << "Created shared memory ring " << name << " of " << num_slots
+            << " slots of " << slot_bytes << " bytes";
+  return ring;
+}
+
+ShmBatchRing* ShmBatchRing::Open(const string& name, int timeout_ms) {
+  CPUTimer timer;
+  timer.Start();
+  for (int attempt = 0; ; ++attempt) {
+    const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        st.st_size >= static_cast<off_t>(sizeof(ShmRingHeader))) {
+      ShmBatchRing* ring = new ShmBatchRing(name, false);
+      ring->Map(fd, st.st_size);
+      __sync_synchronize();
+      // A ring left by a feeder that died is skipped like a missing one,
+      // until the next feeder replaces it.
+      if (ring->header_->magic == kShmRingMagic && !ring->stopped()) {
+        CHECK_EQ(ring->header_->version, kShmRingVersion)
+            << "Unsupported version of shared memory ring " << name;
+        ring->Layout();
+        ring->Lock();
+        ring->next_ = std::max<uint64_t>(ring->header_->written, 1) - 1;
+        ring->Unlock();
+        LOG(INFO) << "Opened shared memory ring " << name;
+        return ring;
+      }
+      delete ring;
+    } else if (fd >= 0) {
+      close(fd);
+    }
+    CHECK_LT(timer.MilliSeconds(), timeout_ms) << "No running feeder "
+        << "created the shared memory ring " << name << " within "
+        << timeout_ms << " ms";
+    if (attempt == 0) {
+      LOG(INFO) << "Waiting for a feeder to create " << name;
+    }
+    usleep(100000);
+  }
+}
+
+ShmBatchRing::~ShmBatchRing() {
+  if (header_ != NULL && producer_) {
+    Lock();
+    header_->closed = 1;
+    pthread_cond_broadcast(&header_->cond);
+    Unlock();
+    shm_unlink(name_.c_str());
+  }
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+  }
+}
+
+void ShmBatchRing::Map(int fd, size_t size) {
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(map != MAP_FAILED) << "Failed to map shared memory " << name_
+      << ": " << strerror(errno);
+  map_ = static_cast<char*>(map);
+  map_size_ = size;
+  header_ = reinterpret_cast<ShmRingHeader*>(map_);
+}
+
+void ShmBatchRing::Layout() {
+  CHECK_GT(header_->num_tops, 0);
+  CHECK_LE(header_->num_tops, kShmRingMaxTops);
+  offsets_.clear();
+  slot_bytes_ = align64(sizeof(ShmSlotHeader));
+  for (int i = 0; i < header_->num_tops; ++i) {
+    offsets_.push_back((slot_bytes_ - align64(sizeof(ShmSlotHeader))) /
+        sizeof(float));
+    slot_bytes_ += align64(header_->capacity[i] * sizeof(float));
+  }
+  CHECK_LE(align64(sizeof(ShmRingHeader)) + header_->num_slots * slot_bytes_,
+      map_size_) << "Truncated shared memory ring " << name_;
+}
+
+vector<int> ShmBatchRing::shape(int top) const {
+  CHECK_LT(top, num_tops());
+  return get_shape(header_->shape[top]);
+}
+
+ShmSlotHeader* ShmBatchRing::slot(uint64_t seq) const {
+  return reinterpret_cast<ShmSlotHeader*>(map_ +
+      align64(sizeof(ShmRingHeader)) + (seq % num_slots()) * slot_bytes_);
+}
+
+float* ShmBatchRing::slot_data(uint64_t seq) const {
+  return reinterpret_cast<float*>(reinterpret_cast<char*>(slot(seq)) +
+      align64(sizeof(ShmSlotHeader)));
+}
+
+void ShmBatchRing::Lock() {
+  const int error = pthread_mutex_lock(&header_->mutex);
+  if (error == EOWNERDEAD) {
+    // The counters are only changed together under the lock, so they are
+    // consistent.
+    LOG(WARNING) << "A process died holding the lock of " << name_;
+    pthread_mutex_consistent(&header_->mutex);
+  } else {
+    CHECK_EQ(error, 0) << "Failed to lock " << name_;
+  }
+}
+
+void ShmBatchRing::Unlock() {
+  pthread_mutex_unlock(&header_->mutex);
+}
+
+bool ShmBatchRing::Wait(int timeout_ms) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  const int error = pthread_cond_timedwait(&header_->cond, &header_->mutex,
+      &deadline);
+  if (error == EOWNERDEAD) {
+    pthread_mutex_consistent(&header_->mutex);
+  }
+  return error != ETIMEDOUT;
+}
+
+bool ShmBatchRing::stopped() const {
+  return header_->closed ||
+      (kill(header_->producer_pid, 0) != 0 && errno == ESRCH);
+}
+
+float* ShmBatchRing::BeginWrite(int timeout_ms) {
+  CHECK(producer_);
+  Lock();
+  while (header_->written + 1 >= header_->read_end + num_slots()) {
+    if (!Wait(timeout_ms)) {
+      Unlock();
+      return NULL;
+    }
+  }
+  slot(header_->written)->seq = kShmSlotWriting;
+  Unlock();
+  return slot_data(header_->written);
+}
+
+void ShmBatchRing::EndWrite(const vector<vector<int> >& shapes) {
+  CHECK_EQ(shapes.size(), num_tops());
+  for (int i = 0; i < num_tops(); ++i) {
+    uint64_t count = 1;
+    for (int j = 0; j < shapes[i].size(); ++j) {
+      count *= shapes[i][j];
+    }
+    CHECK_LE(count, capacity(i)) << "Top " << i << " overflows its slot.";
+  }
+  // The shapes are published with the batch, as the consumers read them.
+  Lock();
+  ShmSlotHeader* written = slot(header_->written);
+  for (int i = 0; i < num_tops(); ++i) {
+    set_shape(shapes[i], &written->shape[i]);
+  }
+  written->seq = header_->written;
+  ++header_->written;
+  pthread_cond_broadcast(&header_->cond);
+  Unlock();
+}
+
+void ShmBatchRing::ShareReads(int rank, int count) {
+  CHECK(!producer_);
+  CHECK_GE(rank, 0);
+  CHECK_LT(rank, count);
+  read_rank_ = rank;
+  read_count_ = count;
+}
+
+const float* ShmBatchRing::BeginRead(int timeout_ms) {
+  CHECK(!producer_);
+  Lock();
+  for (;;) {
+    // Skip the batches of the other ranks.
+    next_ += (read_rank_ + read_count_ - next_ % read_count_) % read_count_;
+    if (next_ < header_->written) {
+      if (slot(next_)->seq == next_) {
+        break;
+      }
+      // Overwritten: catch up with the newest batch of this rank.
+      next_ = header_->written -
+          std::min<uint64_t>(header_->written, read_count_);
+    } else if (header_->closed || !Wait(timeout_ms)) {
+      Unlock();
+      return NULL;
+    }
+  }
+  reading_ = next_;
+  ++next_;
+  // Copy the shapes while the slot holds the batch: the feeder may rewrite
+  // them as soon as the lock is released.
+  read_shapes_.resize(num_tops());
+  for (int i = 0; i < num_tops(); ++i) {
+    read_shapes_[i] = get_shape(slot(reading_)->shape[i]);
+  }
+  if (header_->read_end < next_) {
+    header_->read_end = next_;
+    pthread_cond_broadcast(&header_->cond);
+  }
+  Unlock();
+  return slot_data(reading_);
+}
+
+vector<int> ShmBatchRing::read_shape(int top) const {
+  CHECK_LT(top, read_shapes_.size());
+  return read_shapes_[top];
+}
+
+bool ShmBatchRing::EndRead() {
+  Lock();
+  const bool intact = slot(reading_)->seq == reading_;
+  Unlock();
+  return intact;
+}
+
+}  // namespace caffe
@@ -0,0 +1,157 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+#include "caffe/util/rng.hpp"
+#include "caffe/util/shuffled_cursor.hpp"
+
+namespace caffe { namespace db {
+
+namespace fs = boost::filesystem;
+
+// Last modification of the records of a database: the file itself, or the
+// newest file of a database directory. Lock and log files change on every
+// open, so they are ignored.
+static std::time_t DatabaseWriteTime(const string& source) {
+  if (!fs::is_directory(source)) {
+    return fs::last_write_time(source);
+  }
+  std::time_t write_time = 0;
+  for (fs::directory_iterator it(source); it != fs::directory_iterator();
+       ++it) {
+    const string name = it->path().filename().string();
+    if (name == "lock.mdb" || name == "LOCK" || name == "LOG" ||
+        name == "LOG.old") {
+      continue;
+    }
+    write_time = std::max(write_time, fs::last_write_time(it->path()));
+  }
+  return write_time;
+}
+
+// The side file holds the number of keys, then each key preceded by its size.
+static bool ReadKeyIndex(const string& filename, vector<string>* keys) {
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  uint64_t num_keys;
+  if (!file.read(reinterpret_cast<char*>(&num_keys), sizeof(num_keys))) {
+    return false;
+  }
+  keys->resize(num_keys);
+  for (uint64_t i = 0; i < num_keys; ++i) {
+    uint32_t size;
+    if (!file.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+      return false;
+    }
+    (*keys)[i].resize(size);
+    if (size > 0 && !file.read(&(*keys)[i][0], size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool WriteKeyIndex(const string& filename, const vector<string>& keys) {
+  // Write to a temporary file first, so that concurrent jobs never read a
+  // partial index.
+  const string temp_filename = filename + ".tmp";
+  {
+    std::ofstream file(temp_filename.c_str(),
+                       std::ios::out | std::ios::binary | std::ios::trunc);
+    const uint64_t num_keys = keys.size();
+    file.write(reinterpret_cast<const char*>(&num_keys), sizeof(num_keys));
+    for (int i = 0; i < keys.size(); ++i) {
+      const uint32_t size = keys[i].size();
+      file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      file.write(keys[i].data(), size);
+    }
+    if (!file.good()) {
+      return false;
+    }
+  }
+  return rename(temp_filename.c_str(), filename.c_str()) == 0;
+}
+
+void LoadKeyIndex(const string& source, Cursor* cursor, vector<string>* keys) {
+  const string filename = source + ".keys";
+  keys->clear();
+  if (fs::exists(filename) &&
+      fs::last_write_time(filename) >= DatabaseWriteTime(source)) {
+    if (ReadKeyIndex(filename, keys)) {
+      LOG(INFO) << "Read " << keys->size() << " keys from " << filename;
+      return;
+    }
+    LOG(WARNING) << "Ignoring the corrupted key index " << filename;
+    keys->clear();
+  }
+  // Only the keys are needed: the values are not touched, so LMDB does not
+  // page them in.
+  for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+    keys->push_back(cursor->key());
+  }
+  LOG(INFO) << "Indexed " << keys->size() << " keys of " << source;
+  if (!WriteKeyIndex(filename, *keys)) {
+    LOG(WARNING) << "Failed to save the key index to " << filename
+                 << "; it will be rebuilt next time.";
+  }
+}
+
+ShuffledCursor::ShuffledCursor(Cursor* cursor, const vector<string>& keys,
+    int window_size)
+    : cursor_(cursor), keys_(keys), window_size_(window_size),
+      permutation_(keys.size()), position_(0), window_begin_(0) {
+  CHECK_GT(keys_.size(), 0) << "Cannot shuffle an empty database.";
+  CHECK_GT(window_size_, 0);
+  for (int i = 0; i < permutation_.size(); ++i) {
+    permutation_[i] = i;
+  }
+  SeekToFirst();
+}
+
+void ShuffledCursor::SeekToFirst() {
+  shuffle(permutation_.begin(), permutation_.end());
+  position_ = 0;
+  LoadWindow();
+}
+
+void ShuffledCursor::Next() {
+  ++position_;
+  if (position_ - window_begin_ == window_size_ && valid()) {
+    LoadWindow();
+  }
+}
+
+void ShuffledCursor::SeekToKey(const string& key) {
+  LOG(FATAL) << "ShuffledCursor only iterates its permutation.";
+}
+
+void ShuffledCursor::LoadWindow() {
+  window_begin_ = position_;
+  const int window_end =
+      std::min(window_begin_ + window_size_, int(permutation_.size()));
+  // Sort the window by key index, i.e. by database order, remembering where
+  // each value goes in the permutation.
+  vector<std::pair<int, int> > order;
+  for (int i = window_begin_; i < window_end; ++i) {
+    order.push_back(std::make_pair(permutation_[i], i - window_begin_));
+  }
+  std::sort(order.begin(), order.end());
+  window_values_.resize(window_end - window_begin_);
+  for (int i = 0; i < order.size(); ++i) {
+    const string& key = keys_[order[i].first];
+    cursor_->SeekToKey(key);
+    CHECK(cursor_->valid()) << "Key " << key << " is not in the database; "
+        << "delete the stale key index to rebuild it.";
+    window_values_[order[i].second].assign(cursor_->value_data(),
+                                           cursor_->value_size());
+  }
+}
+
+}  // namespace db
+}  // namespace caffe
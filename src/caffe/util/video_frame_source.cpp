@@ -0,0 +1,153 @@
+#ifdef USE_OPENCV
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/video_frame_source.hpp"
+
+namespace caffe {
+
+VideoFrameSource::VideoFrameSource(const string& video_file,
+    int num_threads, int window_frames)
+    : video_file_(video_file), window_frames_(window_frames),
+      total_frames_(0), fps_(0), end_frame_(-1), decoded_frames_(0),
+      decode_us_(0), round_running_(false), round_begin_(0) {
+  CHECK_GT(num_threads, 0);
+  CHECK_GT(window_frames_, 0);
+  for (int i = 0; i < num_threads; ++i) {
+    shared_ptr<cv::VideoCapture> capture(new cv::VideoCapture());
+    if (!capture->open(video_file_)) {
+      LOG(FATAL) << "Failed to open video: " << video_file_;
+    }
+    captures_.push_back(capture);
+  }
+  capture_positions_.assign(num_threads, 0);
+  total_frames_ = captures_[0]->get(CV_CAP_PROP_FRAME_COUNT);
+  fps_ = captures_[0]->get(CV_CAP_PROP_FPS);
+  decode_pool_.reset(new WorkerPool(num_threads));
+}
+
+VideoFrameSource::~VideoFrameSource() {
+  if (round_running_) {
+    decode_pool_->Wait();
+  }
+}
+
+bool VideoFrameSource::GetFrame(int index, cv::Mat* frame) {
+  CHECK_GE(index, 0);
+  if (end_frame_ >= 0 && index >= end_frame_) {
+    return false;
+  }
+  const int window = window_of(index);
+  if (!windows_.count(window)) {
+    CollectRound();
+    if (!windows_.count(window)) {
+      StartRound(window);
+      CollectRound();
+    }
+  }
+  // Decode the next windows while the caller uses this one.
+  if (!round_running_) {
+    StartRound(window + 1);
+  }
+  const vector<cv::Mat>& frames = windows_[window];
+  const int offset = index - window * window_frames_;
+  if (offset >= frames.size()) {
+    return false;
+  }
+  *frame = frames[offset];
+  return true;
+}
+
+void VideoFrameSource::Release(int index) {
+  const int window = window_of(index);
+  while (!windows_.empty() && windows_.begin()->first < window) {
+    windows_.erase(windows_.begin());
+  }
+}
+
+double VideoFrameSource::decode_fps() const {
+  return decode_us_ > 0 ? decoded_frames_ * 1e6 / decode_us_ : 0;
+}
+
+void VideoFrameSource::StartRound(int first_window) {
+  CHECK(!round_running_);
+  const int num_windows = decode_pool_->size();
+  round_begin_ = first_window;
+  round_wanted_.assign(num_windows, false);
+  bool any_wanted = false;
+  for (int i = 0; i < num_windows; ++i) {
+    const int window = first_window + i;
+    if (windows_.count(window) ||
+        (end_frame_ >= 0 && window * window_frames_ >= end_frame_)) {
+      continue;
+    }
+    round_wanted_[i] = true;
+    any_wanted = true;
+  }
+  if (!any_wanted) {
+    return;
+  }
+  round_frames_.clear();
+  round_frames_.resize(num_windows);
+  round_us_.assign(num_windows, 0);
+  // Item i runs on worker i: once the decoding catches up, each window is
+  // read by the capture that just read the previous one, without seeking.
+  decode_pool_->Start(num_windows,
+      boost::bind(&VideoFrameSource::DecodeWindow, this, _1, _2));
+  round_running_ = true;
+}
+
+void VideoFrameSource::CollectRound() {
+  if (!round_running_) {
+    return;
+  }
+  decode_pool_->Wait();
+  round_running_ = false;
+  for (int i = 0; i < round_wanted_.size(); ++i) {
+    if (!round_wanted_[i]) {
+      continue;
+    }
+    const int window = round_begin_ + i;
+    vector<cv::Mat>& frames = round_frames_[i];
+    decoded_frames_ += frames.size();
+    decode_us_ += round_us_[i];
+    if (frames.size() < window_frames_) {
+      const int end_frame = window * window_frames_ + frames.size();
+      end_frame_ = end_frame_ < 0 ? end_frame : std::min(end_frame_, end_frame);
+    }
+    windows_[window].swap(frames);
+  }
+}
+
+// This function is called on the workers of decode_pool_
+void VideoFrameSource::DecodeWindow(int item_id, int worker_id) {
+  if (!round_wanted_[item_id]) {
+    return;
+  }
+  CPUTimer timer;
+  timer.Start();
+  const int first_frame = (round_begin_ + item_id) * window_frames_;
+  cv::VideoCapture* capture = captures_[worker_id].get();
+  if (capture_positions_[worker_id] != first_frame) {
+    capture->set(CV_CAP_PROP_POS_FRAMES, first_frame);
+  }
+  vector<cv::Mat>& frames = round_frames_[item_id];
+  for (int i = 0; i < window_frames_; ++i) {
+    cv::Mat frame;
+    if (!capture->read(frame) || !frame.data) {
+      break;
+    }
+    frames.push_back(frame);
+  }
+  // Past the end, the position of the capture is unknown.
+  capture_positions_[worker_id] = frames.size() == window_frames_ ?
+      first_frame + window_frames_ : -1;
+  round_us_[item_id] = timer.MicroSeconds();
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -0,0 +1,62 @@
+#include <boost/thread.hpp>
+#include <vector>
+
+#include "caffe/util/worker_pool.hpp"
+
+namespace caffe {
+
+WorkerPool::WorkerPool(int num_workers)
+    : task_(), workers_(), running_(false) {
+  CHECK_GT(num_workers, 0);
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.push_back(shared_ptr<Worker>(new Worker(this, i, num_workers)));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  // Stop the workers while task_ is still alive.
+  workers_.clear();
+}
+
+void WorkerPool::Start(int num_items, const Task& task) {
+  CHECK(!running_) << "Wait() for the previous run first.";
+  task_ = task;
+  running_ = true;
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->jobs_.push(num_items);
+  }
+}
+
+void WorkerPool::Wait() {
+  CHECK(running_) << "No run started.";
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->done_.pop();
+  }
+  running_ = false;
+}
+
+WorkerPool::Worker::Worker(WorkerPool* pool, int worker_id, int num_workers)
+    : jobs_(), done_(), pool_(pool), worker_id_(worker_id),
+      num_workers_(num_workers) {
+  StartInternalThread();
+}
+
+WorkerPool::Worker::~Worker() {
+  StopInternalThread();
+}
+
+void WorkerPool::Worker::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      const int num_items = jobs_.pop();
+      for (int i = worker_id_; i < num_items; i += num_workers_) {
+        pool_->task_(i, worker_id_);
+      }
+      done_.push(num_items);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+}  // namespace caffe
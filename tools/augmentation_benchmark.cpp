@@ -0,0 +1,151 @@
+// Measures the per-sample latency of the annotated data augmentation chain
+// (distort, expand, transform) on the encoded datum and on the decode-once
+// cv::Mat path.
+//
+// Usage:
+//    augmentation_benchmark [FLAGS] INPUT_DB TRANSFORM_PARAM_PROTOTXT
+//
+// where TRANSFORM_PARAM_PROTOTXT holds a text TransformationParameter, e.g.
+// the transform_param block of an AnnotatedData layer.
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/db.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+using boost::scoped_ptr;
+using std::string;
+using std::vector;
+
+DEFINE_string(backend, "lmdb",
+        "The backend {leveldb, lmdb} containing the AnnotatedDatum");
+DEFINE_int32(num_samples, 1000,
+        "The number of samples to run through each path.");
+DEFINE_int32(seed, 1701,
+        "The random seed shared by both paths.");
+
+#ifdef USE_OPENCV
+// Loads up to num_samples encoded AnnotatedDatum from the db.
+void LoadSamples(const string& source, int num_samples,
+                 vector<AnnotatedDatum>* samples) {
+  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
+  db->Open(source, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  while (cursor->valid() && samples->size() < num_samples) {
+    samples->push_back(AnnotatedDatum());
+    samples->back().ParseFromString(cursor->value());
+    CHECK(samples->back().datum().encoded())
+        << "The decode-once path only applies to encoded datums.";
+    cursor->Next();
+  }
+  CHECK_GT(samples->size(), 0) << "No sample in " << source;
+}
+
+// Runs the distort/expand/transform chain of AnnotatedDataLayer over the
+// samples and returns the total time in milliseconds.
+double RunChain(const TransformationParameter& param,
+                const vector<AnnotatedDatum>& samples, bool decode_once) {
+  Caffe::set_random_seed(FLAGS_seed);
+  DataTransformer<float> transformer(param, TRAIN);
+  transformer.InitRand();
+  Blob<float> blob;
+  CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < samples.size(); ++i) {
+    const AnnotatedDatum& anno_datum = samples[i];
+    // Transform appends to it: start each sample empty, as AnnotatedDataLayer
+    // does.
+    vector<AnnotationGroup> transformed_anno_vec;
+    if (decode_once) {
+      cv::Mat cv_img;
+      transformer.DecodeImage(anno_datum.datum(), &cv_img);
+      AnnotatedDatum header_datum;
+      transformer.CopyAnnotation(anno_datum, cv_img, &header_datum);
+      if (param.has_distort_param()) {
+        cv::Mat distort_img;
+        transformer.DistortImage(cv_img, &distort_img);
+        cv_img = distort_img;
+      }
+      AnnotatedDatum expand_datum;
+      cv::Mat expand_img;
+      if (param.has_expand_param()) {
+        transformer.ExpandImage(header_datum, cv_img, &expand_datum,
+                                &expand_img);
+      } else {
+        expand_datum.Swap(&header_datum);
+        expand_img = cv_img;
+      }
+      blob.Reshape(transformer.InferBlobShape(expand_img));
+      transformer.Transform(expand_datum, expand_img, &blob,
+                            &transformed_anno_vec);
+    } else {
+      AnnotatedDatum distort_datum(anno_datum);
+      if (param.has_distort_param()) {
+        transformer.DistortImage(anno_datum.datum(),
+                                 distort_datum.mutable_datum());
+      }
+      AnnotatedDatum expand_datum;
+      if (param.has_expand_param()) {
+        transformer.ExpandImage(distort_datum, &expand_datum);
+      } else {
+        expand_datum.Swap(&distort_datum);
+      }
+      blob.Reshape(transformer.InferBlobShape(expand_datum.datum()));
+      transformer.Transform(expand_datum, &blob, &transformed_anno_vec);
+    }
+  }
+  return timer.MilliSeconds();
+}
+#endif  // USE_OPENCV
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+
+#ifdef USE_OPENCV
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Compare the per-sample latency of the encoded\n"
+        "datum and the decode-once augmentation chains.\n"
+        "Usage:\n"
+        "    augmentation_benchmark [FLAGS] INPUT_DB TRANSFORM_PARAM_PROTOTXT\n");
+
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0],
+        "tools/augmentation_benchmark");
+    return 1;
+  }
+
+  TransformationParameter param;
+  ReadProtoFromTextFileOrDie(argv[2], &param);
+  vector<AnnotatedDatum> samples;
+  LoadSamples(argv[1], FLAGS_num_samples, &samples);
+  LOG(INFO) << "Loaded " << samples.size() << " samples.";
+
+  const double datum_ms = RunChain(param, samples, false);
+  const double mat_ms = RunChain(param, samples, true);
+  LOG(INFO) << "Encoded datum chain: " << datum_ms / samples.size()
+            << " ms/sample.";
+  LOG(INFO) << "Decode-once chain:   " << mat_ms / samples.size()
+            << " ms/sample.";
+  LOG(INFO) << "Speedup: " << datum_ms / mat_ms << "x";
+#else
+  LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+  return 0;
+}
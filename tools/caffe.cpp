@@ -13,6 +13,10 @@ namespace bp = boost::python;
 
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/dag_scheduler.hpp"
+#include "caffe/util/host_allocator.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/shm_batch_ring.hpp"
 #include "caffe/util/signal_handler.h"
 
 using caffe::Blob;
@@ -54,6 +58,21 @@ DEFINE_string(sigint_effect, "stop",
 DEFINE_string(sighup_effect, "snapshot",
              "Optional; action to take when a SIGHUP signal is received: "
              "snapshot, stop or none.");
+DEFINE_int32(host_cache_mb, 0,
+    "Optional; megabytes of freed host memory kept for reuse by the blobs.");
+DEFINE_int32(conv_threads, 1,
+    "Optional; the threads convolving the images of a batch on CPU, for the "
+    "Convolution layers that do not set num_threads.");
+DEFINE_string(shm_name, "",
+    "The shared memory ring to feed, e.g. /pose_train. Only used for 'feed'.");
+DEFINE_int32(shm_slots, 4,
+    "Optional; the number of batches in the shared memory ring.");
+DEFINE_int32(shm_label_capacity, 0,
+    "Optional; the floats of label room in each batch of the ring, for "
+    "labels of varying size. Defaults to the labels of the first batch.");
+DEFINE_string(feed_layer, "",
+    "Optional; the data layer of the model to feed from. Defaults to the "
+    "first layer without bottoms.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -127,6 +146,36 @@ vector<string> get_stages_from_flags() {
   return stages;
 }
 
+// Log the host memory counters, for profiling
+static void log_host_allocator_stats() {
+  const caffe::HostAllocatorStats stats = caffe::HostAllocator::Get().stats();
+  LOG(INFO) << "Host memory: " << stats.allocations << " allocations, "
+            << stats.cache_hits << " from the cache, "
+            << stats.system_allocations << " from the system; peak "
+            << (stats.peak_bytes_in_use >> 20) << " MB in use, "
+            << (stats.bytes_cached >> 20) << " MB cached.";
+}
+
+// Time Forward with the scheduler of forward_threads, and log when and on
+// which thread each layer ran in the last pass, to check their overlap
+static void time_parallel_forward(Net<float>* net) {
+  const caffe::DagScheduler* scheduler = net->forward_scheduler();
+  Timer forward_timer;
+  forward_timer.Start();
+  for (int j = 0; j < FLAGS_iterations; ++j) {
+    net->Forward();
+  }
+  LOG(INFO) << "Average Forward pass on " << scheduler->num_workers()
+    << " threads: " << forward_timer.MilliSeconds() / FLAGS_iterations
+    << " ms.";
+  const vector<caffe::DagScheduler::Trace>& trace = scheduler->trace();
+  for (int i = 0; i < trace.size(); ++i) {
+    LOG(INFO) << std::setfill(' ') << std::setw(10) << net->layer_names()[i]
+      << "\tthread " << trace[i].worker_id << ": " << trace[i].start_us / 1000
+      << " - " << trace[i].end_us / 1000 << " ms.";
+  }
+}
+
 // caffe commands to call by
 //     caffe <command> <args>
 //
@@ -252,6 +301,7 @@ int train() {
         solver->Solve();
     }
     LOG(INFO) << "Optimization Done.";
+    log_host_allocator_stats();
     return 0;
 }
 RegisterBrewFunction(train);
@@ -416,11 +466,98 @@ int time() {
   LOG(INFO) << "Average Forward-Backward: " << total_timer.MilliSeconds() /
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
+  if (caffe_net.forward_scheduler()) {
+    time_parallel_forward(&caffe_net);
+  }
   LOG(INFO) << "*** Benchmark ends ***";
+  log_host_allocator_stats();
   return 0;
 }
 RegisterBrewFunction(time);
 
+// Feed: run the data layer of a model and publish its batches in shared
+// memory for the SharedMemoryData layers of any number of trainings.
+int feed() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to feed from.";
+  CHECK_GT(FLAGS_shm_name.size(), 0) << "Need a shared memory ring to feed.";
+  caffe::NetParameter net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &net_param);
+  net_param.mutable_state()->set_phase(get_phase_from_flags(caffe::TRAIN));
+  net_param.mutable_state()->set_level(FLAGS_level);
+  vector<string> stages = get_stages_from_flags();
+  for (int i = 0; i < stages.size(); ++i) {
+    net_param.mutable_state()->add_stage(stages[i]);
+  }
+  caffe::NetParameter filtered_param;
+  Net<float>::FilterNet(net_param, &filtered_param);
+  const caffe::LayerParameter* layer_param = NULL;
+  for (int i = 0; i < filtered_param.layer_size() && !layer_param; ++i) {
+    const caffe::LayerParameter& param = filtered_param.layer(i);
+    if (FLAGS_feed_layer.size() ? param.name() == FLAGS_feed_layer :
+        param.bottom_size() == 0) {
+      layer_param = &param;
+    }
+  }
+  CHECK(layer_param) << "No layer to feed from in " << FLAGS_model;
+  CHECK_GE(layer_param->top_size(), 1);
+  CHECK_LE(layer_param->top_size(), caffe::kShmRingMaxTops);
+
+  // The data is decoded and augmented on the CPU.
+  Caffe::set_mode(Caffe::CPU);
+  shared_ptr<Layer<float> > layer =
+      caffe::LayerRegistry<float>::CreateLayer(*layer_param);
+  vector<shared_ptr<Blob<float> > > top_blobs;
+  vector<Blob<float>*> bottom, top;
+  for (int i = 0; i < layer_param->top_size(); ++i) {
+    top_blobs.push_back(shared_ptr<Blob<float> >(new Blob<float>()));
+    top.push_back(top_blobs.back().get());
+  }
+  layer->SetUp(bottom, top);
+  layer->Forward(bottom, top);
+
+  // Size the slots after the first batch.
+  vector<uint64_t> capacity;
+  vector<vector<int> > shapes;
+  for (int i = 0; i < top.size(); ++i) {
+    capacity.push_back(top[i]->count());
+    shapes.push_back(top[i]->shape());
+  }
+  if (top.size() > 1 && FLAGS_shm_label_capacity > 0) {
+    capacity[1] = FLAGS_shm_label_capacity;
+  }
+  shared_ptr<caffe::ShmBatchRing> ring(caffe::ShmBatchRing::Create(
+      FLAGS_shm_name, FLAGS_shm_slots, capacity, shapes));
+
+  caffe::SignalHandler signal_handler(caffe::SolverAction::STOP,
+                                      caffe::SolverAction::STOP);
+  caffe::ActionCallback action = signal_handler.GetActionFunction();
+  LOG(INFO) << "Feeding " << FLAGS_shm_name << " from layer "
+            << layer_param->name();
+  int batches = 0;
+  while (action() != caffe::SolverAction::STOP) {
+    float* slot = ring->BeginWrite(100);
+    if (!slot) {
+      continue;
+    }
+    for (int i = 0; i < top.size(); ++i) {
+      CHECK_LE(top[i]->count(), capacity[i]) << "Top " << i << " of "
+          << layer_param->name() << " grew beyond its room in the ring; "
+          << "set --shm_label_capacity.";
+      caffe::caffe_copy(top[i]->count(), top[i]->cpu_data(),
+                        slot + ring->offset(i));
+      shapes[i] = top[i]->shape();
+    }
+    ring->EndWrite(shapes);
+    if (++batches % 1000 == 0) {
+      LOG(INFO) << "Fed " << batches << " batches.";
+    }
+    layer->Forward(bottom, top);
+  }
+  LOG(INFO) << "Fed " << batches << " batches.";
+  return 0;
+}
+RegisterBrewFunction(feed);
+
 int main(int argc, char** argv) {
   // Print output to stderr (while still logging).
   FLAGS_alsologtostderr = 1;
@@ -433,9 +570,14 @@ int main(int argc, char** argv) {
       "  train           train or finetune a model\n"
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
-      "  time            benchmark model execution time");
+      "  time            benchmark model execution time\n"
+      "  feed            publish the batches of a data layer in shared memory");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::HostAllocator::Get().set_cache_bytes(
+      static_cast<size_t>(FLAGS_host_cache_mb) << 20);
+  CHECK_GT(FLAGS_conv_threads, 0) << "conv_threads must be positive.";
+  Caffe::set_conv_threads(FLAGS_conv_threads);
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
@@ -12,6 +12,11 @@
 // For detection task, the file should be in the format as
 //   imgfolder1/img1.JPEG annofolder1/anno1.xml
 //   ....
+//
+// Images are read and annotations parsed by --num_threads workers, while the
+// main thread writes the records in list order, committing every --txn_size
+// records. After each commit the progress is saved to DB_NAME.checkpoint, so
+// that an interrupted build continues where it stopped with --resume.
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -20,7 +25,10 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "boost/variant.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
@@ -28,6 +36,8 @@
 #include "caffe/util/db.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/packed_annotation.hpp"
 #include "caffe/util/rng.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
@@ -60,6 +70,218 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg',...).");
+DEFINE_int32(num_threads, 0,
+    "Number of threads reading the images and annotations, 0 for one per "
+    "core. The database is the same whatever the number of threads.");
+DEFINE_int32(txn_size, 1000,
+    "Number of records written per database transaction.");
+DEFINE_bool(resume, false,
+    "Continue an interrupted conversion from DB_NAME.checkpoint, if any.");
+DEFINE_bool(pack_annotations, false,
+    "For detection, store the annotations in the packed binary layout "
+    "instead of annotation groups.");
+
+#ifdef USE_OPENCV
+typedef std::vector<std::pair<std::string, boost::variant<int, std::string> > >
+    LineList;
+
+// What the workers need to convert a line of the list.
+struct ConvertParam {
+  const LineList* lines;
+  const std::map<std::string, int>* name_to_label;
+  std::string anno_type;
+  AnnotatedDatum_AnnotationType type;
+  AnnoFaceAttributeDatum_AnnoType anno_face;
+  AnnotatedCCpdDatum_AnnotationType anno_ccpd_type;
+  std::string label_type;
+  std::string encode_type;
+  bool encoded;
+  bool is_color;
+  bool pack_annotations;
+  int resize_height;
+  int resize_width;
+  int min_dim;
+  int max_dim;
+};
+
+// A converted line, waiting for the writer.
+struct ConvertedLine {
+  bool ready;
+  bool status;
+  std::string value;
+  // Expected and actual size of the pixel data, for --check_size.
+  int expected_size;
+  int data_size;
+};
+
+// Reads the image and annotation of line line_id and serializes the record.
+void ConvertLine(const ConvertParam& param, int line_id, ConvertedLine* out) {
+  const LineList& lines = *param.lines;
+  AnnotatedDatum anno_datum;
+  Datum* datum = anno_datum.mutable_datum();
+  AnnoFaceAttributeDatum anno_faceAttriDatum;
+  AnnotatedCCpdDatum anno_ccpdDatum;
+  bool status = true;
+  std::string enc = param.encode_type;
+  if (param.encoded && !enc.size()) {
+    // Guess the encoding type from the file name
+    string fn = lines[line_id].first;
+    size_t p = fn.rfind('.');
+    if ( p == fn.npos )
+      LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
+    enc = fn.substr(p);
+    std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+  }
+  const std::string& filename = lines[line_id].first;
+  const std::string& anno_type = param.anno_type;
+  if (anno_type == "classification") {
+    int label = boost::get<int>(lines[line_id].second);
+    status = ReadImageToDatum(filename, label, param.resize_height,
+        param.resize_width, param.min_dim, param.max_dim, param.is_color, enc,
+        datum);
+  } else if (anno_type == "detection") {
+    const std::string& labelname = boost::get<std::string>(lines[line_id].second);
+    status = ReadRichImageToAnnotatedDatum(filename, labelname,
+        param.resize_height, param.resize_width, param.min_dim, param.max_dim,
+        param.is_color, enc, param.type,
+        param.label_type, *param.name_to_label, &anno_datum);
+    anno_datum.set_type(AnnotatedDatum_AnnotationType_BBOX);
+    if (param.pack_annotations) {
+      PackAnnotatedDatum(&anno_datum);
+    }
+  } else if (anno_type == "faceattributes") {
+    // lines contain imagename & label.txt
+    const std::string& labelname = boost::get<std::string>(lines[line_id].second);
+    status = ReadRichFaceAttributeToAnnotatedDatum(filename, labelname,
+        param.resize_height, param.resize_width, param.min_dim, param.max_dim,
+        param.is_color, enc, param.anno_face,
+        param.label_type, &anno_faceAttriDatum);
+    anno_faceAttriDatum.set_type(AnnoFaceAttributeDatum_AnnoType_FACEATTRIBUTE);
+  } else if (anno_type == "Rec_ccpd") {
+    const std::string& labelname = boost::get<std::string>(lines[line_id].second);
+    status = ReadRichCcpdToAnnotatedDatum(filename, labelname,
+        param.resize_height, param.resize_width, param.min_dim, param.max_dim,
+        param.is_color, enc, param.anno_ccpd_type,
+        param.label_type, *param.name_to_label, &anno_ccpdDatum);
+    anno_ccpdDatum.set_type(AnnotatedCCpdDatum_AnnotationType_CCPD);
+  }
+  out->status = status;
+  out->value.clear();
+  if (!status) {
+    return;
+  }
+  out->expected_size = datum->channels() * datum->height() * datum->width();
+  out->data_size = datum->data().size();
+  if (anno_type == "classification" || anno_type == "detection") {
+    CHECK(anno_datum.SerializeToString(&out->value));
+  } else if (anno_type == "faceattributes") {
+    CHECK(anno_faceAttriDatum.SerializeToString(&out->value));
+  } else if (anno_type == "Rec_ccpd") {
+    CHECK(anno_ccpdDatum.SerializeToString(&out->value));
+  }
+}
+
+// Converted lines [next_line, next_line + window) waiting for the writer, in
+// slot line_id % window.
+class ConvertQueue {
+ public:
+  ConvertQueue(int next_line, int window)
+    : next_line_(next_line), slots_(window) {
+    for (int i = 0; i < window; ++i) {
+      slots_[i].ready = false;
+    }
+  }
+
+  // Called by the workers: converts line_id once it fits in the window.
+  void Convert(const ConvertParam& param, int line_id) {
+    ConvertedLine* slot = &slots_[line_id % slots_.size()];
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (line_id >= next_line_ + slots_.size()) {
+        free_.wait(lock);
+      }
+    }
+    ConvertLine(param, line_id, slot);
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      slot->ready = true;
+    }
+    ready_.notify_all();
+  }
+
+  // Called by the writer: waits for the next line, in order.
+  ConvertedLine* Next() {
+    ConvertedLine* slot = &slots_[next_line_ % slots_.size()];
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!slot->ready) {
+      ready_.wait(lock);
+    }
+    return slot;
+  }
+
+  // Called by the writer once done with the slot returned by Next().
+  void Release() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      slots_[next_line_ % slots_.size()].ready = false;
+      ++next_line_;
+    }
+    free_.notify_all();
+  }
+
+ private:
+  int next_line_;
+  std::vector<ConvertedLine> slots_;
+  boost::mutex mutex_;
+  boost::condition_variable ready_;
+  boost::condition_variable free_;
+};
+
+// Worker worker_id converts the lines begin + worker_id, begin + worker_id +
+// num_workers, ...
+void ConvertWorker(const ConvertParam& param, ConvertQueue* queue, int begin,
+                   int worker_id, int num_workers) {
+  for (int line_id = begin + worker_id; line_id < param.lines->size();
+       line_id += num_workers) {
+    queue->Convert(param, line_id);
+  }
+}
+
+double SecondsSince(const boost::posix_time::ptime& start_time) {
+  const boost::posix_time::time_duration elapsed =
+      boost::posix_time::microsec_clock::local_time() - start_time;
+  // Avoid dividing by zero in rates.
+  return std::max(elapsed.total_microseconds(), int64_t(1)) / 1e6;
+}
+
+// The checkpoint holds the number of lines of the list, the next line to
+// convert, the number of records written and the shuffling seed.
+struct Checkpoint {
+  int num_lines;
+  int next_line;
+  int count;
+  unsigned int seed;
+};
+
+bool ReadCheckpoint(const std::string& filename, Checkpoint* checkpoint) {
+  std::ifstream file(filename.c_str());
+  return static_cast<bool>(file >> checkpoint->num_lines
+      >> checkpoint->next_line >> checkpoint->count >> checkpoint->seed);
+}
+
+void WriteCheckpoint(const std::string& filename, const Checkpoint& checkpoint) {
+  // Replace the previous checkpoint atomically.
+  const std::string temp_filename = filename + ".tmp";
+  {
+    std::ofstream file(temp_filename.c_str());
+    file << checkpoint.num_lines << " " << checkpoint.next_line << " "
+         << checkpoint.count << " " << checkpoint.seed << std::endl;
+    CHECK(file.good()) << "Failed to write " << temp_filename;
+  }
+  CHECK_EQ(rename(temp_filename.c_str(), filename.c_str()), 0)
+      << "Failed to write " << filename;
+}
+#endif  // USE_OPENCV
 
 int main(int argc, char** argv) {
 #ifdef USE_OPENCV
@@ -87,16 +309,18 @@ int main(int argc, char** argv) {
   const bool encoded = FLAGS_encoded;
   const string encode_type = FLAGS_encode_type;
   const string anno_type = FLAGS_anno_type;
-  AnnotatedDatum_AnnotationType type;
-  AnnoFaceAttributeDatum_AnnoType anno_face;
-  AnnotatedCCpdDatum_AnnotationType anno_ccpd_type;
+  AnnotatedDatum_AnnotationType type = AnnotatedDatum_AnnotationType_BBOX;
+  AnnoFaceAttributeDatum_AnnoType anno_face =
+      AnnoFaceAttributeDatum_AnnoType_FACEATTRIBUTE;
+  AnnotatedCCpdDatum_AnnotationType anno_ccpd_type =
+      AnnotatedCCpdDatum_AnnotationType_CCPD;
   const string label_type = FLAGS_label_type;
   const string label_map_file = FLAGS_label_map_file;
   const bool check_label = FLAGS_check_label;
   std::map<std::string, int> name_to_label;
 
   std::ifstream infile(argv[2]);
-  std::vector<std::pair<std::string, boost::variant<int, std::string> > > lines;
+  LineList lines;
   std::string filename;
   int label;
   std::string labelname;
@@ -130,9 +354,25 @@ int main(int argc, char** argv) {
       lines.push_back(std::make_pair(filename, labelname));
     } 
   }
+  // Resume from the checkpoint of an interrupted conversion, if any.
+  const std::string checkpoint_file = std::string(argv[3]) + ".checkpoint";
+  Checkpoint checkpoint;
+  checkpoint.num_lines = lines.size();
+  checkpoint.next_line = 0;
+  checkpoint.count = 0;
+  checkpoint.seed = caffe_rng_rand();
+  bool resuming = false;
+  if (FLAGS_resume && ReadCheckpoint(checkpoint_file, &checkpoint)) {
+    CHECK_EQ(checkpoint.num_lines, lines.size())
+        << "The list changed since " << checkpoint_file << " was written.";
+    resuming = true;
+    LOG(INFO) << "Resuming at line " << checkpoint.next_line << " with "
+              << checkpoint.count << " records written.";
+  }
   if (FLAGS_shuffle) {
-    // randomly shuffle data
+    // randomly shuffle data, in the same order when resuming
     LOG(INFO) << "Shuffling data";
+    Caffe::set_random_seed(checkpoint.seed);
     shuffle(lines.begin(), lines.end());
   }
   LOG(INFO) << "A total of " << lines.size() << " images.";
@@ -140,105 +380,108 @@ int main(int argc, char** argv) {
   if (encode_type.size() && !encoded)
     LOG(INFO) << "encode_type specified, assuming encoded=true.";
 
-  int min_dim = std::max<int>(0, FLAGS_min_dim);
-  int max_dim = std::max<int>(0, FLAGS_max_dim);
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
+  ConvertParam param;
+  param.lines = &lines;
+  param.name_to_label = &name_to_label;
+  param.anno_type = anno_type;
+  param.type = type;
+  param.anno_face = anno_face;
+  param.anno_ccpd_type = anno_ccpd_type;
+  param.label_type = label_type;
+  param.encode_type = encode_type;
+  param.encoded = encoded;
+  param.is_color = is_color;
+  param.pack_annotations = FLAGS_pack_annotations;
+  param.min_dim = std::max<int>(0, FLAGS_min_dim);
+  param.max_dim = std::max<int>(0, FLAGS_max_dim);
+  param.resize_height = std::max<int>(0, FLAGS_resize_height);
+  param.resize_width = std::max<int>(0, FLAGS_resize_width);
+  const int txn_size = FLAGS_txn_size;
+  CHECK_GT(txn_size, 0);
+  int num_threads = FLAGS_num_threads;
+  if (num_threads <= 0) {
+    num_threads = std::max<int>(1, boost::thread::hardware_concurrency());
+  }
 
-  // Create new DB
+  // Create new DB, or open the one being resumed
   scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
-  db->Open(argv[3], db::NEW);
+  db->Open(argv[3], resuming ? db::WRITE : db::NEW);
   scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  if (!resuming) {
+    WriteCheckpoint(checkpoint_file, checkpoint);
+  }
 
   // Storing to db
   std::string root_folder(argv[1]);
-  AnnotatedDatum anno_datum;
-  Datum* datum = anno_datum.mutable_datum();
-  AnnoFaceAttributeDatum anno_faceAttriDatum;
-  AnnotatedCCpdDatum anno_ccpdDatum;
+  LOG(INFO) << "Converting with " << num_threads << " threads.";
+  ConvertQueue queue(checkpoint.next_line, 16 * num_threads);
+  boost::thread_group workers;
+  for (int i = 0; i < num_threads; ++i) {
+    workers.create_thread(boost::bind(&ConvertWorker, boost::cref(param),
+        &queue, checkpoint.next_line, i, num_threads));
+  }
 
-  int count = 0;
+  const int initial_count = checkpoint.count;
+  int count = initial_count;
   int data_size = 0;
   bool data_size_initialized = false;
+  int num_failed = 0;
+  int64_t num_bytes = 0;
+  const boost::posix_time::ptime start_time =
+      boost::posix_time::microsec_clock::local_time();
 
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    bool status = true;
-    std::string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      size_t p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
-    }
-    filename = lines[line_id].first;
-    if (anno_type == "classification") {
-      label = boost::get<int>(lines[line_id].second);
-      status = ReadImageToDatum(filename, label, resize_height, resize_width,
-          min_dim, max_dim, is_color, enc, datum);
-    }else if (anno_type == "detection") {
-      labelname = boost::get<std::string>(lines[line_id].second);
-      status = ReadRichImageToAnnotatedDatum(filename, labelname, resize_height,
-          resize_width, min_dim, max_dim, is_color, enc, type, label_type,
-          name_to_label, &anno_datum);
-      anno_datum.set_type(AnnotatedDatum_AnnotationType_BBOX);
-    } else if(anno_type == "faceattributes") {
-      labelname = boost::get<std::string>(lines[line_id].second); // lines contain imagename & label.txt
-		  status = ReadRichFaceAttributeToAnnotatedDatum(filename,
-          labelname, resize_height, resize_width, min_dim, max_dim, is_color,
-          enc, anno_face, label_type, &anno_faceAttriDatum);
-      anno_faceAttriDatum.set_type(AnnoFaceAttributeDatum_AnnoType_FACEATTRIBUTE);
-	  }else if (anno_type == "Rec_ccpd") {
-      labelname = boost::get<std::string>(lines[line_id].second);
-      status = ReadRichCcpdToAnnotatedDatum(filename, labelname, resize_height,
-          resize_width, min_dim, max_dim, is_color, enc, anno_ccpd_type, label_type,
-          name_to_label, &anno_ccpdDatum);
-      anno_ccpdDatum.set_type(AnnotatedCCpdDatum_AnnotationType_CCPD);
-    }
-    if (status == false) {
+  for (int line_id = checkpoint.next_line; line_id < lines.size(); ++line_id) {
+    ConvertedLine* converted = queue.Next();
+    if (converted->status == false) {
       LOG(WARNING) << "Failed to read " << lines[line_id].first;
+      ++num_failed;
+      queue.Release();
       continue;
     }
     if (check_size) {
       if (!data_size_initialized) {
-        data_size = datum->channels() * datum->height() * datum->width();
+        data_size = converted->expected_size;
         data_size_initialized = true;
       } else {
-        const std::string& data = datum->data();
-        CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-            << data.size();
+        CHECK_EQ(converted->data_size, data_size) << "Incorrect data field size "
+            << converted->data_size;
       }
     }
     // sequential
     string key_str = caffe::format_int(line_id, 8) + "_" + lines[line_id].first;
 
     // Put in db
-    string out;
-    if(anno_type == "classification" || anno_type == "detection")
-    {
-      CHECK(anno_datum.SerializeToString(&out));
-      txn->Put(key_str, out);
-    }else if(anno_type == "faceattributes") {
-      CHECK(anno_faceAttriDatum.SerializeToString(&out));
-      txn->Put(key_str, out);
-    }else if(anno_type == "Rec_ccpd") {
-      CHECK(anno_ccpdDatum.SerializeToString(&out));
-      txn->Put(key_str, out);
-    }
-    if (++count % 1000 == 0) {
+    txn->Put(key_str, converted->value);
+    num_bytes += converted->value.size();
+    queue.Release();
+    if (++count % txn_size == 0) {
       // Commit db
       txn->Commit();
       txn.reset(db->NewTransaction());
-      LOG(INFO) << "Processed " << count << " files.";
+      checkpoint.next_line = line_id + 1;
+      checkpoint.count = count;
+      WriteCheckpoint(checkpoint_file, checkpoint);
+      LOG(INFO) << "Processed " << count << " files ("
+                << (count - initial_count) / SecondsSince(start_time)
+                << " files/s).";
     }
   }
   // write the last batch
-  if (count % 1000 != 0) {
+  if (count % txn_size != 0) {
     txn->Commit();
     LOG(INFO) << "Processed " << count << " files.";
   }
+  workers.join_all();
+  // The database is complete, there is nothing left to resume.
+  remove(checkpoint_file.c_str());
+
+  const double seconds = SecondsSince(start_time);
+  const int num_written = count - initial_count;
+  LOG(INFO) << "Converted " << num_written << " images ("
+            << num_failed << " failed) in " << seconds << " s with "
+            << num_threads << " threads: " << num_written / seconds
+            << " images/s, " << num_bytes / seconds / 1e6
+            << " MB/s, " << num_bytes / 1e6 << " MB written.";
 #else
   LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
 #endif  // USE_OPENCV
@@ -0,0 +1,78 @@
+// This program rewrites a database of AnnotatedDatum, moving the annotations
+// to the packed binary layout of caffe/util/packed_annotation.hpp, or back to
+// annotation groups with --unpack. The images and keys are kept as they are.
+// Usage:
+//   repack_annoset [FLAGS] INPUT_DB OUTPUT_DB
+
+#include <string>
+
+#include "boost/scoped_ptr.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/packed_annotation.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using boost::scoped_ptr;
+
+DEFINE_string(backend, "lmdb",
+    "The backend {lmdb, leveldb} of both databases");
+DEFINE_bool(unpack, false,
+    "Convert packed annotations back to annotation groups");
+DEFINE_int32(txn_size, 1000,
+    "Number of records written per database transaction.");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Packs or unpacks the annotations of an annoset\n"
+        "Usage:\n"
+        "    repack_annoset [FLAGS] INPUT_DB OUTPUT_DB\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/repack_annoset");
+    return 1;
+  }
+  CHECK_GT(FLAGS_txn_size, 0);
+
+  scoped_ptr<db::DB> input_db(db::GetDB(FLAGS_backend));
+  input_db->Open(argv[1], db::READ);
+  scoped_ptr<db::Cursor> cursor(input_db->NewCursor());
+  scoped_ptr<db::DB> output_db(db::GetDB(FLAGS_backend));
+  output_db->Open(argv[2], db::NEW);
+  scoped_ptr<db::Transaction> txn(output_db->NewTransaction());
+
+  AnnotatedDatum anno_datum;
+  std::string value;
+  int count = 0;
+  for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+    CHECK(anno_datum.ParseFromArray(cursor->value_data(),
+        cursor->value_size())) << "Failed to parse record " << cursor->key();
+    if (FLAGS_unpack) {
+      UnpackAnnotatedDatum(&anno_datum);
+    } else {
+      PackAnnotatedDatum(&anno_datum);
+    }
+    CHECK(anno_datum.SerializeToString(&value));
+    txn->Put(cursor->key(), value);
+    if (++count % FLAGS_txn_size == 0) {
+      txn->Commit();
+      txn.reset(output_db->NewTransaction());
+      LOG(INFO) << "Processed " << count << " records.";
+    }
+  }
+  if (count % FLAGS_txn_size != 0) {
+    txn->Commit();
+  }
+  LOG(INFO) << "Processed " << count << " records.";
+  return 0;
+}